@@ -0,0 +1,69 @@
+"""Times loops which take a lock on each iteration.
+
+Functions containing a with statement used to always run in the interpreter.
+Run with and without the JIT to compare:
+
+    python bm_with_lock.py
+    python bm_with_lock.py --nojit
+"""
+
+import argparse
+import threading
+import time
+
+
+def counter(lock, n):
+    total = 0
+    for i in range(n):
+        with lock:
+            total += i
+    return total
+
+
+def nested(lock, n):
+    total = 0
+    for i in range(n):
+        with lock:
+            for j in range(4):
+                total += i ^ j
+    return total
+
+
+def bench(func, lock, n, runs):
+    times = []
+    for _ in range(runs):
+        start = time.perf_counter()
+        func(lock, n)
+        times.append(time.perf_counter() - start)
+    return min(times)
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("-n", type=int, default=1000000, help="iterations per run")
+    parser.add_argument("--runs", type=int, default=5)
+    parser.add_argument("--nojit", action="store_true", help="time the interpreter")
+    args = parser.parse_args()
+
+    try:
+        import pyjion
+    except ImportError:
+        pyjion = None
+    if pyjion is not None and args.nojit:
+        pyjion.disable()
+
+    lock = threading.Lock()
+    for func in (counter, nested):
+        elapsed = bench(func, lock, args.n, args.runs)
+        print("%-10s %.6f" % (func.__name__, elapsed))
+        if pyjion is not None and not args.nojit:
+            info = pyjion.info(func)
+            print("           compiled=%s failed=%s" % (info["compiled"], info["failed"]))
+
+    if pyjion is not None and not args.nojit:
+        failures = pyjion.stats().get("opcode_failures", {})
+        print("SETUP_WITH failures: %d" % failures.get("SETUP_WITH", 0))
+
+
+if __name__ == "__main__":
+    main()
@@ -25,6 +25,7 @@
 
 #include "absint.h"
 #include "taggedptr.h"
+#include <structmember.h>
 #include <opcode.h>
 #include <deque>
 #include <unordered_map>
@@ -40,6 +41,12 @@ AbstractInterpreter::AbstractInterpreter(PyCodeObject *code, IPythonCompiler* co
     m_byteCode = (_Py_CODEUNIT *)PyBytes_AS_STRING(code->co_code);
     m_size = PyBytes_Size(code->co_code);
     m_returnValue = &Undefined;
+    m_baseline = false;
+    m_profile = nullptr;
+    m_inline = nullptr;
+    m_elideFrame = false;
+    m_generator = false;
+    m_lastiIndex = -1;
     if (comp != nullptr) {
         m_retLabel = comp->emit_define_label();
         m_retValue = comp->emit_define_local();
@@ -59,9 +66,12 @@ AbstractInterpreter::~AbstractInterpreter() {
 }
 
 bool AbstractInterpreter::preprocess() {
-    if (m_code->co_flags & (CO_COROUTINE | CO_GENERATOR)) {
-        // Don't compile co-routines or generators.  We can't rely on
-        // detecting yields because they could be optimized out.
+    if ((m_code->co_flags & (CO_COROUTINE | CO_GENERATOR | CO_ASYNC_GENERATOR)) &&
+        (!m_generator || (m_code->co_flags & CO_ASYNC_GENERATOR))) {
+        // Generators and co-routines need compile_generator.  We can't rely on
+        // detecting yields because they could be optimized out.  Async generators
+        // wrap the values they yield, which we don't support.
+        m_stats.fail(CF_Generator);
         return false;
     }
     for (int i = 0; i < m_code->co_argcount; i++) {
@@ -106,7 +116,12 @@ bool AbstractInterpreter::preprocess() {
             }
             case YIELD_FROM:
             case YIELD_VALUE:
-                return false;
+                if (!m_generator) {
+                    m_stats.fail(CF_Generator, byte);
+                    return false;
+                }
+                m_yieldOffsets.push_back(opcodeIndex);
+                break;
 
             case UNPACK_EX:
                 if (m_comp != nullptr) {
@@ -121,14 +136,28 @@ bool AbstractInterpreter::preprocess() {
                     m_sequenceLocals[curByte] = m_comp->emit_allocate_stack_array(oparg * sizeof(void*));
                 }
                 break;
+            case CALL_FUNCTION:
+                if (oparg <= 4) {
+                    // emit_call and emit_method_call pass these directly
+                    break;
+                }
+                // fall through
+            case CALL_FUNCTION_KW:
+                // Arguments are passed in an array with a spare slot at the
+                // start for self.
+                if (m_comp != nullptr) {
+                    m_sequenceLocals[curByte] = m_comp->emit_allocate_stack_array((oparg + 1) * sizeof(void*));
+                }
+                break;
             case DELETE_FAST:
                 if (oparg < m_code->co_argcount) {
                     // this local is deleted, so we need to check for assignment
                     m_assignmentState[oparg] = false;
                 }
                 break;
-            case SETUP_WITH:
+            case SETUP_ASYNC_WITH:
                 // not supported...
+                m_stats.fail(CF_UnsupportedOpcode, byte);
                 return false;
             case SETUP_LOOP:
                 blockStarts.push_back(AbsIntBlockInfo(opcodeIndex, oparg + curByte + sizeof(_Py_CODEUNIT), true));
@@ -145,6 +174,9 @@ bool AbstractInterpreter::preprocess() {
                 ehKind.push_back(false);
                 break;
             case SETUP_FINALLY:
+            case SETUP_WITH:
+                // A with statement is a try/finally which calls __exit__ in
+                // the finally block.
                 blockStarts.push_back(AbsIntBlockInfo(opcodeIndex, oparg + curByte + sizeof(_Py_CODEUNIT), false));
                 ehKind.push_back(true);
                 break;
@@ -172,8 +204,20 @@ bool AbstractInterpreter::preprocess() {
                     // optimize your code, and if you alias them you won't get the correct behavior.
                     // Longer term we should patch vars/dir/_getframe and be able to provide the
                     // correct values from generated code.
+                    m_stats.fail(CF_FrameIntrospection, byte);
                     return false;
                 }
+                if (!strcmp(name, "range")) {
+                    auto forIter = find_range_loop(curByte);
+                    if (forIter != -1) {
+                        // We can only resume in the interpreter from loops
+                        bool onlyLoops = true;
+                        for (auto& block : blockStarts) {
+                            onlyLoops &= block.IsLoop;
+                        }
+                        m_rangeLoops[forIter] = onlyLoops;
+                    }
+                }
             }
             break;
             case JUMP_FORWARD:
@@ -189,12 +233,13 @@ bool AbstractInterpreter::preprocess() {
 
         }
     }
+    find_scalar_tuples();
     return true;
 }
 
 void AbstractInterpreter::set_local_type(int index, AbstractValueKind kind) {
     auto& lastState = m_startStates[0];
-    if (kind == AVK_Integer || kind == AVK_Float) {
+    if (is_known_type(kind)) {
         // Replace our starting state with a local which has a known source
         // so that we know it's boxed...
         auto localInfo = AbstractLocalInfo(to_abstract(kind));
@@ -203,6 +248,24 @@ void AbstractInterpreter::set_local_type(int index, AbstractValueKind kind) {
     }
 }
 
+void AbstractInterpreter::set_speculated_local_type(int index, AbstractValueKind kind) {
+    if (kind == AVK_Integer || kind == AVK_Float) {
+        m_speculatedLocals[index] = kind;
+    }
+}
+
+void AbstractInterpreter::set_type_profile(TypeProfile* profile) {
+    m_profile = profile;
+}
+
+void AbstractInterpreter::set_elide_frame(bool elide) {
+    m_elideFrame = elide;
+}
+
+bool AbstractInterpreter::is_speculative() {
+    return !m_guards.empty() || !m_resultGuards.empty();
+}
+
 void AbstractInterpreter::init_starting_state() {
     InterpreterState lastState = InterpreterState(m_code->co_nlocals);
 
@@ -318,10 +381,24 @@ bool AbstractInterpreter::interpret() {
                 case LOAD_CONST:
                 {
                     auto constSource = add_const_source(opcodeIndex, oparg);
+                    auto value = PyTuple_GetItem(m_code->co_consts, oparg);
+
+                    if (m_scalarUnpacks.find(curByte + sizeof(_Py_CODEUNIT)) != m_scalarUnpacks.end()) {
+                        // The tuple is unpacked straight away, we push its items instead
+                        for (auto i = PyTuple_GET_SIZE(value) - 1; i >= 0; i--) {
+                            lastState.push(
+                                AbstractValueWithSources(
+                                    to_abstract(PyTuple_GET_ITEM(value, i)),
+                                    constSource
+                                )
+                            );
+                        }
+                        break;
+                    }
 
                     lastState.push(
                         AbstractValueWithSources(
-                            to_abstract(PyTuple_GetItem(m_code->co_consts, oparg)),
+                            to_abstract(value),
                             constSource
                             )
                         );
@@ -340,6 +417,16 @@ bool AbstractInterpreter::interpret() {
                 case STORE_FAST:
                 {
                     auto valueInfo = lastState.pop_no_escape();
+                    auto speculated = m_speculatedLocals.find(oparg);
+                    if (speculated != m_speculatedLocals.end() && valueInfo.Value->kind() == AVK_Any) {
+                        // Assume we're storing the type we've seen before, we'll check the
+                        // type when we store it and resume in the interpreter if we're wrong.
+                        m_guards[opcodeIndex] = speculated->second;
+                        valueInfo = AbstractValueWithSources(
+                            to_abstract(speculated->second),
+                            add_local_source(opcodeIndex, oparg)
+                        );
+                    }
                     m_opcodeSources[opcodeIndex] = valueInfo.Sources;
                     // STORE_FAST doesn't necessarily give us an assigned value because we
                     // could be assigning an unassigned value.  e.g:
@@ -387,6 +474,12 @@ bool AbstractInterpreter::interpret() {
                     auto two = lastState.pop_no_escape();
                     auto one = lastState.pop_no_escape();
                     auto binaryRes = one.Value->binary(one.Sources, opcode, two);
+                    if (opcode == BINARY_SUBSCR && binaryRes == &Any) {
+                        // The operands have escaped, and the result is checked
+                        // independently of them.
+                        lastState.push(profiled_result(opcodeIndex));
+                        break;
+                    }
 
                     // create an intermediate source which will propagate changes up...
                     auto sources = add_intermediate_source(opcodeIndex);
@@ -509,7 +602,7 @@ bool AbstractInterpreter::interpret() {
                 case LOAD_GLOBAL:
                     // TODO: Look in globals, then builtins, and see if we can resolve
                     // this to anything concrete.
-                    lastState.push(&Any);
+                    lastState.push(profiled_result(opcodeIndex));
                     break;
                 case STORE_GLOBAL:
                     lastState.pop();
@@ -517,7 +610,7 @@ bool AbstractInterpreter::interpret() {
                 case LOAD_ATTR:
                     // TODO: Add support for resolving known members of known types
                     lastState.pop();
-                    lastState.push(&Any);
+                    lastState.push(profiled_result(opcodeIndex));
                     break;
                 case STORE_ATTR:
                     lastState.pop();
@@ -536,6 +629,20 @@ bool AbstractInterpreter::interpret() {
                 case BUILD_TUPLE:
                 case BUILD_TUPLE_UNPACK:
                 {
+                    if (opcode == BUILD_TUPLE &&
+                        m_scalarUnpacks.find(curByte + sizeof(_Py_CODEUNIT)) != m_scalarUnpacks.end()) {
+                        // The tuple is never created, its items go straight to the
+                        // UNPACK_SEQUENCE so they only escape if what's unpacked does.
+                        vector<AbstractValueWithSources> items;
+                        for (int i = 0; i < oparg; i++) {
+                            items.push_back(lastState.pop_no_escape());
+                        }
+                        for (auto& item : items) {
+                            lastState.push(item);
+                        }
+                        break;
+                    }
+
                     vector<AbstractValueWithSources> sources;
                     for (int i = 0; i < oparg; i++) {
                         lastState.pop();
@@ -546,7 +653,8 @@ bool AbstractInterpreter::interpret() {
                     // means that if we have a non-escaping tuple we need to optimize
                     // it away too, otherwise our assumptions about what's in the tuple are
                     // broken.
-                    // This optimization is disabled until the above comment sorted out.
+                    // This optimization is disabled until the above comment sorted out,
+                    // only tuples which are unpacked straight away are optimized.
                     //auto tuple = new TupleSource(sources);
                     //m_sources.push_back(tuple);
                     //lastState.push(AbstractValueWithSources(&Tuple, tuple));
@@ -631,7 +739,7 @@ bool AbstractInterpreter::interpret() {
                     // pop the function...
                     lastState.pop();
 
-                    lastState.push(&Any);
+                    lastState.push(profiled_result(opcodeIndex));
                     break;
                 }
                 case CALL_FUNCTION_KW:
@@ -649,7 +757,7 @@ bool AbstractInterpreter::interpret() {
                     // pop the function
                     lastState.pop();
 
-                    lastState.push(&Any);
+                    lastState.push(profiled_result(opcodeIndex));
                     break;
                 }
                 case CALL_FUNCTION_EX:
@@ -663,7 +771,7 @@ bool AbstractInterpreter::interpret() {
                     // function
                     lastState.pop();
 
-                    lastState.push(&Any);
+                    lastState.push(profiled_result(opcodeIndex));
                     break;
                 case MAKE_FUNCTION:
                 {
@@ -732,6 +840,10 @@ bool AbstractInterpreter::interpret() {
                     }
                     break;
                 case UNPACK_SEQUENCE:
+                    if (m_scalarUnpacks.find(opcodeIndex) != m_scalarUnpacks.end()) {
+                        // The items were pushed in place of the tuple
+                        break;
+                    }
                     // TODO: If the sequence is a known type we could know what types we're pushing here.
                     lastState.pop();
                     for (int i = 0; i < oparg; i++) {
@@ -789,7 +901,16 @@ bool AbstractInterpreter::interpret() {
                     // When we compile this we don't actually leave the value on the stack,
                     // but the sequence of opcodes assumes that happens.  to keep our stack
                     // properly balanced we match what's really going on.
-                    lastState.push(&Any);
+                    auto rangeLoop = m_rangeLoops.find(opcodeIndex);
+                    if (rangeLoop != m_rangeLoops.end() && rangeLoop->second && m_profile != nullptr) {
+                        // Assume range is the builtin, we'll check the values from
+                        // any other iterator and resume in the interpreter if we're wrong.
+                        m_resultGuards[opcodeIndex] = &PyLong_Type;
+                        lastState.push(AbstractValueWithSources(&Integer, add_intermediate_source(opcodeIndex)));
+                    }
+                    else {
+                        lastState.push(&Any);
+                    }
 
                     break;
                 }
@@ -799,6 +920,11 @@ bool AbstractInterpreter::interpret() {
                     // Restore the stack state to what we had on entry
                     lastState.m_stack = m_startStates[m_blockStarts[opcodeIndex]].m_stack;
                     //merge_states(m_startStates[m_blockStarts[opcodeIndex]], lastState);
+                    if (GET_OPCODE(m_blockStarts[opcodeIndex]) == SETUP_WITH) {
+                        // The context manager has been replaced with __exit__
+                        lastState.pop();
+                        lastState.push(&Any);
+                    }
                     break;
                 case POP_EXCEPT:
                     break;
@@ -855,6 +981,34 @@ bool AbstractInterpreter::interpret() {
                     }
                 }
                 break;
+                case SETUP_WITH:
+                {
+                    // The context manager is replaced with its __exit__, and then
+                    // we're in a try/finally with the result of __enter__ pushed.
+                    lastState.pop();
+                    lastState.push(&Any);
+                    auto finallyState = lastState;
+                    finallyState.push(&Any);
+                    if (update_start_state(finallyState, (size_t)oparg + curByte + sizeof(_Py_CODEUNIT))) {
+                        queue.push_back((size_t)oparg + curByte + sizeof(_Py_CODEUNIT));
+                    }
+                    lastState.push(&Any);
+                }
+                break;
+                case WITH_CLEANUP_START:
+                {
+                    // __exit__ is replaced with the exception passed to it and its result
+                    auto reason = lastState.pop_no_escape();
+                    lastState.pop();
+                    lastState.push(reason);
+                    lastState.push(&Any);
+                    lastState.push(&Any);
+                    break;
+                }
+                case WITH_CLEANUP_FINISH:
+                    lastState.pop();
+                    lastState.pop();
+                    break;
                 case SETUP_EXCEPT:
                 {
                     auto ehState = lastState;
@@ -897,11 +1051,12 @@ bool AbstractInterpreter::interpret() {
                     }
                     lastState.push(&String);
                     break;
-                case SETUP_WITH:
                 case YIELD_VALUE:
+                    m_stats.fail(CF_UnsupportedOpcode, opcode);
                     return false;
                 case BUILD_TUPLE_UNPACK_WITH_CALL:
                 case BUILD_MAP_UNPACK_WITH_CALL:
+                    m_stats.fail(CF_UnsupportedOpcode, opcode);
                     return false;
                 case BUILD_CONST_KEY_MAP:
                     lastState.pop(); //keys
@@ -909,11 +1064,13 @@ bool AbstractInterpreter::interpret() {
                         lastState.pop(); // values
                     }
                     lastState.push(&Dict);
+                    m_stats.fail(CF_UnsupportedOpcode, opcode);
                     return false;
                 default:
 #ifdef _DEBUG
                     printf("Unknown unsupported opcode: %s", opcode_name(opcode));
 #endif
+                    m_stats.fail(CF_UnsupportedOpcode, opcode);
                     return false;
             }
             update_start_state(lastState, curByte + sizeof(_Py_CODEUNIT));
@@ -1104,6 +1261,7 @@ void AbstractInterpreter::dump() {
             case SETUP_LOOP:
             case SETUP_EXCEPT:
             case SETUP_FINALLY:
+            case SETUP_WITH:
             case JUMP_FORWARD:
             case FOR_ITER:
                 printf("    %-3Id %-22s %d (to %Id)\r\n",
@@ -1194,43 +1352,6 @@ bool AbstractInterpreter::should_box(size_t opcodeIndex) {
     return true;
 }
 
-bool AbstractInterpreter::can_skip_lasti_update(size_t opcodeIndex) {
-    switch (GET_OPCODE(opcodeIndex)) {
-        case BINARY_TRUE_DIVIDE:
-        case BINARY_FLOOR_DIVIDE:
-        case BINARY_POWER:
-        case BINARY_MODULO:
-        case BINARY_MATRIX_MULTIPLY:
-        case BINARY_LSHIFT:
-        case BINARY_RSHIFT:
-        case BINARY_AND:
-        case BINARY_XOR:
-        case BINARY_OR:
-        case BINARY_MULTIPLY:
-        case BINARY_SUBTRACT:
-        case BINARY_ADD:
-        case INPLACE_POWER:
-        case INPLACE_MULTIPLY:
-        case INPLACE_MATRIX_MULTIPLY:
-        case INPLACE_TRUE_DIVIDE:
-        case INPLACE_FLOOR_DIVIDE:
-        case INPLACE_MODULO:
-        case INPLACE_ADD:
-        case INPLACE_SUBTRACT:
-        case INPLACE_LSHIFT:
-        case INPLACE_RSHIFT:
-        case INPLACE_AND:
-        case INPLACE_XOR:
-        case INPLACE_OR:
-        case COMPARE_OP:
-        case LOAD_FAST:
-            return !should_box(opcodeIndex);
-    }
-
-    return false;
-
-}
-
 void AbstractInterpreter::dump_sources(AbstractSource* sources) {
     if (sources != nullptr) {
         for (auto value : sources->Sources->Sources) {
@@ -1280,6 +1401,7 @@ char* AbstractInterpreter::opcode_name(int opcode) {
             OP_TO_STR(BINARY_OR)
             OP_TO_STR(INPLACE_POWER)
             OP_TO_STR(GET_ITER)
+            OP_TO_STR(GET_YIELD_FROM_ITER)
             OP_TO_STR(PRINT_EXPR)
             OP_TO_STR(LOAD_BUILD_CLASS)
             OP_TO_STR(YIELD_FROM)
@@ -1365,11 +1487,19 @@ char* AbstractInterpreter::opcode_name(int opcode) {
 // Returns information about the specified local variable at a specific 
 // byte code index.
 AbstractLocalInfo AbstractInterpreter::get_local_info(size_t byteCodeIndex, size_t localIndex) {
+    if (m_baseline) {
+        return AbstractLocalInfo(&Any, true);
+    }
     return m_startStates[byteCodeIndex].get_local(localIndex);
 }
 
 // Returns information about the stack at the specific byte code index.
 vector<AbstractValueWithSources>& AbstractInterpreter::get_stack_info(size_t byteCodeIndex) {
+    if (m_baseline) {
+        // We only know the depth of the stack, which we're tracking as we generate code
+        m_baselineStack.resize(m_stack.size(), AbstractValueWithSources(&Any));
+        return m_baselineStack;
+    }
     return m_startStates[byteCodeIndex].m_stack;
 }
 
@@ -1517,6 +1647,20 @@ void AbstractInterpreter::branch_raise(char *reason) {
     auto& ehBlock = get_ehblock();
     auto& entry_stack = ehBlock.EntryStack;
 
+    // The traceback records the opcode which failed, which we may not have
+    // stored yet.
+    if (m_lastiIndex != -1) {
+        m_comp->emit_lasti_update(m_lastiIndex);
+    }
+
+    if (m_inline != nullptr) {
+        // The inlined function shows up in the traceback as if it had run in
+        // its own frame, which takes over its locals.
+        m_comp->emit_inline_trace(m_inline->Function, m_inline->Locals, m_inline->LastI);
+        m_comp->emit_load_local(m_inline->Function);
+        m_comp->emit_pop_top();
+    }
+
 #if DEBUG_TRACE
     if (reason != nullptr) {
         m_comp->emit_debug_msg(reason);
@@ -1575,6 +1719,15 @@ void AbstractInterpreter::clean_stack_for_reraise() {
     }
 }
 
+// Moves the arguments for a call from the stack into the array, leaving the
+// first element free.
+void AbstractInterpreter::store_call_args(Local args, size_t argCnt) {
+    for (size_t i = 0; i < argCnt; i++) {
+        m_comp->emit_store_to_array(args, (int)(argCnt - i));
+        dec_stack();
+    }
+}
+
 void AbstractInterpreter::build_tuple(size_t argCnt) {
     m_comp->emit_new_tuple(argCnt);
     if (argCnt != 0) {
@@ -1960,87 +2113,1127 @@ void AbstractInterpreter::branch(int& curByte) {
     m_offsetStack[oparg] = m_stack;
 }
 
-JittedCode* AbstractInterpreter::compile_worker() {
-    Label ok;
-
-    auto raiseNoHandlerLabel = m_comp->emit_define_label();
-    auto reraiseNoHandlerLabel = m_comp->emit_define_label();
-
-    m_comp->emit_lasti_init();
-    m_comp->emit_push_frame();
+// Gets the number of values an opcode pops from the stack, for opcodes which
+// push a single result and don't branch, or -1 for any other opcode.
+static int values_consumed(int opcode, int oparg) {
+    switch (opcode) {
+        case LOAD_FAST:
+        case LOAD_CONST:
+        case LOAD_GLOBAL:
+        case LOAD_NAME:
+        case LOAD_DEREF:
+        case LOAD_CLASSDEREF:
+        case LOAD_CLOSURE:
+            return 0;
+        case LOAD_ATTR:
+        case UNARY_POSITIVE:
+        case UNARY_NEGATIVE:
+        case UNARY_INVERT:
+            return 1;
+        case BINARY_POWER:
+        case BINARY_MULTIPLY:
+        case BINARY_MATRIX_MULTIPLY:
+        case BINARY_MODULO:
+        case BINARY_ADD:
+        case BINARY_SUBTRACT:
+        case BINARY_SUBSCR:
+        case BINARY_FLOOR_DIVIDE:
+        case BINARY_TRUE_DIVIDE:
+        case BINARY_LSHIFT:
+        case BINARY_RSHIFT:
+        case BINARY_AND:
+        case BINARY_XOR:
+        case BINARY_OR:
+        case COMPARE_OP:
+            return 2;
+        case BUILD_TUPLE:
+        case BUILD_LIST:
+        case BUILD_SET:
+            return oparg;
+        case BUILD_MAP:
+            return oparg * 2;
+        case BUILD_CONST_KEY_MAP:
+            return oparg + 1;
+        case CALL_FUNCTION:
+            return oparg + 1;
+        case CALL_FUNCTION_KW:
+            return oparg + 2;
+    }
+    return -1;
+}
 
-    m_blockStack.push_back(BlockInfo(-1, NOP, 0));
-    m_allHandlers.push_back(
-        ExceptionHandler(
-            0,
-            ExceptionVars(),
-            raiseNoHandlerLabel, 
-            reraiseNoHandlerLabel, 
-            Label(),
-            vector<bool>()
-        )
-    );
+void AbstractInterpreter::find_method_calls() {
+    // We only handle straight line code between the LOAD_ATTR and the call
+    // where we know how much of the stack each opcode uses.  If anything in
+    // between could deoptimize we leave the pair alone as the interpreter
+    // expects a bound method on the stack.
+    for (int curByte = 0; curByte < m_size; curByte += sizeof(_Py_CODEUNIT)) {
+        if (GET_OPCODE(curByte) != LOAD_ATTR ||
+            m_resultGuards.find(curByte) != m_resultGuards.end()) {
+            continue;
+        }
 
-    for (size_t i = 0; i < m_code->co_argcount + m_code->co_kwonlyargcount; i++) {
-        auto local = get_local_info(0, i);
-        if (!local.ValueInfo.needs_boxing()) {
-            m_comp->emit_load_fast(i);
+        // The number of values pushed on top of the method
+        int depth = 0;
+        for (int i = curByte + sizeof(_Py_CODEUNIT); i < m_size; i += sizeof(_Py_CODEUNIT)) {
+            if (m_jumpsTo.find(i) != m_jumpsTo.end()) {
+                break;
+            }
 
-            if (local.ValueInfo.Value->kind() == AVK_Float) {
-                m_comp->emit_unbox_float();
-                m_comp->emit_store_local(get_optimized_local(i, AVK_Float));
+            auto byte = GET_OPCODE(i);
+            auto oparg = GET_OPARG(i);
+            auto consumed = values_consumed(byte, oparg);
+            if (consumed < 0) {
+                break;
             }
-            else if (local.ValueInfo.Value->kind() == AVK_Integer) {
-                m_comp->emit_unbox_int_tagged();
-                m_comp->emit_store_local(get_optimized_local(i, AVK_Any));
+            else if (consumed > depth) {
+                // This opcode uses the method
+                if ((byte == CALL_FUNCTION && oparg == depth) ||
+                    (byte == CALL_FUNCTION_KW && oparg + 1 == depth)) {
+                    m_methodLoads.insert(curByte);
+                    m_methodCalls.insert(i);
+                }
+                break;
+            }
+            else if (m_resultGuards.find(i) != m_resultGuards.end()) {
+                break;
             }
+            depth += 1 - consumed;
         }
     }
-    
-    for (int curByte = 0; curByte < m_size; curByte += sizeof(_Py_CODEUNIT)) {
-        _ASSERTE(curByte % sizeof(_Py_CODEUNIT) == 0);
+}
 
-        auto opcodeIndex = curByte;
+size_t AbstractInterpreter::find_range_loop(size_t loadGlobal) {
+    // Like find_method_calls we only follow straight line code to the call,
+    // which has to be fed straight into the loop.
+    int depth = 0;
+    for (size_t i = loadGlobal + sizeof(_Py_CODEUNIT); i < m_size; i += sizeof(_Py_CODEUNIT)) {
+        auto byte = GET_OPCODE(i);
+        auto oparg = GET_OPARG(i);
+        auto consumed = values_consumed(byte, oparg);
+        if (consumed < 0) {
+            return -1;
+        }
+        else if (consumed > depth) {
+            // This opcode uses range
+            if (byte == CALL_FUNCTION && oparg == depth && oparg >= 1 && oparg <= 3 &&
+                GET_OPCODE(i + sizeof(_Py_CODEUNIT)) == GET_ITER &&
+                get_extended_opcode(i + 2 * sizeof(_Py_CODEUNIT)) == FOR_ITER) {
+                return i + 2 * sizeof(_Py_CODEUNIT);
+            }
+            return -1;
+        }
+        depth += 1 - consumed;
+    }
+    return -1;
+}
 
+void AbstractInterpreter::find_scalar_tuples() {
+    // CPython's peephole optimizer already turns building and unpacking two
+    // or three values into rotations, this picks up the larger ones as well
+    // as constant tuples.
+    int oparg = 0;
+    for (size_t curByte = 0; curByte + sizeof(_Py_CODEUNIT) < m_size; curByte += sizeof(_Py_CODEUNIT)) {
+        oparg = (oparg << 8) | GET_OPARG(curByte);
         auto byte = GET_OPCODE(curByte);
-        auto oparg = GET_OPARG(curByte);
+        if (byte == EXTENDED_ARG) {
+            continue;
+        }
 
-    processOpCode:
-        // See FOR_ITER for special handling of the offset label
-        if (get_extended_opcode(curByte) != FOR_ITER) {
-            mark_offset_label(curByte);
+        auto next = curByte + sizeof(_Py_CODEUNIT);
+        if (GET_OPCODE(next) == UNPACK_SEQUENCE && m_jumpsTo.find(next) == m_jumpsTo.end()) {
+            Py_ssize_t size = -1;
+            if (byte == BUILD_TUPLE) {
+                size = oparg;
+            }
+            else if (byte == LOAD_CONST && PyTuple_CheckExact(PyTuple_GET_ITEM(m_code->co_consts, oparg))) {
+                size = PyTuple_GET_SIZE(PyTuple_GET_ITEM(m_code->co_consts, oparg));
+            }
+
+            if (size == GET_OPARG(next)) {
+                m_scalarUnpacks.insert(next);
+            }
         }
+        oparg = 0;
+    }
+}
 
-        auto curStackDepth = m_offsetStack.find(curByte);
-        if (curStackDepth != m_offsetStack.end()) {
-            m_stack = curStackDepth->second;
+void AbstractInterpreter::reverse_stack(size_t count) {
+    // Spilling pops the values from the top, reloading them in the same
+    // order leaves the old top at the bottom.
+    vector<Local> values;
+    for (size_t i = 0; i < count; i++) {
+        auto kind = m_stack[m_stack.size() - 1 - i] == STACK_KIND_VALUE ? LK_Float : LK_Pointer;
+        auto local = m_comp->emit_define_local(kind);
+        m_comp->emit_store_local(local);
+        values.push_back(local);
+    }
+    for (auto local : values) {
+        m_comp->emit_load_and_free_local(local);
+    }
+    std::reverse(m_stack.end() - count, m_stack.end());
+}
+
+// Names which let code see the frame it's running in, or the frame of its
+// caller.
+static const char* g_frameIntrospectionNames[] = {
+    "locals", "vars", "dir", "globals", "eval", "exec", "super", "_getframe", "currentframe", "stack"
+};
+
+bool AbstractInterpreter::inspects_frame(PyCodeObject* code) {
+    for (auto name : g_frameIntrospectionNames) {
+        for (Py_ssize_t i = 0; i < PyTuple_GET_SIZE(code->co_names); i++) {
+            if (PyUnicode_CompareWithASCIIString(PyTuple_GET_ITEM(code->co_names, i), name) == 0) {
+                return true;
+            }
         }
+    }
+    return false;
+}
 
-        if (m_blockStack.size() > 1 && 
-            curByte >= m_blockStack.back().EndOffset &&
-            m_blockStack.back().EndOffset != -1) {
-            compile_pop_block();
+void AbstractInterpreter::find_register_locals() {
+    // The baseline tier is compiled without CoreCLR's optimizations so there's
+    // no point in giving it the locals.  If the code can inspect its frame,
+    // values could be written to the frame without us seeing them.  Deleted
+    // locals are usually large values being released early, we leave those
+    // in the frame.
+    if (m_baseline || inspects_frame(m_code)) {
+        return;
+    }
+
+    vector<bool> loaded(m_code->co_nlocals), deleted(m_code->co_nlocals);
+    int oparg = 0;
+    for (int curByte = 0; curByte < m_size; curByte += sizeof(_Py_CODEUNIT)) {
+        oparg = (oparg << 8) | GET_OPARG(curByte);
+        switch (GET_OPCODE(curByte)) {
+            case EXTENDED_ARG:
+                continue;
+            case LOAD_FAST:
+                loaded[oparg] = true;
+                break;
+            case DELETE_FAST:
+                deleted[oparg] = true;
+                break;
         }
+        oparg = 0;
+    }
 
-        // update f_lasti
-        if (!can_skip_lasti_update(curByte)) {
-            m_comp->emit_lasti_update(curByte);
+    for (int i = 0; i < m_code->co_nlocals; i++) {
+        if (loaded[i] && !deleted[i]) {
+            m_comp->emit_register_local(i);
         }
+    }
+}
 
-        switch (byte) {
-            case NOP: break;
-            case ROT_TWO: 
-            {
-                std::swap(m_stack[m_stack.size() - 1], m_stack[m_stack.size() - 2]);
+bool AbstractInterpreter::is_borrowable_load(int opcodeIndex, bool inspectsFrame) {
+    if (opcodeIndex >= sizeof(_Py_CODEUNIT) &&
+        GET_OPCODE(opcodeIndex - sizeof(_Py_CODEUNIT)) == EXTENDED_ARG) {
+        return false;
+    }
 
-                if (!should_box(opcodeIndex)) {
-                    auto stackInfo = get_stack_info(opcodeIndex);
-                    auto top_kind = stackInfo[stackInfo.size() - 1].Value->kind();
-                    auto second_kind = stackInfo[stackInfo.size() - 2].Value->kind();
+    switch (GET_OPCODE(opcodeIndex)) {
+        case LOAD_CONST:
+            return true;
+        case LOAD_FAST:
+            // If the code can get at its frame the local could be replaced
+            // while we're holding onto its value.
+            return !inspectsFrame;
+    }
+    return false;
+}
 
-                    if (top_kind == AVK_Float && second_kind == AVK_Float) {
-                        m_comp->emit_rot_two(LK_Float);
-                        break;
+void AbstractInterpreter::find_borrowed_loads() {
+    // Locals are kept alive by the frame and constants by the code object, so
+    // when a value is only tested, and nothing can run in between which could
+    // change the local, we don't need a reference of our own.
+    bool inspectsFrame = inspects_frame(m_code);
+    for (int curByte = 0; curByte < m_size; curByte += sizeof(_Py_CODEUNIT)) {
+        if (!is_borrowable_load(curByte, inspectsFrame)) {
+            continue;
+        }
+
+        auto next = curByte + sizeof(_Py_CODEUNIT);
+        if (next >= m_size || m_jumpsTo.find(next) != m_jumpsTo.end()) {
+            continue;
+        }
+
+        switch (GET_OPCODE(next)) {
+            case POP_JUMP_IF_TRUE:
+            case POP_JUMP_IF_FALSE:
+                m_borrowedLoads.insert(curByte);
+                break;
+            case LOAD_FAST:
+            case LOAD_CONST:
+            {
+                // x is None
+                auto compare = next + sizeof(_Py_CODEUNIT);
+                if (compare < m_size &&
+                    is_borrowable_load(next, inspectsFrame) &&
+                    m_jumpsTo.find(compare) == m_jumpsTo.end() &&
+                    GET_OPCODE(compare) == COMPARE_OP &&
+                    (GET_OPARG(compare) == PyCmp_IS || GET_OPARG(compare) == PyCmp_IS_NOT)) {
+                    m_borrowedLoads.insert(curByte);
+                    m_borrowedLoads.insert(next);
+                }
+                break;
+            }
+        }
+    }
+}
+
+void AbstractInterpreter::own_borrowed_value() {
+    if (m_stack[m_stack.size() - 1] == STACK_KIND_VALUE) {
+        m_comp->emit_dup();
+        m_comp->emit_incref();
+        m_stack[m_stack.size() - 1] = STACK_KIND_OBJECT;
+    }
+}
+
+void AbstractInterpreter::record_callee(size_t opcodeIndex, size_t depth) {
+    vector<Local> args;
+    for (size_t i = 0; i < depth; i++) {
+        args.push_back(m_comp->emit_spill());
+    }
+    m_comp->emit_record_callee(m_profile, opcodeIndex);
+    // And the types of the arguments, the first of which is self for a method call
+    for (size_t i = depth; i > 0; i--) {
+        m_comp->emit_load_and_free_local(args[i - 1]);
+        m_comp->emit_record_arg_type(m_profile, opcodeIndex, depth - i);
+    }
+}
+
+InlineDecision AbstractInterpreter::can_inline(InlineFrame& frame, vector<InlineValue>& args) {
+    // The arguments need to bind directly to the function's locals
+    auto code = frame.Code;
+    auto argCount = (int)args.size();
+    if (code->co_argcount != argCount || code->co_kwonlyargcount != 0 ||
+        (code->co_flags & ~PyCF_MASK) != (CO_OPTIMIZED | CO_NEWLOCALS | CO_NOFREE)) {
+        return ID_Signature;
+    }
+
+    auto size = (size_t)PyBytes_GET_SIZE(code->co_code);
+    if (size > INLINE_MAX_SIZE) {
+        return ID_TooLarge;
+    }
+
+    // Only straight line code which can't look at its frame, call anything,
+    // or see a different set of globals than our own.
+    auto byteCode = (_Py_CODEUNIT *)PyBytes_AS_STRING(code->co_code);
+    auto count = size / sizeof(_Py_CODEUNIT);
+    vector<bool> assigned(code->co_nlocals);
+    for (int i = 0; i < argCount; i++) {
+        assigned[i] = true;
+    }
+    for (size_t i = 0; i < count; i++) {
+        auto oparg = _Py_OPARG(byteCode[i]);
+        switch (_Py_OPCODE(byteCode[i])) {
+            case RETURN_VALUE:
+                if (i != count - 1) {
+                    return ID_UnsupportedOpcode;
+                }
+                break;
+            case LOAD_FAST:
+                if (!assigned[oparg]) {
+                    // Would raise UnboundLocalError
+                    return ID_UnsupportedOpcode;
+                }
+                break;
+            case STORE_FAST:
+                assigned[oparg] = true;
+                break;
+            case COMPARE_OP:
+                if (oparg == PyCmp_EXC_MATCH || oparg == PyCmp_BAD) {
+                    return ID_UnsupportedOpcode;
+                }
+                break;
+            case NOP:
+            case LOAD_CONST:
+            case LOAD_ATTR:
+            case POP_TOP:
+            case BUILD_TUPLE:
+            case UNARY_POSITIVE:
+            case UNARY_NEGATIVE:
+            case UNARY_NOT:
+            case UNARY_INVERT:
+            case BINARY_SUBSCR:
+            case BINARY_ADD:
+            case BINARY_TRUE_DIVIDE:
+            case BINARY_FLOOR_DIVIDE:
+            case BINARY_POWER:
+            case BINARY_MODULO:
+            case BINARY_MATRIX_MULTIPLY:
+            case BINARY_LSHIFT:
+            case BINARY_RSHIFT:
+            case BINARY_AND:
+            case BINARY_XOR:
+            case BINARY_OR:
+            case BINARY_MULTIPLY:
+            case BINARY_SUBTRACT:
+            case INPLACE_POWER:
+            case INPLACE_MULTIPLY:
+            case INPLACE_MATRIX_MULTIPLY:
+            case INPLACE_TRUE_DIVIDE:
+            case INPLACE_FLOOR_DIVIDE:
+            case INPLACE_MODULO:
+            case INPLACE_ADD:
+            case INPLACE_SUBTRACT:
+            case INPLACE_LSHIFT:
+            case INPLACE_RSHIFT:
+            case INPLACE_AND:
+            case INPLACE_XOR:
+            case INPLACE_OR:
+                break;
+            default:
+                return ID_UnsupportedOpcode;
+        }
+    }
+    return inline_types_known(frame, args) ? ID_Inlined : ID_UnknownTypes;
+}
+
+static bool is_scalar(AbstractValue* value) {
+    return is_scalar_type(value->kind());
+}
+
+// Checks if instances of the type keep the attribute in their dictionary or
+// in a slot, so loading it can't run any code, following the same rules as
+// the attribute caches.  offset is set to the slot's offset, or 0 for the
+// dictionary.
+static bool find_instance_attr(PyTypeObject* type, PyObject* name, Py_ssize_t& offset) {
+    if (type->tp_getattro != PyObject_GenericGetAttr || type->tp_dict == nullptr || !PyUnicode_CheckExact(name)) {
+        return false;
+    }
+
+    // Looking the attribute up assigns the type a version tag
+    auto descr = _PyType_Lookup(type, name);
+    if (!PyType_HasFeature(type, Py_TPFLAGS_VALID_VERSION_TAG)) {
+        return false;
+    }
+
+    if (descr == nullptr) {
+        offset = 0;
+        return type->tp_dictoffset != 0;
+    }
+    if (Py_TYPE(descr) == &PyMemberDescr_Type &&
+        ((PyMemberDescrObject*)descr)->d_member->type == T_OBJECT_EX) {
+        offset = ((PyMemberDescrObject*)descr)->d_member->offset;
+        return true;
+    }
+    return false;
+}
+
+bool AbstractInterpreter::inline_types_known(InlineFrame& frame, vector<InlineValue>& args) {
+    // The inlined code has no frame, so anything that could call a user
+    // defined method (which could look at its caller's frame, or raise
+    // through it) is ruled out.  can_inline has already checked the opcodes
+    // and that locals are assigned before they're loaded.
+    auto code = frame.Code;
+    auto byteCode = (_Py_CODEUNIT *)PyBytes_AS_STRING(code->co_code);
+    auto count = PyBytes_GET_SIZE(code->co_code) / sizeof(_Py_CODEUNIT);
+    vector<InlineValue> locals(code->co_nlocals);
+    for (size_t i = 0; i < args.size(); i++) {
+        locals[i] = args[i];
+    }
+    vector<InlineValue> stack;
+    frame.Steps.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        auto byte = _Py_OPCODE(byteCode[i]);
+        auto oparg = _Py_OPARG(byteCode[i]);
+        auto& step = frame.Steps[i];
+        switch (byte) {
+            case NOP:
+            case RETURN_VALUE:
+                break;
+            case LOAD_FAST:
+                stack.push_back(locals[oparg]);
+                break;
+            case STORE_FAST:
+                locals[oparg] = stack.back();
+                stack.pop_back();
+                break;
+            case LOAD_CONST:
+                stack.push_back(to_abstract(PyTuple_GET_ITEM(code->co_consts, oparg)));
+                break;
+            case POP_TOP:
+                stack.pop_back();
+                break;
+            case BUILD_TUPLE:
+                stack.resize(stack.size() - oparg);
+                stack.push_back(&Tuple);
+                break;
+            case LOAD_ATTR:
+            {
+                auto owner = stack.back();
+                if (owner.Type != nullptr) {
+                    // The guard on the class's version tag makes sure nothing
+                    // which would take precedence is added to it later
+                    if (!find_instance_attr(owner.Type, PyTuple_GET_ITEM(code->co_names, oparg), step.Offset)) {
+                        return false;
+                    }
+                    step.Owner = owner.Type;
+                }
+                else {
+                    // Attributes of builtin types are plain descriptors, but a
+                    // function's can be anything
+                    auto kind = owner.Value->kind();
+                    if (!is_known_type(kind) || kind == AVK_Function) {
+                        return false;
+                    }
+                }
+                stack.back() = &Any;
+                break;
+            }
+            case UNARY_POSITIVE:
+            case UNARY_NEGATIVE:
+            case UNARY_NOT:
+            case UNARY_INVERT:
+            {
+                auto value = stack.back().Value;
+                if (byte == UNARY_NOT ? !is_known_type(value->kind()) : !is_scalar(value)) {
+                    return false;
+                }
+                stack.back() = value->unary(nullptr, byte);
+                break;
+            }
+            case BINARY_SUBSCR:
+            {
+                auto index = stack.back().Value->kind();
+                stack.pop_back();
+                switch (stack.back().Value->kind()) {
+                    case AVK_Tuple:
+                    case AVK_List:
+                    case AVK_String:
+                    case AVK_Bytes:
+                        if (index != AVK_Integer && index != AVK_Bool) {
+                            return false;
+                        }
+                        break;
+                    default:
+                        return false;
+                }
+                stack.back() = &Any;
+                break;
+            }
+            case COMPARE_OP:
+            {
+                auto right = stack.back().Value;
+                stack.pop_back();
+                auto left = stack.back().Value;
+                switch (oparg) {
+                    case PyCmp_IS:
+                    case PyCmp_IS_NOT:
+                        break;
+                    case PyCmp_IN:
+                    case PyCmp_NOT_IN:
+                        // Only substring checks, which don't compare items
+                        if ((right->kind() != AVK_String && right->kind() != AVK_Bytes) ||
+                            left->kind() != right->kind()) {
+                            return false;
+                        }
+                        break;
+                    default:
+                        if (!is_scalar(left) || !is_scalar(right)) {
+                            return false;
+                        }
+                        break;
+                }
+                step.Left = left->kind();
+                step.Right = right->kind();
+                stack.back() = &Bool;
+                break;
+            }
+            default:
+            {
+                // The remaining opcodes are binary operators
+                auto right = stack.back().Value;
+                stack.pop_back();
+                auto left = stack.back().Value;
+                bool concat = (byte == BINARY_ADD || byte == INPLACE_ADD) && left->kind() == right->kind() &&
+                    (left->kind() == AVK_List || left->kind() == AVK_Tuple);
+                if (!concat) {
+                    if (!is_scalar(left) || !is_scalar(right)) {
+                        return false;
+                    }
+                    // Formatting converts its arguments with their methods
+                    if ((byte == BINARY_MODULO || byte == INPLACE_MODULO) &&
+                        (left->kind() == AVK_String || left->kind() == AVK_Bytes)) {
+                        return false;
+                    }
+                }
+                step.Left = left->kind();
+                step.Right = right->kind();
+                AbstractValueWithSources other(right);
+                stack.back() = left->binary(nullptr, byte, other);
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+// Checks if the function ends by returning a tuple of the given size
+static bool returns_tuple(PyCodeObject* code, size_t size) {
+    auto byteCode = (_Py_CODEUNIT *)PyBytes_AS_STRING(code->co_code);
+    auto count = PyBytes_GET_SIZE(code->co_code) / sizeof(_Py_CODEUNIT);
+    return count >= 2 &&
+        _Py_OPCODE(byteCode[count - 2]) == BUILD_TUPLE &&
+        _Py_OPARG(byteCode[count - 2]) == size &&
+        _Py_OPCODE(byteCode[count - 1]) == RETURN_VALUE;
+}
+
+bool AbstractInterpreter::inline_call(size_t opcodeIndex, size_t curByte, int argCnt, bool isMethod) {
+    if (m_profile == nullptr) {
+        return false;
+    }
+
+    bool polymorphic;
+    auto code = m_profile->get_callee(opcodeIndex, polymorphic);
+    if (code == nullptr) {
+        if (polymorphic) {
+            m_stats.Inlining[ID_Polymorphic]++;
+        }
+        return false;
+    }
+
+    // The arguments become the function's locals
+    InlineFrame frame(code);
+
+    // Arguments whose types we don't know, including self for a method call,
+    // are specialized on the exact types they had while we were profiling.
+    int calleeArgs = isMethod ? argCnt + 1 : argCnt;
+    vector<InlineValue> args;
+    vector<PyTypeObject*> guards;
+    auto& stackInfo = get_stack_info(opcodeIndex);
+    for (int i = 0; i < calleeArgs; i++) {
+        AbstractValue* value = &Any;
+        if (!isMethod || i != 0) {
+            value = stackInfo[stackInfo.size() - calleeArgs + i].Value;
+        }
+        auto type = value->kind() == AVK_Any ? m_profile->get_arg_type(opcodeIndex, i) : nullptr;
+        if (type == nullptr) {
+            args.push_back(value);
+        }
+        else if (GetAbstractType(type) != AVK_Any) {
+            args.push_back(to_abstract(GetAbstractType(type)));
+        }
+        else {
+            args.push_back(InlineValue(&Any, type));
+        }
+        guards.push_back(type);
+    }
+    auto decision = calleeArgs <= INLINE_MAX_ARGS ? can_inline(frame, args) : ID_Signature;
+    m_stats.Inlining[decision]++;
+    if (decision != ID_Inlined) {
+        return false;
+    }
+
+    // When we unpack the tuple the function returns we can leave its items
+    // on the stack instead of creating it.
+    auto unpackOffset = curByte + sizeof(_Py_CODEUNIT);
+    if (GET_OPCODE(unpackOffset) == UNPACK_SEQUENCE &&
+        m_jumpsTo.find(unpackOffset) == m_jumpsTo.end() &&
+        returns_tuple(code, GET_OPARG(unpackOffset))) {
+        frame.Unpack = GET_OPARG(unpackOffset);
+        m_scalarUnpacks.insert(unpackOffset);
+    }
+    for (int i = calleeArgs - 1; i >= 0; i--) {
+        frame.Locals[i] = m_comp->emit_spill();
+    }
+    dec_stack(calleeArgs);
+    auto callStack = m_stack;
+
+    auto notInlined = m_comp->emit_define_label();
+    auto done = m_comp->emit_define_label();
+    if (isMethod) {
+        // We have the attribute rather than a function to bind self to
+        m_comp->emit_load_local(frame.Locals[0]);
+        m_comp->emit_null();
+        m_comp->emit_branch(BranchEqual, notInlined);
+    }
+    for (int i = 0; i < calleeArgs; i++) {
+        if (guards[i] != nullptr) {
+            // Attributes we load from the instance rely on the class being unchanged
+            bool version = false;
+            for (auto& step : frame.Steps) {
+                version |= step.Owner == guards[i];
+            }
+            m_comp->emit_exact_type_guard(frame.Locals[i], guards[i], version, notInlined);
+        }
+    }
+    m_comp->emit_inline_guard(code, notInlined);
+    frame.Function = m_comp->emit_spill();
+    dec_stack();
+
+    m_inline = &frame;
+    emit_inline_body(frame);
+    m_inline = nullptr;
+    m_comp->emit_load_and_free_local(frame.Function);
+    m_comp->emit_pop_top();
+    if (frame.Unpack == 0) {
+        // An int or float result which the caller wants unboxed, and which
+        // we've computed unboxed, is known to be of the type it's been
+        // profiled as.  Anything else is checked like any other call's result.
+        auto guard = m_resultGuards.find(opcodeIndex);
+        auto kind = guard != m_resultGuards.end() && !should_box(opcodeIndex) ? GetAbstractType(guard->second) : AVK_Any;
+        auto repr = frame.Stack.back();
+        if (!(kind == AVK_Integer && repr == IR_Tagged) && !(kind == AVK_Float && repr == IR_Float)) {
+            inline_convert(frame, 0, IR_Object);
+            profile_result(opcodeIndex, curByte);
+        }
+    }
+    m_comp->emit_branch(BranchAlways, done);
+
+    // Call whatever we've been given instead
+    m_comp->emit_mark_label(notInlined);
+    m_stack = callStack;
+    for (int i = 0; i < calleeArgs; i++) {
+        m_comp->emit_load_local(frame.Locals[i]);
+    }
+    if (isMethod) {
+        m_comp->emit_method_call(argCnt);
+    }
+    else {
+        m_comp->emit_call(argCnt);
+    }
+    dec_stack();
+    error_check("call function failed");
+    inc_stack();
+    if (frame.Unpack != 0) {
+        m_lastiIndex = (int)unpackOffset;
+        unpack_sequence(frame.Unpack, (int)unpackOffset);
+    }
+    else {
+        profile_result(opcodeIndex, curByte);
+    }
+
+    m_comp->emit_mark_label(done);
+    for (auto local : frame.Locals) {
+        if (local.is_valid()) {
+            m_comp->emit_free_local(local);
+        }
+    }
+    return true;
+}
+
+void AbstractInterpreter::inline_convert(InlineFrame& frame, size_t depth, InlineRepr repr) {
+    auto index = frame.Stack.size() - 1 - depth;
+    auto from = frame.Stack[index];
+    if (from == repr) {
+        return;
+    }
+
+    // Get the value to the top of the stack
+    vector<Local> above;
+    for (size_t i = 0; i < depth; i++) {
+        auto local = m_comp->emit_define_local(frame.Stack[frame.Stack.size() - 1 - i] == IR_Float ? LK_Float : LK_Pointer);
+        m_comp->emit_store_local(local);
+        above.push_back(local);
+    }
+
+    switch (repr) {
+        case IR_Object:
+            if (from == IR_Float) {
+                m_comp->emit_box_float();
+            }
+            else {
+                m_comp->emit_box_tagged_ptr();
+            }
+            break;
+        case IR_Tagged:
+        {
+            // If the value was tagged we're done with the original object
+            auto value = m_comp->emit_spill();
+            auto owned = m_comp->emit_define_label();
+            m_comp->emit_load_local(value);
+            m_comp->emit_unbox_int_tagged();
+            m_comp->emit_dup();
+            m_comp->emit_load_local(value);
+            m_comp->emit_branch(BranchEqual, owned);
+            m_comp->emit_load_local(value);
+            m_comp->emit_pop_top();
+            m_comp->emit_mark_label(owned);
+            m_comp->emit_free_local(value);
+            break;
+        }
+        case IR_Float:
+        {
+            auto value = m_comp->emit_spill();
+            m_comp->emit_load_local(value);
+            m_comp->emit_unbox_float();
+            m_comp->emit_load_and_free_local(value);
+            m_comp->emit_pop_top();
+            break;
+        }
+    }
+    frame.Stack[index] = repr;
+    m_stack[m_stack.size() - 1 - depth] = repr == IR_Float ? STACK_KIND_VALUE : STACK_KIND_OBJECT;
+
+    for (auto cur = above.rbegin(); cur != above.rend(); cur++) {
+        m_comp->emit_load_and_free_local(*cur);
+    }
+}
+
+// Integer operators we do on tagged values, the others produce floats or
+// could be better off as objects
+static bool is_tagged_int_op(int byte) {
+    switch (byte) {
+        case BINARY_ADD:
+        case BINARY_SUBTRACT:
+        case BINARY_MULTIPLY:
+        case BINARY_FLOOR_DIVIDE:
+        case BINARY_MODULO:
+        case BINARY_LSHIFT:
+        case BINARY_RSHIFT:
+        case BINARY_AND:
+        case BINARY_OR:
+        case BINARY_XOR:
+        case INPLACE_ADD:
+        case INPLACE_SUBTRACT:
+        case INPLACE_MULTIPLY:
+        case INPLACE_FLOOR_DIVIDE:
+        case INPLACE_MODULO:
+        case INPLACE_LSHIFT:
+        case INPLACE_RSHIFT:
+        case INPLACE_AND:
+        case INPLACE_OR:
+        case INPLACE_XOR:
+            return true;
+    }
+    return false;
+}
+
+// Float operators which can't raise
+static bool is_float_op(int byte) {
+    switch (byte) {
+        case BINARY_ADD:
+        case BINARY_SUBTRACT:
+        case BINARY_MULTIPLY:
+        case INPLACE_ADD:
+        case INPLACE_SUBTRACT:
+        case INPLACE_MULTIPLY:
+            return true;
+    }
+    return false;
+}
+
+void AbstractInterpreter::emit_inline_body(InlineFrame& frame) {
+    // Values are kept unboxed between the int and float operations
+    // inline_types_known found, and boxed when anything else consumes them.
+    auto code = frame.Code;
+    auto byteCode = (_Py_CODEUNIT *)PyBytes_AS_STRING(code->co_code);
+    auto count = PyBytes_GET_SIZE(code->co_code) / sizeof(_Py_CODEUNIT);
+    for (size_t i = 0; i < count; i++) {
+        auto byte = _Py_OPCODE(byteCode[i]);
+        auto oparg = _Py_OPARG(byteCode[i]);
+        auto& step = frame.Steps[i];
+        frame.LastI = (int)(i * sizeof(_Py_CODEUNIT));
+        switch (byte) {
+            case NOP:
+                break;
+            case LOAD_FAST:
+                m_comp->emit_load_local(frame.Locals[oparg]);
+                m_comp->emit_dup();
+                m_comp->emit_incref();
+                inc_stack();
+                frame.Stack.push_back(IR_Object);
+                break;
+            case STORE_FAST:
+                inline_convert(frame, 0, IR_Object);
+                if (frame.Locals[oparg].is_valid()) {
+                    // Release the old value once the new one is stored
+                    m_comp->emit_load_local(frame.Locals[oparg]);
+                    auto old = m_comp->emit_spill();
+                    m_comp->emit_store_local(frame.Locals[oparg]);
+                    m_comp->emit_load_and_free_local(old);
+                    m_comp->emit_pop_top();
+                }
+                else {
+                    frame.Locals[oparg] = m_comp->emit_define_local();
+                    m_comp->emit_store_local(frame.Locals[oparg]);
+                }
+                dec_stack();
+                frame.Stack.pop_back();
+                break;
+            case LOAD_CONST:
+            {
+                auto value = PyTuple_GET_ITEM(code->co_consts, oparg);
+                if (PyLong_CheckExact(value)) {
+                    int overflow;
+                    auto intValue = PyLong_AsLongLongAndOverflow(value, &overflow);
+                    if (!overflow && can_tag(intValue)) {
+                        m_comp->emit_tagged_int(intValue);
+                        inc_stack();
+                        frame.Stack.push_back(IR_Tagged);
+                        break;
+                    }
+                }
+                m_comp->emit_ptr(value);
+                m_comp->emit_dup();
+                m_comp->emit_incref();
+                inc_stack();
+                frame.Stack.push_back(IR_Object);
+                break;
+            }
+            case LOAD_ATTR:
+                inline_convert(frame, 0, IR_Object);
+                if (step.Owner != nullptr) {
+                    m_comp->emit_load_instance_attr(PyTuple_GET_ITEM(code->co_names, oparg), step.Owner, step.Offset);
+                }
+                else {
+                    m_comp->emit_load_attr(PyTuple_GET_ITEM(code->co_names, oparg));
+                }
+                dec_stack();
+                error_check("load attr failed");
+                inc_stack();
+                break;
+            case POP_TOP:
+                if (frame.Stack.back() == IR_Float) {
+                    m_comp->emit_pop();
+                }
+                else {
+                    m_comp->emit_pop_top();
+                }
+                dec_stack();
+                frame.Stack.pop_back();
+                break;
+            case BUILD_TUPLE:
+                for (int j = 0; j < oparg; j++) {
+                    inline_convert(frame, j, IR_Object);
+                }
+                if (frame.Unpack != 0 && i == count - 2) {
+                    // The items are returned on the stack in unpacked order
+                    reverse_stack(oparg);
+                    break;
+                }
+                build_tuple(oparg);
+                inc_stack();
+                frame.Stack.resize(frame.Stack.size() - oparg);
+                frame.Stack.push_back(IR_Object);
+                break;
+            case UNARY_POSITIVE:
+            case UNARY_NEGATIVE:
+            case UNARY_NOT:
+            case UNARY_INVERT:
+                inline_convert(frame, 0, IR_Object);
+                dec_stack();
+                switch (byte) {
+                    case UNARY_POSITIVE: m_comp->emit_unary_positive(); break;
+                    case UNARY_NEGATIVE: m_comp->emit_unary_negative(); break;
+                    case UNARY_NOT: m_comp->emit_unary_not(); break;
+                    case UNARY_INVERT: m_comp->emit_unary_invert(); break;
+                }
+                error_check("unary op failed");
+                inc_stack();
+                break;
+            case COMPARE_OP:
+                if (oparg != PyCmp_IS && oparg != PyCmp_IS_NOT && oparg != PyCmp_IN && oparg != PyCmp_NOT_IN &&
+                    step.Left == AVK_Float && step.Right == AVK_Float) {
+                    inline_convert(frame, 1, IR_Float);
+                    inline_convert(frame, 0, IR_Float);
+                    m_comp->emit_compare_float(oparg);
+                    m_comp->emit_box_bool();
+                    dec_stack(2);
+                    inc_stack();
+                    frame.Stack.pop_back();
+                    frame.Stack.back() = IR_Object;
+                    break;
+                }
+                inline_convert(frame, 1, IR_Object);
+                inline_convert(frame, 0, IR_Object);
+                switch (oparg) {
+                    case PyCmp_IS:
+                    case PyCmp_IS_NOT:
+                        m_comp->emit_is(oparg != PyCmp_IS);
+                        dec_stack();
+                        break;
+                    case PyCmp_IN:
+                    case PyCmp_NOT_IN:
+                        if (oparg == PyCmp_IN) {
+                            m_comp->emit_in();
+                        }
+                        else {
+                            m_comp->emit_not_in();
+                        }
+                        dec_stack(2);
+                        error_check("in failed");
+                        inc_stack();
+                        break;
+                    default:
+                        m_comp->emit_compare_object(oparg);
+                        dec_stack(2);
+                        error_check("compare failed");
+                        inc_stack();
+                        break;
+                }
+                frame.Stack.pop_back();
+                break;
+            case RETURN_VALUE:
+                // The result stays on the stack for the caller
+                for (auto& local : frame.Locals) {
+                    if (local.is_valid()) {
+                        m_comp->emit_load_local(local);
+                        m_comp->emit_pop_top();
+                    }
+                }
+                break;
+            default:
+                // The remaining opcodes can_inline allows are binary operators
+                if (step.Left == AVK_Integer && step.Right == AVK_Integer && is_tagged_int_op(byte)) {
+                    inline_convert(frame, 1, IR_Tagged);
+                    inline_convert(frame, 0, IR_Tagged);
+                    dec_stack(2);
+                    m_comp->emit_binary_tagged_int(byte);
+                    error_check("tagged binary op failed");
+                    inc_stack();
+                    frame.Stack.pop_back();
+                    frame.Stack.back() = IR_Tagged;
+                    break;
+                }
+                if (step.Left == AVK_Float && step.Right == AVK_Float && is_float_op(byte)) {
+                    inline_convert(frame, 1, IR_Float);
+                    inline_convert(frame, 0, IR_Float);
+                    dec_stack(2);
+                    m_comp->emit_binary_float(byte);
+                    inc_stack(1, STACK_KIND_VALUE);
+                    frame.Stack.pop_back();
+                    frame.Stack.back() = IR_Float;
+                    break;
+                }
+                inline_convert(frame, 1, IR_Object);
+                inline_convert(frame, 0, IR_Object);
+                dec_stack(2);
+                m_comp->emit_binary_object(byte);
+                error_check("binary op failed");
+                inc_stack();
+                frame.Stack.pop_back();
+                break;
+        }
+    }
+}
+
+JittedCode* AbstractInterpreter::compile_worker() {
+    StatsTimer timer(m_stats.ILGenTime);
+    Label ok;
+
+    find_method_calls();
+    find_borrowed_loads();
+
+    auto raiseNoHandlerLabel = m_comp->emit_define_label();
+    auto reraiseNoHandlerLabel = m_comp->emit_define_label();
+
+    m_comp->emit_lasti_init();
+    if (!m_elideFrame) {
+        m_comp->emit_push_frame();
+    }
+    find_register_locals();
+
+    m_blockStack.push_back(BlockInfo(-1, NOP, 0));
+    m_allHandlers.push_back(
+        ExceptionHandler(
+            0,
+            ExceptionVars(),
+            raiseNoHandlerLabel, 
+            reraiseNoHandlerLabel, 
+            Label(),
+            vector<bool>()
+        )
+    );
+
+    for (size_t i = 0; i < m_code->co_argcount + m_code->co_kwonlyargcount; i++) {
+        auto local = get_local_info(0, i);
+        if (!local.ValueInfo.needs_boxing()) {
+            m_comp->emit_load_fast(i);
+
+            if (local.ValueInfo.Value->kind() == AVK_Float) {
+                m_comp->emit_unbox_float();
+                m_comp->emit_store_local(get_optimized_local(i, AVK_Float));
+            }
+            else if (local.ValueInfo.Value->kind() == AVK_Integer) {
+                m_comp->emit_unbox_int_tagged();
+                m_comp->emit_store_local(get_optimized_local(i, AVK_Any));
+            }
+        }
+    }
+
+    if (m_generator) {
+        // gen_send_ex passes us the frame the way the last yield left it, we
+        // take over the values saved on it and pick up after the yield.
+        // Otherwise f_lasti is -1 and the generator is starting.
+        m_comp->emit_clear_frame_stack();
+        for (auto offset : m_yieldOffsets) {
+            m_resumeLabels[offset] = m_comp->emit_define_label();
+            m_comp->emit_load_lasti();
+            m_comp->emit_int((int)offset);
+            m_comp->emit_branch(BranchEqual, m_resumeLabels[offset]);
+
+            if (GET_OPCODE(offset) == YIELD_FROM) {
+                m_resendLabels[offset] = m_comp->emit_define_label();
+                m_comp->emit_load_lasti();
+                m_comp->emit_int((int)(offset - sizeof(_Py_CODEUNIT)));
+                m_comp->emit_branch(BranchEqual, m_resendLabels[offset]);
+            }
+        }
+
+        // An exception thrown into a generator which hasn't started is
+        // raised before it runs any code.
+        auto start = m_comp->emit_define_label();
+        m_comp->emit_load_throwflag();
+        m_comp->emit_branch(BranchFalse, start);
+        branch_raise("thrown into generator");
+        m_comp->emit_mark_label(start);
+    }
+    
+    for (int curByte = 0; curByte < m_size; curByte += sizeof(_Py_CODEUNIT)) {
+        _ASSERTE(curByte % sizeof(_Py_CODEUNIT) == 0);
+
+        auto opcodeIndex = curByte;
+
+        auto byte = GET_OPCODE(curByte);
+        auto oparg = GET_OPARG(curByte);
+
+    processOpCode:
+        // See FOR_ITER for special handling of the offset label
+        if (get_extended_opcode(curByte) != FOR_ITER) {
+            mark_offset_label(curByte);
+        }
+
+        auto curStackDepth = m_offsetStack.find(curByte);
+        if (curStackDepth != m_offsetStack.end()) {
+            m_stack = curStackDepth->second;
+        }
+
+        if (m_blockStack.size() > 1 && 
+            curByte >= m_blockStack.back().EndOffset &&
+            m_blockStack.back().EndOffset != -1) {
+            compile_pop_block();
+        }
+
+        // update f_lasti
+        m_lastiIndex = curByte;
+        if (!can_skip_lasti_update(curByte)) {
+            m_comp->emit_lasti_update(curByte);
+        }
+
+        if ((m_guards.find(opcodeIndex) != m_guards.end() ||
+            m_resultGuards.find(opcodeIndex) != m_resultGuards.end()) && !can_deoptimize()) {
+            // We can't rebuild the interpreter's state if a type guard fails here
+            m_stats.fail(CF_Deoptimize, byte);
+            return nullptr;
+        }
+
+        switch (byte) {
+            case NOP: break;
+            case ROT_TWO: 
+            {
+                std::swap(m_stack[m_stack.size() - 1], m_stack[m_stack.size() - 2]);
+
+                if (!should_box(opcodeIndex)) {
+                    auto stackInfo = get_stack_info(opcodeIndex);
+                    auto top_kind = stackInfo[stackInfo.size() - 1].Value->kind();
+                    auto second_kind = stackInfo[stackInfo.size() - 2].Value->kind();
+
+                    if (top_kind == AVK_Float && second_kind == AVK_Float) {
+                        m_comp->emit_rot_two(LK_Float);
+                        break;
                     } else if (top_kind == AVK_Integer && second_kind == AVK_Integer) {
                         m_comp->emit_rot_two(LK_Pointer);
                         break;
@@ -2189,10 +3382,23 @@ JittedCode* AbstractInterpreter::compile_worker() {
                 int_error_check("delete attr failed");
                 break;
             case LOAD_ATTR:
+                if (m_methodLoads.find(opcodeIndex) != m_methodLoads.end()) {
+                    // Leaves the function and self (or the attribute and null)
+                    // on the stack for the CALL_FUNCTION
+                    auto self = m_comp->emit_define_local();
+                    m_comp->emit_load_method(PyTuple_GetItem(m_code->co_names, oparg), self);
+                    dec_stack();
+                    error_check("load method failed");
+                    inc_stack();
+                    m_comp->emit_load_and_free_local(self);
+                    inc_stack();
+                    break;
+                }
                 m_comp->emit_load_attr(PyTuple_GetItem(m_code->co_names, oparg));
                 dec_stack();
                 error_check("load attr failed");
                 inc_stack();
+                profile_result(opcodeIndex, curByte);
                 break;
             case STORE_GLOBAL:
                 m_comp->emit_store_global(PyTuple_GetItem(m_code->co_names, oparg));
@@ -2207,8 +3413,18 @@ JittedCode* AbstractInterpreter::compile_worker() {
                 m_comp->emit_load_global(PyTuple_GetItem(m_code->co_names, oparg));
                 error_check("load global failed");
                 inc_stack();
+                profile_result(opcodeIndex, curByte);
+                break;
+            case LOAD_CONST:
+                if (m_scalarUnpacks.find(curByte + sizeof(_Py_CODEUNIT)) != m_scalarUnpacks.end()) {
+                    auto value = PyTuple_GetItem(m_code->co_consts, oparg);
+                    for (auto i = PyTuple_GET_SIZE(value) - 1; i >= 0; i--) {
+                        load_const_value(PyTuple_GET_ITEM(value, i), opcodeIndex);
+                    }
+                    break;
+                }
+                load_const(oparg, opcodeIndex);
                 break;
-            case LOAD_CONST: load_const(oparg, opcodeIndex); break;
             case STORE_NAME:
                 m_comp->emit_store_name(PyTuple_GetItem(m_code->co_names, oparg));
                 dec_stack();
@@ -2223,30 +3439,38 @@ JittedCode* AbstractInterpreter::compile_worker() {
                 m_comp->emit_pop_top();
                 m_comp->emit_delete_fast(oparg);
                 break;
-            case STORE_FAST: store_fast(oparg, opcodeIndex); break;
+            case STORE_FAST:
+                store_fast(oparg, opcodeIndex);
+                break;
             case LOAD_FAST: load_fast(oparg, opcodeIndex); break;
             case UNPACK_SEQUENCE:
-                unpack_sequence(oparg, curByte);
+                if (m_scalarUnpacks.find(opcodeIndex) == m_scalarUnpacks.end()) {
+                    unpack_sequence(oparg, curByte);
+                }
                 break;
             case UNPACK_EX: unpack_ex(oparg, curByte); break;
             case CALL_FUNCTION_KW:
+            {
                 // names is a tuple on the stack, should have come from a LOAD_CONST
-                if (!m_comp->emit_kwcall(oparg)) {
-                    auto names = m_comp->emit_spill();
-                    dec_stack();    // names
-                    build_tuple(oparg);
-                    m_comp->emit_load_and_free_local(names);
-
-                    m_comp->emit_kwcall_with_tuple();
-                    dec_stack();// function & names
+                auto names = m_comp->emit_spill();
+                dec_stack();    // names
+                auto args = m_sequenceLocals[curByte];
+                store_call_args(args, oparg);
+                if (m_methodCalls.find(opcodeIndex) != m_methodCalls.end()) {
+                    m_comp->emit_method_call_array(args, oparg, names);
+                    dec_stack(2); // function & self
                 }
                 else {
-                    dec_stack(oparg + 2); // + function & names
+                    m_comp->emit_kwcall_array(args, oparg, names);
+                    dec_stack(); // function
                 }
+                m_comp->emit_free_local(names);
 
                 error_check("kwcall failed");
                 inc_stack();
+                profile_result(opcodeIndex, curByte);
                 break;
+            }
             case CALL_FUNCTION_EX:
                 if (oparg & 0x01) {
                     // kwargs, then args, then function
@@ -2259,12 +3483,33 @@ JittedCode* AbstractInterpreter::compile_worker() {
 
                 error_check("call failed");
                 inc_stack();
+                profile_result(opcodeIndex, curByte);
                 break;
             case CALL_FUNCTION:
             {
-                if (!m_comp->emit_call(oparg)) {
-                    build_tuple(oparg);
-                    m_comp->emit_call_with_tuple();
+                bool isMethod = m_methodCalls.find(opcodeIndex) != m_methodCalls.end();
+                if (m_baseline) {
+                    if (m_profile != nullptr && oparg + (isMethod ? 1 : 0) <= INLINE_MAX_ARGS) {
+                        record_callee(opcodeIndex, isMethod ? oparg + 1 : oparg);
+                    }
+                }
+                else if (inline_call(opcodeIndex, curByte, oparg, isMethod)) {
+                    break;
+                }
+
+                if (isMethod) {
+                    if (!m_comp->emit_method_call(oparg)) {
+                        store_call_args(m_sequenceLocals[curByte], oparg);
+                        m_comp->emit_method_call_array(m_sequenceLocals[curByte], oparg, Local());
+                        dec_stack(2);// function & self
+                    }
+                    else {
+                        dec_stack(oparg + 2); // + function & self
+                    }
+                }
+                else if (!m_comp->emit_call(oparg)) {
+                    store_call_args(m_sequenceLocals[curByte], oparg);
+                    m_comp->emit_call_array(m_sequenceLocals[curByte], oparg);
                     dec_stack();// function
                 }
                 else {
@@ -2273,9 +3518,15 @@ JittedCode* AbstractInterpreter::compile_worker() {
                 
                 error_check("call function failed");
                 inc_stack();
+                profile_result(opcodeIndex, curByte);
                 break;
             }
             case BUILD_TUPLE:
+                if (m_scalarUnpacks.find(curByte + sizeof(_Py_CODEUNIT)) != m_scalarUnpacks.end()) {
+                    // Unpacking reverses the order of the items
+                    reverse_stack(oparg);
+                    break;
+                }
                 build_tuple(oparg);
                 inc_stack();
                 break;
@@ -2358,7 +3609,8 @@ JittedCode* AbstractInterpreter::compile_worker() {
             case INPLACE_AND:
             case INPLACE_XOR:
             case INPLACE_OR:
-                if (!should_box(opcodeIndex)) {
+                // A subscript's result is only unboxed when we've speculated on its type
+                if (!should_box(opcodeIndex) && byte != BINARY_SUBSCR) {
                     auto stackInfo = get_stack_info(opcodeIndex);
                     auto one = stackInfo[stackInfo.size() - 1];
                     auto two = stackInfo[stackInfo.size() - 2];
@@ -2447,12 +3699,34 @@ JittedCode* AbstractInterpreter::compile_worker() {
                         break;
                     }
                 }
+                if (byte == BINARY_SUBSCR) {
+                    auto stackInfo = get_stack_info(opcodeIndex);
+                    auto index = stackInfo[stackInfo.size() - 1].Value->kind();
+                    auto container = stackInfo[stackInfo.size() - 2].Value->kind();
+                    if (index == AVK_Integer && (container == AVK_List || container == AVK_Tuple)) {
+                        dec_stack(2);
+                        if (container == AVK_List) {
+                            m_comp->emit_subscr_list_int();
+                        }
+                        else {
+                            m_comp->emit_subscr_tuple_int();
+                        }
+                        error_check("subscript failed");
+                        inc_stack();
+                        profile_result(opcodeIndex, curByte);
+                        break;
+                    }
+                }
+
                 dec_stack(2);
 
                 m_comp->emit_binary_object(byte);
 
                 error_check("binary op failed");
                 inc_stack();
+                if (byte == BINARY_SUBSCR) {
+                    profile_result(opcodeIndex, curByte);
+                }
 
                 break;
             case RETURN_VALUE: return_value(opcodeIndex); break;
@@ -2528,6 +3802,7 @@ JittedCode* AbstractInterpreter::compile_worker() {
                 for_iter(
                     curByte + oparg + sizeof(_Py_CODEUNIT), 
                     opcodeIndex, 
+                    curByte,
                     loopBlock
                 );
                 break;
@@ -2790,9 +4065,31 @@ JittedCode* AbstractInterpreter::compile_worker() {
             }
             break;
 
-            case YIELD_FROM:
             case YIELD_VALUE:
-                return nullptr;
+            case YIELD_FROM:
+                if (!m_generator || !can_suspend()) {
+                    m_stats.fail(CF_Generator, byte);
+                    return nullptr;
+                }
+                if (byte == YIELD_VALUE) {
+                    yield_value(opcodeIndex);
+                }
+                else {
+                    yield_from(opcodeIndex);
+                }
+                break;
+            case GET_YIELD_FROM_ITER:
+                m_comp->emit_get_yield_from_iter();
+                dec_stack();
+                error_check("get yield from iter failed");
+                inc_stack();
+                break;
+            case GET_AWAITABLE:
+                m_comp->emit_get_awaitable();
+                dec_stack();
+                error_check("get awaitable failed");
+                inc_stack();
+                break;
 
             case IMPORT_NAME:
                 m_comp->emit_import_name(PyTuple_GetItem(m_code->co_names, oparg));
@@ -2810,10 +4107,9 @@ JittedCode* AbstractInterpreter::compile_worker() {
                 dec_stack(1);
                 int_error_check("import star failed");
                 break;
-            case SETUP_WITH:
-            case WITH_CLEANUP_START:
-            case WITH_CLEANUP_FINISH:
-                return nullptr;
+            case SETUP_WITH: setup_with(oparg + curByte + sizeof(_Py_CODEUNIT)); break;
+            case WITH_CLEANUP_START: with_cleanup_start(); break;
+            case WITH_CLEANUP_FINISH: with_cleanup_finish(); break;
             case BUILD_MAP_UNPACK_WITH_CALL:
                 /* TODO: Finish implementation
 
@@ -2826,6 +4122,7 @@ JittedCode* AbstractInterpreter::compile_worker() {
 
                 */
             case BUILD_TUPLE_UNPACK_WITH_CALL:
+                m_stats.fail(CF_UnsupportedOpcode, byte);
                 return nullptr;
             case FORMAT_VALUE:
             {
@@ -2947,6 +4244,7 @@ JittedCode* AbstractInterpreter::compile_worker() {
 #if _DEBUG
                 printf("Unsupported opcode: %d (with related)\r\n", byte);
 #endif
+                m_stats.fail(CF_UnsupportedOpcode, byte);
                 return nullptr;
         }
     }
@@ -2998,10 +4296,14 @@ JittedCode* AbstractInterpreter::compile_worker() {
     m_comp->emit_load_local(m_retValue);
 
     m_comp->emit_mark_label(finalRet);
-    m_comp->emit_pop_frame();
+    if (!m_elideFrame) {
+        m_comp->emit_pop_frame();
+    }
 
     m_comp->emit_ret();
 
+    // CoreCLR's time is recorded by the compiler
+    timer.stop();
     return m_comp->emit_compile();
 }
 
@@ -3256,6 +4558,7 @@ void AbstractInterpreter::pop_jump_if(bool isTrue, int opcodeIndex, int jumpTo)
     }
     auto target = getOffsetLabel(jumpTo);
     bool emitted = false;
+    bool borrowed = m_borrowedLoads.find(opcodeIndex - sizeof(_Py_CODEUNIT)) != m_borrowedLoads.end();
     if (!one.needs_boxing()) {
         switch (one.Value->kind()) {
             case AVK_Float:
@@ -3265,12 +4568,50 @@ void AbstractInterpreter::pop_jump_if(bool isTrue, int opcodeIndex, int jumpTo)
                 break;
             case AVK_Integer:
                 emitted = true;
+                if (borrowed) {
+                    own_borrowed_value();
+                }
                 m_comp->emit_unary_not_tagged_int_push_bool();
                 m_comp->emit_branch(isTrue ? BranchFalse : BranchTrue, target);
                 break;
         }
     }
 
+    if (!emitted && borrowed) {
+        // The frame or the code object owns the value, so all we need to do
+        // is drop it from the stack once we've tested it.
+        auto noJump = m_comp->emit_define_label();
+        auto willJump = m_comp->emit_define_label();
+        auto done = m_comp->emit_define_label();
+
+        m_comp->emit_dup();
+        m_comp->emit_ptr(isTrue ? Py_False : Py_True);
+        m_comp->emit_branch(BranchEqual, noJump);
+
+        m_comp->emit_dup();
+        m_comp->emit_ptr(isTrue ? Py_True : Py_False);
+        m_comp->emit_branch(BranchEqual, willJump);
+
+        m_comp->emit_is_true();
+        dec_stack();
+
+        raise_on_negative_one();
+
+        m_comp->emit_branch(isTrue ? BranchTrue : BranchFalse, target);
+        m_comp->emit_branch(BranchAlways, done);
+
+        m_comp->emit_mark_label(willJump);
+        m_comp->emit_pop();
+        m_comp->emit_branch(BranchAlways, target);
+
+        m_comp->emit_mark_label(noJump);
+        m_comp->emit_pop();
+
+        m_comp->emit_mark_label(done);
+        m_offsetStack[jumpTo] = m_stack;
+        return;
+    }
+
     if (!emitted) {
         auto noJump = m_comp->emit_define_label();
         auto willJump = m_comp->emit_define_label();
@@ -3406,7 +4747,11 @@ void AbstractInterpreter::unary_not(int& opcodeIndex) {
 }
 
 JittedCode* AbstractInterpreter::compile() {
-    bool interpreted = interpret();
+    bool interpreted;
+    {
+        StatsTimer timer(m_stats.InterpretTime);
+        interpreted = interpret();
+    }
     if (!interpreted) {
         return nullptr;
     }
@@ -3414,10 +4759,30 @@ JittedCode* AbstractInterpreter::compile() {
     return compile_worker();
 }
 
+JittedCode* AbstractInterpreter::compile_baseline() {
+    if (!preprocess()) {
+        return nullptr;
+    }
+
+    m_baseline = true;
+    return compile_worker();
+}
+
+JittedCode* AbstractInterpreter::compile_generator() {
+    m_generator = true;
+    return compile_baseline();
+}
+
 bool AbstractInterpreter::can_skip_lasti_update(int opcodeIndex) {
+    // branch_raise writes f_lasti on the way to the exception handler, so we
+    // only need to keep it up to date for opcodes which can run arbitrary
+    // code that might look at the frame, e.g. to get the line number for a
+    // warning.
     switch (GET_OPCODE(opcodeIndex)) {
         case DUP_TOP:
         case SETUP_EXCEPT:
+        case SETUP_FINALLY:
+        case SETUP_LOOP:
         case NOP:
         case ROT_TWO:
         case ROT_THREE:
@@ -3430,15 +4795,66 @@ bool AbstractInterpreter::can_skip_lasti_update(int opcodeIndex) {
         case CONTINUE_LOOP:
         case END_FINALLY:
         case LOAD_CONST:
+        case LOAD_FAST:
+        case LOAD_GLOBAL:
+        case LOAD_DEREF:
+        case LOAD_CLOSURE:
+        case BUILD_TUPLE:
+        case BUILD_LIST:
+        case BUILD_SLICE:
+        case RETURN_VALUE:
         case JUMP_FORWARD:
         case JUMP_ABSOLUTE:
             return true;
+        case BINARY_TRUE_DIVIDE:
+        case BINARY_FLOOR_DIVIDE:
+        case BINARY_POWER:
+        case BINARY_MODULO:
+        case BINARY_MATRIX_MULTIPLY:
+        case BINARY_LSHIFT:
+        case BINARY_RSHIFT:
+        case BINARY_AND:
+        case BINARY_XOR:
+        case BINARY_OR:
+        case BINARY_MULTIPLY:
+        case BINARY_SUBTRACT:
+        case BINARY_ADD:
+        case INPLACE_POWER:
+        case INPLACE_MULTIPLY:
+        case INPLACE_MATRIX_MULTIPLY:
+        case INPLACE_TRUE_DIVIDE:
+        case INPLACE_FLOOR_DIVIDE:
+        case INPLACE_MODULO:
+        case INPLACE_ADD:
+        case INPLACE_SUBTRACT:
+        case INPLACE_LSHIFT:
+        case INPLACE_RSHIFT:
+        case INPLACE_AND:
+        case INPLACE_XOR:
+        case INPLACE_OR:
+        case COMPARE_OP:
+            // Unboxed values don't call out to their type
+            return !should_box(opcodeIndex);
+        case STORE_FAST:
+        case DELETE_FAST:
+        {
+            // Releasing the old value can run its finalizer, unless there
+            // isn't one or it's of a builtin scalar type
+            auto kind = get_local_info(opcodeIndex, GET_OPARG(opcodeIndex)).ValueInfo.Value->kind();
+            return kind == AVK_Undefined || is_scalar_type(kind);
+        }
     }
 
     return false;
 }
 
 void AbstractInterpreter::store_fast(int local, int opcodeIndex) {
+    auto guard = m_guards.find(opcodeIndex);
+    if (guard != m_guards.end()) {
+        guarded_store_fast(local, opcodeIndex, guard->second);
+        return;
+    }
+
     if (!should_box(opcodeIndex)) {
         auto stackInfo = get_stack_info(opcodeIndex);
         auto stackValue = stackInfo[stackInfo.size() - 1];
@@ -3451,7 +4867,11 @@ void AbstractInterpreter::store_fast(int local, int opcodeIndex) {
             return;
         }
         else if (stackValue.Value->kind() == AVK_Integer) {
+            // Ints which don't fit in a tagged pointer are owned by the
+            // frame, the optimized local only borrows them.
+            m_comp->emit_dup();
             m_comp->emit_store_local(get_optimized_local(local, AVK_Any));
+            m_comp->emit_store_fast_untagged(local);
             dec_stack();
             return;
         }
@@ -3462,9 +4882,478 @@ void AbstractInterpreter::store_fast(int local, int opcodeIndex) {
     dec_stack();
 }
 
+void AbstractInterpreter::guarded_store_fast(int local, int opcodeIndex, AbstractValueKind kind) {
+    _ASSERTE(m_stack[m_stack.size() - 1] == STACK_KIND_OBJECT);
+    auto failed = m_comp->emit_define_label();
+    auto done = m_comp->emit_define_label();
+
+    m_comp->emit_type_guard(kind == AVK_Float ? &PyFloat_Type : &PyLong_Type, failed);
+    if (should_box(opcodeIndex)) {
+        m_comp->emit_store_fast(local);
+    }
+    else if (kind == AVK_Float) {
+        auto value = m_comp->emit_spill();
+        m_comp->emit_load_local(value);
+        m_comp->emit_unbox_float();
+        m_comp->emit_store_local(get_optimized_local(local, AVK_Float));
+        m_comp->emit_load_and_free_local(value);
+        m_comp->emit_pop_top();
+    }
+    else {
+        // If the value was tagged we're done with the original object,
+        // otherwise the frame owns it and the optimized local borrows it.
+        auto value = m_comp->emit_spill();
+        auto tagged = m_comp->emit_define_label();
+        auto stored = m_comp->emit_define_label();
+        m_comp->emit_load_local(value);
+        m_comp->emit_unbox_int_tagged();
+        m_comp->emit_dup();
+        m_comp->emit_store_local(get_optimized_local(local, AVK_Any));
+        m_comp->emit_load_local(value);
+        m_comp->emit_branch(BranchNotEqual, tagged);
+        m_comp->emit_load_local(value);
+        m_comp->emit_store_fast(local);
+        m_comp->emit_branch(BranchAlways, stored);
+        m_comp->emit_mark_label(tagged);
+        m_comp->emit_load_local(value);
+        m_comp->emit_pop_top();
+        m_comp->emit_mark_label(stored);
+        m_comp->emit_free_local(value);
+    }
+    m_comp->emit_branch(BranchAlways, done);
+
+    m_comp->emit_mark_label(failed);
+    // Resume at the store
+    deoptimize(opcodeIndex, opcodeIndex - sizeof(_Py_CODEUNIT));
+
+    m_comp->emit_mark_label(done);
+    dec_stack();
+}
+
+AbstractValueWithSources AbstractInterpreter::profiled_result(size_t opcodeIndex) {
+    if (m_profile != nullptr) {
+        auto type = m_profile->get_type(opcodeIndex);
+        auto kind = GetAbstractType(type);
+        if (kind != AVK_Any) {
+            m_resultGuards[opcodeIndex] = type;
+            return AbstractValueWithSources(to_abstract(kind), add_intermediate_source(opcodeIndex));
+        }
+    }
+    return &Any;
+}
+
+void AbstractInterpreter::profile_result(size_t opcodeIndex, size_t curByte) {
+    if (m_baseline) {
+        if (m_profile != nullptr) {
+            m_comp->emit_record_type(m_profile, opcodeIndex);
+        }
+        return;
+    }
+
+    auto guard = m_resultGuards.find(opcodeIndex);
+    if (guard == m_resultGuards.end()) {
+        return;
+    }
+
+    _ASSERTE(m_stack[m_stack.size() - 1] == STACK_KIND_OBJECT);
+    auto failed = m_comp->emit_define_label();
+    auto done = m_comp->emit_define_label();
+    auto kind = GetAbstractType(guard->second);
+    bool unboxed = !should_box(opcodeIndex) && (kind == AVK_Float || kind == AVK_Integer);
+
+    m_comp->emit_type_guard(guard->second, failed);
+    if (unboxed && kind == AVK_Float) {
+        auto value = m_comp->emit_spill();
+        m_comp->emit_load_local(value);
+        m_comp->emit_unbox_float();
+        m_comp->emit_load_and_free_local(value);
+        m_comp->emit_pop_top();
+    }
+    else if (unboxed) {
+        // If the value was tagged we're done with the original object
+        auto value = m_comp->emit_spill();
+        auto owned = m_comp->emit_define_label();
+        m_comp->emit_load_local(value);
+        m_comp->emit_unbox_int_tagged();
+        m_comp->emit_dup();
+        m_comp->emit_load_local(value);
+        m_comp->emit_branch(BranchEqual, owned);
+        m_comp->emit_load_local(value);
+        m_comp->emit_pop_top();
+        m_comp->emit_mark_label(owned);
+        m_comp->emit_free_local(value);
+    }
+    m_comp->emit_branch(BranchAlways, done);
+
+    // The opcode has completed, resume after it with its result on the stack
+    m_comp->emit_mark_label(failed);
+    deoptimize(opcodeIndex, curByte);
+
+    m_comp->emit_mark_label(done);
+    if (unboxed && kind == AVK_Float) {
+        m_stack[m_stack.size() - 1] = STACK_KIND_VALUE;
+    }
+}
+
+bool AbstractInterpreter::can_deoptimize() {
+    // We only know how to rebuild the interpreter's state for loops
+    for (size_t i = 1; i < m_blockStack.size(); i++) {
+        if (m_blockStack[i].Kind != SETUP_LOOP) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void AbstractInterpreter::deoptimize(size_t opcodeIndex, size_t lasti) {
+    // Move the values on the stack into locals, boxing any we're holding unboxed
+    vector<Local> stack;
+    for (auto cur = m_stack.rbegin(); cur != m_stack.rend(); cur++) {
+        if (*cur == STACK_KIND_VALUE) {
+            m_comp->emit_box_float();
+        }
+        else {
+            m_comp->emit_box_tagged_ptr();
+        }
+        stack.push_back(m_comp->emit_spill());
+    }
+
+    // Locals which we're holding unboxed need to be written back to the frame
+    for (int i = 0; i < m_code->co_nlocals; i++) {
+        auto localInfo = get_local_info(opcodeIndex, i);
+        if (localInfo.IsMaybeUndefined || localInfo.ValueInfo.needs_boxing()) {
+            continue;
+        }
+
+        auto kind = localInfo.ValueInfo.Value->kind();
+        if (kind == AVK_Float) {
+            m_comp->emit_load_local(get_optimized_local(i, AVK_Float));
+            m_comp->emit_box_float();
+            m_comp->emit_store_fast(i);
+        }
+        else if (kind == AVK_Integer) {
+            // Objects are borrowed from the frame so storing one gives the
+            // frame back the same reference, tagged values get a new object.
+            m_comp->emit_load_local(get_optimized_local(i, AVK_Any));
+            m_comp->emit_dup();
+            m_comp->emit_incref(true);
+            m_comp->emit_box_tagged_ptr();
+            m_comp->emit_store_fast(i);
+        }
+    }
+
+    // Rebuild the loop blocks, the frame takes ownership of our iterators
+    int level = 0;
+    for (size_t i = 1; i < m_blockStack.size(); i++) {
+        m_comp->emit_deopt_push_block(SETUP_LOOP, m_blockStack[i].EndOffset, level);
+        if (m_blockStack[i].LoopVar.is_valid()) {
+            m_comp->emit_load_local(m_blockStack[i].LoopVar);
+            m_comp->emit_deopt_push_value();
+            level++;
+        }
+    }
+
+    // The values on the stack go on top of the loop iterators
+    for (auto cur = stack.rbegin(); cur != stack.rend(); cur++) {
+        m_comp->emit_load_and_free_local(*cur);
+        m_comp->emit_deopt_push_value();
+    }
+
+    m_comp->emit_deoptimize(lasti);
+    m_comp->emit_store_local(m_retValue);
+    m_comp->emit_branch(BranchLeave, m_retLabel);
+}
+
+bool AbstractInterpreter::can_suspend() {
+    // The frame's block stack can describe loops and try bodies, but not the
+    // exception state we keep in locals while running a handler.
+    for (size_t i = 1; i < m_blockStack.size(); i++) {
+        auto kind = m_blockStack[i].Kind;
+        if (kind != SETUP_LOOP && kind != SETUP_EXCEPT && kind != SETUP_FINALLY) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < m_stack.size(); i++) {
+        if (m_stack[i] != STACK_KIND_OBJECT) {
+            return false;
+        }
+    }
+    return true;
+}
+
+vector<Local> AbstractInterpreter::get_live_iterators(size_t opcodeIndex) {
+    vector<Local> iters;
+    for (auto& loop : m_loopIterators) {
+        if (loop.Start < opcodeIndex && opcodeIndex < loop.End) {
+            iters.push_back(loop.Iterator);
+        }
+    }
+    return iters;
+}
+
+vector<FrameValue> AbstractInterpreter::get_frame_values(size_t opcodeIndex, vector<int>& blockLevels) {
+    // Our iterators live in locals while the interpreter keeps them on its
+    // stack.  Values on our stack can be older than a block when they belong
+    // to a with statement, whose __exit__ stays on the stack for the body.
+    auto iters = get_live_iterators(opcodeIndex);
+    vector<FrameValue> values;
+    size_t nextIter = 0, nextValue = 0;
+    for (size_t i = 1; i < m_blockStack.size(); i++) {
+        auto& block = m_blockStack[i];
+        if (block.Kind != SETUP_LOOP) {
+            auto entryDepth = m_allHandlers[block.CurrentHandler].EntryStack.size();
+            while (nextValue < entryDepth) {
+                values.push_back(FrameValue(nextValue++));
+            }
+        }
+        blockLevels.push_back((int)values.size());
+        if (block.Kind == SETUP_LOOP && block.LoopVar.is_valid() && nextIter < iters.size()) {
+            values.push_back(FrameValue(iters[nextIter++]));
+        }
+    }
+
+    // The loops in comprehensions don't have blocks
+    while (nextIter < iters.size()) {
+        values.push_back(FrameValue(iters[nextIter++]));
+    }
+    while (nextValue < m_stack.size()) {
+        values.push_back(FrameValue(nextValue++));
+    }
+    return values;
+}
+
+void AbstractInterpreter::suspend(size_t opcodeIndex, size_t lasti, Local value) {
+    vector<Local> stack(m_stack.size());
+    for (size_t i = m_stack.size(); i-- > 0; ) {
+        stack[i] = m_comp->emit_spill();
+    }
+
+    // The frame is laid out the way the interpreter would leave it so that
+    // either of us can resume it.  The frame takes ownership of our iterators
+    // and the values on our stack.
+    vector<int> blockLevels;
+    auto values = get_frame_values(opcodeIndex, blockLevels);
+    for (size_t i = 1; i < m_blockStack.size(); i++) {
+        m_comp->emit_deopt_push_block(m_blockStack[i].Kind, m_blockStack[i].EndOffset, blockLevels[i - 1]);
+    }
+    for (auto& value : values) {
+        if (value.Iterator.is_valid()) {
+            m_comp->emit_load_local(value.Iterator);
+        }
+        else {
+            m_comp->emit_load_and_free_local(stack[value.StackIndex]);
+        }
+        m_comp->emit_deopt_push_value();
+    }
+
+    m_comp->emit_suspend_frame((int)lasti);
+    m_comp->emit_load_local(value);
+    m_comp->emit_store_local(m_retValue);
+    m_comp->emit_branch(BranchLeave, m_retLabel);
+}
+
+void AbstractInterpreter::resume(size_t opcodeIndex, Label label) {
+    m_comp->emit_mark_label(label);
+
+    auto iters = get_live_iterators(opcodeIndex);
+    vector<int> blockLevels;
+    auto values = get_frame_values(opcodeIndex, blockLevels);
+    for (size_t i = 0; i < values.size(); i++) {
+        m_comp->emit_load_frame_value((int)i);
+        if (values[i].Iterator.is_valid()) {
+            m_comp->emit_store_local(values[i].Iterator);
+        }
+    }
+
+    auto noThrow = m_comp->emit_define_label();
+    m_comp->emit_load_throwflag();
+    m_comp->emit_branch(BranchFalse, noThrow);
+
+    // Unwinding frees the iterators of loop blocks, but the loops in
+    // comprehensions don't have blocks.
+    size_t loopBlocks = 0;
+    for (size_t i = 1; i < m_blockStack.size(); i++) {
+        if (m_blockStack[i].Kind == SETUP_LOOP && m_blockStack[i].LoopVar.is_valid()) {
+            loopBlocks++;
+        }
+    }
+    for (size_t i = loopBlocks; i < iters.size(); i++) {
+        m_comp->emit_load_local(iters[i]);
+        m_comp->emit_pop_top();
+    }
+    branch_raise("thrown into generator");
+
+    m_comp->emit_mark_label(noThrow);
+}
+
+void AbstractInterpreter::yield_value(size_t opcodeIndex) {
+    auto value = m_comp->emit_spill();
+    dec_stack();
+    suspend(opcodeIndex, opcodeIndex, value);
+    m_comp->emit_free_local(value);
+
+    // The value sent to the generator replaces the one it yielded
+    inc_stack();
+    resume(opcodeIndex, m_resumeLabels[opcodeIndex]);
+}
+
+void AbstractInterpreter::yield_from(size_t opcodeIndex) {
+    // While the receiver is producing values we're suspended before the
+    // YIELD_FROM, and resuming sends it the next value.
+    auto send = m_comp->emit_define_label();
+    m_comp->emit_branch(BranchAlways, send);
+    resume(opcodeIndex, m_resendLabels[opcodeIndex]);
+    m_comp->emit_mark_label(send);
+
+    auto value = m_comp->emit_spill();
+    dec_stack();
+    m_comp->emit_dup();
+    m_comp->emit_load_and_free_local(value);
+    auto result = m_comp->emit_define_local();
+    m_comp->emit_yield_from(result);
+    raise_on_negative_one();
+
+    auto done = m_comp->emit_define_label();
+    m_comp->emit_branch(BranchFalse, done);
+    suspend(opcodeIndex, opcodeIndex - sizeof(_Py_CODEUNIT), result);
+
+    // When an exception thrown into the receiver escapes it, gen_throw pops
+    // the receiver and we're resumed after the YIELD_FROM to raise it.
+    auto after = m_comp->emit_define_label();
+    resume(opcodeIndex, m_resumeLabels[opcodeIndex]);
+    m_comp->emit_branch(BranchAlways, after);
+
+    // The receiver is exhausted, its return value replaces it on the stack
+    m_comp->emit_mark_label(done);
+    m_comp->emit_pop_top();
+    m_comp->emit_load_local(result);
+    m_comp->emit_free_local(result);
+    m_comp->emit_mark_label(after);
+}
+
+void AbstractInterpreter::setup_with(int handlerOffset) {
+    // __exit__ replaces the context manager on the stack, where it stays
+    // until the finally block calls it.
+    auto exit = m_comp->emit_define_local();
+    m_comp->emit_setup_with(exit);
+    dec_stack();
+    error_check("setup with failed");
+    auto enterRes = m_comp->emit_spill();
+    m_comp->emit_load_and_free_local(exit);
+    inc_stack();
+
+    // The rest of the statement is a try/finally with the result of __enter__
+    // pushed inside of the try.
+    auto handlerLabel = getOffsetLabel(handlerOffset);
+    m_blockStack.push_back(BlockInfo(handlerOffset, SETUP_FINALLY, m_allHandlers.size(), EHF_With));
+    m_allHandlers.push_back(
+        ExceptionHandler(
+            m_allHandlers.size(),
+            ExceptionVars(m_comp, true),
+            m_comp->emit_define_label(),
+            m_comp->emit_define_label(),
+            handlerLabel,
+            m_stack,
+            EHF_TryFinally | EHF_With
+        )
+    );
+
+    vector<bool> newStack = m_stack;
+    newStack.push_back(STACK_KIND_OBJECT);
+    m_offsetStack[handlerOffset] = newStack;
+
+    m_comp->emit_load_and_free_local(enterRes);
+    inc_stack();
+}
+
+void AbstractInterpreter::with_cleanup_start() {
+    // We're entered like any other finally block, with None, the exception
+    // type, or the reason we're unwinding through the block on top of __exit__.
+    auto curBlock = m_blockStack.back();
+    auto exVars = m_allHandlers[curBlock.CurrentHandler].ExVars;
+    _ASSERTE(curBlock.Flags & EHF_With);
+
+    dec_stack();
+    m_comp->emit_store_local(exVars.FinallyExc);
+
+    // Only an exception gets passed to __exit__, otherwise it gets Nones
+    auto noException = m_comp->emit_define_label();
+    auto callExit = m_comp->emit_define_label();
+    m_comp->emit_load_local(exVars.FinallyExc);
+    m_comp->emit_ptr(Py_None);
+    m_comp->emit_branch(BranchEqual, noException);
+
+    static const EhFlags reasons[] = { EHF_BlockContinues, EHF_BlockReturns, EHF_BlockBreaks };
+    for (auto reason : reasons) {
+        if (curBlock.Flags & reason) {
+            m_comp->emit_load_local(exVars.FinallyExc);
+            m_comp->emit_int(reason);
+            m_comp->emit_branch(BranchEqual, noException);
+        }
+    }
+
+    m_comp->emit_load_local(exVars.FinallyExc);
+    m_comp->emit_branch(BranchAlways, callExit);
+    m_comp->emit_mark_label(noException);
+    m_comp->emit_ptr(Py_None);
+    m_comp->emit_mark_label(callExit);
+    auto exc = m_comp->emit_spill();
+
+    m_comp->emit_load_local(exc);
+    m_comp->emit_load_local(exVars.FinallyValue);
+    m_comp->emit_load_local(exVars.FinallyTb);
+    m_comp->emit_with_cleanup_start();
+    dec_stack();
+    error_check("with exit failed");
+    auto res = m_comp->emit_spill();
+
+    // Like the interpreter we leave the value we were entered with, the
+    // exception we passed to __exit__, and its result.
+    m_comp->emit_load_local(exVars.FinallyExc);
+    inc_stack();
+    m_comp->emit_load_and_free_local(exc);
+    m_comp->emit_dup();
+    m_comp->emit_incref();
+    inc_stack();
+    m_comp->emit_load_and_free_local(res);
+    inc_stack();
+}
+
+void AbstractInterpreter::with_cleanup_finish() {
+    auto curBlock = m_blockStack.back();
+    auto exVars = m_allHandlers[curBlock.CurrentHandler].ExVars;
+
+    m_comp->emit_with_cleanup_finish();
+    dec_stack(2);
+    raise_on_negative_one();
+
+    auto done = m_comp->emit_define_label();
+    m_comp->emit_branch(BranchFalse, done);
+
+    // __exit__ suppressed the exception.  We release it and restore the
+    // exception which was being handled before it, then END_FINALLY sees
+    // None and continues after the statement.
+    m_comp->emit_pop_top();
+    m_comp->emit_load_local(exVars.FinallyValue);
+    m_comp->emit_pop_top();
+    m_comp->emit_load_local(exVars.FinallyTb);
+    m_comp->emit_pop_top();
+    unwind_eh(curBlock.CurrentHandler, m_blockStack[m_blockStack.size() - 2].CurrentHandler);
+    m_comp->emit_ptr(Py_None);
+    m_comp->emit_dup();
+    m_comp->emit_incref();
+
+    m_comp->emit_mark_label(done);
+}
+
 void AbstractInterpreter::load_const(int constIndex, int opcodeIndex) {
-    auto constValue = PyTuple_GetItem(m_code->co_consts, constIndex);
+    load_const_value(PyTuple_GetItem(m_code->co_consts, constIndex), opcodeIndex);
+}
+
+void AbstractInterpreter::load_const_value(PyObject* constValue, int opcodeIndex) {
     if (!should_box(opcodeIndex)) {
+        // Only boxed values are borrowed, and the consumer checks for that
+        m_borrowedLoads.erase(opcodeIndex);
         if (PyFloat_CheckExact(constValue)) {
             m_comp->emit_float(PyFloat_AsDouble(constValue));
             inc_stack(1, STACK_KIND_VALUE);
@@ -3481,6 +5370,10 @@ void AbstractInterpreter::load_const(int constIndex, int opcodeIndex) {
         }
     }
     m_comp->emit_ptr(constValue);
+    if (m_borrowedLoads.find(opcodeIndex) != m_borrowedLoads.end()) {
+        inc_stack(1, STACK_KIND_VALUE);
+        return;
+    }
     m_comp->emit_dup();
     m_comp->emit_incref();
     inc_stack();
@@ -3592,7 +5485,7 @@ void AbstractInterpreter::unpack_sequence(size_t size, int opcode) {
     m_comp->emit_free_local(fastTmp);
 }
 
-void AbstractInterpreter::for_iter(int loopIndex, int opcodeIndex, BlockInfo *loopInfo) {
+void AbstractInterpreter::for_iter(int loopIndex, int opcodeIndex, size_t curByte, BlockInfo *loopInfo) {
     // CPython always generates LOAD_FAST or a GET_ITER before a FOR_ITER.
     // Therefore we know that we always fall into a FOR_ITER when it is
     // initialized, and we branch back to it for the loop condition.  We
@@ -3608,32 +5501,105 @@ void AbstractInterpreter::for_iter(int loopIndex, int opcodeIndex, BlockInfo *lo
     if (loopInfo != nullptr) {
         loopInfo->LoopVar = iterValue;
     }
+    m_loopIterators.push_back(LoopIterator(opcodeIndex, loopIndex, iterValue));
 
     // now that we've saved the value into a temp we can mark the offset
     // label.
     mark_offset_label(opcodeIndex);
 
-    m_comp->emit_load_local(iterValue);
-
-    // TODO: It'd be nice to inline this...
     auto processValue = m_comp->emit_define_label();
+    bool rangeLoop = m_rangeLoops.find(opcodeIndex) != m_rangeLoops.end();
+    Label rangeValue, ended;
+    if (rangeLoop) {
+        // Count natively when we really got a range iterator, and fall back
+        // to calling the iterator if range() was replaced.
+        rangeValue = m_comp->emit_define_label();
+        ended = m_comp->emit_define_label();
+        m_comp->emit_for_next_range(rangeValue, ended, iterValue);
+    }
+
+    m_comp->emit_load_local(iterValue);
 
     m_comp->emit_for_next(processValue, iterValue);
 
+    if (rangeLoop) {
+        m_comp->emit_mark_label(ended);
+    }
     int_error_check("for_iter failed");
 
     jump_absolute(loopIndex, opcodeIndex);
 
     m_comp->emit_mark_label(processValue);
     inc_stack();
+
+    if (rangeLoop) {
+        // Values from other iterators are checked against the int type we
+        // inferred, range() only produces ints.
+        auto done = m_comp->emit_define_label();
+        if (!m_baseline) {
+            profile_result(opcodeIndex, curByte);
+        }
+        m_comp->emit_branch(BranchAlways, done);
+
+        m_comp->emit_mark_label(rangeValue);
+        if (should_box(opcodeIndex)) {
+            m_comp->emit_box_tagged_ptr();
+        }
+        m_comp->emit_mark_label(done);
+    }
+}
+
+// Compares the identity of the top two values inline, when at least one of
+// them is borrowed and so only the others need releasing.
+void AbstractInterpreter::compare_is_borrowed(bool isNot, int& opcodeIndex) {
+    bool rightOwned = m_stack[m_stack.size() - 1] == STACK_KIND_OBJECT;
+    bool leftOwned = m_stack[m_stack.size() - 2] == STACK_KIND_OBJECT;
+    auto right = m_comp->emit_spill();
+    auto left = m_comp->emit_spill();
+
+    m_comp->emit_load_local(left);
+    m_comp->emit_load_local(right);
+    m_comp->emit_compare_equal();
+    if (isNot) {
+        m_comp->emit_int(0);
+        m_comp->emit_compare_equal();
+    }
+
+    if (rightOwned) {
+        m_comp->emit_load_and_free_local(right);
+        m_comp->emit_pop_top();
+    }
+    else {
+        m_comp->emit_free_local(right);
+    }
+    if (leftOwned) {
+        m_comp->emit_load_and_free_local(left);
+        m_comp->emit_pop_top();
+    }
+    else {
+        m_comp->emit_free_local(left);
+    }
+    dec_stack(2);
+
+    if (can_optimize_pop_jump(opcodeIndex)) {
+        inc_stack(1, STACK_KIND_VALUE);
+        branch(opcodeIndex);
+    }
+    else {
+        m_comp->emit_box_bool();
+        inc_stack();
+    }
 }
 
 void AbstractInterpreter::compare_op(int compareType, int& i, int opcodeIndex) {
     switch (compareType) {
         case PyCmp_IS:
         case PyCmp_IS_NOT:
-            //    TODO: Inlining this would be nice, but then we need the dec refs, e.g.:
-            if (can_optimize_pop_jump(i)) {
+            if (m_borrowedLoads.find(opcodeIndex - sizeof(_Py_CODEUNIT)) != m_borrowedLoads.end() ||
+                m_borrowedLoads.find(opcodeIndex - 2 * sizeof(_Py_CODEUNIT)) != m_borrowedLoads.end()) {
+                compare_is_borrowed(compareType != PyCmp_IS, i);
+            }
+            else if (can_optimize_pop_jump(i)) {
                 m_comp->emit_is_push_int(compareType != PyCmp_IS);
                 dec_stack(); // popped 2, pushed 1
                 branch(i);
@@ -3745,6 +5711,7 @@ void AbstractInterpreter::compare_op(int compareType, int& i, int opcodeIndex) {
 void AbstractInterpreter::load_fast(int local, int opcodeIndex) {
     if (!should_box(opcodeIndex)) {
         // We have an optimized local...
+        m_borrowedLoads.erase(opcodeIndex);
         auto localInfo = get_local_info(opcodeIndex, local);
         auto kind = localInfo.ValueInfo.Value->kind();
         // We only optimize floats so far...
@@ -3763,11 +5730,12 @@ void AbstractInterpreter::load_fast(int local, int opcodeIndex) {
     }
 
     bool checkUnbound = m_assignmentState.find(local) == m_assignmentState.end() || !m_assignmentState.find(local)->second;
-    load_fast_worker(local, checkUnbound);
-    inc_stack();
+    bool borrowed = m_borrowedLoads.find(opcodeIndex) != m_borrowedLoads.end();
+    load_fast_worker(local, checkUnbound, borrowed);
+    inc_stack(1, borrowed ? STACK_KIND_VALUE : STACK_KIND_OBJECT);
 }
 
-void AbstractInterpreter::load_fast_worker(int local, bool checkUnbound) {
+void AbstractInterpreter::load_fast_worker(int local, bool checkUnbound, bool borrowed) {
     m_comp->emit_load_fast(local);
 
     if (checkUnbound) {
@@ -3788,8 +5756,10 @@ void AbstractInterpreter::load_fast_worker(int local, bool checkUnbound) {
         m_comp->emit_load_local(m_errorCheckLocal);
     }
 
-    m_comp->emit_dup();
-    m_comp->emit_incref(false);
+    if (!borrowed) {
+        m_comp->emit_dup();
+        m_comp->emit_incref(false);
+    }
 }
 
 void AbstractInterpreter::unpack_ex(size_t size, int opcode) {
@@ -33,6 +33,8 @@
 #include "absvalue.h"
 #include "cowvector.h"
 #include "ipycomp.h"
+#include "typeprofile.h"
+#include "jitstats.h"
 
 using namespace std;
 
@@ -65,6 +67,11 @@ class InterpreterState;
 #define STACK_KIND_OBJECT true      // A Python object, or a tagged int which might be an object
 #define STACK_KIND_VALUE  false     // A non-boxed value, currently just floating point
 
+// Largest function, in bytes of byte code, which we'll inline into its callers
+#define INLINE_MAX_SIZE (16 * sizeof(_Py_CODEUNIT))
+// Most arguments, including self for a method, an inlined call can pass
+#define INLINE_MAX_ARGS 4
+
 enum EhFlags {
     EHF_None = 0,
     // The exception handling block includes a continue statement
@@ -79,6 +86,9 @@ enum EhFlags {
     EHF_TryExcept = 0x10,
     // The exception handling block is in the finally or except portion of a try/finally or try/except
     EHF_InExceptHandler = 0x20,
+    // The exception handling block is the body of a with statement, a try/finally whose finally
+    // calls __exit__ which is kept on the stack below the block
+    EHF_With = 0x40,
 };
 
 EhFlags operator | (EhFlags lhs, EhFlags rhs);
@@ -135,6 +145,70 @@ struct ExceptionHandler {
     }
 };
 
+// An argument to, or a value of, a function we're inlining
+struct InlineValue {
+    AbstractValue* Value;
+    // The exact type of an instance of a user defined class, which is guarded
+    // on along with its version tag before the inlined code runs
+    PyTypeObject* Type;
+
+    InlineValue(AbstractValue* value = nullptr, PyTypeObject* type = nullptr) {
+        Value = value;
+        Type = type;
+    }
+};
+
+// What inline_types_known found out about one opcode of an inlined function
+struct InlineStep {
+    // The kinds of the operands of a binary operator or comparison
+    AbstractValueKind Left, Right;
+    // For a LOAD_ATTR on a user defined class, the class and the offset of the
+    // slot the attribute is stored in, or 0 for the instance dictionary
+    PyTypeObject* Owner;
+    Py_ssize_t Offset;
+
+    InlineStep() {
+        Left = Right = AVK_Any;
+        Owner = nullptr;
+        Offset = 0;
+    }
+};
+
+// How a value of an inlined function is held on the IL stack
+enum InlineRepr {
+    IR_Object,
+    // A tagged int, or an int object if it didn't fit
+    IR_Tagged,
+    // A raw double (STACK_KIND_VALUE)
+    IR_Float
+};
+
+// A function whose code we're emitting inline in its caller.  The function
+// doesn't get a frame, its locals live in IL locals which are handed to the
+// frame we create for the traceback if it raises.
+struct InlineFrame {
+    PyCodeObject* Code;
+    // The function being called, which provides the frame's globals
+    Local Function;
+    vector<Local> Locals;
+    // The offset of the opcode we're emitting, for the traceback
+    int LastI;
+    // The size of the tuple the function returns when the caller unpacks it,
+    // the items are left on the stack instead.
+    size_t Unpack;
+    // One entry per opcode, filled in when we decide to inline the function
+    vector<InlineStep> Steps;
+    // The representation of each value the inlined code has on the stack.
+    // Locals always hold objects.
+    vector<InlineRepr> Stack;
+
+    InlineFrame(PyCodeObject* code) : Locals(code->co_nlocals) {
+        Code = code;
+        LastI = 0;
+        Unpack = 0;
+    }
+};
+
 struct BlockInfo {
     int EndOffset, Kind, ContinueOffset;
     EhFlags Flags;
@@ -153,6 +227,33 @@ struct BlockInfo {
     }
 };
 
+// The iterator of a for loop, live from its FOR_ITER until the loop exits
+struct LoopIterator {
+    size_t Start, End;
+    Local Iterator;
+
+    LoopIterator(size_t start, size_t end, Local iterator) {
+        Start = start;
+        End = end;
+        Iterator = iterator;
+    }
+};
+
+// A value in a suspended generator's frame, either a loop iterator we keep in
+// a local or a value on our stack, counting from the bottom.
+struct FrameValue {
+    Local Iterator;
+    size_t StackIndex;
+
+    FrameValue(Local iterator) {
+        Iterator = iterator;
+        StackIndex = -1;
+    }
+
+    FrameValue(size_t stackIndex) {
+        StackIndex = stackIndex;
+    }
+};
 
 class __declspec(dllexport) AbstractInterpreter {
 #pragma warning (disable:4251)
@@ -210,6 +311,8 @@ class __declspec(dllexport) AbstractInterpreter {
     //  This was so we don't need to have decref/frees spread all over the code
     vector<vector<Label>> m_raiseAndFree, m_reraiseAndFree;
     unordered_set<size_t> m_jumpsTo;
+    // The opcode being compiled, which error paths store into f_lasti
+    int m_lastiIndex;
     Label m_retLabel;
     Local m_retValue;
     // Stores information for a stack allocated local used for sequence unpacking.  We need to allocate
@@ -218,6 +321,48 @@ class __declspec(dllexport) AbstractInterpreter {
     unordered_map<int, Local> m_sequenceLocals;
     unordered_map<int, bool> m_assignmentState;
     unordered_map<int, unordered_map<AbstractValueKind, Local>> m_optLocals;
+    // Locals which we'll assume are always assigned values of a single type,
+    // and the STORE_FAST opcodes which need to check that assumption.
+    unordered_map<int, AbstractValueKind> m_speculatedLocals;
+    unordered_map<size_t, AbstractValueKind> m_guards;
+    // Types recorded by the baseline code, and the opcodes whose results we've
+    // speculated will continue to have the recorded type.
+    TypeProfile* m_profile;
+    unordered_map<size_t, PyTypeObject*> m_resultGuards;
+    // LOAD_ATTR opcodes which load a method and the CALL_FUNCTION opcodes
+    // which call it, compiled so that self is passed as the first argument
+    // instead of allocating a bound method.
+    unordered_set<size_t> m_methodLoads, m_methodCalls;
+    // LOAD_FAST/LOAD_CONST opcodes which push a borrowed reference.  The value
+    // is tracked as STACK_KIND_VALUE so that error paths don't release it.
+    unordered_set<size_t> m_borrowedLoads;
+    // FOR_ITER opcodes looping over range(...), mapped to whether their values
+    // can be typed as ints, which needs a guard that can resume in the
+    // interpreter if range() was replaced.
+    unordered_map<size_t, bool> m_rangeLoops;
+    // UNPACK_SEQUENCE opcodes which have nothing left to do, the tuple they
+    // unpack was never created and its items were pushed in unpacked order.
+    unordered_set<size_t> m_scalarUnpacks;
+    // The function we're currently inlining, if any
+    InlineFrame* m_inline;
+    // Set when we're compiling without the results of interpret(), and the
+    // unknown values we report for the stack in that case.
+    bool m_baseline;
+    vector<AbstractValueWithSources> m_baselineStack;
+    // Set when the code runs without publishing its frame to the thread state
+    bool m_elideFrame;
+    // Set when we're compiling a generator or coroutine.  Its code is entered
+    // again for each value sent to it, and dispatches to the label for the
+    // yield it's suspended at.  A YIELD_FROM is suspended before the opcode
+    // while it's delegating and resumes at m_resendLabels.
+    bool m_generator;
+    vector<size_t> m_yieldOffsets;
+    unordered_map<size_t, Label> m_resumeLabels, m_resendLabels;
+    // Every FOR_ITER we've compiled, in order.  Comprehensions don't have a
+    // loop block, so this is how generators find the iterators to save.
+    vector<LoopIterator> m_loopIterators;
+    // Why compilation failed and how long each phase took
+    CompileStats m_stats;
 
 #pragma warning (default:4251)
 
@@ -226,10 +371,36 @@ public:
     ~AbstractInterpreter();
 
     JittedCode* compile();
+    // Compiles the code without running the abstract interpreter, every value
+    // is treated as an unknown boxed object.
+    JittedCode* compile_baseline();
+    // Compiles a generator or coroutine the way compile_baseline does, into
+    // code which can be resumed at each of its yields.
+    JittedCode* compile_generator();
     bool interpret();
     void dump();
 
     void set_local_type(int index, AbstractValueKind kind);
+    // Speculates that all stores to the local will be of the specified type.  The
+    // speculation is checked at runtime and the function resumes in the interpreter
+    // if it doesn't hold.
+    void set_speculated_local_type(int index, AbstractValueKind kind);
+    // Provides the types recorded for each opcode.  Baseline code records into the
+    // profile, and optimized code speculates on the recorded types.
+    void set_type_profile(TypeProfile* profile);
+    // Produces code which doesn't publish its frame to the thread state so it
+    // can be run with a frame that lives on the caller's native stack.
+    void set_elide_frame(bool elide);
+    // Returns true if the generated code depends upon speculated types.
+    bool is_speculative();
+    // Returns the failure reason and timings for the last compile
+    CompileStats& get_stats() {
+        return m_stats;
+    }
+    static char* opcode_name(int opcode);
+    // Checks if the code refers to something which can look at or change the
+    // locals of its frame, e.g. locals() or sys._getframe.
+    static bool inspects_frame(PyCodeObject* code);
     // Returns information about the specified local variable at a specific
     // byte code index.
     AbstractLocalInfo get_local_info(size_t byteCodeIndex, size_t localIndex);
@@ -241,8 +412,6 @@ public:
     // can be maintained on the stack.
     bool should_box(size_t opcodeIndex);
 
-    bool can_skip_lasti_update(size_t opcodeIndex);
-
     AbstractValue* get_return_info();
 
     bool has_info(size_t byteCodeIndex);
@@ -255,7 +424,6 @@ private:
     bool merge_states(InterpreterState& newState, InterpreterState& mergeTo);
     bool update_start_state(InterpreterState& newState, size_t index);
     void init_starting_state();
-    char* opcode_name(int opcode);
     bool preprocess();
     void dump_sources(AbstractSource* sources);
     AbstractSource* new_source(AbstractSource* source) {
@@ -270,6 +438,7 @@ private:
     void make_function(int oparg);
     void fancy_call(int na, int nk, int flags);
     bool can_skip_lasti_update(int opcodeIndex);
+    void store_call_args(Local args, size_t argCnt);
     void build_tuple(size_t argCnt);
     void extend_tuple(size_t argCnt);
     void build_list(size_t argCnt);
@@ -286,7 +455,7 @@ private:
     void extend_map(size_t argCnt);
 
     Label getOffsetLabel(int jumpTo);
-    void for_iter(int loopIndex, int opcodeIndex, BlockInfo *loopInfo);
+    void for_iter(int loopIndex, int opcodeIndex, size_t curByte, BlockInfo *loopInfo);
 
     // Checks to see if we have a null value as the last value on our stack
     // indicating an error, and if so, branches to our current error handler.
@@ -344,17 +513,90 @@ private:
     // Branches based if the current value is true/false based upon the current opcode
     void branch(int& i);
     void compare_op(int compareType, int& i, int opcodeIndex);
+    void compare_is_borrowed(bool isNot, int& opcodeIndex);
     JittedCode* compile_worker();
 
     void periodic_work();
     void store_fast(int local, int opcodeIndex);
+    void guarded_store_fast(int local, int opcodeIndex, AbstractValueKind kind);
+    // Checks if the current state can be transferred back to the interpreter
+    bool can_deoptimize();
+    // Writes our state back to the frame, including the values on the stack, and
+    // resumes it in the interpreter after the specified byte code offset.
+    void deoptimize(size_t opcodeIndex, size_t lasti);
+    // Checks if the state at a yield can be saved in the frame
+    bool can_suspend();
+    // Gets the iterators of the loops running at a yield, outermost first
+    vector<Local> get_live_iterators(size_t opcodeIndex);
+    // Gets the values at a yield in the order the interpreter would have them
+    // on its stack, and the stack level of each block.
+    vector<FrameValue> get_frame_values(size_t opcodeIndex, vector<int>& blockLevels);
+    // Saves the generator's state in its frame and returns value from the
+    // code, the generator is then resumed after lasti.
+    void suspend(size_t opcodeIndex, size_t lasti, Local value);
+    // Marks the label a resumed generator dispatches to and reloads the state
+    // suspend saved, raising if an exception was thrown into the generator.
+    void resume(size_t opcodeIndex, Label label);
+    void yield_value(size_t opcodeIndex);
+    void yield_from(size_t opcodeIndex);
+    void setup_with(int handlerOffset);
+    void with_cleanup_start();
+    void with_cleanup_finish();
+    // Gets the value produced by an opcode whose result type we can't infer,
+    // speculating on the type recorded in our profile.
+    AbstractValueWithSources profiled_result(size_t opcodeIndex);
+    // Records the type of the opcode's result when compiling baseline code, or
+    // checks the type we've speculated on when optimizing.
+    void profile_result(size_t opcodeIndex, size_t curByte);
+    // Finds the LOAD_ATTR/CALL_FUNCTION pairs we can compile as method calls.
+    void find_method_calls();
+    // Finds the FOR_ITER of a loop over the range() call started by the
+    // LOAD_GLOBAL at loadGlobal, or returns -1.
+    size_t find_range_loop(size_t loadGlobal);
+    // Finds tuples which are unpacked as soon as they're loaded or built.
+    void find_scalar_tuples();
+    // Reverses the order of the values on the top of the stack.
+    void reverse_stack(size_t count);
+    // Keeps the fast locals which can't be changed behind our back in IL
+    // locals, which CoreCLR can enregister.
+    void find_register_locals();
+    // Finds the loads of locals and constants whose values are consumed
+    // straight away by an opcode which doesn't need its own reference.
+    void find_borrowed_loads();
+    bool is_borrowable_load(int opcodeIndex, bool inspectsFrame);
+    // Takes a reference to the borrowed value on the top of the stack, so
+    // that it can be handed to code which releases it.
+    void own_borrowed_value();
+    // Records the function called by a call, which is beneath depth values on
+    // the stack, when compiling baseline code.
+    void record_callee(size_t opcodeIndex, size_t depth);
+    // Checks if we can emit the code of the frame's function inline for a
+    // call which passes positional arguments of the given types.
+    InlineDecision can_inline(InlineFrame& frame, vector<InlineValue>& args);
+    // Checks that every operation in the function only works on builtin
+    // types, or attributes of user defined classes which are stored on the
+    // instance, which can't call back into Python code.  Records the types
+    // each opcode works on in the frame's Steps.
+    bool inline_types_known(InlineFrame& frame, vector<InlineValue>& args);
+    // Emits the code of the function the call has always called inline,
+    // guarded by a check that it's still the function being called, leaving
+    // the result on the stack.  If the result is unpacked straight away the
+    // unpacked values are left instead, and the UNPACK_SEQUENCE is added to
+    // m_scalarUnpacks.  Returns false if the call wasn't inlined and nothing
+    // was emitted.
+    bool inline_call(size_t opcodeIndex, size_t curByte, int argCnt, bool isMethod);
+    void emit_inline_body(InlineFrame& frame);
+    // Converts the inlined value depth entries from the top of the stack to
+    // the given representation, an int or float object can be unboxed.
+    void inline_convert(InlineFrame& frame, size_t depth, InlineRepr repr);
 
     void load_const(int constIndex, int opcodeIndex);
+    void load_const_value(PyObject* constValue, int opcodeIndex);
 
     void return_value(int opcodeIndex);
 
     void load_fast(int local, int opcodeIndex);
-    void load_fast_worker(int local, bool checkUnbound);
+    void load_fast_worker(int local, bool checkUnbound, bool borrowed = false);
     void unpack_sequence(size_t size, int opcode);
     Local get_optimized_local(int index, AbstractValueKind kind);
     void pop_except();
@@ -74,6 +74,24 @@ static bool is_known_type(AbstractValueKind kind) {
     return false;
 }
 
+// The types whose operators with each other are implemented in C, and
+// which can't refer to anything else
+static bool is_scalar_type(AbstractValueKind kind) {
+    switch (kind) {
+        case AVK_Integer:
+        case AVK_Float:
+        case AVK_Bool:
+        case AVK_Complex:
+        case AVK_String:
+        case AVK_Bytes:
+        case AVK_None:
+            return true;
+    }
+    return false;
+}
+
+AbstractValueKind GetAbstractType(PyTypeObject* type);
+
 
 class AbstractSource {
 public:
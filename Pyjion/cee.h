@@ -48,17 +48,19 @@
 #include "utilcode.h"
 #include "openum.h"
 
+#include "codeheap.h"
+
 using namespace std;
 
 class CExecutionEngine : public IExecutionEngine, public IEEMemoryManager {
 public:
-    HANDLE m_codeHeap, m_heap;
+    CodeHeap m_codeHeap;
+    HANDLE m_heap;
     DWORD m_tlsIndex;
     PTLS_CALLBACK_FUNCTION* m_callbacks;
 
 
     CExecutionEngine() {
-        m_codeHeap = HeapCreate(HEAP_CREATE_ENABLE_EXECUTE, 0, 0);
         m_heap = HeapCreate(0, 0, 0);
         m_tlsIndex = TlsAlloc();
         // We can't use new[] here because utilcode isn't spun up yet...
@@ -66,7 +68,6 @@ public:
     }
 
     ~CExecutionEngine() {
-        ::HeapDestroy(m_codeHeap);
         ::HeapDestroy(m_heap);
         TlsFree(m_tlsIndex);
         ::HeapFree(GetProcessHeap(), 0, m_callbacks);
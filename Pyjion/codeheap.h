@@ -0,0 +1,134 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) Microsoft Corporation
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+* OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+*/
+
+#ifndef CODEHEAP_H
+#define CODEHEAP_H
+
+#include <windows.h>
+
+// Method starts are aligned to at least this many bytes
+#define CODE_ALIGNMENT 16
+// Methods at least this large start on a larger boundary so their loops are
+// less likely to straddle instruction fetch blocks.
+#define LARGE_METHOD_SIZE 128
+#define LARGE_METHOD_ALIGNMENT 32
+
+// Stored immediately before each block handed out by the code heap
+struct CodeHeapBlock {
+    void* Allocation;
+    size_t Size;
+};
+
+// Executable arena which the JIT allocates native code and its read-only data
+// from.  Tracks how many bytes are in use so the amount of memory held by
+// generated code can be kept under a budget.  Allocations can come from the
+// background compile thread so the accounting is done under a lock.
+class CodeHeap {
+    HANDLE m_heap;
+    CRITICAL_SECTION m_lock;
+    size_t m_used, m_peak, m_allocations, m_budget;
+
+public:
+    CodeHeap() {
+        m_heap = HeapCreate(HEAP_CREATE_ENABLE_EXECUTE, 0, 0);
+        InitializeCriticalSection(&m_lock);
+        m_used = m_peak = m_allocations = 0;
+        m_budget = 0;
+    }
+
+    ~CodeHeap() {
+        ::HeapDestroy(m_heap);
+        DeleteCriticalSection(&m_lock);
+    }
+
+    // Allocates size bytes starting at a multiple of alignment, which must
+    // be a power of 2.
+    void* alloc(size_t size, size_t alignment) {
+        auto total = size + alignment - 1 + sizeof(CodeHeapBlock);
+        auto mem = (BYTE*)HeapAlloc(m_heap, 0, total);
+        if (mem == nullptr) {
+            return nullptr;
+        }
+
+        auto start = (BYTE*)(((size_t)mem + sizeof(CodeHeapBlock) + alignment - 1) & ~(alignment - 1));
+        auto block = (CodeHeapBlock*)start - 1;
+        block->Allocation = mem;
+        block->Size = total;
+
+        EnterCriticalSection(&m_lock);
+        m_used += total;
+        m_allocations++;
+        if (m_used > m_peak) {
+            m_peak = m_used;
+        }
+        LeaveCriticalSection(&m_lock);
+        return start;
+    }
+
+    void free(void* addr) {
+        auto block = (CodeHeapBlock*)addr - 1;
+        auto mem = block->Allocation;
+
+        EnterCriticalSection(&m_lock);
+        m_used -= block->Size;
+        m_allocations--;
+        LeaveCriticalSection(&m_lock);
+
+        ::HeapFree(m_heap, 0, mem);
+    }
+
+    // Gets the number of bytes an allocation holds, including padding
+    static size_t size_of(void* addr) {
+        return ((CodeHeapBlock*)addr - 1)->Size;
+    }
+
+    size_t used() {
+        return m_used;
+    }
+
+    size_t peak() {
+        return m_peak;
+    }
+
+    size_t allocations() {
+        return m_allocations;
+    }
+
+    // The number of bytes generated code should be kept under, 0 if the
+    // code heap isn't limited.
+    size_t budget() {
+        return m_budget;
+    }
+
+    void set_budget(size_t budget) {
+        m_budget = budget;
+    }
+
+    bool over_budget() {
+        return m_budget != 0 && m_used > m_budget;
+    }
+};
+
+#endif
@@ -0,0 +1,369 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) Microsoft Corporation
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+* OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+*/
+
+#include <windows.h>
+#include <stdio.h>
+#include <sys/utime.h>
+#include <algorithm>
+
+#include <marshal.h>
+
+#include "ilcache.h"
+
+#define ILCACHE_MAGIC 0x4C494A50    // 'PJIL'
+
+ILCache g_ilCache;
+
+struct ILCacheHeader {
+    uint32_t Magic;
+    uint32_t Version;
+    uint64_t Key;
+    uint32_t ILSize;
+    uint32_t LocalCount;
+    uint32_t RelocationCount;
+    uint32_t UserMethodCount;
+    uint32_t Speculative;
+};
+
+/************************************************************************
+* Images
+*/
+
+struct ImageInfo {
+    BYTE* Base;
+    size_t Size;
+    DWORD TimeStamp;
+};
+
+static ImageInfo g_images[ILCACHE_IMAGE_COUNT];
+
+static bool GetImageInfo(void* addr, ImageInfo& info) {
+    HMODULE module;
+    if (!GetModuleHandleExW(
+        GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+        (LPCWSTR)addr,
+        &module)) {
+        return false;
+    }
+
+    auto dosHeader = (PIMAGE_DOS_HEADER)module;
+    auto ntHeaders = (PIMAGE_NT_HEADERS)((BYTE*)module + dosHeader->e_lfanew);
+    info.Base = (BYTE*)module;
+    info.Size = ntHeaders->OptionalHeader.SizeOfImage;
+    info.TimeStamp = ntHeaders->FileHeader.TimeDateStamp;
+    return true;
+}
+
+static ImageInfo* GetImages() {
+    if (g_images[ILCACHE_IMAGE_PYTHON].Base == nullptr) {
+        GetImageInfo(&PyLong_Type, g_images[ILCACHE_IMAGE_PYTHON]);
+        GetImageInfo(&ILCacheFindImage, g_images[ILCACHE_IMAGE_PYJION]);
+    }
+    return g_images;
+}
+
+bool ILCacheFindImage(void* addr, uint32_t& image, uint32_t& offset) {
+    auto images = GetImages();
+    for (uint32_t i = 0; i < ILCACHE_IMAGE_COUNT; i++) {
+        if (images[i].Base != nullptr &&
+            (BYTE*)addr >= images[i].Base &&
+            (BYTE*)addr < images[i].Base + images[i].Size) {
+            image = i;
+            offset = (uint32_t)((BYTE*)addr - images[i].Base);
+            return true;
+        }
+    }
+    return false;
+}
+
+void* ILCacheImageAddress(uint32_t image, uint32_t offset) {
+    auto images = GetImages();
+    if (image >= ILCACHE_IMAGE_COUNT || images[image].Base == nullptr || offset >= images[image].Size) {
+        return nullptr;
+    }
+    return images[image].Base + offset;
+}
+
+/************************************************************************
+* Keys
+*/
+
+#define FNV_OFFSET_BASIS    0xcbf29ce484222325ULL
+#define FNV_PRIME           0x100000001b3ULL
+
+static void HashBytes(uint64_t& hash, const void* data, size_t size) {
+    auto bytes = (const BYTE*)data;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * FNV_PRIME;
+    }
+}
+
+static void HashInt(uint64_t& hash, int64_t value) {
+    HashBytes(hash, &value, sizeof(value));
+}
+
+static bool HashMarshalled(uint64_t& hash, PyObject* obj) {
+    auto data = PyMarshal_WriteObjectToString(obj, Py_MARSHAL_VERSION);
+    if (data == nullptr) {
+        PyErr_Clear();
+        return false;
+    }
+    HashBytes(hash, PyBytes_AS_STRING(data), PyBytes_GET_SIZE(data));
+    Py_DECREF(data);
+    return true;
+}
+
+uint64_t ILCache::get_key(PyCodeObject* code, std::vector<int>& kinds) {
+    uint64_t hash = FNV_OFFSET_BASIS;
+    HashInt(hash, ILCACHE_VERSION);
+    HashInt(hash, PY_VERSION_HEX);
+
+    // Cached IL refers to the images it was produced against
+    auto images = GetImages();
+    for (size_t i = 0; i < ILCACHE_IMAGE_COUNT; i++) {
+        HashInt(hash, images[i].TimeStamp);
+        HashInt(hash, images[i].Size);
+    }
+
+    HashBytes(hash, PyBytes_AS_STRING(code->co_code), PyBytes_GET_SIZE(code->co_code));
+    if (!HashMarshalled(hash, code->co_consts) ||
+        !HashMarshalled(hash, code->co_names) ||
+        !HashMarshalled(hash, code->co_varnames)) {
+        return 0;
+    }
+    HashInt(hash, code->co_argcount);
+    HashInt(hash, code->co_kwonlyargcount);
+    HashInt(hash, code->co_nlocals);
+    HashInt(hash, code->co_stacksize);
+    HashInt(hash, code->co_flags);
+    HashInt(hash, PyTuple_GET_SIZE(code->co_cellvars));
+    HashInt(hash, PyTuple_GET_SIZE(code->co_freevars));
+
+    HashInt(hash, kinds.size());
+    for (auto kind : kinds) {
+        HashInt(hash, kind);
+    }
+
+    // 0 indicates the code can't be cached
+    return hash == 0 ? 1 : hash;
+}
+
+/************************************************************************
+* Cache
+*/
+
+ILCache::ILCache() {
+    m_maxSize = m_size = 0;
+    m_hits = m_misses = m_stores = m_evictions = 0;
+}
+
+bool ILCache::enable(const char* path, size_t maxSize) {
+    disable();
+
+    if (!CreateDirectoryA(path, nullptr) && GetLastError() != ERROR_ALREADY_EXISTS) {
+        return false;
+    }
+
+    m_path = path;
+    m_maxSize = maxSize;
+
+    // Pick up the entries written by previous processes, most recently used first
+    std::vector<std::pair<uint64_t, std::pair<uint64_t, size_t>>> existing;
+    WIN32_FIND_DATAA findData;
+    auto find = FindFirstFileA((m_path + "\\*.pjil").c_str(), &findData);
+    if (find != INVALID_HANDLE_VALUE) {
+        do {
+            auto key = _strtoui64(findData.cFileName, nullptr, 16);
+            auto time = ((uint64_t)findData.ftLastWriteTime.dwHighDateTime << 32) | findData.ftLastWriteTime.dwLowDateTime;
+            existing.push_back(std::make_pair(time, std::make_pair(key, (size_t)findData.nFileSizeLow)));
+        } while (FindNextFileA(find, &findData));
+        FindClose(find);
+    }
+    std::sort(existing.begin(), existing.end());
+    for (auto& entry : existing) {
+        add_entry(entry.second.first, entry.second.second);
+    }
+
+    evict(0);
+    return true;
+}
+
+void ILCache::disable() {
+    m_path.clear();
+    m_lru.clear();
+    m_entries.clear();
+    m_size = 0;
+}
+
+bool ILCache::is_enabled() {
+    return !m_path.empty();
+}
+
+size_t ILCache::size() {
+    return m_size;
+}
+
+size_t ILCache::max_size() {
+    return m_maxSize;
+}
+
+size_t ILCache::entry_count() {
+    return m_entries.size();
+}
+
+std::string ILCache::get_filename(uint64_t key) {
+    char name[32];
+    sprintf_s(name, "\\%016llx.pjil", key);
+    return m_path + name;
+}
+
+void ILCache::add_entry(uint64_t key, size_t size) {
+    remove_entry(key);
+    m_lru.push_front(key);
+    m_entries[key] = std::make_pair(size, m_lru.begin());
+    m_size += size;
+}
+
+void ILCache::remove_entry(uint64_t key) {
+    auto entry = m_entries.find(key);
+    if (entry != m_entries.end()) {
+        m_size -= entry->second.first;
+        m_lru.erase(entry->second.second);
+        m_entries.erase(entry);
+    }
+}
+
+void ILCache::evict(size_t needed) {
+    while (!m_lru.empty() && m_size + needed > m_maxSize) {
+        auto key = m_lru.back();
+        DeleteFileA(get_filename(key).c_str());
+        remove_entry(key);
+        m_evictions++;
+    }
+}
+
+template<typename T> static bool ReadVector(FILE* file, std::vector<T>& values, size_t count) {
+    values.resize(count);
+    return count == 0 || fread(&values[0], sizeof(T), count, file) == count;
+}
+
+bool ILCache::load(uint64_t key, ILCacheEntry& entry) {
+    if (!is_enabled()) {
+        return false;
+    }
+
+    // The file may have been written by another process, so we check for it
+    // even if we don't know about it.
+    auto filename = get_filename(key);
+    FILE* file;
+    if (fopen_s(&file, filename.c_str(), "rb") != 0) {
+        remove_entry(key);
+        m_misses++;
+        return false;
+    }
+
+    ILCacheHeader header;
+    bool success = fread(&header, sizeof(header), 1, file) == 1 &&
+        header.Magic == ILCACHE_MAGIC &&
+        header.Version == ILCACHE_VERSION &&
+        header.Key == key &&
+        ReadVector(file, entry.IL, header.ILSize) &&
+        ReadVector(file, entry.Locals, header.LocalCount) &&
+        ReadVector(file, entry.Relocations, header.RelocationCount) &&
+        ReadVector(file, entry.UserMethods, header.UserMethodCount);
+    size_t size = ftell(file);
+    fclose(file);
+
+    if (!success || entry.IL.size() == 0) {
+        m_misses++;
+        return false;
+    }
+
+    entry.Speculative = header.Speculative != 0;
+    add_entry(key, size);
+    _utime(filename.c_str(), nullptr);
+    m_hits++;
+    return true;
+}
+
+template<typename T> static void WriteVector(FILE* file, std::vector<T>& values) {
+    if (values.size() != 0) {
+        fwrite(&values[0], sizeof(T), values.size(), file);
+    }
+}
+
+void ILCache::store(uint64_t key, ILCacheEntry& entry) {
+    if (!is_enabled()) {
+        return;
+    }
+
+    ILCacheHeader header;
+    header.Magic = ILCACHE_MAGIC;
+    header.Version = ILCACHE_VERSION;
+    header.Key = key;
+    header.ILSize = (uint32_t)entry.IL.size();
+    header.LocalCount = (uint32_t)entry.Locals.size();
+    header.RelocationCount = (uint32_t)entry.Relocations.size();
+    header.UserMethodCount = (uint32_t)entry.UserMethods.size();
+    header.Speculative = entry.Speculative;
+
+    size_t size = sizeof(header) +
+        entry.IL.size() * sizeof(BYTE) +
+        entry.Locals.size() * sizeof(int32_t) +
+        entry.Relocations.size() * sizeof(Relocation) +
+        entry.UserMethods.size() * sizeof(int32_t);
+    if (size > m_maxSize) {
+        return;
+    }
+    remove_entry(key);
+    evict(size);
+
+    // Other processes may be reading the cache, so write the entry to a
+    // temporary file and then move it into place.
+    auto filename = get_filename(key);
+    char suffix[32];
+    sprintf_s(suffix, ".%lu.tmp", GetCurrentProcessId());
+    auto tempname = filename + suffix;
+
+    FILE* file;
+    if (fopen_s(&file, tempname.c_str(), "wb") != 0) {
+        return;
+    }
+    fwrite(&header, sizeof(header), 1, file);
+    WriteVector(file, entry.IL);
+    WriteVector(file, entry.Locals);
+    WriteVector(file, entry.Relocations);
+    WriteVector(file, entry.UserMethods);
+    bool success = !ferror(file);
+    fclose(file);
+
+    if (!success || !MoveFileExA(tempname.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+        DeleteFileA(tempname.c_str());
+        return;
+    }
+
+    add_entry(key, size);
+    m_stores++;
+}
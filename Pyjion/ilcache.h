@@ -0,0 +1,146 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) Microsoft Corporation
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+* OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+*/
+
+
+#ifndef ILCACHE_H
+#define ILCACHE_H
+
+#include <windows.h>
+#include <stdint.h>
+#include <list>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include <Python.h>
+
+// Bump when the format of the cache files or the IL we generate changes
+#define ILCACHE_VERSION 5
+
+// Describes how to recompute a pointer embedded in cached IL
+enum RelocationKind {
+    // An address in one of the images we know about, Index is the image and
+    // Value the offset from the image base.
+    RK_Image,
+    // The code object's names, constants, or variable names, Index is the
+    // index into the tuple.
+    RK_Name,
+    RK_Const,
+    RK_VarName,
+    // The empty tuple singleton
+    RK_EmptyTuple,
+    // An indirection cell for a call to a user module method, Index is the
+    // index into the entry's user methods.
+    RK_UserMethod,
+    // A LOAD_ATTR inline cache, Index is the cache's index in the method.
+    RK_AttributeCache,
+    // A field of a LOAD_GLOBAL inline cache, Index is the cache's index in
+    // the method and Value the offset of the field.
+    RK_GlobalCache,
+    // A call site cache, Index is the cache's index in the method.
+    RK_CallCache,
+};
+
+struct Relocation {
+    uint32_t Offset;
+    uint32_t Kind;
+    uint32_t Index;
+    uint32_t Value;
+};
+
+// The IL and supporting information produced for a function.  Everything
+// here is independent of the process that produced it.
+struct ILCacheEntry {
+    std::vector<BYTE> IL;
+    // The CorInfoType of each local
+    std::vector<int32_t> Locals;
+    std::vector<Relocation> Relocations;
+    // The global method tokens which user method tokens dispatch to, in the
+    // order the tokens were allocated.
+    std::vector<int32_t> UserMethods;
+    bool Speculative;
+
+    ILCacheEntry() {
+        Speculative = false;
+    }
+};
+
+// Images which cached IL can refer to
+#define ILCACHE_IMAGE_PYTHON    0
+#define ILCACHE_IMAGE_PYJION    1
+#define ILCACHE_IMAGE_COUNT     2
+
+// Finds the image containing the address, returning false if it's not in an
+// image we know about.
+bool ILCacheFindImage(void* addr, uint32_t& image, uint32_t& offset);
+// Gets the address at the offset in one of the images we know about.
+void* ILCacheImageAddress(uint32_t image, uint32_t offset);
+
+// On disk cache of the IL generated for functions.  Entries are keyed on a
+// hash of everything which can influence the IL we produce so a process can
+// skip running the abstract interpreter for code it's compiled before.  The
+// cache is limited in size with the least recently used entries evicted
+// first.  The GIL must be held when using the cache.
+class __declspec(dllexport) ILCache {
+#pragma warning (disable:4251)
+    std::string m_path;
+    size_t m_maxSize, m_size;
+    // Most recently used entries are at the front
+    std::list<uint64_t> m_lru;
+    std::unordered_map<uint64_t, std::pair<size_t, std::list<uint64_t>::iterator>> m_entries;
+#pragma warning (default:4251)
+
+public:
+    size_t m_hits, m_misses, m_stores, m_evictions;
+
+    ILCache();
+
+    // Enables the cache, storing entries in the directory and keeping the
+    // total size of the entries under maxSize bytes.
+    bool enable(const char* path, size_t maxSize);
+    void disable();
+    bool is_enabled();
+
+    bool load(uint64_t key, ILCacheEntry& entry);
+    void store(uint64_t key, ILCacheEntry& entry);
+
+    size_t size();
+    size_t max_size();
+    size_t entry_count();
+
+    // Computes the key for a code object.  kinds describes the types the code
+    // is being specialized for.  Returns 0 if the code can't be cached.
+    static uint64_t get_key(PyCodeObject* code, std::vector<int>& kinds);
+
+private:
+    std::string get_filename(uint64_t key);
+    void add_entry(uint64_t key, size_t size);
+    void remove_entry(uint64_t key);
+    void evict(size_t needed);
+};
+
+extern __declspec(dllexport) ILCache g_ilCache;
+
+#endif
@@ -73,6 +73,8 @@ public:
     vector<byte> m_il;
     int m_localCount;
     vector<LabelInfo> m_labels;
+    // Offsets of the pointer values loaded by the IL
+    vector<size_t> m_pointers;
 
 public:
 
@@ -203,6 +205,10 @@ public:
         push_back(CEE_LDIND_I4);
     }
 
+    void ld_ind_i8() {
+        push_back(CEE_LDIND_I8);
+    }
+
     void ld_ind_r8() {
         push_back(CEE_LDIND_R8);
     }
@@ -271,6 +277,18 @@ public:
         m_il.push_back(CEE_NEG);
     }
 
+    void conv_i() {
+        m_il.push_back(CEE_CONV_I);
+    }
+
+    void conv_i2() {
+        m_il.push_back(CEE_CONV_I2);
+    }
+
+    void conv_i4() {
+        m_il.push_back(CEE_CONV_I4);
+    }
+
     void dup() {
         m_il.push_back(CEE_DUP);
     }
@@ -279,6 +297,18 @@ public:
         m_il.push_back(CEE_AND);
     }
 
+    void bitwise_or() {
+        m_il.push_back(CEE_OR);
+    }
+
+    void bitwise_xor() {
+        m_il.push_back(CEE_XOR);
+    }
+
+    void shift_right() {
+        m_il.push_back(CEE_SHR);
+    }
+
     void pop() {
         m_il.push_back(CEE_POP);
     }
@@ -339,33 +369,53 @@ public:
     }
 
     void ld_i(size_t i) {
-        ld_i((void*)i);
-    }
-
-    void ld_i(void* ptr) {
-        size_t value = (size_t)ptr;
 #ifdef _TARGET_AMD64_
-        if ((value & 0xFFFFFFFF) == value) {
-            ld_i((int)value);
+        if ((i & 0xFFFFFFFF) == i) {
+            ld_i((int)i);
         }
         else {
-            m_il.push_back(CEE_LDC_I8);
-            m_il.push_back(value & 0xff);
-            m_il.push_back((value >> 8) & 0xff);
-            m_il.push_back((value >> 16) & 0xff);
-            m_il.push_back((value >> 24) & 0xff);
-            m_il.push_back((value >> 32) & 0xff);
-            m_il.push_back((value >> 40) & 0xff);
-            m_il.push_back((value >> 48) & 0xff);
-            m_il.push_back((value >> 56) & 0xff);
-            m_il.push_back(CEE_CONV_I);
+            ld_i8(i);
         }
 #else
-        ld_i(value);
-        m_il.push_back(CEE_CONV_I);
+        ld_i((int)i);
+#endif
+    }
+
+    // Loads a pointer.  Pointers are always emitted at full width and their
+    // offsets are recorded so the IL can be relocated when it's reused.
+    void ld_i(void* ptr) {
+        m_pointers.push_back(m_il.size() + 1);
+#ifdef _TARGET_AMD64_
+        ld_i8((size_t)ptr);
+#else
+        ld_i((int)ptr);
 #endif
     }
 
+    size_t get_pointer(size_t offset) {
+        size_t value;
+        memcpy(&value, &m_il[offset], sizeof(size_t));
+        return value;
+    }
+
+    void set_pointer(size_t offset, size_t value) {
+        memcpy(&m_il[offset], &value, sizeof(size_t));
+    }
+
+    vector<Parameter>& get_locals() {
+        return m_locals;
+    }
+
+    // Replaces the IL we've generated with IL saved from an earlier compilation
+    void load(vector<byte>& il, vector<Parameter>& locals) {
+        m_il = il;
+        m_locals = locals;
+        m_localCount = (int)locals.size();
+        m_pointers.clear();
+        m_freedLocals.clear();
+        m_labels.clear();
+    }
+
     void emit_call(int token) {
         m_il.push_back(CEE_CALL);
         emit_int(token);
@@ -471,7 +521,7 @@ public:
         return methodInfo;
     }
 
-    Method compile(ICorJitInfo* jitInfo, ICorJitCompiler* jit, int stackSize) {
+    Method compile(ICorJitInfo* jitInfo, ICorJitCompiler* jit, int stackSize, bool minOpts = false) {
         BYTE* nativeEntry;
         ULONG nativeSizeOfCode;
         auto res = Method(m_module, m_retType, m_params, nullptr);
@@ -479,7 +529,7 @@ public:
         CorJitResult result = jit->compileMethod(
             /*ICorJitInfo*/jitInfo,
             /*CORINFO_METHOD_INFO */&methodInfo,
-            /*flags*/CORJIT_FLG_SKIP_VERIFICATION,
+            /*flags*/CORJIT_FLG_SKIP_VERIFICATION | (minOpts ? CORJIT_FLG_MIN_OPT : 0),
             &nativeEntry,
             &nativeSizeOfCode
             );
@@ -543,6 +593,21 @@ private:
         m_il.push_back(b);
     }
 
+#ifdef _TARGET_AMD64_
+    void ld_i8(size_t value) {
+        m_il.push_back(CEE_LDC_I8);
+        m_il.push_back(value & 0xff);
+        m_il.push_back((value >> 8) & 0xff);
+        m_il.push_back((value >> 16) & 0xff);
+        m_il.push_back((value >> 24) & 0xff);
+        m_il.push_back((value >> 32) & 0xff);
+        m_il.push_back((value >> 40) & 0xff);
+        m_il.push_back((value >> 48) & 0xff);
+        m_il.push_back((value >> 56) & 0xff);
+        m_il.push_back(CEE_CONV_I);
+    }
+#endif
+
 
 };
 
@@ -0,0 +1,247 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) Microsoft Corporation
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+* OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+*/
+
+#ifndef INLINECACHE_H
+#define INLINECACHE_H
+
+#include <Python.h>
+#include <vector>
+
+using namespace std;
+
+// How an attribute load resolved the last time a call site ran
+enum AttributeCacheKind {
+    // Nothing has been cached, or the last lookup couldn't be cached
+    ACK_Empty,
+    // The type doesn't define the attribute, it's in the instance dictionary
+    ACK_InstanceDict,
+    // The attribute is a __slots__ member stored at a fixed offset
+    ACK_Slot,
+    // A class attribute which isn't a descriptor, instances can shadow it
+    ACK_ClassAttr,
+    // A non-data descriptor such as a function which is bound to the
+    // instance, instances can shadow it
+    ACK_Descriptor,
+    // A data descriptor such as a property
+    ACK_DataDescriptor,
+    // The site has missed too often to be worth caching
+    ACK_Megamorphic,
+};
+
+// Number of misses after which a call site stops caching
+#define ATTR_CACHE_MAX_MISSES 64
+
+// Per call site cache for LOAD_ATTR.  The cache is valid when the owner's
+// type and the type's version tag match, a type gets a new version tag
+// whenever it or one of its bases is modified.
+struct AttributeCache {
+    PyTypeObject* Type;
+    unsigned int VersionTag;
+    AttributeCacheKind Kind;
+    // The offset of the slot for ACK_Slot
+    Py_ssize_t Offset;
+    // The class attribute or descriptor found on the type.  The reference is
+    // borrowed from the type which can't change while the version tag matches.
+    PyObject* Value;
+    size_t Hits, Misses;
+
+    AttributeCache() {
+        Type = nullptr;
+        VersionTag = 0;
+        Kind = ACK_Empty;
+        Offset = 0;
+        Value = nullptr;
+        Hits = Misses = 0;
+    }
+};
+
+// Per call site cache for LOAD_GLOBAL.  Dictionaries get a new, globally
+// unique, version whenever they're created or modified, so while the versions
+// of the frame's globals and builtins match the ones we saw when filling the
+// cache the name must still resolve to the same value.
+struct GlobalCache {
+    uint64_t GlobalsVersion, BuiltinsVersion;
+    // Borrowed from globals or builtins, which hold it while the versions match
+    PyObject* Value;
+    // Number of times the cache had to be refilled after a dict changed
+    size_t Invalidations;
+
+    GlobalCache() {
+        // Dict versions start at 1 so an empty cache never matches
+        GlobalsVersion = BuiltinsVersion = 0;
+        Value = nullptr;
+        Invalidations = 0;
+    }
+};
+
+// Number of times a call site's target can change before we stop caching it
+#define CALL_CACHE_MAX_MISSES 64
+
+struct SpecializedTreeNode;
+class PyjionJittedCode;
+
+// Per call site cache for calls to jitted Python functions, letting us build
+// the callee's frame and run its native code directly.  The function and its
+// code are held by weak references, a strong reference would create a cycle
+// through the jitted code for recursive functions which code objects can't
+// be collected from.  Trace and Target belong to the code so are only used
+// once the code is known to be alive.
+struct CallCache {
+    PyObject* Function;
+    PyObject* Code;
+    PyjionJittedCode* Trace;
+    // The specialization the last call through the site ran
+    SpecializedTreeNode* Target;
+    size_t Hits, Misses;
+
+    CallCache() {
+        Function = Code = nullptr;
+        Trace = nullptr;
+        Target = nullptr;
+        Hits = Misses = 0;
+    }
+
+    ~CallCache() {
+        Py_XDECREF(Function);
+        Py_XDECREF(Code);
+    }
+};
+
+// The inline caches referenced by a method's code.  Owned by the compiled
+// code so they're freed when the code is.
+class InlineCaches {
+    vector<AttributeCache*> m_attributes;
+    vector<GlobalCache*> m_globals;
+    vector<CallCache*> m_calls;
+    // Objects referenced by the code which it keeps alive
+    vector<PyObject*> m_objects;
+
+public:
+    ~InlineCaches() {
+        for (auto obj : m_objects) {
+            Py_DECREF(obj);
+        }
+        for (auto cache : m_attributes) {
+            delete cache;
+        }
+        for (auto cache : m_globals) {
+            delete cache;
+        }
+        for (auto cache : m_calls) {
+            delete cache;
+        }
+    }
+
+    AttributeCache* new_attribute_cache() {
+        auto res = new AttributeCache();
+        m_attributes.push_back(res);
+        return res;
+    }
+
+    // Gets the cache at index, allocating caches up to it.  Used when IL
+    // from the IL cache refers to the caches by their index.
+    AttributeCache* get_attribute_cache(size_t index) {
+        while (m_attributes.size() <= index) {
+            new_attribute_cache();
+        }
+        return m_attributes[index];
+    }
+
+    bool find_attribute_cache(void* cache, size_t& index) {
+        for (index = 0; index < m_attributes.size(); index++) {
+            if (m_attributes[index] == cache) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    GlobalCache* new_global_cache() {
+        auto res = new GlobalCache();
+        m_globals.push_back(res);
+        return res;
+    }
+
+    GlobalCache* get_global_cache(size_t index) {
+        while (m_globals.size() <= index) {
+            new_global_cache();
+        }
+        return m_globals[index];
+    }
+
+    // Finds the global cache which addr points into, the code loads the
+    // cache's fields directly so offset is the field's offset.
+    bool find_global_cache(void* addr, size_t& index, size_t& offset) {
+        for (index = 0; index < m_globals.size(); index++) {
+            offset = (size_t)addr - (size_t)m_globals[index];
+            if (offset < sizeof(GlobalCache)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void keep_alive(PyObject* obj) {
+        Py_INCREF(obj);
+        m_objects.push_back(obj);
+    }
+
+    CallCache* new_call_cache() {
+        auto res = new CallCache();
+        m_calls.push_back(res);
+        return res;
+    }
+
+    CallCache* get_call_cache(size_t index) {
+        while (m_calls.size() <= index) {
+            new_call_cache();
+        }
+        return m_calls[index];
+    }
+
+    bool find_call_cache(void* cache, size_t& index) {
+        for (index = 0; index < m_calls.size(); index++) {
+            if (m_calls[index] == cache) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+// Totals for all of the inline caches in the process
+struct InlineCacheStats {
+    size_t AttrHits, AttrMisses;
+    // Global cache hits are handled entirely in the generated code so
+    // aren't counted.
+    size_t GlobalMisses, GlobalInvalidations;
+    // Calls which went directly to a callee's optimized code, and calls
+    // which took the generic path.
+    size_t CallHits, CallMisses;
+};
+
+extern __declspec(dllexport) InlineCacheStats g_inlineCacheStats;
+
+#endif
@@ -27,6 +27,7 @@
 
 #include "intrins.h"
 #include "taggedptr.h"
+#include "pyjit.h"
 #include <cstdint>
 
 #ifdef _MSC_VER
@@ -38,7 +39,10 @@ using namespace msl::utilities;
 
 //#define DEBUG_TRACE
 PyObject* g_emptyTuple;
+InlineCacheStats g_inlineCacheStats;
 #include <dictobject.h>
+#include <structmember.h>
+#include <opcode.h>
 #define NAME_ERROR_MSG \
     "name '%.200s' is not defined"
 
@@ -106,6 +110,48 @@ PyObject* PyJit_Subscr(PyObject *left, PyObject *right) {
     return res;
 }
 
+// Gets the item from a list or tuple for an in range index, returning nullptr
+// w/o an error set if we need to go through the generic path.
+static inline PyObject* SequenceItem(PyObject **items, Py_ssize_t size, PyObject *index) {
+    if (!PyLong_CheckExact(index)) {
+        return nullptr;
+    }
+    auto i = PyLong_AsSsize_t(index);
+    if (i == -1 && PyErr_Occurred()) {
+        PyErr_Clear();
+        return nullptr;
+    }
+    if (i < 0) {
+        i += size;
+    }
+    if (i < 0 || i >= size) {
+        return nullptr;
+    }
+    return items[i];
+}
+
+PyObject* PyJit_SubscrListInt(PyObject *list, PyObject *index) {
+    auto res = SequenceItem(((PyListObject*)list)->ob_item, PyList_GET_SIZE(list), index);
+    if (res == nullptr) {
+        return PyJit_Subscr(list, index);
+    }
+    Py_INCREF(res);
+    Py_DECREF(list);
+    Py_DECREF(index);
+    return res;
+}
+
+PyObject* PyJit_SubscrTupleInt(PyObject *tuple, PyObject *index) {
+    auto res = SequenceItem(((PyTupleObject*)tuple)->ob_item, PyTuple_GET_SIZE(tuple), index);
+    if (res == nullptr) {
+        return PyJit_Subscr(tuple, index);
+    }
+    Py_INCREF(res);
+    Py_DECREF(tuple);
+    Py_DECREF(index);
+    return res;
+}
+
 PyObject* PyJit_RichCompare(PyObject *left, PyObject *right, int op) {
     auto res = PyObject_RichCompare(left, right, op);
     Py_DECREF(left);
@@ -992,6 +1038,183 @@ void PyJit_PopFrame(PyFrameObject* frame) {
     PyThreadState_Get()->frame = frame->f_back;
 }
 
+void PyJit_DeoptPushBlock(PyFrameObject* frame, int type, int handler, int level) {
+    PyFrame_BlockSetup(frame, type, handler, level);
+}
+
+// Transfers ownership of the value to the frame's value stack.
+void PyJit_DeoptPushValue(PyObject* value, PyFrameObject* frame) {
+    if (frame->f_stacktop == nullptr) {
+        frame->f_stacktop = frame->f_valuestack;
+    }
+    *frame->f_stacktop++ = value;
+}
+
+// Finishes running a frame in the interpreter when one of our speculative type
+// guards has failed.  The jitted code has already written its locals, blocks,
+// and values back to the frame.
+PyObject* PyJit_Deoptimize(PyFrameObject* frame, int lasti) {
+    auto jittedCode = PyJit_EnsureExtra((PyObject*)frame->f_code);
+    if (jittedCode != nullptr) {
+        jittedCode->j_deopt_count++;
+    }
+
+    if (frame->f_stacktop == nullptr) {
+        frame->f_stacktop = frame->f_valuestack;
+    }
+    frame->f_lasti = lasti;
+    return PyJit_EvalFrameInterpreted(frame);
+}
+
+// Marks a generator's frame as suspended at lasti once its live values have
+// been pushed onto the value stack.  gen_send_ex treats a frame without a
+// stack top as finished, so we need one even when nothing was pushed.
+void PyJit_SuspendFrame(PyFrameObject* frame, int lasti) {
+    if (frame->f_stacktop == nullptr) {
+        frame->f_stacktop = frame->f_valuestack;
+    }
+    frame->f_lasti = lasti;
+}
+
+// Sends value to the receiver of a yield from or await, stealing the value.
+// Returns 1 when the receiver yielded, 0 when it finished, and -1 on an error,
+// storing the value it yielded or returned in result.
+int PyJit_YieldFrom(PyObject* receiver, PyObject* value, PyObject** result) {
+    PyObject* res;
+    if (PyGen_CheckExact(receiver) || PyCoro_CheckExact(receiver)) {
+        res = _PyGen_Send((PyGenObject*)receiver, value);
+    }
+    else if (value == Py_None) {
+        res = Py_TYPE(receiver)->tp_iternext(receiver);
+    }
+    else {
+        _Py_IDENTIFIER(send);
+        res = _PyObject_CallMethodIdObjArgs(receiver, &PyId_send, value, NULL);
+    }
+    Py_DECREF(value);
+
+    if (res != nullptr) {
+        *result = res;
+        return 1;
+    }
+    // The return value comes back in a StopIteration, which we clear
+    if (_PyGen_FetchStopIterationValue(result) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+PyObject* PyJit_GetYieldFromIter(PyObject* iterable, int isCoroutine) {
+    if (PyCoro_CheckExact(iterable)) {
+        if (!isCoroutine) {
+            Py_DECREF(iterable);
+            PyErr_SetString(PyExc_TypeError,
+                "cannot 'yield from' a coroutine object in a non-coroutine generator");
+            return nullptr;
+        }
+        return iterable;
+    }
+    else if (PyGen_CheckExact(iterable)) {
+        return iterable;
+    }
+
+    auto iter = PyObject_GetIter(iterable);
+    Py_DECREF(iterable);
+    return iter;
+}
+
+static bool IsCoroutine(PyObject* value) {
+    return PyCoro_CheckExact(value) ||
+        (PyGen_CheckExact(value) && 
+        (((PyCodeObject*)((PyGenObject*)value)->gi_code)->co_flags & CO_ITERABLE_COROUTINE));
+}
+
+// Gets the iterator an await delegates to, stealing the awaited value.  This
+// follows _PyCoro_GetAwaitableIter and _PyGen_yf, which python36.dll doesn't
+// export.
+PyObject* PyJit_GetAwaitable(PyObject* value) {
+    PyObject* res = nullptr;
+    auto type = Py_TYPE(value);
+    if (IsCoroutine(value)) {
+        Py_INCREF(value);
+        res = value;
+    }
+    else if (type->tp_as_async != nullptr && type->tp_as_async->am_await != nullptr) {
+        res = type->tp_as_async->am_await(value);
+        if (res != nullptr) {
+            // __await__ must return an iterator, not another awaitable
+            if (IsCoroutine(res)) {
+                PyErr_SetString(PyExc_TypeError, "__await__() returned a coroutine");
+                Py_CLEAR(res);
+            }
+            else if (!PyIter_Check(res)) {
+                PyErr_Format(PyExc_TypeError,
+                    "__await__() returned non-iterator of type '%.100s'",
+                    Py_TYPE(res)->tp_name);
+                Py_CLEAR(res);
+            }
+        }
+    }
+    else {
+        PyErr_Format(PyExc_TypeError,
+            "object %.100s can't be used in 'await' expression",
+            type->tp_name);
+    }
+    Py_DECREF(value);
+
+    if (res != nullptr && PyCoro_CheckExact(res)) {
+        // A coroutine which is suspended in a yield from is already being
+        // awaited by someone else.
+        auto frame = ((PyGenObject*)res)->gi_frame;
+        if (frame != nullptr && frame->f_stacktop != nullptr && frame->f_lasti >= 0) {
+            auto code = (_Py_CODEUNIT*)PyBytes_AS_STRING(frame->f_code->co_code);
+            if (_Py_OPCODE(code[frame->f_lasti / sizeof(_Py_CODEUNIT) + 1]) == YIELD_FROM) {
+                Py_DECREF(res);
+                PyErr_SetString(PyExc_RuntimeError, "coroutine is being awaited already");
+                return nullptr;
+            }
+        }
+    }
+    return res;
+}
+
+void PyJit_RecordType(PyObject* value, TypeProfile* profile, size_t opcodeIndex) {
+    profile->record(opcodeIndex, Py_TYPE(value));
+}
+
+void PyJit_RecordCallee(PyObject* function, TypeProfile* profile, size_t opcodeIndex) {
+    profile->record_callee(opcodeIndex, function);
+}
+
+void PyJit_RecordArgType(PyObject* value, TypeProfile* profile, size_t opcodeIndex, size_t arg) {
+    // Method calls pass NULL in place of self when the attribute wasn't a method
+    if (value != nullptr) {
+        profile->record_arg(opcodeIndex, arg, Py_TYPE(value));
+    }
+}
+
+// Code inlined from a function runs without a frame of its own, we only
+// create one when the traceback needs it.  It has the function's globals,
+// and the caller fills in its locals.
+PyFrameObject* PyJit_NewInlineFrame(PyObject* function) {
+    PyObject *type, *value, *traceback;
+    PyErr_Fetch(&type, &value, &traceback);
+    auto frame = PyFrame_New(
+        PyThreadState_GET(),
+        (PyCodeObject*)PyFunction_GET_CODE(function),
+        PyFunction_GET_GLOBALS(function),
+        nullptr
+    );
+    PyErr_Restore(type, value, traceback);
+    return frame;
+}
+
+void PyJit_InlineTrace(PyFrameObject* frame, int lasti) {
+    frame->f_lasti = lasti;
+    PyTraceBack_Here(frame);
+    Py_DECREF(frame);
+}
+
 void PyJit_EhTrace(PyFrameObject *f) {
     PyTraceBack_Here(f);
     
@@ -1190,14 +1413,6 @@ int PyJit_DeleteSubscr(PyObject *container, PyObject *index) {
     return res;
 }
 
-PyObject* PyJit_CallN(PyObject *target, PyObject* args) {
-    // we stole references for the tuple...
-    auto res = PyObject_Call(target, args, nullptr);
-    Py_DECREF(target);
-    Py_DECREF(args);
-    return res;
-}
-
 PyObject* PyJit_CallNKW(PyObject *target, PyObject* args, PyObject* kwargs) {
     // we stole references for the tuple...
 #ifdef DEBUG_TRACE
@@ -1275,6 +1490,39 @@ PyObject* PyJit_LoadGlobal(PyFrameObject* f, PyObject* name) {
     return v;
 }
 
+// Called when the generated code finds the dictionary versions in the cache
+// don't match the frame's globals and builtins.
+PyObject* PyJit_LoadGlobalCached(PyFrameObject* f, PyObject* name, GlobalCache* cache) {
+    g_inlineCacheStats.GlobalMisses++;
+    if (!PyDict_CheckExact(f->f_globals) || !PyDict_CheckExact(f->f_builtins)) {
+        return PyJit_LoadGlobal(f, name);
+    }
+
+    // Capture the versions before the lookup, if comparing keys modifies
+    // either dict the next load will miss rather than use a stale value.
+    auto globalsVersion = ((PyDictObject*)f->f_globals)->ma_version_tag;
+    auto builtinsVersion = ((PyDictObject*)f->f_builtins)->ma_version_tag;
+    auto v = _PyDict_LoadGlobal((PyDictObject *)f->f_globals,
+        (PyDictObject *)f->f_builtins,
+        name);
+    if (v == NULL) {
+        if (!_PyErr_OCCURRED())
+            format_exc_check_arg(PyExc_NameError, NAME_ERROR_MSG, name);
+        return nullptr;
+    }
+
+    if (cache->Value != nullptr) {
+        cache->Invalidations++;
+        g_inlineCacheStats.GlobalInvalidations++;
+    }
+    cache->GlobalsVersion = globalsVersion;
+    cache->BuiltinsVersion = builtinsVersion;
+    cache->Value = v;
+
+    Py_INCREF(v);
+    return v;
+}
+
 PyObject* PyJit_GetIter(PyObject* iterable) {
     auto res = PyObject_GetIter(iterable);
     Py_DECREF(iterable);
@@ -1563,6 +1811,239 @@ PyObject* PyJit_LoadAttr(PyObject* owner, PyObject* name) {
     return res;
 }
 
+// Records how the attribute was found so the next load from the same type can
+// skip the lookup through the MRO.  We only cache for types which use the
+// default attribute lookup, everything else always goes through the slow path.
+static void FillAttributeCache(AttributeCache* cache, PyTypeObject* type, PyObject* name) {
+    cache->Kind = ACK_Empty;
+    if (type->tp_getattro != PyObject_GenericGetAttr || type->tp_dict == nullptr || !PyUnicode_CheckExact(name)) {
+        return;
+    }
+
+    // Looking the attribute up assigns the type a version tag
+    auto descr = _PyType_Lookup(type, name);
+    if (!PyType_HasFeature(type, Py_TPFLAGS_VALID_VERSION_TAG)) {
+        return;
+    }
+
+    AttributeCacheKind kind;
+    if (descr == nullptr) {
+        if (type->tp_dictoffset == 0) {
+            return;
+        }
+        kind = ACK_InstanceDict;
+    }
+    else {
+        auto descrType = Py_TYPE(descr);
+        if (descrType->tp_descr_set != nullptr) {
+            if (descrType == &PyMemberDescr_Type &&
+                ((PyMemberDescrObject*)descr)->d_member->type == T_OBJECT_EX) {
+                kind = ACK_Slot;
+                cache->Offset = ((PyMemberDescrObject*)descr)->d_member->offset;
+            }
+            else if (descrType->tp_descr_get != nullptr) {
+                kind = ACK_DataDescriptor;
+            }
+            else {
+                return;
+            }
+        }
+        else if (descrType->tp_descr_get != nullptr) {
+            kind = ACK_Descriptor;
+        }
+        else {
+            kind = ACK_ClassAttr;
+        }
+    }
+
+    cache->Type = type;
+    cache->VersionTag = type->tp_version_tag;
+    cache->Value = descr;
+    cache->Kind = kind;
+}
+
+// Gets the value for name from the instance dictionary, or nullptr if there
+// isn't one.  Returns a borrowed reference.
+static PyObject* LookupInstanceDict(PyObject* owner, PyObject* name) {
+    auto dictPtr = _PyObject_GetDictPtr(owner);
+    if (dictPtr != nullptr && *dictPtr != nullptr) {
+        return PyDict_GetItem(*dictPtr, name);
+    }
+    return nullptr;
+}
+
+PyObject* PyJit_LoadAttrCached(PyObject* owner, PyObject* name, AttributeCache* cache) {
+    auto type = Py_TYPE(owner);
+    if (type == cache->Type &&
+        type->tp_version_tag == cache->VersionTag &&
+        PyType_HasFeature(type, Py_TPFLAGS_VALID_VERSION_TAG)) {
+        PyObject* res = nullptr;
+        bool hit = true;
+        switch (cache->Kind) {
+            case ACK_InstanceDict:
+                res = LookupInstanceDict(owner, name);
+                Py_XINCREF(res);
+                // Let the slow path report the missing attribute
+                hit = res != nullptr;
+                break;
+            case ACK_Slot:
+                res = *(PyObject**)((char*)owner + cache->Offset);
+                Py_XINCREF(res);
+                hit = res != nullptr;
+                break;
+            case ACK_ClassAttr:
+                res = LookupInstanceDict(owner, name);
+                if (res == nullptr) {
+                    res = cache->Value;
+                }
+                Py_INCREF(res);
+                break;
+            case ACK_Descriptor:
+                res = LookupInstanceDict(owner, name);
+                if (res != nullptr) {
+                    Py_INCREF(res);
+                }
+                else {
+                    res = Py_TYPE(cache->Value)->tp_descr_get(cache->Value, owner, (PyObject*)type);
+                }
+                break;
+            case ACK_DataDescriptor:
+                res = Py_TYPE(cache->Value)->tp_descr_get(cache->Value, owner, (PyObject*)type);
+                break;
+            default:
+                hit = false;
+                break;
+        }
+
+        if (hit) {
+            cache->Hits++;
+            g_inlineCacheStats.AttrHits++;
+            Py_DECREF(owner);
+            return res;
+        }
+    }
+
+    cache->Misses++;
+    g_inlineCacheStats.AttrMisses++;
+    if (cache->Kind != ACK_Megamorphic) {
+        if (cache->Misses > ATTR_CACHE_MAX_MISSES) {
+            cache->Kind = ACK_Megamorphic;
+        }
+        else {
+            FillAttributeCache(cache, type, name);
+        }
+    }
+    return PyJit_LoadAttr(owner, name);
+}
+
+// Finds __enter__ or __exit__ on the type, skipping the instance dictionary
+// like the interpreter's special method lookup.  The cache holds the
+// descriptor found for the last type, which we can reuse while the type's
+// version tag is unchanged.  Returns a borrowed reference.
+static PyObject* LookupWithMethod(PyObject* mgr, _Py_Identifier* id, AttributeCache* cache) {
+    auto type = Py_TYPE(mgr);
+    if (type == cache->Type &&
+        cache->Kind != ACK_Empty &&
+        type->tp_version_tag == cache->VersionTag &&
+        PyType_HasFeature(type, Py_TPFLAGS_VALID_VERSION_TAG)) {
+        cache->Hits++;
+        g_inlineCacheStats.AttrHits++;
+        return cache->Value;
+    }
+
+    cache->Misses++;
+    g_inlineCacheStats.AttrMisses++;
+    auto descr = _PyType_LookupId(type, id);
+    if (descr == nullptr) {
+        if (!PyErr_Occurred()) {
+            PyErr_SetObject(PyExc_AttributeError, _PyUnicode_FromId(id));
+        }
+        return nullptr;
+    }
+
+    if (cache->Kind != ACK_Megamorphic) {
+        if (cache->Misses > ATTR_CACHE_MAX_MISSES) {
+            cache->Kind = ACK_Megamorphic;
+        }
+        else if (PyType_HasFeature(type, Py_TPFLAGS_VALID_VERSION_TAG)) {
+            cache->Type = type;
+            cache->VersionTag = type->tp_version_tag;
+            cache->Value = descr;
+            cache->Kind = Py_TYPE(descr)->tp_descr_get != nullptr ? ACK_Descriptor : ACK_ClassAttr;
+        }
+    }
+    return descr;
+}
+
+static PyObject* BindWithMethod(PyObject* descr, PyObject* mgr) {
+    auto get = Py_TYPE(descr)->tp_descr_get;
+    if (get != nullptr) {
+        return get(descr, mgr, (PyObject*)Py_TYPE(mgr));
+    }
+    Py_INCREF(descr);
+    return descr;
+}
+
+PyObject* PyJit_SetupWith(PyObject* mgr, AttributeCache* enterCache, AttributeCache* exitCache, PyObject** exit) {
+    _Py_IDENTIFIER(__enter__);
+    _Py_IDENTIFIER(__exit__);
+
+    *exit = nullptr;
+    auto enter = LookupWithMethod(mgr, &PyId___enter__, enterCache);
+    if (enter == nullptr) {
+        Py_DECREF(mgr);
+        return nullptr;
+    }
+    // Binding __exit__ can run arbitrary code which could modify the type
+    Py_INCREF(enter);
+
+    PyObject* res = nullptr;
+    auto exitDescr = LookupWithMethod(mgr, &PyId___exit__, exitCache);
+    if (exitDescr != nullptr) {
+        *exit = BindWithMethod(exitDescr, mgr);
+    }
+    if (*exit != nullptr) {
+        if (PyFunction_Check(enter)) {
+            // Call the function directly rather than allocating a bound method
+            res = PyObject_CallFunctionObjArgs(enter, mgr, NULL);
+        }
+        else {
+            auto bound = BindWithMethod(enter, mgr);
+            if (bound != nullptr) {
+                res = PyObject_CallFunctionObjArgs(bound, NULL);
+                Py_DECREF(bound);
+            }
+        }
+        if (res == nullptr) {
+            Py_CLEAR(*exit);
+        }
+    }
+
+    Py_DECREF(enter);
+    Py_DECREF(mgr);
+    return res;
+}
+
+PyObject* PyJit_WithCleanupStart(PyObject* exit, PyObject* exc, PyObject* val, PyObject* tb) {
+    // When the body didn't raise the value and traceback weren't set
+    if (exc == Py_None) {
+        val = tb = Py_None;
+    }
+    auto res = PyObject_CallFunctionObjArgs(exit, exc, val, tb, NULL);
+    Py_DECREF(exit);
+    return res;
+}
+
+int PyJit_WithCleanupFinish(PyObject* exc, PyObject* res) {
+    int err = 0;
+    if (exc != Py_None) {
+        err = PyObject_IsTrue(res);
+    }
+    Py_DECREF(res);
+    Py_DECREF(exc);
+    return err;
+}
+
 const char * ObjInfo(PyObject *obj) {
     if (obj == nullptr) {
         return "<NULL>";
@@ -1760,73 +2241,6 @@ PyObject* Call0(PyObject *target) {
     return res;
 }
 
-PyObject* Call0_Function(PyObject *target, void** addr) {
-    PyObject* res;
-    if (PyFunction_Check(target)) {
-        PyObject* empty[1] = { nullptr };
-        res = fast_function(target, empty, 0);
-    }
-    else {
-        return Call0_Generic(target, addr);
-    }
-
-    Py_DECREF(target);
-    return res;
-}
-
-PyObject* Call0_Method(PyObject *target, void** addr) {
-    PyObject* res;
-    if (PyMethod_Check(target) && PyMethod_GET_SELF(target) != NULL) {
-        PyObject *self = PyMethod_GET_SELF(target);
-        PyObject* func = PyMethod_GET_FUNCTION(target);
-        Py_INCREF(self);
-        Py_INCREF(func);
-        res = Call1(func, self);
-    }
-    else {
-        return Call0_Generic(target, addr);
-    }
-
-    Py_DECREF(target);
-    return res;
-}
-
-PyObject* Call0_CFunction(PyObject *target, void** addr) {
-    PyObject* res;
-    if (PyCFunction_Check(target)) {
-        res = PyCFunction_Call(target, g_emptyTuple, nullptr);
-    }
-    else {
-        return Call0_Generic(target, addr);
-    }
-
-    Py_DECREF(target);
-    return res;
-}
-
-
-PyObject* Call0_Generic(PyObject *target, void** addr) {
-    PyObject* res;
-    if (PyFunction_Check(target)) {
-        *addr = &Call0_Function;
-        return Call0_Function(target, addr);
-    }
-    else if (PyCFunction_Check(target)) {
-        *addr = Call0_CFunction;
-        return Call0_CFunction(target, addr);
-    }
-    else if (PyMethod_Check(target) && PyMethod_GET_SELF(target) != NULL) {
-        *addr = Call0_Method;
-        return Call0_Method(target, addr);
-    }
-    else {
-        res = PyObject_Call(target, g_emptyTuple, nullptr);
-    }
-    Py_DECREF(target);
-    return res;
-}
-
-
 PyObject* Call1(PyObject *target, PyObject* arg0) {
     PyObject* res = nullptr;
     if (PyFunction_Check(target)) {
@@ -1845,19 +2259,11 @@ PyObject* Call1(PyObject *target, PyObject* arg0) {
     }
 
 
-    auto args = PyTuple_New(1);
-    if (args == nullptr) {
-        Py_DECREF(arg0);
-        goto error;
-    }
-    PyTuple_SET_ITEM(args, 0, arg0);
-    if (PyCFunction_Check(target)) {
-        res = PyCFunction_Call(target, args, nullptr);
-    }
-    else {
-        res = PyObject_Call(target, args, nullptr);
+    {
+        PyObject* stack[1] = { arg0 };
+        res = _PyObject_FastCall(target, stack, 1);
     }
-    Py_DECREF(args);
+    Py_DECREF(arg0);
 error:
     Py_DECREF(target);
     return res;
@@ -1882,21 +2288,12 @@ PyObject* Call2(PyObject *target, PyObject* arg0, PyObject* arg1) {
     }
 
 
-    auto args = PyTuple_New(2);
-    if (args == nullptr) {
-        Py_DECREF(arg0);
-        Py_DECREF(arg1);
-        goto error;
-    }
-    PyTuple_SET_ITEM(args, 0, arg0);
-    PyTuple_SET_ITEM(args, 1, arg1);
-    if (PyCFunction_Check(target)) {
-        res = PyCFunction_Call(target, args, nullptr);
-    }
-    else {
-        res = PyObject_Call(target, args, nullptr);
+    {
+        PyObject* stack[2] = { arg0, arg1 };
+        res = _PyObject_FastCall(target, stack, 2);
     }
-    Py_DECREF(args);
+    Py_DECREF(arg0);
+    Py_DECREF(arg1);
 error:
     Py_DECREF(target);
     return res;
@@ -1921,23 +2318,13 @@ PyObject* Call3(PyObject *target, PyObject* arg0, PyObject* arg1, PyObject* arg2
         goto error;
     }
 
-    auto args = PyTuple_New(3);
-    if (args == nullptr) {
-        Py_DECREF(arg0);
-        Py_DECREF(arg1);
-        Py_DECREF(arg2);
-        goto error;
-    }
-    PyTuple_SET_ITEM(args, 0, arg0);
-    PyTuple_SET_ITEM(args, 1, arg1);
-    PyTuple_SET_ITEM(args, 2, arg2);
-    if (PyCFunction_Check(target)) {
-        res = PyCFunction_Call(target, args, nullptr);
-    }
-    else {
-        res = PyObject_Call(target, args, nullptr);
+    {
+        PyObject* stack[3] = { arg0, arg1, arg2 };
+        res = _PyObject_FastCall(target, stack, 3);
     }
-    Py_DECREF(args);
+    Py_DECREF(arg0);
+    Py_DECREF(arg1);
+    Py_DECREF(arg2);
 error:
     Py_DECREF(target);
     return res;
@@ -1955,81 +2342,174 @@ PyObject* Call4(PyObject *target, PyObject* arg0, PyObject* arg1, PyObject* arg2
         goto error;
     }
 
-    auto args = PyTuple_New(4);
-    if (args == nullptr) {
-        Py_DECREF(arg0);
-        Py_DECREF(arg1);
-        Py_DECREF(arg2);
-        Py_DECREF(arg3);
-        goto error;
+    {
+        PyObject* stack[4] = { arg0, arg1, arg2, arg3 };
+        res = _PyObject_FastCall(target, stack, 4);
+    }
+    Py_DECREF(arg0);
+    Py_DECREF(arg1);
+    Py_DECREF(arg2);
+    Py_DECREF(arg3);
+error:
+    Py_DECREF(target);
+    return res;
+}
+
+// Loads an attribute which is about to be called.  If it's a function defined
+// on the class we return the function and pass back obj as self rather than
+// allocating a bound method.  Otherwise self is null and we return the
+// attribute.  The C method descriptors would just allocate a bound builtin
+// method when called, so those are left to the normal lookup.
+PyObject* PyJit_LoadMethod(PyObject* obj, PyObject* name, PyObject** self) {
+    auto type = Py_TYPE(obj);
+    *self = nullptr;
+    if (type->tp_getattro == PyObject_GenericGetAttr && PyUnicode_CheckExact(name)) {
+        auto descr = _PyType_Lookup(type, name);
+        if (descr != nullptr && PyFunction_Check(descr)) {
+            // Functions aren't data descriptors so the instance dictionary
+            // takes precedence.
+            Py_INCREF(descr);
+            auto attr = LookupInstanceDict(obj, name);
+            if (attr != nullptr) {
+                Py_INCREF(attr);
+                Py_DECREF(descr);
+                Py_DECREF(obj);
+                return attr;
+            }
+
+            // self takes our reference to obj
+            *self = obj;
+            return descr;
+        }
+    }
+
+    auto res = PyObject_GetAttr(obj, name);
+    Py_DECREF(obj);
+    return res;
+}
+
+PyObject* PyJit_MethodCall0(PyObject* target, PyObject* self) {
+    if (self == nullptr) {
+        return Call0(target);
     }
-    PyTuple_SET_ITEM(args, 0, arg0);
-    PyTuple_SET_ITEM(args, 1, arg1);
-    PyTuple_SET_ITEM(args, 2, arg2);
-    PyTuple_SET_ITEM(args, 3, arg3);
-    if (PyCFunction_Check(target)) {
-        res = PyCFunction_Call(target, args, nullptr);
+    return Call1(target, self);
+}
+
+PyObject* PyJit_MethodCall1(PyObject* target, PyObject* self, PyObject* arg0) {
+    if (self == nullptr) {
+        return Call1(target, arg0);
+    }
+    return Call2(target, self, arg0);
+}
+
+PyObject* PyJit_MethodCall2(PyObject* target, PyObject* self, PyObject* arg0, PyObject* arg1) {
+    if (self == nullptr) {
+        return Call2(target, arg0, arg1);
+    }
+    return Call3(target, self, arg0, arg1);
+}
+
+PyObject* PyJit_MethodCall3(PyObject* target, PyObject* self, PyObject* arg0, PyObject* arg1, PyObject* arg2) {
+    if (self == nullptr) {
+        return Call3(target, arg0, arg1, arg2);
+    }
+    return Call4(target, self, arg0, arg1, arg2);
+}
+
+PyObject* PyJit_MethodCall4(PyObject* target, PyObject* self, PyObject* arg0, PyObject* arg1, PyObject* arg2, PyObject* arg3) {
+    if (self == nullptr) {
+        return Call4(target, arg0, arg1, arg2, arg3);
+    }
+
+    PyObject* res;
+    if (PyFunction_Check(target)) {
+        PyObject* stack[5] = { self, arg0, arg1, arg2, arg3 };
+        res = fast_function(target, stack, 5);
     }
     else {
-        res = PyObject_Call(target, args, nullptr);
+        PyObject* stack[5] = { self, arg0, arg1, arg2, arg3 };
+        res = _PyObject_FastCall(target, stack, 5);
+    }
+    Py_DECREF(self);
+    Py_DECREF(arg0);
+    Py_DECREF(arg1);
+    Py_DECREF(arg2);
+    Py_DECREF(arg3);
+    Py_DECREF(target);
+    return res;
+}
+
+// Calls target with the arguments in the array, the last len(names) of which
+// are keyword arguments.  The array always has a spare slot before args so
+// that we can unwrap bound methods without copying the arguments.
+PyObject* PyJit_KwCallArray(PyObject* target, PyObject** args, size_t argCount, PyObject* names) {
+    auto posCount = argCount - (names == nullptr ? 0 : PyTuple_GET_SIZE(names));
+    PyObject* res;
+    if (PyMethod_Check(target) && PyMethod_GET_SELF(target) != NULL) {
+        // borrowed, target keeps them alive for the call
+        args[-1] = PyMethod_GET_SELF(target);
+        res = _PyObject_FastCallKeywords(PyMethod_GET_FUNCTION(target), args - 1, posCount + 1, names);
     }
-    Py_DECREF(args);
-error:
+    else {
+        res = _PyObject_FastCallKeywords(target, args, posCount, names);
+    }
+
+    for (size_t i = 0; i < argCount; i++) {
+        Py_DECREF(args[i]);
+    }
+    Py_XDECREF(names);
     Py_DECREF(target);
     return res;
 }
 
-PyObject* PyJit_KwCall1(PyObject *target, PyObject* arg0, PyObject* names) {
-	return nullptr;
+// Calls from CALL_FUNCTION, the arrays have a spare slot before the arguments
+// like the ones from preprocess().
+PyObject* PyJit_CallArrayCached(PyObject* target, PyObject** args, size_t argCount, CallCache* cache) {
+    return PyJit_CallCached(target, args, argCount, cache);
 }
 
-PyObject* PyJit_KwCall2(PyObject *target, PyObject* arg0, PyObject* arg1, PyObject* names) {
-	return nullptr;
+PyObject* PyJit_CallCached0(PyObject* target, CallCache* cache) {
+    PyObject* stack[1] = { nullptr };
+    return PyJit_CallCached(target, stack + 1, 0, cache);
 }
 
-PyObject* PyJit_KwCall3(PyObject *target, PyObject* arg0, PyObject* arg1, PyObject* arg2, PyObject* names) {
-	return nullptr;
+PyObject* PyJit_CallCached1(PyObject* target, PyObject* arg0, CallCache* cache) {
+    PyObject* stack[2] = { nullptr, arg0 };
+    return PyJit_CallCached(target, stack + 1, 1, cache);
 }
 
-PyObject* PyJit_KwCall4(PyObject *target, PyObject* arg0, PyObject* arg1, PyObject* arg2, PyObject* arg3, PyObject* names) {
-	return nullptr;
+PyObject* PyJit_CallCached2(PyObject* target, PyObject* arg0, PyObject* arg1, CallCache* cache) {
+    PyObject* stack[3] = { nullptr, arg0, arg1 };
+    return PyJit_CallCached(target, stack + 1, 2, cache);
 }
 
-PyObject* PyJit_KwCallN(PyObject *target, PyObject* args, PyObject* names) {
-	PyObject* result = nullptr, *kwArgs = nullptr;
+PyObject* PyJit_CallCached3(PyObject* target, PyObject* arg0, PyObject* arg1, PyObject* arg2, CallCache* cache) {
+    PyObject* stack[4] = { nullptr, arg0, arg1, arg2 };
+    return PyJit_CallCached(target, stack + 1, 3, cache);
+}
 
-	auto argCount = PyTuple_Size(args) - PyTuple_Size(names);
-	PyObject* posArgs;
-	posArgs = PyTuple_New(argCount);
-	if (posArgs == nullptr) {
-		goto error;
-	}
-	for (auto i = 0; i < argCount; i++) {
-		auto item = PyTuple_GET_ITEM(args, i);
-		Py_INCREF(item);
-		PyTuple_SET_ITEM(posArgs, i, item);
-	}
-	kwArgs = PyDict_New();
-	if (kwArgs == nullptr) {
-		goto error;
-	}
+PyObject* PyJit_CallCached4(PyObject* target, PyObject* arg0, PyObject* arg1, PyObject* arg2, PyObject* arg3, CallCache* cache) {
+    PyObject* stack[5] = { nullptr, arg0, arg1, arg2, arg3 };
+    return PyJit_CallCached(target, stack + 1, 4, cache);
+}
 
-	for (auto i = 0; i < PyTuple_GET_SIZE(names); i++) {
-		PyDict_SetItem(
-			kwArgs, 
-			PyTuple_GET_ITEM(names, i), 
-			PyTuple_GET_ITEM(args, i + argCount)
-		);	
-	}
+// Calls a function from PyJit_LoadMethod, with self in the spare slot
+PyObject* PyJit_MethodCallArray(PyObject* target, PyObject* self, PyObject** args, size_t argCount, PyObject* names) {
+    if (self == nullptr) {
+        return PyJit_KwCallArray(target, args, argCount, names);
+    }
 
-	result = PyObject_Call(target, posArgs, kwArgs);
-error:
-	Py_XDECREF(kwArgs);
-	Py_XDECREF(posArgs);
-	Py_DECREF(target);
-	Py_DECREF(args);
-	Py_DECREF(names);
-	return result;
+    auto posCount = argCount - (names == nullptr ? 0 : PyTuple_GET_SIZE(names));
+    args[-1] = self;
+    auto res = _PyObject_FastCallKeywords(target, args - 1, posCount + 1, names);
+
+    for (size_t i = 0; i < argCount; i++) {
+        Py_DECREF(args[i]);
+    }
+    Py_DECREF(self);
+    Py_XDECREF(names);
+    Py_DECREF(target);
+    return res;
 }
 
 PyObject* PyJit_Is(PyObject* lhs, PyObject* rhs) {
@@ -2068,6 +2548,11 @@ void PyJit_DecRef(PyObject* value) {
 	Py_XDECREF(value);
 }
 
+// Called by the inline decref once the last reference has gone away.
+void PyJit_Dealloc(PyObject* value) {
+    _Py_Dealloc(value);
+}
+
 void PyJit_FloatDivideByZero() {
     PyErr_SetString(PyExc_ZeroDivisionError, "float division by zero");
 }
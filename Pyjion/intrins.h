@@ -28,6 +28,8 @@
 
 #include <Python.h>
 #include <frameobject.h>
+#include "typeprofile.h"
+#include "inlinecache.h"
 
 #define NAME_ERROR_MSG \
     "name '%.200s' is not defined"
@@ -48,6 +50,8 @@ format_exc_unbound(PyCodeObject *co, int oparg);
 PyObject* PyJit_Add(PyObject *left, PyObject *right);
 
 PyObject* PyJit_Subscr(PyObject *left, PyObject *right);
+PyObject* PyJit_SubscrListInt(PyObject *list, PyObject *index);
+PyObject* PyJit_SubscrTupleInt(PyObject *tuple, PyObject *index);
 
 PyObject* PyJit_RichCompare(PyObject *left, PyObject *right, int op);
 
@@ -164,18 +168,28 @@ int PyJit_ImportStar(PyObject*from, PyFrameObject* f);
 PyObject* PyJit_CallArgs(PyObject* func, PyObject*callargs);
 PyObject* PyJit_CallKwArgs(PyObject* func, PyObject*callargs, PyObject*kwargs);
 
-PyObject* PyJit_KwCall1(PyObject *target, PyObject* arg0, PyObject* names);
-PyObject* PyJit_KwCall2(PyObject *target, PyObject* arg0, PyObject* arg1, PyObject* names);
-PyObject* PyJit_KwCall3(PyObject *target, PyObject* arg0, PyObject* arg1, PyObject* arg2, PyObject* names);
-PyObject* PyJit_KwCall4(PyObject *target, PyObject* arg0, PyObject* arg1, PyObject* arg2, PyObject* arg3, PyObject* names);
-PyObject* PyJit_KwCallN(PyObject *target, PyObject* args, PyObject* names);
+PyObject* PyJit_CallArrayCached(PyObject* target, PyObject** args, size_t argCount, CallCache* cache);
+PyObject* PyJit_KwCallArray(PyObject* target, PyObject** args, size_t argCount, PyObject* names);
 
 void PyJit_DebugDumpFrame(PyFrameObject* frame);
 
 void PyJit_PushFrame(PyFrameObject* frame);
 void PyJit_PopFrame(PyFrameObject* frame);
 
+void PyJit_DeoptPushBlock(PyFrameObject* frame, int type, int handler, int level);
+void PyJit_DeoptPushValue(PyObject* value, PyFrameObject* frame);
+PyObject* PyJit_Deoptimize(PyFrameObject* frame, int lasti);
+void PyJit_SuspendFrame(PyFrameObject* frame, int lasti);
+int PyJit_YieldFrom(PyObject* receiver, PyObject* value, PyObject** result);
+PyObject* PyJit_GetYieldFromIter(PyObject* iterable, int isCoroutine);
+PyObject* PyJit_GetAwaitable(PyObject* value);
+void PyJit_RecordType(PyObject* value, TypeProfile* profile, size_t opcodeIndex);
+void PyJit_RecordCallee(PyObject* function, TypeProfile* profile, size_t opcodeIndex);
+void PyJit_RecordArgType(PyObject* value, TypeProfile* profile, size_t opcodeIndex, size_t arg);
+
 void PyJit_EhTrace(PyFrameObject *f);
+PyFrameObject* PyJit_NewInlineFrame(PyObject* function);
+void PyJit_InlineTrace(PyFrameObject* frame, int lasti);
 
 int PyJit_Raise(PyObject *exc, PyObject *cause);
 
@@ -194,8 +208,6 @@ int PyJit_StoreSubscr(PyObject* value, PyObject *container, PyObject *index);
 
 int PyJit_DeleteSubscr(PyObject *container, PyObject *index);
 
-PyObject* PyJit_CallN(PyObject *target, PyObject* args);
-
 PyObject* PyJit_CallNKW(PyObject *target, PyObject* args, PyObject* kwargs);
 
 int PyJit_StoreGlobal(PyObject* v, PyFrameObject* f, PyObject* name);
@@ -203,6 +215,7 @@ int PyJit_StoreGlobal(PyObject* v, PyFrameObject* f, PyObject* name);
 int PyJit_DeleteGlobal(PyFrameObject* f, PyObject* name);
 
 PyObject* PyJit_LoadGlobal(PyFrameObject* f, PyObject* name);
+PyObject* PyJit_LoadGlobalCached(PyFrameObject* f, PyObject* name, GlobalCache* cache);
 
 PyObject* PyJit_GetIter(PyObject* iterable);
 PyObject* PyJit_GetIterOptimized(PyObject* iterable, size_t* iterstate1, size_t* iterstate2);
@@ -210,6 +223,16 @@ PyObject* PyJit_IterNextOptimized(PyObject* iter, int*error, size_t* iterstate1,
 
 PyObject* PyJit_IterNext(PyObject* iter, int*error);
 
+// The layout of CPython's range iterator (rangeobject.c), which for loops over
+// range() advance inline.  CPython only uses it when every value fits in a long.
+typedef struct {
+    PyObject_HEAD
+    long index;
+    long start;
+    long step;
+    long len;
+} rangeiterobject;
+
 void PyJit_CellSet(PyObject* value, PyObject* cell);
 
 PyObject* PyJit_BuildClass(PyFrameObject *f);
@@ -225,6 +248,16 @@ PyObject** PyJit_UnpackSequenceEx(PyObject* seq, size_t leftSize, size_t rightSi
 PyObject** PyJit_UnpackSequence(PyObject* seq, size_t size, PyObject** tempStorage);
 
 PyObject* PyJit_LoadAttr(PyObject* owner, PyObject* name);
+PyObject* PyJit_LoadAttrCached(PyObject* owner, PyObject* name, AttributeCache* cache);
+
+// Calls __enter__ on the context manager, consuming it, and stores its bound
+// __exit__ in exit.  The lookups are cached on the type.
+PyObject* PyJit_SetupWith(PyObject* mgr, AttributeCache* enterCache, AttributeCache* exitCache, PyObject** exit);
+// Calls __exit__, consuming it, with the exception being handled or Nones
+PyObject* PyJit_WithCleanupStart(PyObject* exit, PyObject* exc, PyObject* val, PyObject* tb);
+// Returns 1 if __exit__ suppressed the exception, 0 if it didn't or there
+// was no exception, and -1 on error.  Consumes both values.
+int PyJit_WithCleanupFinish(PyObject* exc, PyObject* res);
 
 const char * ObjInfo(PyObject *obj);
 
@@ -249,12 +282,25 @@ PyObject* Call2(PyObject *target, PyObject* arg0, PyObject* arg1);
 PyObject* Call3(PyObject *target, PyObject* arg0, PyObject* arg1, PyObject* arg2);
 PyObject* Call4(PyObject *target, PyObject* arg0, PyObject* arg1, PyObject* arg2, PyObject* arg3);
 
-PyObject* Call0_Generic(PyObject *target, void**addr);
+PyObject* PyJit_LoadMethod(PyObject* obj, PyObject* name, PyObject** self);
+PyObject* PyJit_MethodCall0(PyObject* target, PyObject* self);
+PyObject* PyJit_MethodCall1(PyObject* target, PyObject* self, PyObject* arg0);
+PyObject* PyJit_MethodCall2(PyObject* target, PyObject* self, PyObject* arg0, PyObject* arg1);
+PyObject* PyJit_MethodCall3(PyObject* target, PyObject* self, PyObject* arg0, PyObject* arg1, PyObject* arg2);
+PyObject* PyJit_MethodCall4(PyObject* target, PyObject* self, PyObject* arg0, PyObject* arg1, PyObject* arg2, PyObject* arg3);
+PyObject* PyJit_MethodCallArray(PyObject* target, PyObject* self, PyObject** args, size_t argCount, PyObject* names);
+
+PyObject* PyJit_CallCached0(PyObject* target, CallCache* cache);
+PyObject* PyJit_CallCached1(PyObject* target, PyObject* arg0, CallCache* cache);
+PyObject* PyJit_CallCached2(PyObject* target, PyObject* arg0, PyObject* arg1, CallCache* cache);
+PyObject* PyJit_CallCached3(PyObject* target, PyObject* arg0, PyObject* arg1, PyObject* arg2, CallCache* cache);
+PyObject* PyJit_CallCached4(PyObject* target, PyObject* arg0, PyObject* arg1, PyObject* arg2, PyObject* arg3, CallCache* cache);
 
 extern PyObject* g_emptyTuple;
 
 
 void PyJit_DecRef(PyObject* value);
+void PyJit_Dealloc(PyObject* value);
 
 void PyJit_FloatDivideByZero();
 
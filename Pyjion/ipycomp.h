@@ -26,6 +26,8 @@
 #ifndef IPYCOMP_H
 #define IPYCOMP_H
 
+#include <vector>
+
 class Local {
 public:
     int m_index;
@@ -69,6 +71,8 @@ public:
     virtual ~JittedCode() {
     }
     virtual void* get_code_addr() = 0;
+    // Gets the number of bytes of executable memory held by the code
+    virtual size_t get_code_size() = 0;
 
 };
 
@@ -177,7 +181,14 @@ public:
 
      // Loads/stores/deletes from the frame objects fast local variables
     virtual void emit_load_fast(int local) = 0;
+    // Keeps a copy of the fast local in an IL local which loads are served
+    // from, stores and deletes update both.  Must be emitted before any
+    // other access to the local.
+    virtual void emit_register_local(int local) = 0;
     virtual void emit_store_fast(int local) = 0;
+    // Stores an int which may be tagged in the fast local when it's an
+    // object, tagged values aren't objects and are dropped.
+    virtual void emit_store_fast_untagged(int local) = 0;
     virtual void emit_delete_fast(int index) = 0;
     virtual void emit_unbound_local_check() = 0;
 
@@ -188,6 +199,9 @@ public:
 
     // Loads/stores/deletes an attribute on an object
     virtual void emit_load_attr(void* name) = 0;
+    // Loads a method for a call, pushing the function and storing self into
+    // the local, or pushing the attribute and storing null.
+    virtual void emit_load_method(void* name, Local self) = 0;
     virtual void emit_store_attr(void* name) = 0;
     virtual void emit_delete_attr(void* name) = 0;
 
@@ -283,14 +297,22 @@ public:
 
     // Emits a call for the specified argument count.  If the compiler
     // can't emit a call with this number of args then it returns false,
-    // and emit_call_with_tuple is used to call with a variable sized
-    // tuple instead.
+    // and emit_call_array is used to call with the arguments in an array
+    // instead.
     virtual bool emit_call(size_t argCnt) = 0;
-    // Emits a call with the arguments to be invoked in a tuple object
-    virtual void emit_call_with_tuple() = 0;
-
-	virtual bool emit_kwcall(size_t argCnt) = 0;
-	virtual void emit_kwcall_with_tuple() = 0;
+    // Emits a call to the function on the stack with the arguments stored
+    // at indexes 1 through argCnt of an array from emit_allocate_stack_array.
+    // Index 0 is left free for the callee to pass self.
+    virtual void emit_call_array(Local args, size_t argCnt) = 0;
+    // Emits a call to a value from emit_load_method, which has the function
+    // and self (or null) on the stack below the arguments.
+    virtual bool emit_method_call(size_t argCnt) = 0;
+    // Like emit_call_array for a value from emit_load_method, names holds
+    // the keyword argument names or null.
+    virtual void emit_method_call_array(Local args, size_t argCnt, Local names) = 0;
+    // Emits a call with keyword arguments, the last len(names) values in the
+    // array are the values for the keywords.
+    virtual void emit_kwcall_array(Local args, size_t argCnt, Local names) = 0;
 
     // Emits a call which includes *args 
 	virtual void emit_call_args() = 0;
@@ -320,6 +342,10 @@ public:
     virtual void emit_getiter() = 0;
     //void emit_getiter_opt() = 0;
     virtual void emit_for_next(Label processValue, Local iterValue) = 0;
+    // Advances a range iterator inline, branching to processValue with the next
+    // value as a tagged int, or to ended with the error flag (0) when it's
+    // exhausted.  Falls through for any other kind of iterator.
+    virtual void emit_for_next_range(Label processValue, Label ended, Local iterValue) = 0;
 
     /*****************************************************
      * Operators */
@@ -348,6 +374,10 @@ public:
     virtual void emit_binary_float(int opcode) = 0;
     // Performs a binary operation for values on the stack which are boxed objects
     virtual void emit_binary_object(int opcode) = 0;
+    // Performs a subscript of a list by a boxed int
+    virtual void emit_subscr_list_int() = 0;
+    // Performs a subscript of a tuple by a boxed int
+    virtual void emit_subscr_tuple_int() = 0;
 
     virtual void emit_binary_tagged_int(int opcode) = 0;
 
@@ -376,6 +406,66 @@ public:
     // Performs a comparison of two tagged integers
     virtual void emit_compare_tagged_int(int compareType) = 0;
 
+    /*****************************************************
+     * Speculation */
+    // Checks the type of the object on the stack, leaving it on the stack, and branches to failed if it doesn't match
+    virtual void emit_type_guard(PyTypeObject* type, Label failed) = 0;
+    // Pushes a block onto the frame's block stack before transferring execution to the interpreter,
+    // or suspending a generator
+    virtual void emit_deopt_push_block(int type, int handler, int level) = 0;
+    // Transfers the object on the stack to the frame's value stack before transferring execution to
+    // the interpreter, or suspending a generator
+    virtual void emit_deopt_push_value() = 0;
+    // Resumes execution of the frame in the interpreter after the specified byte code offset, pushing the result
+    virtual void emit_deoptimize(int lasti) = 0;
+    // Records the type of the object on the stack, leaving it on the stack, in a TypeProfile
+    virtual void emit_record_type(void* profile, size_t opcodeIndex) = 0;
+    // Records the function on the stack, leaving it on the stack, as the callee of a call in a TypeProfile
+    virtual void emit_record_callee(void* profile, size_t opcodeIndex) = 0;
+    // Records the type of the argument on the stack, leaving it on the stack, for a call in a TypeProfile
+    virtual void emit_record_arg_type(void* profile, size_t opcodeIndex, size_t arg) = 0;
+    // Branches to failed if the object in value isn't exactly of the specified type, and
+    // if version is set, if the type has been modified since the code was compiled
+    virtual void emit_exact_type_guard(Local value, PyTypeObject* type, bool version, Label failed) = 0;
+    // Loads an attribute which was found in the instance dictionary (offset 0) or a slot of an
+    // object of the specified type, the object on the stack is consumed
+    virtual void emit_load_instance_attr(void* name, PyTypeObject* type, Py_ssize_t offset) = 0;
+    // Checks that the object on the stack is a function with the specified code, leaving it on the stack,
+    // and branches to failed if it isn't
+    virtual void emit_inline_guard(PyCodeObject* code, Label failed) = 0;
+
+    /*****************************************************
+     * Generators */
+    // Pushes the flag gen_send_ex passes when an exception should be raised where the generator resumes
+    virtual void emit_load_throwflag() = 0;
+    // Pushes the frame's f_lasti, which is -1 before a generator starts
+    virtual void emit_load_lasti() = 0;
+    // Pushes a value from a suspended generator's value stack, taking ownership of it
+    virtual void emit_load_frame_value(int index) = 0;
+    // Marks the frame's value and block stacks as empty once a resumed generator owns their contents
+    virtual void emit_clear_frame_stack() = 0;
+    // Records that the generator is suspended at lasti after its values were pushed onto the frame
+    virtual void emit_suspend_frame(int lasti) = 0;
+    // Sends the value on the stack to the receiver below it, consuming both.  Pushes 1 when the receiver
+    // yielded, 0 when it finished, and -1 on an error, storing the value it yielded or returned in result.
+    virtual void emit_yield_from(Local result) = 0;
+    // Gets the iterator for a yield from, taking the iterable from the stack
+    virtual void emit_get_yield_from_iter() = 0;
+    // Gets the iterator for an await, taking the awaited value from the stack
+    virtual void emit_get_awaitable() = 0;
+
+    /*****************************************************
+     * With statements */
+    // Calls __enter__ on the context manager on the stack, consuming it, and pushes the result.  The
+    // bound __exit__ is stored in exit, or exit is null if this fails.
+    virtual void emit_setup_with(Local exit) = 0;
+    // Calls __exit__ with the exception type, value, and traceback on the stack, consuming __exit__.
+    // Pushes the result of the call.
+    virtual void emit_with_cleanup_start() = 0;
+    // Takes the exception passed to __exit__ and its result from the stack, pushing 1 if the
+    // exception is suppressed, 0 if not, and -1 on an error
+    virtual void emit_with_cleanup_finish() = 0;
+
     /*****************************************************
      * Exception handling */
      // Raises an exception taking the exception, type, and cause
@@ -383,6 +473,9 @@ public:
     // Clears the current exception
     // Updates the trace back as it propagtes through a function
     virtual void emit_eh_trace() = 0;
+    // Updates the trace back for an exception raised from code inlined from a function, creating
+    // the frame the function would have run in.  The frame takes over the valid locals.
+    virtual void emit_inline_trace(Local function, std::vector<Local>& locals, int lasti) = 0;
     // Performs exception handling unwind as we go through loops
     virtual void emit_unwind_eh(Local prevExc, Local prevExcVal, Local prevTraceback) = 0;
     // Prepares to raise an exception, storing the existing exceptions
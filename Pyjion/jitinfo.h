@@ -57,6 +57,7 @@
 #include "codemodel.h"
 #include "cee.h"
 #include "ipycomp.h"
+#include "inlinecache.h"
 
 using namespace std;
 
@@ -66,13 +67,15 @@ class CorJitInfo : public ICorJitInfo, public JittedCode {
     void* m_dataAddr;
     PyCodeObject *m_code;
     UserModule* m_module;
+    InlineCaches* m_caches;
 
 public:
 
-    CorJitInfo(CExecutionEngine& executionEngine, PyCodeObject* code, UserModule* module) : m_executionEngine(executionEngine) {
+    CorJitInfo(CExecutionEngine& executionEngine, PyCodeObject* code, UserModule* module, InlineCaches* caches) : m_executionEngine(executionEngine) {
         m_codeAddr = m_dataAddr = nullptr;
         m_code = code;
         m_module = module;
+        m_caches = caches;
     }
 
     ~CorJitInfo() {
@@ -80,22 +83,34 @@ public:
             freeMem(m_codeAddr);
         }
         if (m_dataAddr != nullptr) {
-            ::GlobalFree(m_dataAddr);
+            freeMem(m_dataAddr);
         }
         delete m_module;
+        delete m_caches;
     }
 
     void* get_code_addr() {
         return m_codeAddr;
     }
 
+    size_t get_code_size() {
+        size_t size = 0;
+        if (m_codeAddr != nullptr) {
+            size += CodeHeap::size_of(m_codeAddr);
+        }
+        if (m_dataAddr != nullptr) {
+            size += CodeHeap::size_of(m_dataAddr);
+        }
+        return size;
+    }
+
     /* ICorJitInfo */
     IEEMemoryManager* getMemoryManager() {
         return &m_executionEngine;
     }
 
     void freeMem(PVOID code) {
-        HeapFree(m_executionEngine.m_codeHeap, 0, code);
+        m_executionEngine.m_codeHeap.free(code);
     }
 
     virtual void allocMem(
@@ -109,13 +124,16 @@ public:
         void **             roDataBlock     /* OUT */
         ) {
         //printf("allocMem\r\n");
-        // TODO: Alignment?
         //printf("Code size: %d\r\n", hotCodeSize);
-        auto code = HeapAlloc(m_executionEngine.m_codeHeap, 0, hotCodeSize);
+        auto code = m_executionEngine.m_codeHeap.alloc(
+            hotCodeSize,
+            hotCodeSize >= LARGE_METHOD_SIZE ? LARGE_METHOD_ALIGNMENT : CODE_ALIGNMENT
+        );
         *hotCodeBlock = m_codeAddr = code;
         if (roDataSize != 0) {
-            // TODO: This mem needs to be freed...
-            *roDataBlock = m_dataAddr = GlobalAlloc(0, roDataSize);
+            // Read-only data can hold constants loaded with aligned SSE
+            // instructions.
+            *roDataBlock = m_dataAddr = m_executionEngine.m_codeHeap.alloc(roDataSize, CODE_ALIGNMENT);
         }
     }
 
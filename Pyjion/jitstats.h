@@ -0,0 +1,188 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) Microsoft Corporation
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+* OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+*/
+
+#ifndef JITSTATS_H
+#define JITSTATS_H
+
+#include <windows.h>
+#include <string.h>
+
+// Why we were unable to produce code for a function
+enum CompileFailure {
+    CF_None,
+    // Generators and coroutines aren't compiled
+    CF_Generator,
+    // The code uses an opcode we can't compile
+    CF_UnsupportedOpcode,
+    // The code calls vars, dir, locals, or eval which need a real frame
+    CF_FrameIntrospection,
+    // A type guard is somewhere we can't resume in the interpreter from
+    CF_Deoptimize,
+    // CoreCLR failed to produce native code from our IL
+    CF_CompileMethod,
+    CF_Count
+};
+
+static const char* compile_failure_name(CompileFailure failure) {
+    switch (failure) {
+        case CF_None: return "none";
+        case CF_Generator: return "generator";
+        case CF_UnsupportedOpcode: return "unsupported_opcode";
+        case CF_FrameIntrospection: return "frame_introspection";
+        case CF_Deoptimize: return "deoptimize";
+        case CF_CompileMethod: return "compile_method";
+    }
+    return "unknown";
+}
+
+// What we decided to do with a call to a function when optimizing
+enum InlineDecision {
+    ID_Inlined,
+    // The call has called more than one function
+    ID_Polymorphic,
+    // The function takes different arguments, or has cells or free variables
+    ID_Signature,
+    // The function's byte code is over INLINE_MAX_SIZE
+    ID_TooLarge,
+    // The function isn't straight line code we can run without a frame
+    ID_UnsupportedOpcode,
+    // An operation in the function could run arbitrary code for the types
+    // it's called with, which would need the function's frame
+    ID_UnknownTypes,
+    ID_Count
+};
+
+static const char* inline_decision_name(InlineDecision decision) {
+    switch (decision) {
+        case ID_Inlined: return "inlined";
+        case ID_Polymorphic: return "polymorphic";
+        case ID_Signature: return "signature";
+        case ID_TooLarge: return "too_large";
+        case ID_UnsupportedOpcode: return "unsupported_opcode";
+        case ID_UnknownTypes: return "unknown_types";
+    }
+    return "unknown";
+}
+
+// Information about a single compilation.  Times are in performance counter
+// ticks, only the start and end of each phase are sampled so this is cheap
+// enough to always collect.
+struct CompileStats {
+    CompileFailure Failure;
+    // The opcode we couldn't compile, or -1
+    int FailureOpcode;
+    LONGLONG InterpretTime, ILGenTime, NativeTime;
+    size_t ILSize, NativeSize;
+    // Number of calls for which we made each inlining decision
+    size_t Inlining[ID_Count];
+
+    CompileStats() {
+        Failure = CF_None;
+        FailureOpcode = -1;
+        InterpretTime = ILGenTime = NativeTime = 0;
+        ILSize = NativeSize = 0;
+        memset(Inlining, 0, sizeof(Inlining));
+    }
+
+    void fail(CompileFailure failure, int opcode = -1) {
+        Failure = failure;
+        FailureOpcode = opcode;
+    }
+
+    // Combines the information the abstract interpreter and the compiler
+    // each recorded about the same compilation.
+    void add(const CompileStats& other) {
+        if (other.Failure != CF_None) {
+            Failure = other.Failure;
+            FailureOpcode = other.FailureOpcode;
+        }
+        InterpretTime += other.InterpretTime;
+        ILGenTime += other.ILGenTime;
+        NativeTime += other.NativeTime;
+        ILSize += other.ILSize;
+        NativeSize += other.NativeSize;
+        for (int i = 0; i < ID_Count; i++) {
+            Inlining[i] += other.Inlining[i];
+        }
+    }
+};
+
+// Totals over all of the compilations for a function, or for the process.
+struct JitStats {
+    size_t Compiles, BaselineCompiles, CachedCompiles;
+    size_t Failures[CF_Count];
+    LONGLONG InterpretTime, ILGenTime, NativeTime;
+    size_t ILSize, NativeSize;
+    size_t Inlining[ID_Count];
+
+    JitStats() {
+        Compiles = BaselineCompiles = CachedCompiles = 0;
+        memset(Failures, 0, sizeof(Failures));
+        InterpretTime = ILGenTime = NativeTime = 0;
+        ILSize = NativeSize = 0;
+        memset(Inlining, 0, sizeof(Inlining));
+    }
+
+    void record(const CompileStats& stats) {
+        Compiles++;
+        Failures[stats.Failure]++;
+        InterpretTime += stats.InterpretTime;
+        ILGenTime += stats.ILGenTime;
+        NativeTime += stats.NativeTime;
+        ILSize += stats.ILSize;
+        NativeSize += stats.NativeSize;
+        for (int i = 0; i < ID_Count; i++) {
+            Inlining[i] += stats.Inlining[i];
+        }
+    }
+};
+
+// Adds the time from construction until stop() or destruction to a counter
+class StatsTimer {
+    LONGLONG& m_counter;
+    LARGE_INTEGER m_start;
+    bool m_running;
+
+public:
+    StatsTimer(LONGLONG& counter) : m_counter(counter) {
+        QueryPerformanceCounter(&m_start);
+        m_running = true;
+    }
+
+    ~StatsTimer() {
+        stop();
+    }
+
+    void stop() {
+        if (m_running) {
+            LARGE_INTEGER end;
+            QueryPerformanceCounter(&end);
+            m_counter += end.QuadPart - m_start.QuadPart;
+            m_running = false;
+        }
+    }
+};
+
+#endif
@@ -24,6 +24,7 @@
 */
 
 #include "pycomp.h"
+#include "taggedptr.h"
 #include <corjit.h>
 #include <openum.h>
 
@@ -33,6 +34,9 @@ HRESULT __stdcall GetCORSystemDirectoryInternal(SString& pbuffer) {
 }
 
 CExecutionEngine g_execEngine;
+// The JIT's per thread state and our execution engine aren't safe to use from
+// more than one thread at a time, and the GIL is released while compiling.
+static SRWLOCK g_jitLock = SRWLOCK_INIT;
 
 extern "C" __declspec(dllexport) BOOL WINAPI DllMain(
     _In_ HINSTANCE hinstDLL,
@@ -107,10 +111,13 @@ InitHolder g_initHolder;
 Module g_module;
 ICorJitCompiler* g_jit;
 
-PythonCompiler::PythonCompiler(PyCodeObject *code) :
+PythonCompiler::PythonCompiler(PyCodeObject *code, bool releaseGil, bool minOpts) :
     m_il(m_module = new UserModule(g_module),
         CORINFO_TYPE_NATIVEINT, std::vector < Parameter > {Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT) }) {
     this->m_code = code;
+    m_releaseGil = releaseGil;
+    m_minOpts = minOpts;
+    m_caches = new InlineCaches();
     m_lasti = m_il.define_local(Parameter(CORINFO_TYPE_NATIVEINT));
 }
 
@@ -133,6 +140,45 @@ void PythonCompiler::emit_eh_trace() {
     m_il.emit_call(METHOD_EH_TRACE);
 }
 
+void PythonCompiler::emit_inline_trace(Local function, vector<Local>& locals, int lasti) {
+    auto frame = m_il.define_local(Parameter(CORINFO_TYPE_NATIVEINT));
+    auto noFrame = m_il.define_label();
+    auto done = m_il.define_label();
+
+    m_il.ld_loc(function);
+    m_il.emit_call(METHOD_NEW_INLINE_FRAME);
+    m_il.st_loc(frame);
+    m_il.ld_loc(frame);
+    m_il.branch(BranchFalse, noFrame);
+
+    // The frame owns the locals from here on
+    for (size_t i = 0; i < locals.size(); i++) {
+        if (locals[i].is_valid()) {
+            m_il.ld_loc(frame);
+            m_il.ld_i(offsetof(PyFrameObject, f_localsplus) + i * sizeof(size_t));
+            m_il.add();
+            m_il.ld_loc(locals[i]);
+            m_il.st_ind_i();
+        }
+    }
+    m_il.ld_loc(frame);
+    m_il.ld_i4(lasti);
+    m_il.emit_call(METHOD_INLINE_TRACE);
+    m_il.branch(BranchAlways, done);
+
+    // We couldn't create the frame, so there's no traceback entry
+    m_il.mark_label(noFrame);
+    for (auto local : locals) {
+        if (local.is_valid()) {
+            m_il.ld_loc(local);
+            decref();
+        }
+    }
+
+    m_il.mark_label(done);
+    m_il.free_local(frame);
+}
+
 void PythonCompiler::emit_lasti_init() {
     load_frame();
     m_il.ld_i(offsetof(PyFrameObject, f_lasti));
@@ -147,6 +193,12 @@ void PythonCompiler::emit_lasti_update(int index) {
 }
 
 void PythonCompiler::load_local(int oparg) {
+    auto reg = m_registerLocals.find(oparg);
+    if (reg != m_registerLocals.end()) {
+        m_il.ld_loc(reg->second);
+        return;
+    }
+
     load_frame();
     m_il.ld_i(offsetof(PyFrameObject, f_localsplus) + oparg * sizeof(size_t));
     m_il.add();
@@ -183,17 +235,43 @@ void PythonCompiler::emit_incref(bool maybeTagged) {
 }
 
 void PythonCompiler::decref() {
-    m_il.emit_call(METHOD_DECREF_TOKEN);
-    // It might be nice to inline this at some point:
-    //LD_FIELDA(PyObject, ob_refcnt);
-    //m_il.push_back(CEE_DUP);
-    //m_il.push_back(CEE_LDIND_I4);
-    //m_il.push_back(CEE_LDC_I4_1);
-    //m_il.push_back(CEE_SUB);
-    ////m_il.push_back(CEE_DUP);
-    //// _Py_Dealloc(_py_decref_tmp)
+    if (m_minOpts) {
+        // Keep the baseline code small
+        m_il.emit_call(METHOD_DECREF_TOKEN);
+        return;
+    }
+
+    // Py_XDECREF inline, only calling out when the object needs to be freed.
+    // Tagged ints aren't objects and have no reference count.
+    auto value = m_il.define_local(Parameter(CORINFO_TYPE_NATIVEINT));
+    auto done = m_il.define_label();
+    m_il.st_loc(value);
+
+    m_il.ld_loc(value);
+    m_il.branch(BranchFalse, done);
+
+    m_il.ld_loc(value);
+    m_il.ld_i(1);
+    m_il.bitwise_and();
+    m_il.branch(BranchTrue, done);
 
-    //m_il.push_back(CEE_STIND_I4);
+    m_il.ld_loc(value);
+    LD_FIELDA(PyObject, ob_refcnt);
+    m_il.dup();
+    m_il.ld_ind_i();
+    m_il.ld_i4(1);
+    m_il.sub();
+    m_il.st_ind_i();
+
+    m_il.ld_loc(value);
+    LD_FIELD(PyObject, ob_refcnt);
+    m_il.branch(BranchTrue, done);
+
+    m_il.ld_loc(value);
+    m_il.emit_call(METHOD_DEALLOC_TOKEN);
+
+    m_il.mark_label(done);
+    m_il.free_local(value);
 }
 
 
@@ -221,6 +299,13 @@ void PythonCompiler::emit_load_fast(int local) {
     load_local(local);
 }
 
+void PythonCompiler::emit_register_local(int local) {
+    load_local(local);
+    auto reg = m_il.define_local_no_cache(Parameter(CORINFO_TYPE_NATIVEINT));
+    m_il.st_loc(reg);
+    m_registerLocals[local] = reg;
+}
+
 CorInfoType PythonCompiler::to_clr_type(LocalKind kind) {
     switch (kind) {
         case LK_Float: return CORINFO_TYPE_DOUBLE;
@@ -232,8 +317,6 @@ CorInfoType PythonCompiler::to_clr_type(LocalKind kind) {
 
 
 void PythonCompiler::emit_store_fast(int local) {
-    // TODO: Move locals out of the Python frame object and into real locals
-
     auto valueTmp = m_il.define_local(Parameter(CORINFO_TYPE_NATIVEINT));
     m_il.st_loc(valueTmp);
 
@@ -250,12 +333,37 @@ void PythonCompiler::emit_store_fast(int local) {
 
     m_il.st_ind_i();
 
+    // The frame stays up to date so tracebacks, deoptimization, and anyone
+    // inspecting the frame see the value.
+    auto reg = m_registerLocals.find(local);
+    if (reg != m_registerLocals.end()) {
+        m_il.ld_loc(valueTmp);
+        m_il.st_loc(reg->second);
+    }
+
     m_il.free_local(valueTmp);
 
     // now dec ref the old value potentially freeing it.
     decref();
 }
 
+void PythonCompiler::emit_store_fast_untagged(int local) {
+    auto tagged = m_il.define_label();
+    auto done = m_il.define_label();
+    m_il.dup();
+    m_il.ld_i(1);
+    m_il.bitwise_and();
+    m_il.branch(BranchTrue, tagged);
+
+    emit_store_fast(local);
+    m_il.branch(BranchAlways, done);
+
+    m_il.mark_label(tagged);
+    m_il.pop();
+
+    m_il.mark_label(done);
+}
+
 void PythonCompiler::emit_rot_two(LocalKind kind) {
     auto top = m_il.define_local(Parameter(to_clr_type(kind)));
     auto second = m_il.define_local(Parameter(to_clr_type(kind)));
@@ -460,7 +568,8 @@ void PythonCompiler::emit_delete_attr(void* name) {
 
 void PythonCompiler::emit_load_attr(void* name) {
     m_il.ld_i(name);
-    m_il.emit_call(METHOD_LOADATTR_TOKEN);
+    m_il.ld_i(m_caches->new_attribute_cache());
+    m_il.emit_call(METHOD_LOADATTR_CACHED_TOKEN);
 }
 
 void PythonCompiler::emit_store_global(void* name) {
@@ -477,9 +586,44 @@ void PythonCompiler::emit_delete_global(void* name) {
 }
 
 void PythonCompiler::emit_load_global(void* name) {
+    auto cache = m_caches->new_global_cache();
+    auto miss = m_il.define_label();
+    auto done = m_il.define_label();
+
+    // The cached value is good as long as neither globals nor builtins have
+    // changed since it was looked up.
+    load_frame();
+    LD_FIELD(PyFrameObject, f_globals);
+    m_il.ld_i(offsetof(PyDictObject, ma_version_tag));
+    m_il.add();
+    m_il.ld_ind_i8();
+    m_il.ld_i(&cache->GlobalsVersion);
+    m_il.ld_ind_i8();
+    m_il.branch(BranchNotEqual, miss);
+
+    load_frame();
+    LD_FIELD(PyFrameObject, f_builtins);
+    m_il.ld_i(offsetof(PyDictObject, ma_version_tag));
+    m_il.add();
+    m_il.ld_ind_i8();
+    m_il.ld_i(&cache->BuiltinsVersion);
+    m_il.ld_ind_i8();
+    m_il.branch(BranchNotEqual, miss);
+
+    m_il.ld_i(&cache->Value);
+    m_il.ld_ind_i();
+    m_il.dup();
+    emit_incref(false);
+    m_il.branch(BranchAlways, done);
+
+    // Look the name up and refill the cache
+    m_il.mark_label(miss);
     load_frame();
     m_il.ld_i(name);
-    m_il.emit_call(METHOD_LOADGLOBAL_TOKEN);
+    m_il.ld_i(cache);
+    m_il.emit_call(METHOD_LOADGLOBAL_CACHED_TOKEN);
+
+    m_il.mark_label(done);
 }
 
 void PythonCompiler::emit_delete_fast(int index) {
@@ -489,12 +633,18 @@ void PythonCompiler::emit_delete_fast(int index) {
     m_il.add();
     m_il.load_null();
     m_il.st_ind_i();
+    auto reg = m_registerLocals.find(index);
+    if (reg != m_registerLocals.end()) {
+        m_il.load_null();
+        m_il.st_loc(reg->second);
+    }
     decref();
 }
 
 void PythonCompiler::emit_new_tuple(size_t size) {
     if (size == 0) {
-        m_il.ld_i(PyTuple_New(0));
+        // The empty tuple is a singleton which JitInit keeps alive
+        m_il.ld_i(g_emptyTuple);
         m_il.dup();
         emit_incref(false);
     }
@@ -674,33 +824,67 @@ void PythonCompiler::emit_call_kwargs() {
 }
 
 bool PythonCompiler::emit_call(size_t argCnt) {
+    int token;
     switch (argCnt) {
-        case 0: call_optimizing_function(METHOD_CALL0_OPT_TOKEN); return true;
-        case 1: m_il.emit_call(METHOD_CALL1_TOKEN); return true;
-        case 2: m_il.emit_call(METHOD_CALL2_TOKEN); return true;
-        case 3: m_il.emit_call(METHOD_CALL3_TOKEN); return true;
-        case 4: m_il.emit_call(METHOD_CALL4_TOKEN); return true;
+        case 0: token = METHOD_CALL0_TOKEN; break;
+        case 1: token = METHOD_CALL1_TOKEN; break;
+        case 2: token = METHOD_CALL2_TOKEN; break;
+        case 3: token = METHOD_CALL3_TOKEN; break;
+        case 4: token = METHOD_CALL4_TOKEN; break;
+        default: return false;
     }
-    return false;
+    m_il.ld_i(m_caches->new_call_cache());
+    m_il.emit_call(token);
+    return true;
 }
 
-void PythonCompiler::emit_call_with_tuple() {
-    m_il.emit_call(METHOD_CALLN_TOKEN);
+void PythonCompiler::emit_call_array(Local args, size_t argCnt) {
+    m_il.ld_loc(args);
+    m_il.ld_i(sizeof(size_t));
+    m_il.add();
+    m_il.ld_i(argCnt);
+    m_il.ld_i(m_caches->new_call_cache());
+    m_il.emit_call(METHOD_CALLARRAY_TOKEN);
 }
 
-bool PythonCompiler::emit_kwcall(size_t argCnt) {
-	/*
-	switch (argCnt) {
-		case 1: m_il.emit_call(METHOD_KWCALL1_TOKEN); return true;
-		case 2: m_il.emit_call(METHOD_KWCALL2_TOKEN); return true;
-		case 3: m_il.emit_call(METHOD_KWCALL3_TOKEN); return true;
-		case 4: m_il.emit_call(METHOD_KWCALL4_TOKEN); return true;
-	}*/
-	return false;
+void PythonCompiler::emit_load_method(void* name, Local self) {
+    m_il.ld_i(name);
+    m_il.ld_loca(self);
+    m_il.emit_call(METHOD_LOADMETHOD_TOKEN);
 }
 
-void PythonCompiler::emit_kwcall_with_tuple() {
-	m_il.emit_call(METHOD_KWCALLN_TOKEN);
+bool PythonCompiler::emit_method_call(size_t argCnt) {
+    switch (argCnt) {
+        case 0: m_il.emit_call(METHOD_METHODCALL0_TOKEN); return true;
+        case 1: m_il.emit_call(METHOD_METHODCALL1_TOKEN); return true;
+        case 2: m_il.emit_call(METHOD_METHODCALL2_TOKEN); return true;
+        case 3: m_il.emit_call(METHOD_METHODCALL3_TOKEN); return true;
+        case 4: m_il.emit_call(METHOD_METHODCALL4_TOKEN); return true;
+    }
+    return false;
+}
+
+void PythonCompiler::emit_method_call_array(Local args, size_t argCnt, Local names) {
+    m_il.ld_loc(args);
+    m_il.ld_i(sizeof(size_t));
+    m_il.add();
+    m_il.ld_i(argCnt);
+    if (names.is_valid()) {
+        m_il.ld_loc(names);
+    }
+    else {
+        m_il.load_null();
+    }
+    m_il.emit_call(METHOD_METHODCALLARRAY_TOKEN);
+}
+
+void PythonCompiler::emit_kwcall_array(Local args, size_t argCnt, Local names) {
+    m_il.ld_loc(args);
+    m_il.ld_i(sizeof(size_t));
+    m_il.add();
+    m_il.ld_i(argCnt);
+    m_il.ld_loc(names);
+    m_il.emit_call(METHOD_KWCALLARRAY_TOKEN);
 }
 
 void PythonCompiler::call_optimizing_function(int baseFunction) {
@@ -708,6 +892,7 @@ void PythonCompiler::call_optimizing_function(int baseFunction) {
     m_il.ld_i(&id->m_addr);
     auto token = (int)(FIRST_USER_FUNCTION_TOKEN + m_module->m_methods.size());
     m_module->m_methods[token] = id;
+    m_userMethods.push_back(baseFunction);
     m_il.emit_call(token);
 }
 
@@ -1005,6 +1190,86 @@ void PythonCompiler::emit_for_next(Label processValue, Local iterValue) {
     m_il.free_local(error);
 }
 
+void PythonCompiler::emit_for_next_range(Label processValue, Label ended, Local iterValue) {
+    // The iterator is advanced in place rather than replaced by a counter so
+    // that break, deoptimization and suspended generators still see it.
+    static_assert(sizeof(long) == sizeof(int32_t), "range iterator fields are read as int32");
+    auto notRange = m_il.define_label();
+    auto exhausted = m_il.define_label();
+
+    m_il.ld_loc(iterValue);
+    LD_FIELD(PyObject, ob_type);
+    m_il.ld_i(&PyRangeIter_Type);
+    m_il.branch(BranchNotEqual, notRange);
+
+    // index < len
+    m_il.ld_loc(iterValue);
+    LD_FIELDA(rangeiterobject, index);
+    m_il.ld_ind_i4();
+    m_il.ld_loc(iterValue);
+    LD_FIELDA(rangeiterobject, len);
+    m_il.ld_ind_i4();
+    m_il.compare_lt();
+    m_il.branch(BranchFalse, exhausted);
+
+    // start + index * step, like rangeiter_next this wraps around in 32 bits
+    // but the result always fits in a long.
+    m_il.ld_loc(iterValue);
+    LD_FIELDA(rangeiterobject, start);
+    m_il.ld_ind_i4();
+    m_il.ld_loc(iterValue);
+    LD_FIELDA(rangeiterobject, index);
+    m_il.ld_ind_i4();
+    m_il.ld_loc(iterValue);
+    LD_FIELDA(rangeiterobject, step);
+    m_il.ld_ind_i4();
+    m_il.mul();
+    m_il.add();
+    m_il.conv_i();
+#ifdef _TARGET_AMD64_
+    static_assert(sizeof(tagged_ptr) > sizeof(long), "a long always fits in a tagged pointer");
+#else
+    // A tagged pointer is no wider than a long, values which don't fit are
+    // left to the iterator to produce as objects.  (value << 1) overflows
+    // when the sign changes.
+    auto value = m_il.define_local(Parameter(CORINFO_TYPE_NATIVEINT));
+    m_il.st_loc(value);
+    m_il.ld_loc(value);
+    m_il.dup();
+    m_il.add();
+    m_il.ld_loc(value);
+    m_il.bitwise_xor();
+    m_il.ld_i(0);
+    m_il.compare_lt();
+    m_il.branch(BranchTrue, notRange);
+    m_il.ld_loc(value);
+    m_il.free_local(value);
+#endif
+    // (value << 1) | 1
+    m_il.dup();
+    m_il.add();
+    m_il.ld_i(1);
+    m_il.add();
+
+    // index++
+    m_il.ld_loc(iterValue);
+    LD_FIELDA(rangeiterobject, index);
+    m_il.dup();
+    m_il.ld_ind_i4();
+    m_il.ld_i4(1);
+    m_il.add();
+    m_il.st_ind_i4();
+    m_il.branch(BranchAlways, processValue);
+
+    m_il.mark_label(exhausted);
+    m_il.ld_loc(iterValue);
+    decref();
+    m_il.ld_i4(0);
+    m_il.branch(BranchAlways, ended);
+
+    m_il.mark_label(notRange);
+}
+
 /*
 void PythonCompiler::emit_getiter_opt() {
     m_il.ld_loca(loopOpt1);
@@ -1050,7 +1315,7 @@ void PythonCompiler::emit_binary_float(int opcode) {
 void PythonCompiler::emit_binary_tagged_int(int opcode) {
     switch (opcode) {
         case INPLACE_ADD:
-        case BINARY_ADD: m_il.emit_call(METHOD_ADD_INT_TOKEN); break;
+        case BINARY_ADD: emit_binary_tagged_int_inline(opcode, METHOD_ADD_INT_TOKEN); break;
         case INPLACE_TRUE_DIVIDE:
         case BINARY_TRUE_DIVIDE: m_il.emit_call(METHOD_DIVIDE_INT_TOKEN); break;
         case INPLACE_FLOOR_DIVIDE:
@@ -1064,16 +1329,137 @@ void PythonCompiler::emit_binary_tagged_int(int opcode) {
         case INPLACE_RSHIFT:
         case BINARY_RSHIFT: m_il.emit_call(METHOD_BINARY_RSHIFT_INT_TOKEN); break;
         case INPLACE_AND:
-        case BINARY_AND: m_il.emit_call(METHOD_BINARY_AND_INT_TOKEN); break;
+        case BINARY_AND: emit_binary_tagged_int_inline(opcode, METHOD_BINARY_AND_INT_TOKEN); break;
         case INPLACE_XOR:
-        case BINARY_XOR: m_il.emit_call(METHOD_BINARY_XOR_INT_TOKEN); break;
+        case BINARY_XOR: emit_binary_tagged_int_inline(opcode, METHOD_BINARY_XOR_INT_TOKEN); break;
         case INPLACE_OR:
-        case BINARY_OR: m_il.emit_call(METHOD_BINARY_OR_INT_TOKEN); break;
+        case BINARY_OR: emit_binary_tagged_int_inline(opcode, METHOD_BINARY_OR_INT_TOKEN); break;
         case INPLACE_MULTIPLY:
-        case BINARY_MULTIPLY: m_il.emit_call(METHOD_MULTIPLY_INT_TOKEN); break;
+        case BINARY_MULTIPLY: emit_binary_tagged_int_inline(opcode, METHOD_MULTIPLY_INT_TOKEN); break;
         case INPLACE_SUBTRACT:
-        case BINARY_SUBTRACT: m_il.emit_call(METHOD_SUBTRACT_INT_TOKEN); break;
+        case BINARY_SUBTRACT: emit_binary_tagged_int_inline(opcode, METHOD_SUBTRACT_INT_TOKEN); break;
+    }
+}
+
+void PythonCompiler::emit_binary_tagged_int_inline(int opcode, int slowToken) {
+    // When both values are tagged we do the arithmetic in IL, and only call
+    // the helper, which promotes the result to a long object, when one of
+    // them is already an object or the result doesn't fit in a tagged pointer.
+    auto right = m_il.define_local(Parameter(CORINFO_TYPE_NATIVEINT));
+    auto left = m_il.define_local(Parameter(CORINFO_TYPE_NATIVEINT));
+    auto slowPath = m_il.define_label();
+    auto done = m_il.define_label();
+    m_il.st_loc(right);
+    m_il.st_loc(left);
+
+    m_il.ld_loc(left);
+    m_il.ld_loc(right);
+    m_il.bitwise_and();
+    m_il.ld_i(1);
+    m_il.bitwise_and();
+    m_il.branch(BranchFalse, slowPath);
+
+    switch (opcode) {
+        case INPLACE_AND:
+        case BINARY_AND:
+            // The tag bits survive and, or and xor, so these can't overflow
+            m_il.ld_loc(left);
+            m_il.ld_loc(right);
+            m_il.bitwise_and();
+            break;
+        case INPLACE_OR:
+        case BINARY_OR:
+            m_il.ld_loc(left);
+            m_il.ld_loc(right);
+            m_il.bitwise_or();
+            break;
+        case INPLACE_XOR:
+        case BINARY_XOR:
+            m_il.ld_loc(left);
+            m_il.ld_loc(right);
+            m_il.bitwise_xor();
+            m_il.ld_i(1);
+            m_il.bitwise_or();
+            break;
+        default:
+        {
+            // Untag the values, neither add nor subtract can overflow a machine
+            // word from there.  Multiplying is limited to values which fit in
+            // half a word.
+            auto value = m_il.define_local(Parameter(CORINFO_TYPE_NATIVEINT));
+            auto tagged = m_il.define_local(Parameter(CORINFO_TYPE_NATIVEINT));
+            m_il.ld_loc(left);
+            m_il.ld_i4(1);
+            m_il.shift_right();
+            m_il.ld_loc(right);
+            m_il.ld_i4(1);
+            m_il.shift_right();
+            switch (opcode) {
+                case INPLACE_ADD:
+                case BINARY_ADD: m_il.add(); break;
+                case INPLACE_SUBTRACT:
+                case BINARY_SUBTRACT: m_il.sub(); break;
+                case INPLACE_MULTIPLY:
+                case BINARY_MULTIPLY:
+                {
+                    auto x = m_il.define_local(Parameter(CORINFO_TYPE_NATIVEINT));
+                    auto y = m_il.define_local(Parameter(CORINFO_TYPE_NATIVEINT));
+                    m_il.st_loc(y);
+                    m_il.st_loc(x);
+                    emit_branch_not_half_word(x, slowPath);
+                    emit_branch_not_half_word(y, slowPath);
+                    m_il.ld_loc(x);
+                    m_il.ld_loc(y);
+                    m_il.mul();
+                    m_il.free_local(x);
+                    m_il.free_local(y);
+                    break;
+                }
+            }
+            m_il.st_loc(value);
+
+            // Tag the result, (value << 1) overflows when the sign changes
+            m_il.ld_loc(value);
+            m_il.dup();
+            m_il.add();
+            m_il.st_loc(tagged);
+            m_il.ld_loc(value);
+            m_il.ld_loc(tagged);
+            m_il.bitwise_xor();
+            m_il.ld_i(0);
+            m_il.compare_lt();
+            m_il.branch(BranchTrue, slowPath);
+
+            m_il.ld_loc(tagged);
+            m_il.ld_i(1);
+            m_il.add();
+            m_il.free_local(value);
+            m_il.free_local(tagged);
+            break;
+        }
     }
+    m_il.branch(BranchAlways, done);
+
+    m_il.mark_label(slowPath);
+    m_il.ld_loc(left);
+    m_il.ld_loc(right);
+    m_il.emit_call(slowToken);
+
+    m_il.mark_label(done);
+    m_il.free_local(left);
+    m_il.free_local(right);
+}
+
+void PythonCompiler::emit_branch_not_half_word(Local value, Label label) {
+    m_il.ld_loc(value);
+#ifdef _TARGET_AMD64_
+    m_il.conv_i4();
+#else
+    m_il.conv_i2();
+#endif
+    m_il.conv_i();
+    m_il.ld_loc(value);
+    m_il.branch(BranchNotEqual, label);
 }
 
 void PythonCompiler::emit_binary_object(int opcode) {
@@ -1111,6 +1497,14 @@ void PythonCompiler::emit_binary_object(int opcode) {
     }
 }
 
+void PythonCompiler::emit_subscr_list_int() {
+    m_il.emit_call(METHOD_SUBSCR_LIST_INT);
+}
+
+void PythonCompiler::emit_subscr_tuple_int() {
+    m_il.emit_call(METHOD_SUBSCR_TUPLE_INT);
+}
+
 void PythonCompiler::emit_is_push_int(bool isNot) {
     m_il.emit_call(isNot ? METHOD_ISNOT_BOOL : METHOD_IS_BOOL);
 }
@@ -1149,14 +1543,49 @@ void PythonCompiler::emit_compare_float(int compareType) {
 }
 
 void PythonCompiler::emit_compare_tagged_int(int compareType) {
+    // Tagging preserves the order of the values, so when both are tagged we
+    // can compare them directly.
+    auto right = m_il.define_local(Parameter(CORINFO_TYPE_NATIVEINT));
+    auto left = m_il.define_local(Parameter(CORINFO_TYPE_NATIVEINT));
+    auto slowPath = m_il.define_label();
+    auto done = m_il.define_label();
+    m_il.st_loc(right);
+    m_il.st_loc(left);
+
+    m_il.ld_loc(left);
+    m_il.ld_loc(right);
+    m_il.bitwise_and();
+    m_il.ld_i(1);
+    m_il.bitwise_and();
+    m_il.branch(BranchFalse, slowPath);
+
+    m_il.ld_loc(left);
+    m_il.ld_loc(right);
     switch (compareType) {
-        case Py_EQ:  m_il.emit_call(METHOD_EQUALS_INT_TOKEN); break;
+        case Py_EQ: m_il.compare_eq(); break;
+        case Py_LT: m_il.compare_lt(); break;
+        case Py_LE: m_il.compare_le(); break;
+        case Py_NE: m_il.compare_ne(); break;
+        case Py_GT: m_il.compare_gt(); break;
+        case Py_GE: m_il.compare_ge(); break;
+    }
+    m_il.branch(BranchAlways, done);
+
+    m_il.mark_label(slowPath);
+    m_il.ld_loc(left);
+    m_il.ld_loc(right);
+    switch (compareType) {
+        case Py_EQ: m_il.emit_call(METHOD_EQUALS_INT_TOKEN); break;
         case Py_LT: m_il.emit_call(METHOD_LESS_THAN_INT_TOKEN); break;
         case Py_LE: m_il.emit_call(METHOD_LESS_THAN_EQUALS_INT_TOKEN); break;
         case Py_NE: m_il.emit_call(METHOD_NOT_EQUALS_INT_TOKEN); break;
         case Py_GT: m_il.emit_call(METHOD_GREATER_THAN_INT_TOKEN); break;
         case Py_GE: m_il.emit_call(METHOD_GREATER_THAN_EQUALS_INT_TOKEN); break;
     }
+
+    m_il.mark_label(done);
+    m_il.free_local(left);
+    m_il.free_local(right);
 }
 
 void PythonCompiler::emit_compare_object(int compareType) {
@@ -1183,10 +1612,199 @@ void PythonCompiler::emit_periodic_work() {
     m_il.emit_call(METHOD_PERIODIC_WORK);
 }
 
+void PythonCompiler::emit_type_guard(PyTypeObject* type, Label failed) {
+    m_il.dup();
+    LD_FIELD(PyObject, ob_type);
+    m_il.ld_i(type);
+    m_il.branch(BranchNotEqual, failed);
+}
+
+void PythonCompiler::emit_deopt_push_block(int type, int handler, int level) {
+    load_frame();
+    m_il.ld_i4(type);
+    m_il.ld_i4(handler);
+    m_il.ld_i4(level);
+    m_il.emit_call(METHOD_DEOPT_PUSH_BLOCK);
+}
+
+void PythonCompiler::emit_deopt_push_value() {
+    load_frame();
+    m_il.emit_call(METHOD_DEOPT_PUSH_VALUE);
+}
+
+void PythonCompiler::emit_deoptimize(int lasti) {
+    load_frame();
+    m_il.ld_i4(lasti);
+    m_il.emit_call(METHOD_DEOPTIMIZE);
+}
+
+void PythonCompiler::emit_record_type(void* profile, size_t opcodeIndex) {
+    m_il.dup();
+    m_il.ld_i(profile);
+    m_il.ld_i(opcodeIndex);
+    m_il.emit_call(METHOD_RECORD_TYPE);
+}
+
+void PythonCompiler::emit_record_callee(void* profile, size_t opcodeIndex) {
+    m_il.dup();
+    m_il.ld_i(profile);
+    m_il.ld_i(opcodeIndex);
+    m_il.emit_call(METHOD_RECORD_CALLEE);
+}
+
+void PythonCompiler::emit_record_arg_type(void* profile, size_t opcodeIndex, size_t arg) {
+    m_il.dup();
+    m_il.ld_i(profile);
+    m_il.ld_i(opcodeIndex);
+    m_il.ld_i(arg);
+    m_il.emit_call(METHOD_RECORD_ARG_TYPE);
+}
+
+void PythonCompiler::emit_exact_type_guard(Local value, PyTypeObject* type, bool version, Label failed) {
+    // The type is referenced by our code
+    m_caches->keep_alive((PyObject*)type);
+
+    m_il.ld_loc(value);
+    LD_FIELD(PyObject, ob_type);
+    m_il.ld_i(type);
+    m_il.branch(BranchNotEqual, failed);
+    if (version) {
+        // Modifying the type clears the flag, and it gets a new tag the next
+        // time it's looked up.
+        m_il.ld_i(type);
+        LD_FIELDA(PyTypeObject, tp_flags);
+        m_il.ld_ind_i4();
+        m_il.ld_i4(Py_TPFLAGS_VALID_VERSION_TAG);
+        m_il.bitwise_and();
+        m_il.branch(BranchFalse, failed);
+        m_il.ld_i(type);
+        LD_FIELDA(PyTypeObject, tp_version_tag);
+        m_il.ld_ind_i4();
+        m_il.ld_i4((int)type->tp_version_tag);
+        m_il.branch(BranchNotEqual, failed);
+    }
+}
+
+void PythonCompiler::emit_load_instance_attr(void* name, PyTypeObject* type, Py_ssize_t offset) {
+    // Start the site's cache off with what the inliner found, the lookup
+    // still checks the type and its version tag.
+    auto cache = m_caches->new_attribute_cache();
+    cache->Type = type;
+    cache->VersionTag = type->tp_version_tag;
+    cache->Kind = offset == 0 ? ACK_InstanceDict : ACK_Slot;
+    cache->Offset = offset;
+
+    m_il.ld_i(name);
+    m_il.ld_i(cache);
+    m_il.emit_call(METHOD_LOADATTR_CACHED_TOKEN);
+}
+
+void PythonCompiler::emit_inline_guard(PyCodeObject* code, Label failed) {
+    // The code we inline from, and its constants and names, need to outlive
+    // our code.
+    m_caches->keep_alive((PyObject*)code);
+
+    m_il.dup();
+    LD_FIELD(PyObject, ob_type);
+    m_il.ld_i(&PyFunction_Type);
+    m_il.branch(BranchNotEqual, failed);
+    m_il.dup();
+    LD_FIELD(PyFunctionObject, func_code);
+    m_il.ld_i(code);
+    m_il.branch(BranchNotEqual, failed);
+}
+
+void PythonCompiler::emit_load_throwflag() {
+    // Generator code is called with the throw flag in place of the unused
+    // first argument.
+    m_il.ld_arg(0);
+}
+
+void PythonCompiler::emit_load_lasti() {
+    m_il.ld_loc(m_lasti);
+    m_il.ld_ind_i4();
+}
+
+void PythonCompiler::emit_load_frame_value(int index) {
+    load_frame();
+    LD_FIELD(PyFrameObject, f_valuestack);
+    m_il.ld_i(index * sizeof(PyObject*));
+    m_il.add();
+    m_il.ld_ind_i();
+}
+
+void PythonCompiler::emit_clear_frame_stack() {
+    load_frame();
+    LD_FIELDA(PyFrameObject, f_stacktop);
+    m_il.load_null();
+    m_il.st_ind_i();
+
+    load_frame();
+    LD_FIELDA(PyFrameObject, f_iblock);
+    m_il.ld_i4(0);
+    m_il.st_ind_i4();
+}
+
+void PythonCompiler::emit_suspend_frame(int lasti) {
+    load_frame();
+    m_il.ld_i4(lasti);
+    m_il.emit_call(METHOD_SUSPEND_FRAME);
+}
+
+void PythonCompiler::emit_yield_from(Local result) {
+    m_il.ld_loca(result);
+    m_il.emit_call(METHOD_YIELD_FROM);
+}
+
+void PythonCompiler::emit_get_yield_from_iter() {
+    m_il.ld_i4((m_code->co_flags & (CO_COROUTINE | CO_ITERABLE_COROUTINE)) != 0);
+    m_il.emit_call(METHOD_GET_YIELD_FROM_ITER);
+}
+
+void PythonCompiler::emit_get_awaitable() {
+    m_il.emit_call(METHOD_GET_AWAITABLE);
+}
+
+void PythonCompiler::emit_setup_with(Local exit) {
+    // One cache each for __enter__ and __exit__
+    m_il.ld_i(m_caches->new_attribute_cache());
+    m_il.ld_i(m_caches->new_attribute_cache());
+    m_il.ld_loca(exit);
+    m_il.emit_call(METHOD_SETUP_WITH);
+}
+
+void PythonCompiler::emit_with_cleanup_start() {
+    m_il.emit_call(METHOD_WITH_CLEANUP_START);
+}
+
+void PythonCompiler::emit_with_cleanup_finish() {
+    m_il.emit_call(METHOD_WITH_CLEANUP_FINISH);
+}
+
 JittedCode* PythonCompiler::emit_compile() {
-    CorJitInfo* jitInfo = new CorJitInfo(g_execEngine, m_code, m_module);
-    auto addr = m_il.compile(jitInfo, g_jit, m_code->co_stacksize + 100).m_addr;
+    CorJitInfo* jitInfo = new CorJitInfo(g_execEngine, m_code, m_module, m_caches);
+    void* addr;
+    // The timer is stopped after we've re-acquired the GIL so the stats are
+    // only ever updated while holding it.
+    StatsTimer timer(m_stats.NativeTime);
+    if (m_releaseGil) {
+        // Native code generation doesn't touch any Python objects
+        Py_BEGIN_ALLOW_THREADS
+        AcquireSRWLockExclusive(&g_jitLock);
+        addr = m_il.compile(jitInfo, g_jit, m_code->co_stacksize + 100, m_minOpts).m_addr;
+        ReleaseSRWLockExclusive(&g_jitLock);
+        Py_END_ALLOW_THREADS
+    }
+    else {
+        AcquireSRWLockExclusive(&g_jitLock);
+        addr = m_il.compile(jitInfo, g_jit, m_code->co_stacksize + 100, m_minOpts).m_addr;
+        ReleaseSRWLockExclusive(&g_jitLock);
+    }
+    timer.stop();
+
+    m_stats.ILSize = m_il.m_il.size();
     if (addr == nullptr) {
+        m_stats.fail(CF_CompileMethod);
         printf("Compiling failed %s from %s line %d\r\n",
             PyUnicode_AsUTF8(m_code->co_name),
             PyUnicode_AsUTF8(m_code->co_filename),
@@ -1195,10 +1813,157 @@ JittedCode* PythonCompiler::emit_compile() {
         delete jitInfo;
         return nullptr;
     }
+    m_stats.NativeSize = jitInfo->get_code_size();
     return jitInfo;
 
 }
 
+// Pointers below this are small values which were loaded as pointers, the
+// first 64k of the address space is never allocated.
+#define MIN_POINTER 0x10000
+
+static bool FindTupleItem(PyObject* tuple, size_t value, uint32_t& index) {
+    for (Py_ssize_t i = 0; i < PyTuple_GET_SIZE(tuple); i++) {
+        if ((size_t)PyTuple_GET_ITEM(tuple, i) == value) {
+            index = (uint32_t)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool PythonCompiler::save_il(ILCacheEntry& entry) {
+    entry.IL = m_il.m_il;
+    entry.UserMethods.assign(m_userMethods.begin(), m_userMethods.end());
+    entry.Locals.clear();
+    for (auto& local : m_il.get_locals()) {
+        entry.Locals.push_back(local.m_type);
+    }
+
+    entry.Relocations.clear();
+    size_t index, field;
+    for (auto offset : m_il.m_pointers) {
+        auto value = m_il.get_pointer(offset);
+        if (value < MIN_POINTER) {
+            continue;
+        }
+
+        Relocation reloc;
+        reloc.Offset = (uint32_t)offset;
+        reloc.Index = reloc.Value = 0;
+        if (ILCacheFindImage((void*)value, reloc.Index, reloc.Value)) {
+            reloc.Kind = RK_Image;
+        }
+        else if (FindTupleItem(m_code->co_names, value, reloc.Index)) {
+            reloc.Kind = RK_Name;
+        }
+        else if (FindTupleItem(m_code->co_consts, value, reloc.Index)) {
+            reloc.Kind = RK_Const;
+        }
+        else if (FindTupleItem(m_code->co_varnames, value, reloc.Index)) {
+            reloc.Kind = RK_VarName;
+        }
+        else if (value == (size_t)g_emptyTuple) {
+            reloc.Kind = RK_EmptyTuple;
+        }
+        else if (m_caches->find_attribute_cache((void*)value, index)) {
+            reloc.Kind = RK_AttributeCache;
+            reloc.Index = (uint32_t)index;
+        }
+        else if (m_caches->find_call_cache((void*)value, index)) {
+            reloc.Kind = RK_CallCache;
+            reloc.Index = (uint32_t)index;
+        }
+        else if (m_caches->find_global_cache((void*)value, index, field)) {
+            reloc.Kind = RK_GlobalCache;
+            reloc.Index = (uint32_t)index;
+            reloc.Value = (uint32_t)field;
+        }
+        else {
+            reloc.Kind = RK_UserMethod;
+            for (reloc.Index = 0; reloc.Index < m_userMethods.size(); reloc.Index++) {
+                auto method = (IndirectDispatchMethod*)m_module->m_methods[FIRST_USER_FUNCTION_TOKEN + reloc.Index];
+                if (value == (size_t)&method->m_addr) {
+                    break;
+                }
+            }
+            if (reloc.Index == m_userMethods.size()) {
+                // Something allocated for this process only
+                return false;
+            }
+        }
+        entry.Relocations.push_back(reloc);
+    }
+    return true;
+}
+
+bool PythonCompiler::load_il(ILCacheEntry& entry) {
+    vector<Parameter> locals;
+    for (auto local : entry.Locals) {
+        locals.push_back(Parameter((CorInfoType)local));
+    }
+    m_il.load(entry.IL, locals);
+    for (auto token : entry.UserMethods) {
+        auto method = g_module.m_methods.find(token);
+        if (method == g_module.m_methods.end()) {
+            return false;
+        }
+        m_module->m_methods[(int)(FIRST_USER_FUNCTION_TOKEN + m_userMethods.size())] = new IndirectDispatchMethod(method->second);
+        m_userMethods.push_back(token);
+    }
+
+    for (auto& reloc : entry.Relocations) {
+        if (reloc.Offset + sizeof(size_t) > entry.IL.size()) {
+            return false;
+        }
+
+        void* value = nullptr;
+        switch (reloc.Kind) {
+            case RK_Image: value = ILCacheImageAddress(reloc.Index, reloc.Value); break;
+            case RK_Name:
+                if (reloc.Index < PyTuple_GET_SIZE(m_code->co_names)) {
+                    value = PyTuple_GET_ITEM(m_code->co_names, reloc.Index);
+                }
+                break;
+            case RK_Const:
+                if (reloc.Index < PyTuple_GET_SIZE(m_code->co_consts)) {
+                    value = PyTuple_GET_ITEM(m_code->co_consts, reloc.Index);
+                }
+                break;
+            case RK_VarName:
+                if (reloc.Index < PyTuple_GET_SIZE(m_code->co_varnames)) {
+                    value = PyTuple_GET_ITEM(m_code->co_varnames, reloc.Index);
+                }
+                break;
+            case RK_EmptyTuple:
+                value = g_emptyTuple;
+                break;
+            case RK_UserMethod:
+                if (reloc.Index < m_userMethods.size()) {
+                    value = &((IndirectDispatchMethod*)m_module->m_methods[FIRST_USER_FUNCTION_TOKEN + reloc.Index])->m_addr;
+                }
+                break;
+            case RK_AttributeCache:
+                value = m_caches->get_attribute_cache(reloc.Index);
+                break;
+            case RK_CallCache:
+                value = m_caches->get_call_cache(reloc.Index);
+                break;
+            case RK_GlobalCache:
+                if (reloc.Value < sizeof(GlobalCache)) {
+                    value = (char*)m_caches->get_global_cache(reloc.Index) + reloc.Value;
+                }
+                break;
+        }
+        if (value == nullptr) {
+            return false;
+        }
+        m_il.set_pointer(reloc.Offset, (size_t)value);
+        m_il.m_pointers.push_back(reloc.Offset);
+    }
+    return true;
+}
+
 void PythonCompiler::emit_tagged_int_to_float() {
     m_il.emit_call(METHOD_INT_TO_FLOAT);
 }
@@ -1221,6 +1986,8 @@ public:
 
 GLOBAL_METHOD(METHOD_ADD_TOKEN, &PyJit_Add, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
 GLOBAL_METHOD(METHOD_SUBSCR_TOKEN, &PyJit_Subscr, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
+GLOBAL_METHOD(METHOD_SUBSCR_LIST_INT, &PyJit_SubscrListInt, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
+GLOBAL_METHOD(METHOD_SUBSCR_TUPLE_INT, &PyJit_SubscrTupleInt, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
 
 GLOBAL_METHOD(METHOD_MULTIPLY_TOKEN, &PyJit_Multiply, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
 GLOBAL_METHOD(METHOD_DIVIDE_TOKEN, &PyJit_TrueDivide, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
@@ -1276,24 +2043,46 @@ GLOBAL_METHOD(METHOD_UNPACK_SEQUENCEEX_TOKEN, &PyJit_UnpackSequenceEx, CORINFO_T
 
 GLOBAL_METHOD(METHOD_PYSET_ADD, &PySet_Add, CORINFO_TYPE_INT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
 
-GLOBAL_METHOD(METHOD_CALL0_TOKEN, &Call0, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT));
-GLOBAL_METHOD(METHOD_CALL1_TOKEN, &Call1, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
-GLOBAL_METHOD(METHOD_CALL2_TOKEN, &Call2, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
-GLOBAL_METHOD(METHOD_CALL3_TOKEN, &Call3, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
-GLOBAL_METHOD(METHOD_CALL4_TOKEN, &Call4, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
-GLOBAL_METHOD(METHOD_CALLN_TOKEN, &PyJit_CallN, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
+GLOBAL_METHOD(METHOD_CALL0_TOKEN, &PyJit_CallCached0, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
+GLOBAL_METHOD(METHOD_CALL1_TOKEN, &PyJit_CallCached1, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
+GLOBAL_METHOD(METHOD_CALL2_TOKEN, &PyJit_CallCached2, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
+GLOBAL_METHOD(METHOD_CALL3_TOKEN, &PyJit_CallCached3, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
+GLOBAL_METHOD(METHOD_CALL4_TOKEN, &PyJit_CallCached4, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
+
+GLOBAL_METHOD(METHOD_LOADMETHOD_TOKEN, &PyJit_LoadMethod, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
+GLOBAL_METHOD(METHOD_METHODCALL0_TOKEN, &PyJit_MethodCall0, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
+GLOBAL_METHOD(METHOD_METHODCALL1_TOKEN, &PyJit_MethodCall1, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
+GLOBAL_METHOD(METHOD_METHODCALL2_TOKEN, &PyJit_MethodCall2, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
+GLOBAL_METHOD(METHOD_METHODCALL3_TOKEN, &PyJit_MethodCall3, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
+GLOBAL_METHOD(METHOD_METHODCALL4_TOKEN, &PyJit_MethodCall4, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
+GLOBAL_METHOD(METHOD_METHODCALLARRAY_TOKEN, &PyJit_MethodCallArray, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
+GLOBAL_METHOD(METHOD_CALLARRAY_TOKEN, &PyJit_CallArrayCached, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
+GLOBAL_METHOD(METHOD_KWCALLARRAY_TOKEN, &PyJit_KwCallArray, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
 GLOBAL_METHOD(METHOD_CALLNKW_TOKEN, &PyJit_CallNKW, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
 
-GLOBAL_METHOD(METHOD_KWCALL1_TOKEN, &PyJit_KwCall1, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
-GLOBAL_METHOD(METHOD_KWCALL2_TOKEN, &PyJit_KwCall2, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
-GLOBAL_METHOD(METHOD_KWCALL3_TOKEN, &PyJit_KwCall3, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
-GLOBAL_METHOD(METHOD_KWCALL4_TOKEN, &PyJit_KwCall4, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
-GLOBAL_METHOD(METHOD_KWCALLN_TOKEN, &PyJit_KwCallN, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
 
 GLOBAL_METHOD(METHOD_STOREGLOBAL_TOKEN, &PyJit_StoreGlobal, CORINFO_TYPE_INT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
 GLOBAL_METHOD(METHOD_DELETEGLOBAL_TOKEN, &PyJit_DeleteGlobal, CORINFO_TYPE_INT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
+
+GLOBAL_METHOD(METHOD_DEOPT_PUSH_BLOCK, &PyJit_DeoptPushBlock, CORINFO_TYPE_VOID, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_INT), Parameter(CORINFO_TYPE_INT), Parameter(CORINFO_TYPE_INT));
+GLOBAL_METHOD(METHOD_DEOPT_PUSH_VALUE, &PyJit_DeoptPushValue, CORINFO_TYPE_VOID, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
+GLOBAL_METHOD(METHOD_DEOPTIMIZE, &PyJit_Deoptimize, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_INT));
+GLOBAL_METHOD(METHOD_RECORD_TYPE, &PyJit_RecordType, CORINFO_TYPE_VOID, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
+GLOBAL_METHOD(METHOD_RECORD_CALLEE, &PyJit_RecordCallee, CORINFO_TYPE_VOID, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
+GLOBAL_METHOD(METHOD_RECORD_ARG_TYPE, &PyJit_RecordArgType, CORINFO_TYPE_VOID, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
+GLOBAL_METHOD(METHOD_NEW_INLINE_FRAME, &PyJit_NewInlineFrame, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT));
+GLOBAL_METHOD(METHOD_INLINE_TRACE, &PyJit_InlineTrace, CORINFO_TYPE_VOID, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_INT));
+GLOBAL_METHOD(METHOD_SUSPEND_FRAME, &PyJit_SuspendFrame, CORINFO_TYPE_VOID, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_INT));
+GLOBAL_METHOD(METHOD_YIELD_FROM, &PyJit_YieldFrom, CORINFO_TYPE_INT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
+GLOBAL_METHOD(METHOD_GET_YIELD_FROM_ITER, &PyJit_GetYieldFromIter, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_INT));
+GLOBAL_METHOD(METHOD_GET_AWAITABLE, &PyJit_GetAwaitable, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT));
+GLOBAL_METHOD(METHOD_SETUP_WITH, &PyJit_SetupWith, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
+GLOBAL_METHOD(METHOD_WITH_CLEANUP_START, &PyJit_WithCleanupStart, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
+GLOBAL_METHOD(METHOD_WITH_CLEANUP_FINISH, &PyJit_WithCleanupFinish, CORINFO_TYPE_INT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
 GLOBAL_METHOD(METHOD_LOADGLOBAL_TOKEN, &PyJit_LoadGlobal, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
 GLOBAL_METHOD(METHOD_LOADATTR_TOKEN, &PyJit_LoadAttr, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
+GLOBAL_METHOD(METHOD_LOADGLOBAL_CACHED_TOKEN, &PyJit_LoadGlobalCached, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
+GLOBAL_METHOD(METHOD_LOADATTR_CACHED_TOKEN, &PyJit_LoadAttrCached, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
 
 GLOBAL_METHOD(METHOD_STOREATTR_TOKEN, &PyJit_StoreAttr, CORINFO_TYPE_INT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
 GLOBAL_METHOD(METHOD_DELETEATTR_TOKEN, &PyJit_DeleteAttr, CORINFO_TYPE_INT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
@@ -1306,6 +2095,7 @@ GLOBAL_METHOD(METHOD_GETITER_TOKEN, &PyJit_GetIter, CORINFO_TYPE_NATIVEINT, Para
 GLOBAL_METHOD(SIG_ITERNEXT_TOKEN, &PyJit_IterNext, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
 
 GLOBAL_METHOD(METHOD_DECREF_TOKEN, &PyJit_DecRef, CORINFO_TYPE_VOID, Parameter(CORINFO_TYPE_NATIVEINT));
+GLOBAL_METHOD(METHOD_DEALLOC_TOKEN, &PyJit_Dealloc, CORINFO_TYPE_VOID, Parameter(CORINFO_TYPE_NATIVEINT));
 
 GLOBAL_METHOD(METHOD_PYCELL_SET_TOKEN, &PyJit_CellSet, CORINFO_TYPE_VOID, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
 GLOBAL_METHOD(METHOD_SET_CLOSURE, &PyJit_SetClosure, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
@@ -1382,7 +2172,6 @@ GLOBAL_METHOD(METHOD_ISNOT_BOOL, &PyJit_IsNot_Bool, CORINFO_TYPE_INT, Parameter(
 GLOBAL_METHOD(METHOD_GETITER_OPTIMIZED_TOKEN, &PyJit_GetIterOptimized, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
 GLOBAL_METHOD(SIG_ITERNEXT_OPTIMIZED_TOKEN, &PyJit_IterNextOptimized, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
 
-GLOBAL_METHOD(METHOD_CALL0_OPT_TOKEN, &Call0_Generic, CORINFO_TYPE_NATIVEINT, Parameter(CORINFO_TYPE_NATIVEINT), Parameter(CORINFO_TYPE_NATIVEINT));
 
 GLOBAL_METHOD(METHOD_FLOAT_POWER_TOKEN, static_cast<double(*)(double, double)>(pow), CORINFO_TYPE_DOUBLE, Parameter(CORINFO_TYPE_DOUBLE), Parameter(CORINFO_TYPE_DOUBLE));
 GLOBAL_METHOD(METHOD_FLOAT_FLOOR_TOKEN, static_cast<double(*)(double)>(floor), CORINFO_TYPE_DOUBLE, Parameter(CORINFO_TYPE_DOUBLE));
@@ -43,6 +43,7 @@
 #include <unordered_map>
 
 #include "ipycomp.h"
+#include "ilcache.h"
 #include "jitinfo.h"
 #include "codemodel.h"
 #include "ilgen.h"
@@ -169,6 +170,9 @@
 #define METHOD_STOREMAP_NO_DECREF_TOKEN          0x00000073
 #define METHOD_FORMAT_VALUE                      0x00000074
 #define METHOD_FORMAT_OBJECT                     0x00000075
+#define METHOD_SUBSCR_LIST_INT                   0x00000076
+#define METHOD_SUBSCR_TUPLE_INT                  0x00000077
+#define METHOD_DEALLOC_TOKEN                     0x00000078
 
 
 // call helpers
@@ -177,26 +181,22 @@
 #define METHOD_CALL2_TOKEN        0x00010002
 #define METHOD_CALL3_TOKEN        0x00010003
 #define METHOD_CALL4_TOKEN        0x00010004
-#define METHOD_CALL5_TOKEN        0x00010005
-#define METHOD_CALL6_TOKEN        0x00010006
-#define METHOD_CALL7_TOKEN        0x00010007
-#define METHOD_CALL8_TOKEN        0x00010008
-#define METHOD_CALL9_TOKEN        0x00010009
 
 #define METHOD_CALL_ARGS            0x0001000A
 #define METHOD_CALL_KWARGS          0x0001000B
 #define METHOD_PYUNICODE_JOINARRAY  0x0002000C
 
-#define METHOD_CALLN_TOKEN          0x000101FF
+#define METHOD_CALLARRAY_TOKEN      0x00010010
+#define METHOD_KWCALLARRAY_TOKEN    0x00010011
+
+#define METHOD_METHODCALL0_TOKEN    0x00010100
+#define METHOD_METHODCALL1_TOKEN    0x00010101
+#define METHOD_METHODCALL2_TOKEN    0x00010102
+#define METHOD_METHODCALL3_TOKEN    0x00010103
+#define METHOD_METHODCALL4_TOKEN    0x00010104
+#define METHOD_METHODCALLARRAY_TOKEN 0x00010105
 
-#define METHOD_KWCALL0_TOKEN        0x00010300
-#define METHOD_KWCALL1_TOKEN        0x00010301
-#define METHOD_KWCALL2_TOKEN        0x00010302
-#define METHOD_KWCALL3_TOKEN        0x00010303
-#define METHOD_KWCALL4_TOKEN        0x00010304
-#define METHOD_KWCALLN_TOKEN        0x000103FF
 
-#define METHOD_CALL0_OPT_TOKEN      0x00010200
 
 
 
@@ -221,6 +221,24 @@
 #define METHOD_DELETEATTR_TOKEN      0x00030003
 #define METHOD_STOREGLOBAL_TOKEN     0x00030004
 #define METHOD_DELETEGLOBAL_TOKEN    0x00030005
+#define METHOD_DEOPT_PUSH_BLOCK      0x00030006
+#define METHOD_DEOPT_PUSH_VALUE      0x00030007
+#define METHOD_DEOPTIMIZE            0x00030008
+#define METHOD_RECORD_TYPE           0x00030009
+#define METHOD_LOADATTR_CACHED_TOKEN 0x0003000A
+#define METHOD_LOADGLOBAL_CACHED_TOKEN 0x0003000B
+#define METHOD_LOADMETHOD_TOKEN      0x0003000C
+#define METHOD_RECORD_CALLEE         0x0003000D
+#define METHOD_INLINE_TRACE          0x0003000E
+#define METHOD_SUSPEND_FRAME         0x0003000F
+#define METHOD_YIELD_FROM            0x00030010
+#define METHOD_GET_YIELD_FROM_ITER   0x00030011
+#define METHOD_GET_AWAITABLE         0x00030012
+#define METHOD_SETUP_WITH            0x00030013
+#define METHOD_WITH_CLEANUP_START    0x00030014
+#define METHOD_WITH_CLEANUP_FINISH   0x00030015
+#define METHOD_NEW_INLINE_FRAME      0x00030016
+#define METHOD_RECORD_ARG_TYPE       0x00030017
 
 #define METHOD_FLOAT_POWER_TOKEN    0x00050000
 #define METHOD_FLOAT_FLOOR_TOKEN    0x00050001
@@ -237,15 +255,39 @@
 #define ST_FIELD(type, field) m_il.ld_i(offsetof(type, field)); m_il.add(); m_il.st_ind_i();
 
 extern ICorJitCompiler* g_jit;
+extern CExecutionEngine g_execEngine;
 class PythonCompiler : public IPythonCompiler {
     PyCodeObject *m_code;
     // pre-calculate some information...
     ILGenerator m_il;
     UserModule* m_module;
     Local m_lasti;
+    // Release the GIL while CoreCLR compiles, used by the background compile thread
+    bool m_releaseGil;
+    // Compile with CoreCLR's optimizations disabled, used by the baseline tier
+    bool m_minOpts;
+    // The global method tokens dispatched to by our user method tokens
+    vector<int> m_userMethods;
+    // CoreCLR's compile time and the size of the IL and native code
+    CompileStats m_stats;
+    // Inline caches used by the code, owned by the code once it's compiled
+    InlineCaches* m_caches;
+    // Fast locals we keep a copy of in IL locals so CoreCLR can enregister them
+    unordered_map<int, Local> m_registerLocals;
 
 public:
-    PythonCompiler(PyCodeObject *code);
+    PythonCompiler(PyCodeObject *code, bool releaseGil = false, bool minOpts = false);
+
+    CompileStats& get_stats() {
+        return m_stats;
+    }
+
+    // Saves the IL we've generated in a form which can be reused by another
+    // process.  Returns false if the IL refers to something we can't relocate.
+    bool save_il(ILCacheEntry& entry);
+    // Replaces the IL we've generated with IL from the cache, after which the
+    // code can be compiled with emit_compile.
+    bool load_il(ILCacheEntry& entry);
 
     virtual void emit_rot_two(LocalKind kind = LK_Pointer);
 
@@ -263,6 +305,7 @@ public:
     virtual void emit_push_frame();
     virtual void emit_pop_frame();
     virtual void emit_eh_trace();
+    virtual void emit_inline_trace(Local function, vector<Local>& locals, int lasti);
 
     void emit_lasti_init();
     void emit_lasti_update(int index);
@@ -274,6 +317,7 @@ public:
     virtual void emit_store_attr(void* name);
     virtual void emit_delete_attr(void* name);
     virtual void emit_load_attr(void* name);
+    virtual void emit_load_method(void* name, Local self);
     virtual void emit_store_global(void* name);
     virtual void emit_delete_global(void* name);
     virtual void emit_load_global(void* name);
@@ -335,13 +379,14 @@ public:
 
     // Emits a call for the specified argument count.  If the compiler
     // can't emit a call with this number of args then it returns false,
-    // and emit_call_with_tuple is used to call with a variable sized
-    // tuple instead.
+    // and emit_call_array is used to call with the arguments in an array
+    // instead.
     virtual bool emit_call(size_t argCnt);
-    virtual void emit_call_with_tuple();
+    virtual void emit_call_array(Local args, size_t argCnt);
+    virtual bool emit_method_call(size_t argCnt);
+    virtual void emit_method_call_array(Local args, size_t argCnt, Local names);
 
-    virtual bool emit_kwcall(size_t argCnt);
-    virtual void emit_kwcall_with_tuple();
+    virtual void emit_kwcall_array(Local args, size_t argCnt, Local names);
 
     virtual void emit_call_args();
     virtual void emit_call_kwargs();
@@ -381,10 +426,13 @@ public:
     virtual void emit_getiter();
     //void emit_getiter_opt();
     virtual void emit_for_next(Label processValue, Local iterValue);
+    virtual void emit_for_next_range(Label processValue, Label ended, Local iterValue);
 
     virtual void emit_binary_float(int opcode);
     virtual void emit_binary_tagged_int(int opcode);
     virtual void emit_binary_object(int opcode);
+    virtual void emit_subscr_list_int();
+    virtual void emit_subscr_tuple_int();
     virtual void emit_tagged_int_to_float();
 
     virtual void emit_in_push_int();
@@ -402,9 +450,11 @@ public:
     virtual bool emit_compare_object_push_int(int compareType);
 
     virtual void emit_store_fast(int local);
+    virtual void emit_store_fast_untagged(int local);
 
     virtual void emit_unbound_local_check();
     virtual void emit_load_fast(int local);
+    virtual void emit_register_local(int local);
 
     virtual Label emit_define_label();
     virtual void emit_mark_label(Label label);
@@ -441,6 +491,30 @@ public:
 
     virtual void emit_periodic_work();
 
+    virtual void emit_type_guard(PyTypeObject* type, Label failed);
+    virtual void emit_deopt_push_block(int type, int handler, int level);
+    virtual void emit_deopt_push_value();
+    virtual void emit_deoptimize(int lasti);
+    virtual void emit_record_type(void* profile, size_t opcodeIndex);
+    virtual void emit_record_callee(void* profile, size_t opcodeIndex);
+    virtual void emit_record_arg_type(void* profile, size_t opcodeIndex, size_t arg);
+    virtual void emit_exact_type_guard(Local value, PyTypeObject* type, bool version, Label failed);
+    virtual void emit_load_instance_attr(void* name, PyTypeObject* type, Py_ssize_t offset);
+    virtual void emit_inline_guard(PyCodeObject* code, Label failed);
+
+    virtual void emit_load_throwflag();
+    virtual void emit_load_lasti();
+    virtual void emit_load_frame_value(int index);
+    virtual void emit_clear_frame_stack();
+    virtual void emit_suspend_frame(int lasti);
+    virtual void emit_yield_from(Local result);
+    virtual void emit_get_yield_from_iter();
+    virtual void emit_get_awaitable();
+
+    virtual void emit_setup_with(Local exit);
+    virtual void emit_with_cleanup_start();
+    virtual void emit_with_cleanup_finish();
+
     virtual JittedCode* emit_compile();
 
 private:
@@ -451,6 +525,10 @@ private:
 
     void call_optimizing_function(int baseFunction);
 
+    void emit_binary_tagged_int_inline(int opcode, int slowToken);
+    // Branches to label if the value doesn't fit in half of a machine word
+    void emit_branch_not_half_word(Local value, Label label);
+
     CorInfoType to_clr_type(LocalKind kind);
 };
 
@@ -27,6 +27,7 @@
 
 #include "pyjit.h"
 #include "pycomp.h"
+#include <malloc.h>
 
 HINSTANCE            g_pMSCorEE;
 
@@ -35,23 +36,59 @@ HINSTANCE            g_pMSCorEE;
 // we'll have a jitted code object & optimized evalutation function optimized
 // for those arguments.  
 struct SpecializedTreeNode {
+	// The argument types we're specialized for
+	vector<PyTypeObject*> types;
 #ifdef TRACE_TREE
 	vector<pair<PyTypeObject*, SpecializedTreeNode*>> children;
 #else
-	vector<PyTypeObject*> types;
+	// Hash of types used to find this node in the dispatch cache
+	size_t signature;
 #endif
+	// Types of the locals seen at the end of interpreted runs, nullptr
+	// if a local held different types.
+	vector<PyTypeObject*> localTypes;
+	// Set when the compiled code depends upon localTypes
+	bool speculative;
+	// Cleared when speculating has failed too often
+	bool speculate;
+	// Set when a run which deoptimized showed a local changing type
+	bool refined;
+	// Set when the code was compiled to run without publishing its frame
+	bool elideFrame;
 	Py_EvalFunc addr;
 	JittedCode* jittedCode;
 	int hitCount;
+	// Set while the node is waiting to be compiled in the background
+	bool queued;
+	// The code we were compiled for, and when our optimized code last ran
+	PyjionJittedCode* owner;
+	PY_UINT64_T lastUsed;
+	// Number of calls which ran our optimized code
+	PY_UINT64_T callCount;
 
 #ifdef TRACE_TREE
-	SpecializedTreeNode() {
-#else
 	SpecializedTreeNode(vector<PyTypeObject*>& types) : types(types) {
+#else
+	SpecializedTreeNode(vector<PyTypeObject*>& types, size_t signature) : types(types), signature(signature) {
 #endif
 		addr = nullptr;
 		jittedCode = nullptr;
 		hitCount = 0;
+		queued = false;
+		owner = nullptr;
+		lastUsed = 0;
+		callCount = 0;
+		speculative = false;
+		speculate = true;
+		refined = false;
+		elideFrame = false;
+		// Keep user defined classes alive so a new class can't be allocated
+		// at the same address and match our types.
+		for (auto type : types) {
+			if (type != nullptr && PyType_HasFeature(type, Py_TPFLAGS_HEAPTYPE)) {
+				Py_INCREF(type);
+			}
+		}
 	}
 
 #ifdef TRACE_TREE
@@ -62,24 +99,68 @@ struct SpecializedTreeNode {
 			}
 		}
 
-		auto res = new SpecializedTreeNode();
+		auto childTypes = types;
+		childTypes.push_back(type);
+		auto res = new SpecializedTreeNode(childTypes);
 		children.push_back(pair<PyTypeObject*, SpecializedTreeNode*>(type, res));
 		return res;
 	}
+#else
+	// Checks if the argument types in the frame match the types we were specialized for.
+	bool matches(PyObject** locals);
 #endif
+	// Records the types of the locals after the frame has been interpreted,
+	// returns true if a local no longer has a single type.
+	bool observe_locals(PyFrameObject* frame);
 
-	~SpecializedTreeNode() {
-		delete jittedCode;
-#ifdef TRACE_TREE
-		for (auto cur = children.begin(); cur != children.end(); cur++) {
-			delete cur->second;
+	~SpecializedTreeNode();
+};
+
+
+// Traces which currently hold optimized code, candidates for eviction when
+// the code heap goes over its budget.
+static vector<SpecializedTreeNode*> g_compiledTraces;
+// Incremented each time optimized code is run to order traces by last use
+static PY_UINT64_T g_codeClock;
+static size_t g_codeEvictions;
+
+// Totals for every compilation, and the number of failures caused by each opcode
+static JitStats g_jitStats;
+static size_t g_opcodeFailures[256];
+
+static void UnregisterTrace(SpecializedTreeNode* target) {
+	for (auto cur = g_compiledTraces.begin(); cur != g_compiledTraces.end(); cur++) {
+		if (*cur == target) {
+			g_compiledTraces.erase(cur);
+			break;
 		}
-#endif
 	}
-};
+}
 
+SpecializedTreeNode::~SpecializedTreeNode() {
+	if (jittedCode != nullptr) {
+		UnregisterTrace(this);
+		delete jittedCode;
+	}
+	for (auto type : types) {
+		if (type != nullptr && PyType_HasFeature(type, Py_TPFLAGS_HEAPTYPE)) {
+			Py_DECREF(type);
+		}
+	}
+#ifdef TRACE_TREE
+	for (auto cur = children.begin(); cur != children.end(); cur++) {
+		delete cur->second;
+	}
+#endif
+}
 
 PyjionJittedCode::~PyjionJittedCode() {
+	delete j_profile;
+	delete j_baseline_code;
+	delete j_generator_code;
+	for (auto code : j_retired) {
+		delete code;
+	}
 #ifdef TRACE_TREE
 	delete funcs;
 #else
@@ -89,6 +170,22 @@ PyjionJittedCode::~PyjionJittedCode() {
 #endif
 }
 
+PyObject* PyJit_EvalFrameInterpreted(PyFrameObject* frame) {
+	if (!PyJit_IsElidedFrame(frame)) {
+		return _PyEval_EvalFrameDefault(frame, 0);
+	}
+
+	// The interpreter publishes the frame it runs, so it can't run one which
+	// lives on the native stack.
+	auto heap = PyJit_MaterializeFrame(frame);
+	if (heap == nullptr) {
+		return nullptr;
+	}
+	auto res = _PyEval_EvalFrameDefault(heap, 0);
+	Py_DECREF(heap);
+	return res;
+}
+
 PyObject* Jit_EvalHelper(void* state, PyFrameObject*frame) {
 #if DEBUG_CALL_TRACE
     printf("Invoking trace %s from %s line %d %p %p\r\n",
@@ -103,7 +200,7 @@ PyObject* Jit_EvalHelper(void* state, PyFrameObject*frame) {
     PyThreadState *tstate = PyThreadState_GET();
     if (tstate->use_tracing) {
         if (tstate->c_tracefunc != NULL) {
-            return _PyEval_EvalFrameDefault(frame, 0);
+            return PyJit_EvalFrameInterpreted(frame);
         }
     }
 
@@ -126,11 +223,44 @@ PyObject* Jit_EvalHelper(void* state, PyFrameObject*frame) {
 
 static DWORD g_extraSlot;
 
+// Checks if the code is the body of a module
+static bool IsModuleCode(PyCodeObject* code) {
+	return strcmp(PyUnicode_AsUTF8(code->co_name), "<module>") == 0;
+}
+
+// A trace which has gotten hot and is waiting for the compile thread.  We
+// hold a reference to the code object so it stays alive while queued.
+struct CompileRequest {
+	PyjionJittedCode* trace;
+	SpecializedTreeNode* target;
+};
+
+// Run code in the baseline tier before producing optimized code
+static bool g_tieredCompile = true;
+
+// Run code which doesn't inspect its frame without publishing the frame, and
+// put the frames of direct calls to it on the native stack.
+static bool g_frameElision;
+FrameElisionStats g_frameElisionStats;
+
+// Background compilation state
+static bool g_asyncCompile;
+static HANDLE g_compileThread;
+static CRITICAL_SECTION g_compileLock;
+static CONDITION_VARIABLE g_compileReady;
+static deque<CompileRequest> g_compileQueue;
+// Set to ask the compile thread to exit, and while it's working on a request
+static bool g_compileStopping, g_compileBusy;
+static size_t g_compileQueueMaxDepth, g_compileQueued, g_compileCompleted;
+
 extern "C" __declspec(dllexport) void JitInit() {
 	g_extraSlot = TlsAlloc();
 
 	g_jit = getJit();
 
+	InitializeCriticalSection(&g_compileLock);
+	InitializeConditionVariable(&g_compileReady);
+
     g_emptyTuple = PyTuple_New(0);
 }
 
@@ -139,7 +269,7 @@ extern "C" __declspec(dllexport) void JitInit() {
 unordered_map<PyjionJittedCode*, JittedCode*> g_pyjionJittedCode;
 
 __declspec(dllexport) bool jit_compile(PyCodeObject* code) {
-    if (strcmp(PyUnicode_AsUTF8(code->co_name), "<module>") == 0) {
+    if (IsModuleCode(code)) {
         return false;
     }
 
@@ -175,235 +305,692 @@ __declspec(dllexport) bool jit_compile(PyCodeObject* code) {
 
 #else
 
-AbstractValueKind GetAbstractType(PyTypeObject* type) {
-    if (type == nullptr) {
-        return AVK_Any;
-    } else if (type == &PyLong_Type) {
-        return AVK_Integer;
-    }
-    else if (type == &PyFloat_Type) {
-        return AVK_Float;
-    }
-    else if (type == &PyDict_Type) {
-        return AVK_Dict;
-    }
-    else if (type == &PyTuple_Type) {
-        return AVK_Tuple;
-    }
-    else if (type == &PyList_Type) {
-        return AVK_List;
-    }
-    else if (type == &PyBool_Type) {
-        return AVK_Bool;
-    }
-    else if (type == &PyUnicode_Type) {
-        return AVK_String;
-    }
-    else if (type == &PyBytes_Type) {
-        return AVK_Bytes;
-    }
-    else if (type == &PySet_Type) {
-        return AVK_Set;
-    }
-    else if (type == &_PyNone_Type) {
-        return AVK_None;
-    }
-    else if (type == &PyFunction_Type) {
-        return AVK_Function;
-    }
-    else if (type == &PySlice_Type) {
-        return AVK_Slice;
-    }
-    else if (type == &PyComplex_Type) {
-        return AVK_Complex;
-    }
-    return AVK_Any;
-}
-
 PyTypeObject* GetArgType(int arg, PyObject** locals) {
     auto objValue = locals[arg];
     PyTypeObject* type = nullptr;
     if (objValue != nullptr) {
         type = objValue->ob_type;
-        // We currently only generate optimal code for ints and floats,
-        // so don't bother specializing on other types...
-        if (type != &PyLong_Type && type != &PyFloat_Type) {
+        // Specialize on the builtin types the abstract interpreter knows
+        // about, and on user defined classes which are matched exactly.
+        if (GetAbstractType(type) == AVK_Any && !PyType_HasFeature(type, Py_TPFLAGS_HEAPTYPE)) {
             type = nullptr;
         }
     }
     return type;
 }
 
+// Runs the optimized code for a trace, tracking that it's on the stack so
+// it can't be evicted while it's running.
+PyObject* Jit_EvalOptimized(PyjionJittedCode* trace, SpecializedTreeNode* target, PyFrameObject* frame) {
+	trace->j_active++;
+	target->callCount++;
+	target->lastUsed = ++g_codeClock;
+	auto deopts = trace->j_deopt_count;
+	auto res = Jit_EvalHelper(target->addr, frame);
+	trace->j_active--;
+
+	// A run which deoptimized finished in the interpreter, so its locals
+	// show us which of our speculations didn't hold.
+	if (target->speculative && trace->j_deopt_count != deopts &&
+		!PyJit_IsElidedFrame(frame) && target->observe_locals(frame)) {
+		target->refined = true;
+	}
+	return res;
+}
+
 PyObject* Jit_EvalGeneric(PyjionJittedCode* state, PyFrameObject*frame) {
     auto trace = (PyjionJittedCode*)state;
-    return Jit_EvalHelper(trace->j_generic, frame);
+    return Jit_EvalOptimized(trace, trace->j_generic, frame);
+}
+
+PyObject* Jit_EvalTrace(PyjionJittedCode* state, PyFrameObject *frame);
+
+// Throws away the optimized code for a trace so it runs interpreted again.
+// Code which may still be running is kept alive until the code object is
+// freed.
+void ReleaseTrace(PyjionJittedCode* trace, SpecializedTreeNode* target) {
+	if (trace->j_generic == target) {
+		trace->j_evalfunc = Jit_EvalTrace;
+		trace->j_generic = nullptr;
+	}
+	target->addr = nullptr;
+	if (target->jittedCode != nullptr) {
+		UnregisterTrace(target);
+		if (trace->j_active == 0) {
+			delete target->jittedCode;
+		}
+		else {
+			trace->j_retired.push_back(target->jittedCode);
+		}
+		target->jittedCode = nullptr;
+	}
+}
+
+// Discards the least recently run optimized code until the code heap is back
+// under its budget.  Code which is on the stack can't be freed, and keep is
+// never evicted so the trace we just compiled gets to run.  The GIL must be
+// held.
+void EvictColdTraces(SpecializedTreeNode* keep) {
+	while (g_execEngine.m_codeHeap.over_budget()) {
+		SpecializedTreeNode* coldest = nullptr;
+		for (auto cur : g_compiledTraces) {
+			if (cur != keep && cur->owner->j_active == 0 &&
+				(coldest == nullptr || cur->lastUsed < coldest->lastUsed)) {
+				coldest = cur;
+			}
+		}
+		if (coldest == nullptr) {
+			break;
+		}
+
+#if DEBUG_TRACE
+		printf("Evicting %s from %s line %d\r\n",
+			PyUnicode_AsUTF8(((PyCodeObject*)coldest->owner->j_code)->co_name),
+			PyUnicode_AsUTF8(((PyCodeObject*)coldest->owner->j_code)->co_filename),
+			((PyCodeObject*)coldest->owner->j_code)->co_firstlineno
+		);
+#endif
+		ReleaseTrace(coldest->owner, coldest);
+		coldest->hitCount = 0;
+		g_codeEvictions++;
+	}
 }
 
 #define MAX_TRACE 5
+// Number of times speculative code can fall back to the interpreter before
+// we recompile it without speculating
+#define MAX_DEOPT 100
+
+static_assert(MAX_TRACE < DISPATCH_CACHE_SIZE, "dispatch cache must always have a free slot");
+static_assert((DISPATCH_CACHE_SIZE & (DISPATCH_CACHE_SIZE - 1)) == 0, "dispatch cache size must be a power of 2");
+
+#ifndef TRACE_TREE
+// Computes the signature for the specialized argument types of a frame.  Types
+// we don't specialize on hash the same as an unbound argument.
+size_t HashArgTypes(PyObject** locals, int argCount) {
+	size_t hash = argCount;
+	for (int i = 0; i < argCount; i++) {
+		hash = (hash * 1000003) ^ ((size_t)GetArgType(i, locals) >> 4);
+	}
+	return hash ^ (hash >> 16);
+}
 
-PyObject* Jit_EvalTrace(PyjionJittedCode* state, PyFrameObject *frame) {
-	// Walk our tree of argument types to find the SpecializedTreeNode which
-    // corresponds with our sets of arguments here.
-    auto trace = (PyjionJittedCode*)state;
+bool SpecializedTreeNode::matches(PyObject** locals) {
+	for (size_t i = 0; i < types.size(); i++) {
+		if (types[i] != GetArgType(i, locals)) {
+			return false;
+		}
+	}
+	return true;
+}
+#endif
 
-#ifdef TRACE_TREE
-    // no match on specialized functions...
+bool SpecializedTreeNode::observe_locals(PyFrameObject* frame) {
+	auto localCount = frame->f_code->co_nlocals;
+	if (localTypes.size() == 0) {
+		for (int i = 0; i < localCount; i++) {
+			localTypes.push_back(GetArgType(i, frame->f_localsplus));
+		}
+		return false;
+	}
 
-    SpecializedTreeNode* curNode = trace->funcs;
-    int argCount = frame->f_code->co_argcount + frame->f_code->co_kwonlyargcount;
-    for (int i = 0; i < argCount; i++) {
-        curNode = curNode->getNextNode(GetArgType(i, frame->f_localsplus));
-    }
+	bool changed = false;
+	for (int i = 0; i < localCount; i++) {
+		if (localTypes[i] != nullptr && localTypes[i] != GetArgType(i, frame->f_localsplus)) {
+			localTypes[i] = nullptr;
+			changed = true;
+		}
+	}
+	return changed;
+}
 
-    curNode->hitCount += 1;
+// Computes the key used to find the IL for the trace in the IL cache from
+// everything the abstract interpreter would know about the code.  Returns 0
+// if the trace can't be cached.
+uint64_t GetCacheKey(PyjionJittedCode* trace, SpecializedTreeNode* target) {
+	if (!g_ilCache.is_enabled()) {
+		return 0;
+	}
 
-    if (curNode->addr != nullptr) {
-        // we have a specialized function for this, just invoke it
-        return Jit_EvalHelper(curNode->addr, frame);
-    }
+	vector<int> kinds;
+	for (auto type : target->types) {
+		kinds.push_back(GetAbstractType(type));
+	}
+	if (target->speculate) {
+		kinds.push_back(-1);
+		for (size_t i = target->types.size(); i < target->localTypes.size(); i++) {
+			kinds.push_back(GetAbstractType(target->localTypes[i]));
+		}
+		if (trace->j_profile != nullptr) {
+			kinds.push_back(-1);
+			for (size_t i = 0; i < trace->j_profile->code_size(); i += sizeof(_Py_CODEUNIT)) {
+				kinds.push_back(GetAbstractType(trace->j_profile->get_type(i)));
+			}
+		}
+	}
+	if (target->elideFrame) {
+		kinds.push_back(-2);
+	}
+	return ILCache::get_key((PyCodeObject*)trace->j_code, kinds);
+}
 
-    // No specialized function yet, let's see if we should create one...
-    auto jittedCode = (PyjionJittedCode *)trace->code->co_extra;
-    if (curNode->hitCount > jittedCode->j_specialization_threshold) {
-        // Compile and run the now compiled code...
-        PythonCompiler jitter(trace->code);
-        AbstractInterpreter interp(trace->code, &jitter);
+// Adds a compilation to the totals for the code and the process
+void RecordCompile(PyjionJittedCode* trace, CompileStats& stats, bool baseline, bool cached) {
+	for (auto totals : { &trace->j_stats, &g_jitStats }) {
+		totals->record(stats);
+		if (baseline) {
+			totals->BaselineCompiles++;
+		}
+		if (cached) {
+			totals->CachedCompiles++;
+		}
+	}
 
-        // provide the interpreter information about the specialized types
-        for (int i = 0; i < argCount; i++) {
-            auto type = GetAbstractType(GetArgType(i, frame->f_localsplus));
-            interp.set_local_type(i, type);
-        }
+	if (stats.Failure != CF_None) {
+		trace->j_failure = stats.Failure;
+		trace->j_failure_opcode = stats.FailureOpcode;
+		if (stats.FailureOpcode >= 0 && stats.FailureOpcode < _countof(g_opcodeFailures)) {
+			g_opcodeFailures[stats.FailureOpcode]++;
+		}
+	}
+}
 
-        auto res = interp.compile();
-        bool isSpecialized = false;
-        for (int i = 0; i < argCount; i++) {
-            auto type = GetAbstractType(GetArgType(i, frame->f_localsplus));
-            if (type == AVK_Integer || type == AVK_Float) {
-                if (!interp.get_local_info(0, i).ValueInfo.needs_boxing()) {
-                    isSpecialized = true;
-                }
-            }
-        }
+// Produces the IL for the trace using the abstract interpreter and compiles it
+JittedCode* CompileWithInterpreter(PyjionJittedCode* trace, SpecializedTreeNode* target, PythonCompiler& jitter, bool& speculative, CompileStats& stats) {
+	AbstractInterpreter interp((PyCodeObject*)trace->j_code, &jitter);
 
-        if (res == nullptr) {
-#ifdef DEBUG_TRACE
-            printf("Compilation failure #%d\r\n", ++failCount);
+	// provide the interpreter information about the specialized types
+	for (size_t i = 0; i < target->types.size(); i++) {
+		interp.set_local_type(i, GetAbstractType(target->types[i]));
+	}
+
+	// speculate that locals which held a single type while we were
+	// interpreting will continue to do so, and that opcodes will keep
+	// producing the types the baseline code recorded
+	if (target->speculate) {
+		for (size_t i = target->types.size(); i < target->localTypes.size(); i++) {
+			interp.set_speculated_local_type(i, GetAbstractType(target->localTypes[i]));
+		}
+		interp.set_type_profile(trace->j_profile);
+	}
+	interp.set_elide_frame(target->elideFrame);
+
+	auto res = interp.compile();
+	speculative = interp.is_speculative();
+	stats.add(interp.get_stats());
+	return res;
+}
+
+// Checks if the code specialized for the target's argument types can run
+// without publishing its frame.  CanElideFrame has checked the code only works
+// on its arguments and constants, when they're all builtin scalars none of its
+// operations can dispatch to Python code which could look for the frame.
+bool CanElideNode(PyjionJittedCode* trace, SpecializedTreeNode* target) {
+	if (!trace->j_elide_frame) {
+		return false;
+	}
+	for (auto type : target->types) {
+		if (!is_scalar_type(GetAbstractType(type))) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Compiles the code specialized for the argument types recorded in target and
+// publishes the result.  The GIL must be held.  Background compiles release the
+// GIL while CoreCLR is generating the native code.
+bool CompileTrace(PyjionJittedCode* trace, SpecializedTreeNode* target, bool background) {
+	JittedCode* res = nullptr;
+	bool speculative = false, cached = false;
+	CompileStats stats;
+	ILCacheEntry entry;
+	target->elideFrame = CanElideNode(trace, target);
+	auto cacheKey = GetCacheKey(trace, target);
+	if (cacheKey != 0 && g_ilCache.load(cacheKey, entry)) {
+		// We've produced the IL for this code before, we only need CoreCLR
+		// to generate the native code.
+		PythonCompiler jitter((PyCodeObject*)trace->j_code, background);
+		if (jitter.load_il(entry)) {
+			res = jitter.emit_compile();
+			speculative = entry.Speculative;
+			cached = true;
+			stats.add(jitter.get_stats());
+		}
+	}
+
+	if (!cached) {
+		PythonCompiler jitter((PyCodeObject*)trace->j_code, background);
+		res = CompileWithInterpreter(trace, target, jitter, speculative, stats);
+		stats.add(jitter.get_stats());
+		if (res == nullptr && speculative) {
+			RecordCompile(trace, stats, false, false);
+			// We may not be able to resume in the interpreter from where
+			// we're guarding, try again without speculating.
+			target->speculate = false;
+			return CompileTrace(trace, target, background);
+		}
+
+		if (res != nullptr && cacheKey != 0 && jitter.save_il(entry)) {
+			entry.Speculative = speculative;
+			g_ilCache.store(cacheKey, entry);
+		}
+	}
+
+	RecordCompile(trace, stats, false, cached);
+
+	// Code with type guards only dispatches through this node so we can
+	// discard it if the guards keep failing.  Code which was analyzed with
+	// known argument types can only run when the arguments match.
+	bool isSpecialized = target->speculative = speculative;
+	for (size_t i = 0; i < target->types.size(); i++) {
+		if (GetAbstractType(target->types[i]) != AVK_Any) {
+			isSpecialized = true;
+		}
+	}
+#if DEBUG_TRACE
+	printf("Tracing %s from %s line %d %s\r\n",
+		PyUnicode_AsUTF8(((PyCodeObject*)trace->j_code)->co_name),
+		PyUnicode_AsUTF8(((PyCodeObject*)trace->j_code)->co_filename),
+		((PyCodeObject*)trace->j_code)->co_firstlineno,
+		isSpecialized ? "specialized" : ""
+	);
 #endif
-            return PyEval_EvalFrameDefault(frame, 0);
-        }
 
-        // Update the jitted information for this tree node
-        curNode->addr = (Py_EvalFunc)res->get_code_addr();
-        curNode->jittedCode = res;
-        if (!isSpecialized) {
-            trace->Generic = curNode->addr;
-            PyjionJittedCode* pyjionCode = (PyjionJittedCode*)frame->f_code->co_extra;
-            pyjionCode->j_evalfunc = Jit_EvalGeneric;
-        }
+	if (res == nullptr) {
+#if DEBUG_TRACE
+		static int failCount;
+		printf("Compilation failure #%d\r\n", ++failCount);
+#endif
+		trace->j_failed = true;
+		return false;
+	}
 
-        // And finally dispatch to the newly compiled code
-        return Jit_EvalHelper(curNode->addr, frame);
-    }
+	// Update the jitted information for this tree node.  The address is
+	// published last so a caller never sees a partially initialized node.
+	auto addr = (Py_EvalFunc)res->get_code_addr();
+	target->jittedCode = res;
+	target->owner = trace;
+	target->lastUsed = ++g_codeClock;
+	g_compiledTraces.push_back(target);
+	InterlockedExchangePointer((PVOID*)&target->addr, addr);
+	if (!isSpecialized) {
+		// We didn't produce a specialized function, force all code down
+		// the generic code path.
+		trace->j_generic = target;
+		MemoryBarrier();
+		trace->j_evalfunc = Jit_EvalGeneric;
+	}
+
+	if (g_execEngine.m_codeHeap.over_budget()) {
+		EvictColdTraces(target);
+	}
+	return true;
+}
+
+// Compiles the code w/o running the abstract interpreter and with CoreCLR's
+// optimizations disabled.  This gets code running natively quickly, and we'll
+// produce optimized code once the function has been called enough.
+bool CompileBaseline(PyjionJittedCode* trace) {
+	auto code = (PyCodeObject*)trace->j_code;
+	PythonCompiler jitter(code, false, true);
+	AbstractInterpreter interp(code, &jitter);
+
+	if (trace->j_profile == nullptr) {
+		trace->j_profile = new TypeProfile(PyBytes_GET_SIZE(code->co_code));
+	}
+	interp.set_type_profile(trace->j_profile);
+
+	auto res = interp.compile_baseline();
+	auto stats = interp.get_stats();
+	stats.add(jitter.get_stats());
+	RecordCompile(trace, stats, true, false);
+	if (res == nullptr) {
+		trace->j_baseline_failed = true;
+		return false;
+	}
+
+	trace->j_baseline_code = res;
+	trace->j_baseline = (Py_EvalFunc)res->get_code_addr();
+	return true;
+}
+
+// Compiles a generator or coroutine into code which can start it or resume it
+// at any of its yields.  Like the baseline tier we don't analyze types, so
+// there's only one version of the code, but it's optimized by CoreCLR as it
+// lives as long as the code object.
+bool CompileGenerator(PyjionJittedCode* trace) {
+	auto code = (PyCodeObject*)trace->j_code;
+	PythonCompiler jitter(code);
+	AbstractInterpreter interp(code, &jitter);
+
+	auto res = interp.compile_generator();
+	auto stats = interp.get_stats();
+	stats.add(jitter.get_stats());
+	RecordCompile(trace, stats, false, false);
+	if (res == nullptr) {
+		trace->j_failed = true;
+		return false;
+	}
+
+	trace->j_generator_code = res;
+	trace->j_generator = (Py_EvalGeneratorFunc)res->get_code_addr();
+	return true;
+}
+
+// The interpreter's handling of the exception state for generators, see
+// save_exc_state and restore_and_clear_exc_state in ceval.c.  We hold on
+// to the caller's exception state while the generator runs, and give it
+// back when the generator yields or finishes.
+static void SaveExcState(PyThreadState* tstate, PyFrameObject* frame) {
+	Py_XINCREF(tstate->exc_type);
+	Py_XINCREF(tstate->exc_value);
+	Py_XINCREF(tstate->exc_traceback);
+	auto type = frame->f_exc_type;
+	auto value = frame->f_exc_value;
+	auto traceback = frame->f_exc_traceback;
+	frame->f_exc_type = tstate->exc_type;
+	frame->f_exc_value = tstate->exc_value;
+	frame->f_exc_traceback = tstate->exc_traceback;
+	Py_XDECREF(type);
+	Py_XDECREF(value);
+	Py_XDECREF(traceback);
+}
+
+static void RestoreAndClearExcState(PyThreadState* tstate, PyFrameObject* frame) {
+	auto type = tstate->exc_type;
+	auto value = tstate->exc_value;
+	auto traceback = tstate->exc_traceback;
+	tstate->exc_type = frame->f_exc_type;
+	tstate->exc_value = frame->f_exc_value;
+	tstate->exc_traceback = frame->f_exc_traceback;
+	frame->f_exc_type = nullptr;
+	frame->f_exc_value = nullptr;
+	frame->f_exc_traceback = nullptr;
+	Py_XDECREF(type);
+	Py_XDECREF(value);
+	Py_XDECREF(traceback);
+}
+
+// Runs a generator or coroutine from gen_send_ex.  The frame is either new
+// or suspended at a yield by our code or the interpreter, which lay it out
+// the same way, so we can switch between them at any yield.
+PyObject* Jit_EvalGenerator(PyjionJittedCode* trace, PyFrameObject* frame, int throwflag) {
+	if (trace->j_generator == nullptr && !trace->j_failed &&
+		(trace->j_run_count++ >= trace->j_specialization_threshold || trace->j_has_loops)) {
+		CompileGenerator(trace);
+	}
+
+	PyThreadState *tstate = PyThreadState_GET();
+	if (trace->j_generator == nullptr || (tstate->use_tracing && tstate->c_tracefunc != NULL)) {
+		return _PyEval_EvalFrameDefault(frame, throwflag);
+	}
+
+	if (Py_EnterRecursiveCall("")) {
+		return NULL;
+	}
+
+	// We can't yield from inside an except handler, so unlike the interpreter
+	// we never have exception state of our own to swap back in.
+	SaveExcState(tstate, frame);
+	frame->f_executing = 1;
+	auto res = trace->j_generator(throwflag, frame);
+	frame->f_executing = 0;
+	RestoreAndClearExcState(tstate, frame);
+
+	Py_LeaveRecursiveCall();
+	return _Py_CheckFunctionResult(NULL, res, "Jit_EvalGenerator");
+}
+
+// Checks if the code has run enough in the baseline tier to be optimized
+bool IsOptimizable(PyjionJittedCode* trace) {
+	return !g_tieredCompile ||
+		trace->j_baseline_failed ||
+		trace->j_baseline_count >= trace->j_optimize_threshold;
+}
+
+DWORD WINAPI CompileThread(LPVOID param) {
+	while (true) {
+		EnterCriticalSection(&g_compileLock);
+		while (g_compileQueue.empty() && !g_compileStopping) {
+			SleepConditionVariableCS(&g_compileReady, &g_compileLock, INFINITE);
+		}
+		if (g_compileStopping) {
+			LeaveCriticalSection(&g_compileLock);
+			break;
+		}
+		auto request = g_compileQueue.front();
+		g_compileQueue.pop_front();
+		g_compileBusy = true;
+		LeaveCriticalSection(&g_compileLock);
+
+		auto gil = PyGILState_Ensure();
+		if (!request.trace->j_failed) {
+			CompileTrace(request.trace, request.target, true);
+		}
+		request.target->queued = false;
+		g_compileCompleted++;
+		Py_DECREF(request.trace->j_code);
+		g_compileBusy = false;
+		PyGILState_Release(gil);
+	}
+	return 0;
+}
+
+// Queues a trace to be compiled on the background thread.  The GIL must be held.
+void QueueCompile(PyjionJittedCode* trace, SpecializedTreeNode* target) {
+	target->queued = true;
+	Py_INCREF(trace->j_code);
+
+	EnterCriticalSection(&g_compileLock);
+	g_compileQueue.push_back(CompileRequest{ trace, target });
+	g_compileQueued++;
+	if (g_compileQueue.size() > g_compileQueueMaxDepth) {
+		g_compileQueueMaxDepth = g_compileQueue.size();
+	}
+	LeaveCriticalSection(&g_compileLock);
+	WakeConditionVariable(&g_compileReady);
+}
+
+bool StartCompileThread() {
+	if (g_compileThread != nullptr) {
+		return true;
+	}
+
+	// The compile thread acquires the GIL so we need threading support
+	PyEval_InitThreads();
+	g_compileThread = CreateThread(nullptr, 0, CompileThread, nullptr, 0, nullptr);
+	return g_compileThread != nullptr;
+}
+
+// Asks the compile thread to exit and waits for it to finish the request it's
+// working on.  Requests it hasn't started are dropped, their traces get queued
+// again the next time they're called.  The GIL must be held.
+void StopCompileThread() {
+	g_asyncCompile = false;
+	if (g_compileThread == nullptr) {
+		return;
+	}
+
+	EnterCriticalSection(&g_compileLock);
+	g_compileStopping = true;
+	LeaveCriticalSection(&g_compileLock);
+	WakeConditionVariable(&g_compileReady);
+
+	Py_BEGIN_ALLOW_THREADS
+	WaitForSingleObject(g_compileThread, INFINITE);
+	Py_END_ALLOW_THREADS
+
+	CloseHandle(g_compileThread);
+	g_compileThread = nullptr;
+	// During finalization the thread exits when it tries to take the GIL,
+	// possibly in the middle of a request.
+	g_compileStopping = false;
+	g_compileBusy = false;
+
+	deque<CompileRequest> pending;
+	EnterCriticalSection(&g_compileLock);
+	pending.swap(g_compileQueue);
+	LeaveCriticalSection(&g_compileLock);
+
+	// Releasing a code object can free its traces, so finish with the
+	// traces before dropping any references.
+	vector<PyObject*> codes;
+	for (auto& request : pending) {
+		request.target->queued = false;
+		codes.push_back(request.trace->j_code);
+	}
+	for (auto code : codes) {
+		Py_DECREF(code);
+	}
+}
+
+extern "C" __declspec(dllexport) bool PyJit_SetAsyncCompile(bool enabled) {
+	if (!enabled) {
+		StopCompileThread();
+		return true;
+	}
+	if (!StartCompileThread()) {
+		return false;
+	}
+	g_asyncCompile = true;
+	return true;
+}
+
+extern "C" __declspec(dllexport) void PyJit_GetCompileQueueStats(CompileQueueStats* stats) {
+	EnterCriticalSection(&g_compileLock);
+	stats->Depth = g_compileQueue.size();
+	LeaveCriticalSection(&g_compileLock);
+	stats->MaxDepth = g_compileQueueMaxDepth;
+	stats->Queued = g_compileQueued;
+	stats->Completed = g_compileCompleted;
+}
+
+extern "C" __declspec(dllexport) void PyJit_WaitForCompiles() {
+	while (g_compileThread != nullptr) {
+		EnterCriticalSection(&g_compileLock);
+		bool idle = g_compileQueue.empty() && !g_compileBusy;
+		LeaveCriticalSection(&g_compileLock);
+		if (idle) {
+			break;
+		}
+
+		Py_BEGIN_ALLOW_THREADS
+		Sleep(1);
+		Py_END_ALLOW_THREADS
+	}
+}
+
+PyObject* Jit_EvalTrace(PyjionJittedCode* state, PyFrameObject *frame) {
+	// Walk our tree of argument types to find the SpecializedTreeNode which
+    // corresponds with our sets of arguments here.
+    auto trace = (PyjionJittedCode*)state;
+
+#ifdef TRACE_TREE
+	// Each argument's type selects a child, the leaf is the trace for the
+	// frame's argument types.
+	if (trace->funcs == nullptr) {
+		vector<PyTypeObject*> types;
+		trace->funcs = new SpecializedTreeNode(types);
+	}
+	SpecializedTreeNode* target = trace->funcs;
+	int argCount = frame->f_code->co_argcount + frame->f_code->co_kwonlyargcount;
+	for (int i = 0; i < argCount; i++) {
+		target = target->getNextNode(GetArgType(i, frame->f_localsplus));
+	}
 #else
 
-	SpecializedTreeNode* target = nullptr;
-    for (auto cur = trace->j_optimized.begin(); cur != trace->j_optimized.end() && target == nullptr; cur++) {
-        PyObject** locals = frame->f_localsplus;
-
-		target = *cur;
-        for (auto type = target->types.begin(); type != target->types.end(); type++, locals++) {
-            PyTypeObject *argType = nullptr;
-            if (*locals != nullptr) {
-                argType = (*locals)->ob_type;
-                // We currently only generate optimal code for ints and floats,
-                // so don't bother specializing on other types...
-                if (argType != &PyLong_Type && argType != &PyFloat_Type) {
-                    argType = nullptr;
-                }
-            }
-
-            if (*type != argType) {
-				target = nullptr;
-                break;
-            }
-        }
-    }
+	// Hash the argument types and check the last trace we dispatched to
+	// before falling back to probing the dispatch cache.
+	PyObject** locals = frame->f_localsplus;
+	int argCount = frame->f_code->co_argcount + frame->f_code->co_kwonlyargcount;
+	auto signature = HashArgTypes(locals, argCount);
+
+	SpecializedTreeNode* target = trace->j_monomorphic;
+	if (target == nullptr || target->signature != signature || !target->matches(locals)) {
+		target = nullptr;
+		for (size_t i = signature & (DISPATCH_CACHE_SIZE - 1); trace->j_dispatch[i] != nullptr; i = (i + 1) & (DISPATCH_CACHE_SIZE - 1)) {
+			auto cur = trace->j_dispatch[i];
+			if (cur->signature == signature && cur->matches(locals)) {
+				target = cur;
+				trace->j_monomorphic = cur;
+				break;
+			}
+		}
+	}
 
     // record the new trace...
     if (target == nullptr && trace->j_optimized.size() < MAX_TRACE) {
-        int argCount = frame->f_code->co_argcount + frame->f_code->co_kwonlyargcount;
         vector<PyTypeObject*> types;
         for (int i = 0; i < argCount; i++) {
-            auto type = GetArgType(i, frame->f_localsplus);
+            auto type = GetArgType(i, locals);
             types.push_back(type);
         }
-		target = new SpecializedTreeNode(types);
+		target = new SpecializedTreeNode(types, signature);
         trace->j_optimized.push_back(target);
+		trace->j_monomorphic = target;
+
+		auto i = signature & (DISPATCH_CACHE_SIZE - 1);
+		while (trace->j_dispatch[i] != nullptr) {
+			i = (i + 1) & (DISPATCH_CACHE_SIZE - 1);
+		}
+		trace->j_dispatch[i] = target;
 	}
 #endif
 
 	if (target != nullptr && !trace->j_failed) {
+		if (target->addr != nullptr && target->speculative && trace->j_deopt_count > MAX_DEOPT) {
+			// Our type guards keep failing, throw away the code.  If the
+			// runs which deoptimized showed us locals changing type we try
+			// again without speculating on those, otherwise we produce code
+			// which doesn't speculate.  Each retry forgets at least one
+			// local's type, so this can't go on forever.
+			ReleaseTrace(trace, target);
+			target->speculative = false;
+			target->speculate = target->speculate && target->refined;
+			target->refined = false;
+			target->hitCount = 0;
+			trace->j_deopt_count = 0;
+		}
+
 		if (target->addr != nullptr) {
 			// we have a specialized function for this, just invoke it
-			auto res = Jit_EvalHelper(target->addr, frame);
+			auto res = Jit_EvalOptimized(trace, target, frame);
 			return res;
 		}
 
 		target->hitCount++;
 		// we've recorded these types before...
 		// No specialized function yet, let's see if we should create one...
-		if (target->hitCount >= trace->j_specialization_threshold) {
-			// Compile and run the now compiled code...
-			PythonCompiler jitter((PyCodeObject*)trace->j_code);
-			AbstractInterpreter interp((PyCodeObject*)trace->j_code, &jitter);
-			int argCount = frame->f_code->co_argcount + frame->f_code->co_kwonlyargcount;
-
-			// provide the interpreter information about the specialized types
-			for (int i = 0; i < argCount; i++) {
-				auto type = GetAbstractType(GetArgType(i, frame->f_localsplus));
-				interp.set_local_type(i, type);
-			}
-
-			auto res = interp.compile();
-			bool isSpecialized = false;
-			for (int i = 0; i < argCount; i++) {
-				auto type = GetAbstractType(GetArgType(i, frame->f_localsplus));
-				if (type == AVK_Integer || type == AVK_Float) {
-					if (!interp.get_local_info(0, i).ValueInfo.needs_boxing()) {
-						isSpecialized = true;
-					}
+		if (target->hitCount >= trace->j_specialization_threshold && IsOptimizable(trace)) {
+			if (g_asyncCompile) {
+				// Let the compile thread produce the code, we'll pick it up
+				// on a later call and keep interpreting until then.
+				if (!target->queued) {
+					QueueCompile(trace, target);
 				}
 			}
-#if DEBUG_TRACE
-			printf("Tracing %s from %s line %d %s\r\n",
-				PyUnicode_AsUTF8(frame->f_code->co_name),
-				PyUnicode_AsUTF8(frame->f_code->co_filename),
-				frame->f_code->co_firstlineno,
-				isSpecialized ? "specialized" : ""
-			);
-#endif
-
-			if (res == nullptr) {
-#if DEBUG_TRACE
-				static int failCount;
-				printf("Compilation failure #%d\r\n", ++failCount);
-#endif
-				trace->j_failed = true;
-				return _PyEval_EvalFrameDefault(frame, 0);
+			else if (CompileTrace(trace, target, false)) {
+				return Jit_EvalOptimized(trace, target, frame);
 			}
+			else {
+				return PyJit_EvalFrameInterpreted(frame);
+			}
+		}
+	}
+
+	if (g_tieredCompile && !trace->j_failed) {
+		if (trace->j_baseline == nullptr && !trace->j_baseline_failed) {
+			CompileBaseline(trace);
+		}
 
-			// Update the jitted information for this tree node
-			target->addr = (Py_EvalFunc)res->get_code_addr();
-			//opt->jittedCode = res;
-			if (!isSpecialized) {
-				// We didn't produce a specialized function, force all code down
-				// the generic code path.
-				trace->j_generic = target->addr;
-				trace->j_evalfunc = Jit_EvalGeneric;
+		if (trace->j_baseline != nullptr) {
+			trace->j_baseline_count++;
+			auto res = Jit_EvalHelper(trace->j_baseline, frame);
+			if (target != nullptr && target->addr == nullptr) {
+				target->observe_locals(frame);
 			}
-			
-			return Jit_EvalHelper(target->addr, frame);
+			return res;
 		}
 	}
 
@@ -416,7 +1003,10 @@ PyObject* Jit_EvalTrace(PyjionJittedCode* state, PyFrameObject *frame) {
 		frame
 	);
 #endif
-	auto res = _PyEval_EvalFrameDefault(frame, 0);
+	auto res = PyJit_EvalFrameInterpreted(frame);
+	if (target != nullptr && target->addr == nullptr && !PyJit_IsElidedFrame(frame)) {
+		target->observe_locals(frame);
+	}
 #ifdef DEBUG_CALL_TRACE
     printf("Returning default %s from %s line %d %s %p\r\n",
 		PyUnicode_AsUTF8(frame->f_code->co_name),
@@ -429,8 +1019,11 @@ PyObject* Jit_EvalTrace(PyjionJittedCode* state, PyFrameObject *frame) {
 }
 
 __declspec(dllexport) bool jit_compile(PyCodeObject* code) {
-	if (strcmp(PyUnicode_AsUTF8(code->co_name), "<module>") == 0 ||
-		strcmp(PyUnicode_AsUTF8(code->co_name), "<genexpr>") == 0) {
+	auto jittedCode = PyJit_EnsureExtra((PyObject*)code);
+
+	// Module bodies only run once, so they're only worth compiling when
+	// they contain a loop.
+	if (IsModuleCode(code) && !jittedCode->j_has_loops) {
         return false;
     }
 #ifdef DEBUG_TRACE
@@ -443,8 +1036,6 @@ __declspec(dllexport) bool jit_compile(PyCodeObject* code) {
         failCount);
 #endif
 
-	auto jittedCode = PyJit_EnsureExtra((PyObject*)code);
-
 	jittedCode->j_evalfunc = &Jit_EvalTrace;
     return true;
 }
@@ -452,6 +1043,81 @@ __declspec(dllexport) bool jit_compile(PyCodeObject* code) {
 #endif
 
 
+// Checks if the code has a backwards jump.  CPython doesn't give us a hook to
+// count backedges in the interpreter and take over a running frame, so code
+// with a loop is compiled the first time it's entered instead of waiting for
+// the call count to cross the threshold.  It starts in the baseline tier like
+// other code.
+bool HasLoops(PyCodeObject* code) {
+	auto byteCode = (_Py_CODEUNIT *)PyBytes_AS_STRING(code->co_code);
+	auto size = PyBytes_Size(code->co_code) / sizeof(_Py_CODEUNIT);
+	int oparg = 0;
+	for (Py_ssize_t i = 0; i < size; i++) {
+		oparg = (oparg << 8) | _Py_OPARG(byteCode[i]);
+		switch (_Py_OPCODE(byteCode[i])) {
+			case EXTENDED_ARG:
+				continue;
+			case JUMP_ABSOLUTE:
+			case CONTINUE_LOOP:
+			case POP_JUMP_IF_FALSE:
+			case POP_JUMP_IF_TRUE:
+			case JUMP_IF_FALSE_OR_POP:
+			case JUMP_IF_TRUE_OR_POP:
+				if (oparg <= i * sizeof(_Py_CODEUNIT)) {
+					return true;
+				}
+				break;
+		}
+		oparg = 0;
+	}
+	return false;
+}
+
+// Checks if the code can run without publishing its frame to the thread state.
+// Nothing running below the code can find the frame, so the only references to
+// it come from tracebacks for exceptions leaving the code, and from the
+// interpreter if we deoptimize, and we move the frame to the heap for those.
+// The code can't call anything, as the callee would find our caller's frame
+// in place of ours.  Operators and attributes can call Python code too, so
+// the code can only load its arguments and constants, and CanElideNode checks
+// the types of the arguments.
+bool CanElideFrame(PyCodeObject* code) {
+	if ((code->co_flags & ~PyCF_MASK) != (CO_OPTIMIZED | CO_NEWLOCALS | CO_NOFREE) ||
+		AbstractInterpreter::inspects_frame(code)) {
+		return false;
+	}
+
+	// Handled exceptions can save a traceback referring to the frame, and
+	// imports look up the importing module's globals from the current frame.
+	// Globals could be anything, and releasing one when it's replaced could
+	// run a finalizer.
+	auto byteCode = (_Py_CODEUNIT *)PyBytes_AS_STRING(code->co_code);
+	auto size = PyBytes_Size(code->co_code) / sizeof(_Py_CODEUNIT);
+	for (Py_ssize_t i = 0; i < size; i++) {
+		switch (_Py_OPCODE(byteCode[i])) {
+			case SETUP_EXCEPT:
+			case SETUP_FINALLY:
+			case SETUP_WITH:
+			case SETUP_ASYNC_WITH:
+			case IMPORT_NAME:
+			case IMPORT_STAR:
+			case CALL_FUNCTION:
+			case CALL_FUNCTION_KW:
+			case CALL_FUNCTION_EX:
+			case LOAD_GLOBAL:
+			case STORE_GLOBAL:
+			case DELETE_GLOBAL:
+			case LOAD_NAME:
+			case STORE_NAME:
+			case DELETE_NAME:
+			case LOAD_CLASSDEREF:
+			case LOAD_BUILD_CLASS:
+				return false;
+		}
+	}
+	return true;
+}
+
 extern "C" __declspec(dllexport) PyjionJittedCode* PyJit_EnsureExtra(PyObject* codeObject) {
 	ssize_t index = (ssize_t)TlsGetValue(g_extraSlot);
 	if (index == 0) {
@@ -475,6 +1141,19 @@ extern "C" __declspec(dllexport) PyjionJittedCode* PyJit_EnsureExtra(PyObject* c
 	if (jitted == nullptr) {
 	    jitted = new PyjionJittedCode(codeObject);
 		if (jitted != nullptr) {
+			if (HasLoops((PyCodeObject*)codeObject)) {
+				jitted->j_has_loops = true;
+				// A module body only ever runs once, so it won't get another
+				// chance at optimized code.
+				if (IsModuleCode((PyCodeObject*)codeObject)) {
+					jitted->j_specialization_threshold = 0;
+					jitted->j_optimize_threshold = 0;
+				}
+			}
+			if (g_frameElision && CanElideFrame((PyCodeObject*)codeObject)) {
+				jitted->j_elide_frame = true;
+			}
+
 			if (_PyCode_SetExtra(codeObject, index, jitted)) {
 				PyErr_Clear();
 
@@ -494,6 +1173,14 @@ extern "C" __declspec(dllexport) PyObject *PyJit_EvalFrame(PyFrameObject *f, int
 	auto err = GetLastError();
 
 	auto jitted = PyJit_EnsureExtra((PyObject*)f->f_code);
+	if (jitted != nullptr &&
+		(f->f_code->co_flags & (CO_GENERATOR | CO_COROUTINE)) &&
+		!(f->f_code->co_flags & CO_ASYNC_GENERATOR)) {
+		// Generators are resumed with exceptions thrown into them, so they
+		// handle the throw flag themselves.
+		SetLastError(err);
+		return Jit_EvalGenerator(jitted, f, throwflag);
+	}
 	if (jitted != nullptr && !throwflag) {
 		if (jitted->j_evalfunc != nullptr) {
 			SetLastError(err);
@@ -507,7 +1194,7 @@ extern "C" __declspec(dllexport) PyObject *PyJit_EvalFrame(PyFrameObject *f, int
 #endif
 			return jitted->j_evalfunc(jitted, f);
 		}
-		else if (!jitted->j_failed && jitted->j_run_count++ >= jitted->j_specialization_threshold) {
+		else if (!jitted->j_failed && (jitted->j_run_count++ >= jitted->j_specialization_threshold || jitted->j_has_loops)) {
 			if (jit_compile(f->f_code)) {
 				// execute the jitted code...
 				SetLastError(err);
@@ -548,6 +1235,276 @@ extern "C" __declspec(dllexport) PyObject *PyJit_EvalFrame(PyFrameObject *f, int
 	return res;
 }
 
+// Fills in a call site's cache for a function whose code has been (or is
+// going to be) jitted and which we can bind the arguments of ourselves.
+// Returns false if the call should go through the normal call path.
+static bool FillCallCache(PyObject* target, size_t argCount, CallCache* cache) {
+	if (cache->Misses > CALL_CACHE_MAX_MISSES || !PyFunction_Check(target)) {
+		return false;
+	}
+
+	auto code = (PyCodeObject*)PyFunction_GET_CODE(target);
+	if ((size_t)code->co_argcount != argCount || code->co_kwonlyargcount != 0 ||
+		(code->co_flags & ~PyCF_MASK) != (CO_OPTIMIZED | CO_NEWLOCALS | CO_NOFREE)) {
+		return false;
+	}
+
+	auto trace = PyJit_EnsureExtra((PyObject*)code);
+	if (trace == nullptr || trace->j_evalfunc == nullptr) {
+		return false;
+	}
+
+	auto function = PyWeakref_NewRef(target, nullptr);
+	if (function == nullptr) {
+		PyErr_Clear();
+		return false;
+	}
+	auto codeRef = PyWeakref_NewRef((PyObject*)code, nullptr);
+	if (codeRef == nullptr) {
+		PyErr_Clear();
+		Py_DECREF(function);
+		return false;
+	}
+
+	if (cache->Function != nullptr) {
+		cache->Misses++;
+	}
+	Py_XDECREF(cache->Function);
+	Py_XDECREF(cache->Code);
+	cache->Function = function;
+	cache->Code = codeRef;
+	cache->Trace = trace;
+	cache->Target = nullptr;
+	return true;
+}
+
+// Frames for direct calls to code which doesn't publish its frame live on the
+// caller's native stack.  We don't elide frames which would use too much of
+// the stack.
+#define ELIDED_FRAME_MAX_SIZE 1024
+
+// Finds the builtins for a new frame the way PyFrame_New does, sharing them
+// with the calling frame if it has the same globals.  Returns a borrowed
+// reference, or nullptr if the globals don't have any builtins.
+static PyObject* GetFrameBuiltins(PyThreadState* tstate, PyObject* globals) {
+	_Py_IDENTIFIER(__builtins__);
+
+	auto back = tstate->frame;
+	if (back != nullptr && back->f_globals == globals) {
+		return back->f_builtins;
+	}
+
+	auto builtins = _PyDict_GetItemId(globals, &PyId___builtins__);
+	if (builtins != nullptr && PyModule_Check(builtins)) {
+		builtins = PyModule_GetDict(builtins);
+	}
+	return builtins;
+}
+
+// Initializes a frame on the native stack the way PyFrame_New would.  The
+// buffer starts with a GC header which is never tracked, as objects which
+// refer to the frame may still be visited by the GC.
+static PyFrameObject* InitElidedFrame(void* buffer, PyThreadState* tstate, PyCodeObject* code, PyObject* globals, PyObject* builtins) {
+	auto gc = (PyGC_Head*)buffer;
+	gc->gc.gc_next = gc->gc.gc_prev = nullptr;
+	gc->gc.gc_refs = 0;
+	_PyGCHead_SET_REFS(gc, _PyGC_REFS_UNTRACKED);
+
+	auto frame = (PyFrameObject*)(gc + 1);
+	auto extras = code->co_nlocals + code->co_stacksize;
+	PyObject_INIT_VAR(frame, &PyFrame_Type, extras);
+
+	auto back = tstate->frame;
+	Py_XINCREF(back);
+	Py_INCREF(code);
+	Py_INCREF(builtins);
+	Py_INCREF(globals);
+	frame->f_back = back;
+	frame->f_code = code;
+	frame->f_builtins = builtins;
+	frame->f_globals = globals;
+	frame->f_locals = nullptr;
+	frame->f_valuestack = frame->f_localsplus + code->co_nlocals;
+	frame->f_stacktop = frame->f_valuestack;
+	frame->f_trace = nullptr;
+	frame->f_exc_type = frame->f_exc_value = frame->f_exc_traceback = nullptr;
+	frame->f_gen = nullptr;
+	frame->f_lasti = -1;
+	frame->f_lineno = code->co_firstlineno;
+	frame->f_iblock = 0;
+	frame->f_executing = 0;
+	memset(frame->f_localsplus, 0, extras * sizeof(PyObject*));
+	g_frameElisionStats.Elided++;
+	return frame;
+}
+
+PyFrameObject* PyJit_MaterializeFrame(PyFrameObject* frame) {
+	auto heap = PyFrame_New(PyThreadState_GET(), frame->f_code, frame->f_globals, nullptr);
+	if (heap == nullptr) {
+		return nullptr;
+	}
+
+	Py_XINCREF(frame->f_back);
+	Py_XDECREF(heap->f_back);
+	heap->f_back = frame->f_back;
+
+	// The heap frame takes ownership of the locals and values
+	for (int i = 0; i < frame->f_code->co_nlocals; i++) {
+		heap->f_localsplus[i] = frame->f_localsplus[i];
+		frame->f_localsplus[i] = nullptr;
+	}
+	if (frame->f_stacktop == nullptr) {
+		heap->f_stacktop = nullptr;
+	}
+	else {
+		for (auto value = frame->f_valuestack; value < frame->f_stacktop; value++) {
+			*heap->f_stacktop++ = *value;
+		}
+		frame->f_stacktop = frame->f_valuestack;
+	}
+
+	memcpy(heap->f_blockstack, frame->f_blockstack, frame->f_iblock * sizeof(PyTryBlock));
+	heap->f_iblock = frame->f_iblock;
+	heap->f_lasti = frame->f_lasti;
+	heap->f_lineno = frame->f_lineno;
+	g_frameElisionStats.Materialized++;
+	return heap;
+}
+
+// Releases a frame on the native stack once the call has returned.  If the
+// exception leaving the call has a traceback which refers to the frame we move
+// it to the heap first.
+static void ReleaseElidedFrame(PyFrameObject* frame) {
+	if (Py_REFCNT(frame) != 1) {
+		PyObject *type, *value, *traceback;
+		PyErr_Fetch(&type, &value, &traceback);
+		auto heap = PyJit_MaterializeFrame(frame);
+		if (heap == nullptr) {
+			Py_FatalError("Pyjion: unable to materialize an elided frame");
+		}
+		for (auto tb = (PyTracebackObject*)traceback; tb != nullptr; tb = tb->tb_next) {
+			if (tb->tb_frame == frame) {
+				Py_INCREF(heap);
+				tb->tb_frame = heap;
+				Py_DECREF(frame);
+			}
+		}
+		Py_DECREF(heap);
+		PyErr_Restore(type, value, traceback);
+
+		if (Py_REFCNT(frame) != 1) {
+			Py_FatalError("Pyjion: elided frame escaped");
+		}
+	}
+
+	for (int i = 0; i < frame->f_code->co_nlocals; i++) {
+		Py_CLEAR(frame->f_localsplus[i]);
+	}
+	if (frame->f_stacktop != nullptr) {
+		for (auto value = frame->f_valuestack; value < frame->f_stacktop; value++) {
+			Py_XDECREF(*value);
+		}
+	}
+	Py_XDECREF(frame->f_back);
+	Py_DECREF(frame->f_code);
+	Py_DECREF(frame->f_builtins);
+	Py_DECREF(frame->f_globals);
+	Py_XDECREF(frame->f_locals);
+	Py_XDECREF(frame->f_trace);
+	_Py_DEC_REFTOTAL;
+	_Py_ForgetReference((PyObject*)frame);
+}
+
+#if !defined(NO_TRACE) && !defined(TRACE_TREE)
+// Gets the trace we last dispatched to from the call site if the argument
+// types still match it, or nullptr.
+static SpecializedTreeNode* GetCachedTarget(CallCache* cache, PyObject** args, size_t argCount) {
+	auto trace = cache->Trace;
+	auto node = cache->Target;
+	if (node != nullptr && node->addr != nullptr && !(node->speculative && trace->j_deopt_count > MAX_DEOPT) &&
+		(node == trace->j_generic ||
+		(node->signature == HashArgTypes(args, (int)argCount) && node->matches(args)))) {
+		return node;
+	}
+	return nullptr;
+}
+
+// Runs the jitted code for a direct call, the trace from GetCachedTarget if
+// there was one.
+static PyObject* RunCallCached(CallCache* cache, SpecializedTreeNode* node, PyFrameObject* frame) {
+	auto trace = cache->Trace;
+	PyObject* res;
+	if (node != nullptr) {
+		cache->Hits++;
+		g_inlineCacheStats.CallHits++;
+		res = Jit_EvalOptimized(trace, node, frame);
+	}
+	else {
+		res = trace->j_evalfunc(trace, frame);
+		cache->Target = trace->j_evalfunc == Jit_EvalGeneric ? trace->j_generic : trace->j_monomorphic;
+	}
+	return res;
+}
+#endif
+
+PyObject* PyJit_CallCached(PyObject* target, PyObject** args, size_t argCount, CallCache* cache) {
+#if !defined(NO_TRACE) && !defined(TRACE_TREE)
+	// Once the JIT has been disabled code which is still running makes its
+	// calls through the interpreter like everything else.
+	if (PyThreadState_GET()->interp->eval_frame == PyJit_EvalFrame &&
+		((cache->Function != nullptr && PyWeakref_GET_OBJECT(cache->Function) == target &&
+		PyFunction_GET_CODE(target) == PyWeakref_GET_OBJECT(cache->Code)) || FillCallCache(target, argCount, cache))) {
+		// Build the frame like fast_function does and run the jitted code for
+		// it directly, skipping the frame evaluation hook and, when the site
+		// keeps calling with the same argument types, the dispatch cache.
+		auto tstate = PyThreadState_GET();
+		auto code = (PyCodeObject*)PyFunction_GET_CODE(target);
+		auto globals = PyFunction_GET_GLOBALS(target);
+		PyObject* res;
+
+		// When the code we'll run won't publish its frame it can live on our stack
+		auto node = GetCachedTarget(cache, args, argCount);
+		auto frameSize = sizeof(PyFrameObject) + (code->co_nlocals + code->co_stacksize) * sizeof(PyObject*);
+		PyObject* builtins;
+		if (node != nullptr && node->elideFrame && frameSize <= ELIDED_FRAME_MAX_SIZE &&
+			(builtins = GetFrameBuiltins(tstate, globals)) != nullptr) {
+			auto frame = InitElidedFrame(_alloca(sizeof(PyGC_Head) + frameSize), tstate, code, globals, builtins);
+			for (size_t i = 0; i < argCount; i++) {
+				frame->f_localsplus[i] = args[i];
+			}
+
+			res = RunCallCached(cache, node, frame);
+			ReleaseElidedFrame(frame);
+			Py_DECREF(target);
+			return res;
+		}
+
+		auto frame = PyFrame_New(tstate, code, globals, nullptr);
+		if (frame == nullptr) {
+			for (size_t i = 0; i < argCount; i++) {
+				Py_DECREF(args[i]);
+			}
+			Py_DECREF(target);
+			return nullptr;
+		}
+
+		for (size_t i = 0; i < argCount; i++) {
+			frame->f_localsplus[i] = args[i];
+		}
+
+		res = RunCallCached(cache, node, frame);
+
+		++tstate->recursion_depth;
+		Py_DECREF(frame);
+		--tstate->recursion_depth;
+		Py_DECREF(target);
+		return res;
+	}
+	g_inlineCacheStats.CallMisses++;
+#endif
+	return PyJit_KwCallArray(target, args, argCount, nullptr);
+}
+
 void PyjionJitFree(void* obj) {
 	PyjionJittedCode* function = (PyjionJittedCode*)obj;
 #ifdef NO_TRACE
@@ -591,6 +1548,51 @@ static PyObject *pyjion_status(PyObject *self, PyObject* args) {
     Py_RETURN_FALSE;
 }
 
+// Stores value in the dictionary and releases our reference to it
+static void SetDictItem(PyObject* dict, const char* name, PyObject* value) {
+	if (value != nullptr) {
+		PyDict_SetItemString(dict, name, value);
+		Py_DECREF(value);
+	}
+}
+
+static PyObject* TicksToSeconds(LONGLONG ticks) {
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	return PyFloat_FromDouble((double)ticks / frequency.QuadPart);
+}
+
+// Adds the compilation totals to a stats or info dictionary
+static void AddJitStats(PyObject* res, JitStats& stats) {
+	SetDictItem(res, "compiles", PyLong_FromSize_t(stats.Compiles));
+	SetDictItem(res, "baseline_compiles", PyLong_FromSize_t(stats.BaselineCompiles));
+	SetDictItem(res, "cached_compiles", PyLong_FromSize_t(stats.CachedCompiles));
+
+	auto failures = PyDict_New();
+	if (failures != nullptr) {
+		for (int i = CF_None + 1; i < CF_Count; i++) {
+			if (stats.Failures[i] != 0) {
+				SetDictItem(failures, compile_failure_name((CompileFailure)i), PyLong_FromSize_t(stats.Failures[i]));
+			}
+		}
+		SetDictItem(res, "failures", failures);
+	}
+
+	SetDictItem(res, "interpret_time", TicksToSeconds(stats.InterpretTime));
+	SetDictItem(res, "il_gen_time", TicksToSeconds(stats.ILGenTime));
+	SetDictItem(res, "compile_method_time", TicksToSeconds(stats.NativeTime));
+	SetDictItem(res, "il_size", PyLong_FromSize_t(stats.ILSize));
+	SetDictItem(res, "native_size", PyLong_FromSize_t(stats.NativeSize));
+
+	auto inlining = PyDict_New();
+	if (inlining != nullptr) {
+		for (int i = 0; i < ID_Count; i++) {
+			SetDictItem(inlining, inline_decision_name((InlineDecision)i), PyLong_FromSize_t(stats.Inlining[i]));
+		}
+		SetDictItem(res, "inlining", inlining);
+	}
+}
+
 static PyObject *pyjion_info(PyObject *self, PyObject* func) {
 	PyObject* code;
 	if (PyFunction_Check(func)) {
@@ -612,14 +1614,111 @@ static PyObject *pyjion_info(PyObject *self, PyObject* func) {
 
 	PyDict_SetItemString(res, "failed", jitted->j_failed ? Py_True : Py_False);
 	PyDict_SetItemString(res, "compiled", jitted->j_evalfunc != nullptr ? Py_True : Py_False);
+	PyDict_SetItemString(res, "has_loops", jitted->j_has_loops ? Py_True : Py_False);
+	PyDict_SetItemString(res, "elide_frame", jitted->j_elide_frame ? Py_True : Py_False);
+	PyDict_SetItemString(res, "baseline", jitted->j_baseline != nullptr ? Py_True : Py_False);
+	PyDict_SetItemString(res, "generator", jitted->j_generator != nullptr ? Py_True : Py_False);
 	
 	auto runCount = PyLong_FromLongLong(jitted->j_run_count);
 	PyDict_SetItemString(res, "run_count", runCount);
 	Py_DECREF(runCount);
+
+	auto baselineCount = PyLong_FromLongLong(jitted->j_baseline_count);
+	PyDict_SetItemString(res, "baseline_count", baselineCount);
+	Py_DECREF(baselineCount);
+
+	// Executable memory held by the baseline and optimized code
+	size_t codeSize = 0;
+	if (jitted->j_baseline_code != nullptr) {
+		codeSize += jitted->j_baseline_code->get_code_size();
+	}
+	if (jitted->j_generator_code != nullptr) {
+		codeSize += jitted->j_generator_code->get_code_size();
+	}
+#ifndef TRACE_TREE
+	for (auto target : jitted->j_optimized) {
+		if (target->jittedCode != nullptr) {
+			codeSize += target->jittedCode->get_code_size();
+		}
+	}
+#endif
+	auto codeSizeValue = PyLong_FromSize_t(codeSize);
+	PyDict_SetItemString(res, "code_size", codeSizeValue);
+	Py_DECREF(codeSizeValue);
+
+	AddJitStats(res, jitted->j_stats);
+	if (jitted->j_failure != CF_None) {
+		SetDictItem(res, "last_failure", PyUnicode_FromString(compile_failure_name(jitted->j_failure)));
+		if (jitted->j_failure_opcode != -1) {
+			SetDictItem(res, "last_failure_opcode", PyUnicode_FromString(AbstractInterpreter::opcode_name(jitted->j_failure_opcode)));
+		}
+	}
+
+#ifndef TRACE_TREE
+	// The argument types each trace was specialized for and how often it ran
+	auto specializations = PyList_New(0);
+	if (specializations != nullptr) {
+		for (auto target : jitted->j_optimized) {
+			auto spec = PyDict_New();
+			if (spec == nullptr) {
+				break;
+			}
+
+			auto types = PyTuple_New(target->types.size());
+			if (types != nullptr) {
+				for (size_t i = 0; i < target->types.size(); i++) {
+					auto type = target->types[i] == nullptr ? Py_None : (PyObject*)target->types[i];
+					Py_INCREF(type);
+					PyTuple_SET_ITEM(types, i, type);
+				}
+				SetDictItem(spec, "types", types);
+			}
+			PyDict_SetItemString(spec, "compiled", target->addr != nullptr ? Py_True : Py_False);
+			PyDict_SetItemString(spec, "speculative", target->speculative ? Py_True : Py_False);
+			SetDictItem(spec, "hit_count", PyLong_FromLong(target->hitCount));
+			SetDictItem(spec, "call_count", PyLong_FromUnsignedLongLong(target->callCount));
+
+			PyList_Append(specializations, spec);
+			Py_DECREF(spec);
+		}
+		SetDictItem(res, "specializations", specializations);
+	}
+#endif
 	
 	return res;
 }
 
+static PyObject *pyjion_stats(PyObject *self, PyObject* args) {
+	auto res = PyDict_New();
+	if (res == nullptr) {
+		return nullptr;
+	}
+
+	AddJitStats(res, g_jitStats);
+
+	auto opcodes = PyDict_New();
+	if (opcodes != nullptr) {
+		for (int i = 0; i < _countof(g_opcodeFailures); i++) {
+			if (g_opcodeFailures[i] != 0) {
+				SetDictItem(opcodes, AbstractInterpreter::opcode_name(i), PyLong_FromSize_t(g_opcodeFailures[i]));
+			}
+		}
+		SetDictItem(res, "opcode_failures", opcodes);
+	}
+
+	SetDictItem(res, "attr_cache_hits", PyLong_FromSize_t(g_inlineCacheStats.AttrHits));
+	SetDictItem(res, "attr_cache_misses", PyLong_FromSize_t(g_inlineCacheStats.AttrMisses));
+	SetDictItem(res, "global_cache_misses", PyLong_FromSize_t(g_inlineCacheStats.GlobalMisses));
+	SetDictItem(res, "global_cache_invalidations", PyLong_FromSize_t(g_inlineCacheStats.GlobalInvalidations));
+	SetDictItem(res, "call_cache_hits", PyLong_FromSize_t(g_inlineCacheStats.CallHits));
+	SetDictItem(res, "call_cache_misses", PyLong_FromSize_t(g_inlineCacheStats.CallMisses));
+	SetDictItem(res, "elided_frames", PyLong_FromSize_t(g_frameElisionStats.Elided));
+	SetDictItem(res, "materialized_frames", PyLong_FromSize_t(g_frameElisionStats.Materialized));
+	SetDictItem(res, "traces", PyLong_FromSize_t(g_compiledTraces.size()));
+	SetDictItem(res, "code_heap_used", PyLong_FromSize_t(g_execEngine.m_codeHeap.used()));
+	return res;
+}
+
 static PyObject *pyjion_set_threshold(PyObject *self, PyObject* args) {
 	if (!PyLong_Check(args)) {
 		PyErr_SetString(PyExc_TypeError, "Expected int for new threshold");
@@ -641,6 +1740,201 @@ static PyObject *pyjion_get_threshold(PyObject *self, PyObject* args) {
 	return PyLong_FromLongLong(HOT_CODE);
 }
 
+static PyObject *pyjion_set_async_compile(PyObject *self, PyObject* args) {
+	if (!PyBool_Check(args)) {
+		PyErr_SetString(PyExc_TypeError, "Expected bool for async compile");
+		return nullptr;
+	}
+
+	auto prev = g_asyncCompile ? Py_True : Py_False;
+	if (!PyJit_SetAsyncCompile(args == Py_True)) {
+		PyErr_SetString(PyExc_RuntimeError, "Failed to start compile thread");
+		return nullptr;
+	}
+
+	Py_INCREF(prev);
+	return prev;
+}
+
+static PyObject *pyjion_set_tiered_compile(PyObject *self, PyObject* args) {
+	if (!PyBool_Check(args)) {
+		PyErr_SetString(PyExc_TypeError, "Expected bool for tiered compile");
+		return nullptr;
+	}
+
+	auto prev = g_tieredCompile ? Py_True : Py_False;
+	g_tieredCompile = args == Py_True;
+
+	Py_INCREF(prev);
+	return prev;
+}
+
+extern "C" __declspec(dllexport) bool PyJit_SetFrameElision(bool enabled) {
+	auto prev = g_frameElision;
+	g_frameElision = enabled;
+	return prev;
+}
+
+static PyObject *pyjion_set_frame_elision(PyObject *self, PyObject* args) {
+	if (!PyBool_Check(args)) {
+		PyErr_SetString(PyExc_TypeError, "Expected bool for frame elision");
+		return nullptr;
+	}
+
+	auto prev = PyJit_SetFrameElision(args == Py_True) ? Py_True : Py_False;
+	Py_INCREF(prev);
+	return prev;
+}
+
+static PyObject *pyjion_compile_queue_stats(PyObject *self, PyObject* args) {
+	auto res = PyDict_New();
+	if (res == nullptr) {
+		return nullptr;
+	}
+
+	CompileQueueStats stats;
+	PyJit_GetCompileQueueStats(&stats);
+
+	PyDict_SetItemString(res, "enabled", g_asyncCompile ? Py_True : Py_False);
+
+	auto value = PyLong_FromSize_t(stats.Depth);
+	PyDict_SetItemString(res, "depth", value);
+	Py_DECREF(value);
+
+	value = PyLong_FromSize_t(stats.MaxDepth);
+	PyDict_SetItemString(res, "max_depth", value);
+	Py_DECREF(value);
+
+	value = PyLong_FromSize_t(stats.Queued);
+	PyDict_SetItemString(res, "queued", value);
+	Py_DECREF(value);
+
+	value = PyLong_FromSize_t(stats.Completed);
+	PyDict_SetItemString(res, "completed", value);
+	Py_DECREF(value);
+
+	return res;
+}
+
+// Default limit on the size of the IL cache
+#define DEFAULT_IL_CACHE_SIZE (64 * 1024 * 1024)
+
+static PyObject *pyjion_enable_cache(PyObject *self, PyObject* args) {
+	const char* path;
+	Py_ssize_t maxSize = DEFAULT_IL_CACHE_SIZE;
+	if (!PyArg_ParseTuple(args, "s|n:enable_cache", &path, &maxSize)) {
+		return nullptr;
+	}
+	if (maxSize < 0) {
+		PyErr_SetString(PyExc_ValueError, "Expected positive cache size");
+		return nullptr;
+	}
+
+	if (!g_ilCache.enable(path, maxSize)) {
+		PyErr_SetFromWindowsErr(0);
+		return nullptr;
+	}
+	Py_RETURN_NONE;
+}
+
+static PyObject *pyjion_disable_cache(PyObject *self, PyObject* args) {
+	g_ilCache.disable();
+	Py_RETURN_NONE;
+}
+
+static PyObject *pyjion_cache_stats(PyObject *self, PyObject* args) {
+	auto res = PyDict_New();
+	if (res == nullptr) {
+		return nullptr;
+	}
+
+	PyDict_SetItemString(res, "enabled", g_ilCache.is_enabled() ? Py_True : Py_False);
+
+	auto value = PyLong_FromSize_t(g_ilCache.m_hits);
+	PyDict_SetItemString(res, "hits", value);
+	Py_DECREF(value);
+
+	value = PyLong_FromSize_t(g_ilCache.m_misses);
+	PyDict_SetItemString(res, "misses", value);
+	Py_DECREF(value);
+
+	value = PyLong_FromSize_t(g_ilCache.m_stores);
+	PyDict_SetItemString(res, "stores", value);
+	Py_DECREF(value);
+
+	value = PyLong_FromSize_t(g_ilCache.m_evictions);
+	PyDict_SetItemString(res, "evictions", value);
+	Py_DECREF(value);
+
+	value = PyLong_FromSize_t(g_ilCache.entry_count());
+	PyDict_SetItemString(res, "entries", value);
+	Py_DECREF(value);
+
+	value = PyLong_FromSize_t(g_ilCache.size());
+	PyDict_SetItemString(res, "size", value);
+	Py_DECREF(value);
+
+	value = PyLong_FromSize_t(g_ilCache.max_size());
+	PyDict_SetItemString(res, "max_size", value);
+	Py_DECREF(value);
+
+	return res;
+}
+
+static PyObject *pyjion_set_code_budget(PyObject *self, PyObject* args) {
+	if (!PyLong_Check(args)) {
+		PyErr_SetString(PyExc_TypeError, "Expected int for code budget");
+		return nullptr;
+	}
+
+	auto newValue = PyLong_AsSsize_t(args);
+	if (newValue == -1 && PyErr_Occurred()) {
+		return nullptr;
+	}
+	if (newValue < 0) {
+		PyErr_SetString(PyExc_ValueError, "Expected positive code budget");
+		return nullptr;
+	}
+
+	auto prev = PyLong_FromSize_t(g_execEngine.m_codeHeap.budget());
+	g_execEngine.m_codeHeap.set_budget(newValue);
+	EvictColdTraces(nullptr);
+	return prev;
+}
+
+static PyObject *pyjion_code_heap_stats(PyObject *self, PyObject* args) {
+	auto res = PyDict_New();
+	if (res == nullptr) {
+		return nullptr;
+	}
+
+	auto value = PyLong_FromSize_t(g_execEngine.m_codeHeap.used());
+	PyDict_SetItemString(res, "used", value);
+	Py_DECREF(value);
+
+	value = PyLong_FromSize_t(g_execEngine.m_codeHeap.peak());
+	PyDict_SetItemString(res, "peak", value);
+	Py_DECREF(value);
+
+	value = PyLong_FromSize_t(g_execEngine.m_codeHeap.budget());
+	PyDict_SetItemString(res, "budget", value);
+	Py_DECREF(value);
+
+	value = PyLong_FromSize_t(g_execEngine.m_codeHeap.allocations());
+	PyDict_SetItemString(res, "allocations", value);
+	Py_DECREF(value);
+
+	value = PyLong_FromSize_t(g_compiledTraces.size());
+	PyDict_SetItemString(res, "traces", value);
+	Py_DECREF(value);
+
+	value = PyLong_FromSize_t(g_codeEvictions);
+	PyDict_SetItemString(res, "evictions", value);
+	Py_DECREF(value);
+
+	return res;
+}
+
 static PyMethodDef PyjionMethods[] = {
 	{ 
 		"enable",  
@@ -664,7 +1958,13 @@ static PyMethodDef PyjionMethods[] = {
 		"info",
 		pyjion_info,
 		METH_O,
-		"Returns a dictionary describing information about a function or code objects current JIT status."
+		"Returns a dictionary describing information about a function or code objects current JIT status, compilation statistics, and specialized traces."
+	},
+	{
+		"stats",
+		pyjion_stats,
+		METH_NOARGS,
+		"Returns a dictionary describing all compilations: counts, failures by reason and opcode, time spent in each phase, IL and native code size, and inline cache hits and misses."
 	},
 	{
 		"set_threshold",
@@ -678,16 +1978,80 @@ static PyMethodDef PyjionMethods[] = {
 		METH_O,
 		"Gets the number of times a method needs to be executed before the JIT is triggered."
 	},
+	{
+		"set_async_compile",
+		pyjion_set_async_compile,
+		METH_O,
+		"Enables or disables compiling hot code on a background thread.  Returns the previous setting."
+	},
+	{
+		"set_tiered_compile",
+		pyjion_set_tiered_compile,
+		METH_O,
+		"Enables or disables running unoptimized code until a function is hot enough to optimize.  Returns the previous setting."
+	},
+	{
+		"set_frame_elision",
+		pyjion_set_frame_elision,
+		METH_O,
+		"Enables or disables running functions which don't inspect their frame without publishing the frame, keeping the frames of direct calls on the native stack until something needs them.  Only applies to functions which haven't been seen yet.  Returns the previous setting."
+	},
+	{
+		"compile_queue_stats",
+		pyjion_compile_queue_stats,
+		METH_NOARGS,
+		"Returns a dictionary describing the current and maximum depth of the background compile queue and how many compiles it has processed."
+	},
+	{
+		"enable_cache",
+		pyjion_enable_cache,
+		METH_VARARGS,
+		"Caches the IL generated for functions in the specified directory so other processes can reuse it.  An optional second argument limits the size of the cache in bytes."
+	},
+	{
+		"disable_cache",
+		pyjion_disable_cache,
+		METH_NOARGS,
+		"Stops using the IL cache."
+	},
+	{
+		"cache_stats",
+		pyjion_cache_stats,
+		METH_NOARGS,
+		"Returns a dictionary describing the IL cache's hits, misses, stores, evictions, and size."
+	},
+	{
+		"set_code_budget",
+		pyjion_set_code_budget,
+		METH_O,
+		"Sets the number of bytes of executable memory optimized code can use before the least recently run code is discarded, 0 for no limit.  Returns the previous budget."
+	},
+	{
+		"code_heap_stats",
+		pyjion_code_heap_stats,
+		METH_NOARGS,
+		"Returns a dictionary describing the executable memory used by generated code, the budget, and how many traces have been evicted."
+	},
 	{NULL, NULL, 0, NULL}        /* Sentinel */
 };
 
+// The compile thread needs the GIL, so it has to be gone before the
+// interpreter is.
+static void pyjion_free(void* module) {
+	StopCompileThread();
+}
+
 static struct PyModuleDef pyjionmodule = {
 	PyModuleDef_HEAD_INIT,
 	"pyjion",   /* name of module */
 	"Pyjion - A Just-in-Time Compiler for CPython 3.6.x", /* module documentation, may be NULL */
 	-1,       /* size of per-interpreter state of the module,
 			  or -1 if the module keeps state in global variables. */
-	PyjionMethods
+	PyjionMethods,
+	nullptr,  /* m_slots */
+	nullptr,  /* m_traverse */
+	nullptr,  /* m_clear */
+	pyjion_free
 }; 
 
 PyMODINIT_FUNC PyInit_pyjion(void)
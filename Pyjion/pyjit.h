@@ -45,10 +45,14 @@
 
 #include <vector>
 #include <unordered_map>
+#include <deque>
 
 #include <frameobject.h>
 #include <Python.h>
 
+#include "typeprofile.h"
+#include "jitstats.h"
+
 
  //#define NO_TRACE
  //#define TRACE_TREE
@@ -60,11 +64,62 @@ extern "C" __declspec(dllexport) void JitInit();
 extern "C" __declspec(dllexport) PyObject *PyJit_EvalFrame(PyFrameObject *, int);
 extern "C" __declspec(dllexport) PyjionJittedCode* PyJit_EnsureExtra(PyObject* codeObject);
 
+struct CallCache;
+// Calls target from jitted code, the arguments are in an array with a spare
+// slot before the first one.  Steals the references to target and the
+// arguments.
+PyObject* PyJit_CallCached(PyObject* target, PyObject** args, size_t argCount, CallCache* cache);
+
+// Enables running code which doesn't inspect its frame with frames that live
+// on the native stack.  Only affects code we haven't seen yet, returns the
+// previous setting.
+extern "C" __declspec(dllexport) bool PyJit_SetFrameElision(bool enabled);
+
+// How many frames we've elided, and how many had to be moved to the heap
+struct FrameElisionStats {
+	size_t Elided, Materialized;
+};
+extern __declspec(dllexport) FrameElisionStats g_frameElisionStats;
+
+// Starts compiling hot code on a background thread, or stops the thread and
+// drops the requests it hasn't started.  Returns false if the thread couldn't
+// be started.  The GIL must be held.
+extern "C" __declspec(dllexport) bool PyJit_SetAsyncCompile(bool enabled);
+// Waits, with the GIL released, until the compile thread has no more work
+extern "C" __declspec(dllexport) void PyJit_WaitForCompiles();
+
+struct CompileQueueStats {
+	size_t Depth, MaxDepth, Queued, Completed;
+};
+extern "C" __declspec(dllexport) void PyJit_GetCompileQueueStats(CompileQueueStats* stats);
+// Checks if the frame lives on the native stack of a direct call.  Elided
+// frames are never tracked by the GC, frames from PyFrame_New always are.
+inline bool PyJit_IsElidedFrame(PyFrameObject* frame) {
+	return _PyGC_REFS(frame) == _PyGC_REFS_UNTRACKED;
+}
+// Moves the state of an elided frame into a new heap allocated frame which
+// can outlive the call.
+PyFrameObject* PyJit_MaterializeFrame(PyFrameObject* frame);
+// Runs the frame in the interpreter, moving it to the heap first if it's elided
+PyObject* PyJit_EvalFrameInterpreted(PyFrameObject* frame);
+
 class PyjionJittedCode;
+class JittedCode;
 typedef PyObject* (*Py_EvalFunc)(PyjionJittedCode*, struct _frame*);
+// Generator code is passed the throw flag from gen_send_ex
+typedef PyObject* (*Py_EvalGeneratorFunc)(size_t, struct _frame*);
 
 static PY_UINT64_T HOT_CODE = 0;
 
+// Number of calls which run in the baseline tier before we produce optimized
+// code for a function.
+#define OPTIMIZE_THRESHOLD 1000
+
+// Number of slots in the per-code dispatch cache used to find a specialized
+// trace from the argument types.  Must be a power of 2 and larger than the
+// maximum number of traces we'll record so probing always terminates.
+#define DISPATCH_CACHE_SIZE 8
+
 void PyjionJitFree(void* obj);
 
 /* Jitted code object.  This object is returned from the JIT implementation.  The JIT can allocate
@@ -76,13 +131,49 @@ public:
 	bool j_failed;
 	Py_EvalFunc j_evalfunc;
 	PY_UINT64_T j_specialization_threshold;
+	// The code contains a backwards jump, so a single call may run for a long time
+	bool j_has_loops;
+	// The code only works on its arguments and constants, so when it's
+	// specialized for arguments of builtin scalar types it doesn't publish its
+	// frame, and direct calls to it put the frame on the native stack
+	bool j_elide_frame;
+	// Number of times a speculative type guard failed and we fell back to the interpreter
+	PY_UINT64_T j_deopt_count;
+	// Code compiled without type analysis which runs until we optimize the function
+	Py_EvalFunc j_baseline;
+	bool j_baseline_failed;
+	// Number of calls run by the baseline code, and how many we run before optimizing
+	PY_UINT64_T j_baseline_count;
+	PY_UINT64_T j_optimize_threshold;
+	JittedCode* j_baseline_code;
+	// Types produced by each opcode while running the baseline code
+	TypeProfile* j_profile;
+	// Code for a generator or coroutine, which is resumed at its yields
+	// instead of going through the baseline and optimized tiers
+	Py_EvalGeneratorFunc j_generator;
+	JittedCode* j_generator_code;
+	// Number of calls currently running optimized code, code can't be
+	// evicted while it may be on the stack.
+	size_t j_active;
+	// Optimized code which was replaced while it was running, freed with
+	// the code object.
+	std::vector<JittedCode*> j_retired;
+	// Totals for every compilation of the code, and why the last failure happened
+	JitStats j_stats;
+	CompileFailure j_failure;
+	int j_failure_opcode;
 	PyObject* j_code;
 #ifdef TRACE_TREE
 	SpecializedTreeNode* funcs;
 #else
 	std::vector<SpecializedTreeNode*> j_optimized;
+	// The most recently dispatched to trace, checked before the cache
+	SpecializedTreeNode* j_monomorphic;
+	// Open addressed cache of traces keyed on their argument type signature
+	SpecializedTreeNode* j_dispatch[DISPATCH_CACHE_SIZE];
 #endif
-	Py_EvalFunc j_generic;
+	// The trace all calls are dispatched to when we didn't specialize
+	SpecializedTreeNode* j_generic;
 
 	PyjionJittedCode(PyObject* code) {
 		j_code = code;
@@ -90,8 +181,26 @@ public:
 		j_failed = false;
 		j_evalfunc = nullptr;
 		j_specialization_threshold = HOT_CODE;
+		j_has_loops = false;
+		j_elide_frame = false;
+		j_deopt_count = 0;
+		j_baseline = nullptr;
+		j_baseline_failed = false;
+		j_baseline_count = 0;
+		j_optimize_threshold = OPTIMIZE_THRESHOLD;
+		j_baseline_code = nullptr;
+		j_profile = nullptr;
+		j_generator = nullptr;
+		j_generator_code = nullptr;
+		j_active = 0;
+		j_failure = CF_None;
+		j_failure_opcode = -1;
 #ifdef TRACE_TREE
-		funcs = new SpecializedTreeNode();
+		// Created on the first dispatch, the node type is private to pyjit.cpp
+		funcs = nullptr;
+#else
+		j_monomorphic = nullptr;
+		memset(j_dispatch, 0, sizeof(j_dispatch));
 #endif
 		j_generic = nullptr;
 	}
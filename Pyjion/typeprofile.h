@@ -0,0 +1,166 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) Microsoft Corporation
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+* OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+*/
+
+
+#ifndef TYPEPROFILE_H
+#define TYPEPROFILE_H
+
+#include <Python.h>
+#include <vector>
+#include <unordered_map>
+
+// Marks an opcode which has produced values of more than one type
+#define PROFILE_POLYMORPHIC ((PyTypeObject*)0x01)
+// Marks a call which has called more than one function
+#define PROFILE_POLYMORPHIC_CALLEE ((PyObject*)0x01)
+
+// Records the types of the values produced by opcodes while a function is
+// running in the baseline tier.  When we optimize the function we speculate
+// that opcodes which have only produced a single type will continue to do so.
+class TypeProfile {
+    // Indexed by byte code offset / sizeof(_Py_CODEUNIT)
+    std::vector<PyTypeObject*> m_types;
+    // Weak references to the code of the Python function each call has
+    // called, keyed the same way.
+    std::unordered_map<size_t, PyObject*> m_callees;
+    // The types of the arguments each call has passed, keyed the same way.
+    // We hold references to the types so the inliner can look up their
+    // attributes.
+    std::unordered_map<size_t, std::vector<PyTypeObject*>> m_argTypes;
+
+public:
+    TypeProfile(size_t codeSize) : m_types(codeSize / sizeof(_Py_CODEUNIT)) {
+    }
+
+    ~TypeProfile() {
+        for (auto& cur : m_callees) {
+            if (cur.second != PROFILE_POLYMORPHIC_CALLEE) {
+                Py_DECREF(cur.second);
+            }
+        }
+        for (auto& cur : m_argTypes) {
+            for (auto type : cur.second) {
+                if (type != PROFILE_POLYMORPHIC) {
+                    Py_XDECREF(type);
+                }
+            }
+        }
+    }
+
+    void record(size_t opcodeIndex, PyTypeObject* type) {
+        auto& cur = m_types[opcodeIndex / sizeof(_Py_CODEUNIT)];
+        if (cur == nullptr) {
+            cur = type;
+        }
+        else if (cur != type) {
+            cur = PROFILE_POLYMORPHIC;
+        }
+    }
+
+    // Records the function called by a call.  Calls are identified by the
+    // callee's code so closures created on each run of the caller still look
+    // like a single callee.
+    void record_callee(size_t opcodeIndex, PyObject* function) {
+        auto& cur = m_callees[opcodeIndex / sizeof(_Py_CODEUNIT)];
+        if (cur == PROFILE_POLYMORPHIC_CALLEE) {
+            return;
+        }
+
+        auto code = PyFunction_Check(function) ? PyFunction_GET_CODE(function) : nullptr;
+        if (cur == nullptr && code != nullptr) {
+            cur = PyWeakref_NewRef(code, nullptr);
+            if (cur != nullptr) {
+                return;
+            }
+            PyErr_Clear();
+        }
+        else if (cur != nullptr && code != nullptr && PyWeakref_GET_OBJECT(cur) == code) {
+            return;
+        }
+
+        Py_XDECREF(cur);
+        cur = PROFILE_POLYMORPHIC_CALLEE;
+    }
+
+    // Records the type of an argument passed by a call, self counts as the
+    // first argument of a method call.
+    void record_arg(size_t opcodeIndex, size_t arg, PyTypeObject* type) {
+        auto& types = m_argTypes[opcodeIndex / sizeof(_Py_CODEUNIT)];
+        if (types.size() <= arg) {
+            types.resize(arg + 1);
+        }
+
+        auto& cur = types[arg];
+        if (cur == nullptr) {
+            Py_INCREF(type);
+            cur = type;
+        }
+        else if (cur != type && cur != PROFILE_POLYMORPHIC) {
+            Py_DECREF(cur);
+            cur = PROFILE_POLYMORPHIC;
+        }
+    }
+
+    // Gets the only type the call has passed for the argument, or nullptr if
+    // the call hasn't run or has passed values of different types.
+    PyTypeObject* get_arg_type(size_t opcodeIndex, size_t arg) {
+        auto cur = m_argTypes.find(opcodeIndex / sizeof(_Py_CODEUNIT));
+        if (cur == m_argTypes.end() || cur->second.size() <= arg ||
+            cur->second[arg] == PROFILE_POLYMORPHIC) {
+            return nullptr;
+        }
+        return cur->second[arg];
+    }
+
+    // Gets the code of the only function the call has called, or nullptr if
+    // the call hasn't run, has called something else, or the code is gone.
+    PyCodeObject* get_callee(size_t opcodeIndex, bool& polymorphic) {
+        polymorphic = false;
+        auto cur = m_callees.find(opcodeIndex / sizeof(_Py_CODEUNIT));
+        if (cur == m_callees.end()) {
+            return nullptr;
+        }
+        if (cur->second == PROFILE_POLYMORPHIC_CALLEE) {
+            polymorphic = true;
+            return nullptr;
+        }
+        auto code = PyWeakref_GET_OBJECT(cur->second);
+        return code == Py_None ? nullptr : (PyCodeObject*)code;
+    }
+
+    // Gets the size of the byte code the profile covers
+    size_t code_size() {
+        return m_types.size() * sizeof(_Py_CODEUNIT);
+    }
+
+    // Gets the single type produced by the opcode, or nullptr if the opcode
+    // hasn't run or has produced values of different types.
+    PyTypeObject* get_type(size_t opcodeIndex) {
+        auto type = m_types[opcodeIndex / sizeof(_Py_CODEUNIT)];
+        return type == PROFILE_POLYMORPHIC ? nullptr : type;
+    }
+};
+
+#endif
@@ -0,0 +1,91 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) Microsoft Corporation
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+* OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+*/
+
+/**
+  Test the executable memory arena generated code is allocated from.
+*/
+
+#include "stdafx.h"
+#include "catch.hpp"
+#include <codeheap.h>
+#include <vector>
+
+TEST_CASE("Code heap", "[codeheap]") {
+    SECTION("allocations are aligned") {
+        CodeHeap heap;
+        std::vector<void*> blocks;
+        for (size_t size = 1; size < 300; size += 7) {
+            auto small = heap.alloc(size, CODE_ALIGNMENT);
+            auto large = heap.alloc(size, LARGE_METHOD_ALIGNMENT);
+            REQUIRE(small != nullptr);
+            REQUIRE(large != nullptr);
+            CHECK(((size_t)small & (CODE_ALIGNMENT - 1)) == 0);
+            CHECK(((size_t)large & (LARGE_METHOD_ALIGNMENT - 1)) == 0);
+            // The memory must be writable
+            memset(small, 0xCC, size);
+            memset(large, 0xCC, size);
+            blocks.push_back(small);
+            blocks.push_back(large);
+        }
+        for (auto block : blocks) {
+            heap.free(block);
+        }
+        CHECK(heap.used() == 0);
+        CHECK(heap.allocations() == 0);
+    }
+
+    SECTION("sizes are tracked") {
+        CodeHeap heap;
+        auto first = heap.alloc(100, CODE_ALIGNMENT);
+        auto second = heap.alloc(1000, LARGE_METHOD_ALIGNMENT);
+        CHECK(CodeHeap::size_of(first) >= 100);
+        CHECK(CodeHeap::size_of(second) >= 1000);
+        CHECK(heap.used() == CodeHeap::size_of(first) + CodeHeap::size_of(second));
+        CHECK(heap.allocations() == 2);
+
+        auto peak = heap.used();
+        heap.free(second);
+        CHECK(heap.used() == CodeHeap::size_of(first));
+        CHECK(heap.peak() == peak);
+        heap.free(first);
+        CHECK(heap.used() == 0);
+    }
+
+    SECTION("budget") {
+        CodeHeap heap;
+        auto block = heap.alloc(1000, CODE_ALIGNMENT);
+        CHECK(!heap.over_budget());
+
+        heap.set_budget(500);
+        CHECK(heap.over_budget());
+
+        heap.set_budget(heap.used());
+        CHECK(!heap.over_budget());
+
+        heap.free(block);
+        heap.set_budget(0);
+        CHECK(!heap.over_budget());
+    }
+}
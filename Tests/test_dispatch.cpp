@@ -0,0 +1,218 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) Microsoft Corporation
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+* OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+*/
+
+/**
+  Test dispatching to specialized traces based upon argument types.
+*/
+
+#include "stdafx.h"
+#include "catch.hpp"
+#include "testing_util.h"
+#include <Python.h>
+#include <frameobject.h>
+#include <util.h>
+#include <pyjit.h>
+#include <chrono>
+#include <vector>
+
+class DispatchTest {
+private:
+    py_ptr<PyCodeObject> m_code;
+    PyjionJittedCode* m_jittedcode;
+    PyObject_ptr m_globals;
+    std::vector<PyFrameObject*> m_frames;
+
+public:
+    DispatchTest(const char *code) : m_globals(PyDict_New()) {
+        m_code.reset(CompileCode(code));
+        if (m_code.get() == nullptr) {
+            FAIL("failed to compile code");
+        }
+        m_jittedcode = PyJit_EnsureExtra((PyObject*)*m_code);
+        if (!jit_compile(m_code.get())) {
+            FAIL("failed to JIT code");
+        }
+        // Specialize on the first call for each set of argument types.
+        m_jittedcode->j_specialization_threshold = 0;
+        m_jittedcode->j_optimize_threshold = 0;
+
+        auto builtins = PyThreadState_GET()->interp->builtins;
+        PyDict_SetItemString(m_globals.get(), "__builtins__", builtins);
+    }
+
+    ~DispatchTest() {
+        for (auto frame : m_frames) {
+            Py_DECREF(frame);
+        }
+    }
+
+    // Adds a frame which will be invoked with the given arguments, returning
+    // its index.
+    size_t add_frame(std::vector<PyObject*> args) {
+        auto frame = PyFrame_New(PyThreadState_Get(), m_code.get(), m_globals.get(), nullptr);
+        REQUIRE(frame != nullptr);
+        for (size_t i = 0; i < args.size(); i++) {
+            frame->f_localsplus[i] = args[i];
+        }
+        m_frames.push_back(frame);
+        return m_frames.size() - 1;
+    }
+
+    PyObject* run(size_t frameIndex) {
+        return m_jittedcode->j_evalfunc(m_jittedcode, m_frames[frameIndex]);
+    }
+
+    std::string returns(size_t frameIndex) {
+        auto res = PyObject_ptr(run(frameIndex));
+        REQUIRE(res.get() != nullptr);
+        REQUIRE(!PyErr_Occurred());
+
+        return std::string(PyUnicode_AsUTF8(PyObject_Repr(res.get())));
+    }
+
+    size_t frame_count() {
+        return m_frames.size();
+    }
+
+    PyjionJittedCode* jitted() {
+        return m_jittedcode;
+    }
+
+    PyObject* globals() {
+        return m_globals.get();
+    }
+
+    // Evaluates an expression in the test's globals
+    PyObject* eval(const char* expr) {
+        auto res = PyRun_String(expr, Py_eval_input, m_globals.get(), m_globals.get());
+        REQUIRE(res != nullptr);
+        return res;
+    }
+};
+
+TEST_CASE("Specialized trace dispatch", "[dispatch]") {
+    SECTION("each set of argument types gets its own result") {
+        auto t = DispatchTest("def f(a, b): return a + b");
+        auto ints = t.add_frame({ PyLong_FromLong(1), PyLong_FromLong(2) });
+        auto floats = t.add_frame({ PyFloat_FromDouble(1.5), PyFloat_FromDouble(2) });
+        auto mixed = t.add_frame({ PyLong_FromLong(1), PyFloat_FromDouble(2.5) });
+        auto strs = t.add_frame({ PyUnicode_FromString("a"), PyUnicode_FromString("b") });
+
+        for (int i = 0; i < 3; i++) {
+            CHECK(t.returns(ints) == "3");
+            CHECK(t.returns(floats) == "3.5");
+            CHECK(t.returns(mixed) == "3.5");
+            CHECK(t.returns(strs) == "'ab'");
+        }
+    }
+
+    SECTION("container and user class arguments") {
+        auto t = DispatchTest("def f(a, b): return a[b]");
+        auto list = t.add_frame({ Py_BuildValue("[iii]", 1, 2, 3), PyLong_FromLong(-1) });
+        auto tuple = t.add_frame({ Py_BuildValue("(iii)", 4, 5, 6), PyLong_FromLong(1) });
+        auto dict = t.add_frame({ Py_BuildValue("{si}", "a", 7), PyUnicode_FromString("a") });
+        auto str = t.add_frame({ PyUnicode_FromString("abc"), PyLong_FromLong(2) });
+        auto bigIndex = t.add_frame({ Py_BuildValue("[iii]", 1, 2, 3), PyLong_FromLong(3) });
+        auto userClass = PyObject_ptr(t.eval("type('C', (), {'__getitem__': lambda self, i: i * 2})"));
+        PyDict_SetItemString(t.globals(), "C", userClass.get());
+        auto user = t.add_frame({ PyObject_CallObject(userClass.get(), nullptr), PyLong_FromLong(4) });
+
+        for (int i = 0; i < 3; i++) {
+            CHECK(t.returns(list) == "3");
+            CHECK(t.returns(tuple) == "5");
+            CHECK(t.returns(dict) == "7");
+            CHECK(t.returns(str) == "'c'");
+            CHECK(t.run(bigIndex) == nullptr);
+            CHECK(PyErr_ExceptionMatches(PyExc_IndexError));
+            PyErr_Clear();
+            CHECK(t.returns(user) == "8");
+        }
+
+        // The user class gets its own trace alongside the builtin types
+        CHECK(t.jitted()->j_optimized.size() == 5);
+
+        // Classes are matched exactly, so a subclass needs another trace.
+        // We're out of traces so it runs the unspecialized code.
+        auto subclass = PyObject_ptr(t.eval("type('D', (C,), {})"));
+        auto userSubclass = t.add_frame({ PyObject_CallObject(subclass.get(), nullptr), PyLong_FromLong(5) });
+        for (int i = 0; i < 3; i++) {
+            CHECK(t.returns(userSubclass) == "10");
+            CHECK(t.returns(user) == "8");
+        }
+        CHECK(t.jitted()->j_optimized.size() == 5);
+    }
+
+    SECTION("more argument types than traces") {
+        auto t = DispatchTest("def f(a, b, c): return a + b + c");
+        std::vector<size_t> frames;
+        for (int i = 0; i < 8; i++) {
+            frames.push_back(t.add_frame({
+                i & 1 ? PyFloat_FromDouble(1) : PyLong_FromLong(1),
+                i & 2 ? PyFloat_FromDouble(1) : PyLong_FromLong(1),
+                i & 4 ? PyFloat_FromDouble(1) : PyLong_FromLong(1),
+            }));
+        }
+
+        for (int i = 0; i < 3; i++) {
+            for (size_t frame = 0; frame < frames.size(); frame++) {
+                CHECK(t.returns(frames[frame]) == (frame == 0 ? "3" : "3.0"));
+            }
+        }
+    }
+}
+
+// Measures the per-call cost of finding the specialized trace when callers
+// cycle between 1, 3, and 5 different sets of argument types.  Run with
+// "[benchmark]" to include it.
+TEST_CASE("Specialized trace dispatch overhead", "[.][benchmark][dispatch]") {
+    const int iterations = 1000000;
+
+    for (int specializations : { 1, 3, 5 }) {
+        auto t = DispatchTest("def f(a, b, c): return a");
+        for (int i = 0; i < specializations; i++) {
+            t.add_frame({
+                i & 1 ? PyFloat_FromDouble(1) : PyLong_FromLong(1),
+                i & 2 ? PyFloat_FromDouble(1) : PyLong_FromLong(1),
+                i & 4 ? PyFloat_FromDouble(1) : PyLong_FromLong(1),
+            });
+        }
+
+        // Warm up so all of the traces are compiled
+        for (size_t i = 0; i < t.frame_count(); i++) {
+            Py_XDECREF(t.run(i));
+        }
+
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < iterations; i++) {
+            Py_DECREF(t.run(i % specializations));
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::high_resolution_clock::now() - start);
+
+        printf("%d specialization(s): %.1f ns per call\r\n",
+            specializations,
+            (double)elapsed.count() / iterations);
+    }
+}
@@ -32,8 +32,28 @@
 #include "testing_util.h"
 #include <Python.h>
 #include <frameobject.h>
+#include <opcode.h>
 #include <util.h>
 #include <pyjit.h>
+#include <inlinecache.h>
+
+// Finds the code for a function defined, possibly indirectly, in code
+static PyjionJittedCode* FindNestedCode(PyCodeObject* code, const char* name) {
+    for (Py_ssize_t i = 0; i < PyTuple_GET_SIZE(code->co_consts); i++) {
+        auto value = PyTuple_GET_ITEM(code->co_consts, i);
+        if (PyCode_Check(value)) {
+            auto inner = (PyCodeObject*)value;
+            if (strcmp(PyUnicode_AsUTF8(inner->co_name), name) == 0) {
+                return PyJit_EnsureExtra(value);
+            }
+            auto res = FindNestedCode(inner, name);
+            if (res != nullptr) {
+                return res;
+            }
+        }
+    }
+    return nullptr;
+}
 
 class EmissionTest {
 private:
@@ -56,7 +76,7 @@ private:
     }
 
 public:
-    EmissionTest(const char *code) {
+    EmissionTest(const char *code, bool baseline = false) {
         m_code.reset(CompileCode(code));
         if (m_code.get() == nullptr) {
             FAIL("failed to compile code");
@@ -65,6 +85,10 @@ public:
         if (!jit_compile(m_code.get())) {
             FAIL("failed to JIT code");
         }
+        // Run the optimized code unless we're testing the baseline tier
+        if (!baseline) {
+            jitted->j_optimize_threshold = 0;
+        }
         m_jittedcode.reset(jitted);
     }
 
@@ -84,6 +108,40 @@ public:
         return std::string(repr);
     }
 
+    PyjionJittedCode* jitted() {
+        return m_jittedcode.get();
+    }
+
+    // The jitted code for a function defined in the test's function.  It's
+    // only run by the JIT while a JitEnabled is alive.
+    PyjionJittedCode* nested(const char* name) {
+        auto res = FindNestedCode(m_code.get(), name);
+        REQUIRE(res != nullptr);
+        return res;
+    }
+
+    // Has a function defined in the test's function produce optimized code
+    // the first time it's called instead of starting in the baseline tier.
+    PyjionJittedCode* optimize(const char* name) {
+        auto res = nested(name);
+        res->j_optimize_threshold = 0;
+        return res;
+    }
+
+    // Runs the code once in the baseline tier so the next run produces
+    // optimized code from the profile it records.  Construct the test with
+    // baseline set.
+    void profile() {
+        m_jittedcode->j_specialization_threshold = 0;
+        m_jittedcode->j_optimize_threshold = 1;
+        Py_XDECREF(run());
+        PyErr_Clear();
+    }
+
+    size_t inlining(InlineDecision decision) {
+        return m_jittedcode->j_stats.Inlining[decision];
+    }
+
     PyObject* raises() {
         auto res = run();
         REQUIRE(res == nullptr);
@@ -93,6 +151,21 @@ public:
     }
 };
 
+// Installs the JIT's frame evaluation function while it's alive, so calls
+// made by the code under test are jitted too
+class JitEnabled {
+    _PyFrameEvalFunction m_prev;
+public:
+    JitEnabled() {
+        auto interp = PyThreadState_GET()->interp;
+        m_prev = interp->eval_frame;
+        interp->eval_frame = PyJit_EvalFrame;
+    }
+    ~JitEnabled() {
+        PyThreadState_GET()->interp->eval_frame = m_prev;
+    }
+};
+
 TEST_CASE("General list unpacking", "[list][BUILD_LIST_UNPACK][emission]") {
     SECTION("common case") {
         auto t = EmissionTest("def f(): return [1, *[2], 3]");
@@ -140,3 +213,857 @@ TEST_CASE("General dict unpacking", "[dict][BUILD_MAP_UNPACK][emission]") {
         CHECK(t.raises() == PyExc_TypeError);
     }
 }
+
+TEST_CASE("Baseline tier", "[baseline][emission]") {
+    SECTION("arithmetic") {
+        auto t = EmissionTest("def f():\n  x = 1.5\n  y = 2\n  return x * y + -y", true);
+        CHECK(t.returns() == "1.0");
+    }
+
+    SECTION("loops and branches") {
+        auto t = EmissionTest("def f():\n  total = 0\n  for i in range(10):\n    if i % 2:\n      total += i\n  return total", true);
+        CHECK(t.returns() == "25");
+        CHECK(t.jitted()->j_baseline != nullptr);
+        CHECK(t.jitted()->j_stats.Compiles == t.jitted()->j_stats.BaselineCompiles);
+    }
+
+    SECTION("exceptions") {
+        auto t = EmissionTest("def f():\n  try:\n    raise ValueError()\n  except ValueError:\n    return 'handled'", true);
+        CHECK(t.returns() == "'handled'");
+    }
+
+    SECTION("unbound locals") {
+        auto t = EmissionTest("def f():\n  if False:\n    x = 1\n  return x", true);
+        CHECK(t.raises() == PyExc_UnboundLocalError);
+    }
+}
+
+TEST_CASE("Code with loops", "[baseline][emission]") {
+    SECTION("function starts in the baseline tier") {
+        JitEnabled jit;
+        auto t = EmissionTest("def f():\n  def g(n):\n    total = 0\n    for i in range(n):\n      for j in range(n):\n        total += j\n    return total\n  return g(10)");
+        CHECK(t.returns() == "450");
+
+        auto g = t.nested("g");
+        CHECK(g->j_has_loops);
+        CHECK(g->j_evalfunc != nullptr);
+        CHECK(g->j_baseline != nullptr);
+        CHECK(g->j_specialization_threshold == HOT_CODE);
+        CHECK(g->j_optimize_threshold == OPTIMIZE_THRESHOLD);
+        CHECK(g->j_stats.Compiles == g->j_stats.BaselineCompiles);
+    }
+
+    SECTION("module body is optimized right away") {
+        auto code = PyObject_ptr(Py_CompileString("total = 0\nfor i in range(10):\n  total += i\n", "<test>", Py_file_input));
+        REQUIRE(code.get() != nullptr);
+
+        auto jitted = PyJit_EnsureExtra(code.get());
+        CHECK(jitted->j_has_loops);
+        CHECK(jitted->j_specialization_threshold == 0);
+        CHECK(jitted->j_optimize_threshold == 0);
+    }
+}
+
+TEST_CASE("Deoptimization", "[deopt][emission]") {
+    SECTION("int locals are written back without leaking") {
+        JitEnabled jit;
+        auto t = EmissionTest("def f():\n  class C: pass\n  c = C()\n  def g(v):\n    big = 2**64\n    for i in range(2):\n      x = v.value\n    return big + 1\n  c.value = 1\n  g(c)\n  k = max(n for n in g.__code__.co_consts if type(n) is int)\n  before = sys.getrefcount(k)\n  c.value = 'a'\n  g(c)\n  return sys.getrefcount(k) - before");
+        // Profile g once in the baseline tier, the second call runs the
+        // optimized code and the guard on x fails.
+        auto g = t.nested("g");
+        g->j_optimize_threshold = 1;
+        CHECK(t.returns() == "0");
+        CHECK(g->j_deopt_count >= 1);
+    }
+}
+
+TEST_CASE("Compilation statistics", "[stats][emission]") {
+    SECTION("successful compile") {
+        auto t = EmissionTest("def f():\n  x = 1.5\n  return x * 2");
+        CHECK(t.returns() == "3.0");
+
+        auto& stats = t.jitted()->j_stats;
+        CHECK(stats.Compiles >= 1);
+        CHECK(stats.Failures[CF_None] == stats.Compiles);
+        CHECK(stats.ILSize > 0);
+        CHECK(stats.NativeSize > 0);
+        CHECK(stats.NativeTime > 0);
+        CHECK(t.jitted()->j_failure == CF_None);
+    }
+
+    SECTION("failure reason") {
+        auto t = EmissionTest("def f():\n  return len(vars())");
+        CHECK(t.returns() == "0");
+
+        auto& stats = t.jitted()->j_stats;
+        CHECK(stats.Failures[CF_FrameIntrospection] >= 1);
+        CHECK(t.jitted()->j_failure == CF_FrameIntrospection);
+        CHECK(t.jitted()->j_failure_opcode == LOAD_GLOBAL);
+    }
+}
+
+// Compiles hot code on the background thread while it's alive
+class AsyncCompile {
+public:
+    AsyncCompile() {
+        REQUIRE(PyJit_SetAsyncCompile(true));
+    }
+    ~AsyncCompile() {
+        PyJit_SetAsyncCompile(false);
+    }
+};
+
+TEST_CASE("Background compilation", "[async][emission]") {
+    CompileQueueStats before, after;
+    PyJit_GetCompileQueueStats(&before);
+
+    SECTION("hot code is queued once and compiled") {
+        AsyncCompile async;
+        auto t = EmissionTest("def f():\n  x = 1.5\n  return x * 2");
+        CHECK(t.returns() == "3.0");
+        CHECK(t.returns() == "3.0");
+        PyJit_WaitForCompiles();
+
+        PyJit_GetCompileQueueStats(&after);
+        CHECK(after.Queued - before.Queued == 1);
+        CHECK(after.Completed - before.Completed == 1);
+        CHECK(after.Depth == 0);
+
+        auto& stats = t.jitted()->j_stats;
+        CHECK(stats.Compiles - stats.BaselineCompiles == 1);
+        CHECK(t.returns() == "3.0");
+    }
+
+    SECTION("disabling stops the compile thread") {
+        auto t = EmissionTest("def f():\n  x = 1.5\n  return x * 2");
+        {
+            AsyncCompile async;
+            CHECK(t.returns() == "3.0");
+        }
+
+        // The request was either compiled before the thread stopped or
+        // dropped, and we now compile on the calling thread.
+        PyJit_GetCompileQueueStats(&after);
+        CHECK(after.Depth == 0);
+        CHECK(after.Queued - before.Queued == 1);
+        CHECK(t.returns() == "3.0");
+
+        auto& stats = t.jitted()->j_stats;
+        CHECK(stats.Compiles - stats.BaselineCompiles == 1);
+    }
+}
+
+TEST_CASE("Attribute inline caches", "[LOAD_ATTR][emission]") {
+    SECTION("instance dictionary") {
+        auto t = EmissionTest("def f():\n  class C: pass\n  c = C()\n  c.x = 2\n  total = 0\n  for i in range(5):\n    total += c.x\n  return total");
+        CHECK(t.returns() == "10");
+    }
+
+    SECTION("slots") {
+        auto t = EmissionTest("def f():\n  class C:\n    __slots__ = ('x',)\n  c = C()\n  c.x = 3\n  total = 0\n  for i in range(5):\n    total += c.x\n  return total");
+        CHECK(t.returns() == "15");
+    }
+
+    SECTION("unassigned slot") {
+        auto t = EmissionTest("def f():\n  class C:\n    __slots__ = ('x',)\n  c = C()\n  for i in range(5):\n    if i == 3:\n      del c.x\n    else:\n      c.x = i\n    c.x\n");
+        CHECK(t.raises() == PyExc_AttributeError);
+    }
+
+    SECTION("class attributes and methods") {
+        auto t = EmissionTest("def f():\n  class C:\n    y = 1\n    def m(self): return self.y * 2\n  c = C()\n  total = 0\n  for i in range(5):\n    total += c.y + c.m()\n  return total");
+        CHECK(t.returns() == "15");
+    }
+
+    SECTION("properties") {
+        auto t = EmissionTest("def f():\n  class C:\n    @property\n    def p(self): return 4\n  c = C()\n  total = 0\n  for i in range(5):\n    total += c.p\n  return total");
+        CHECK(t.returns() == "20");
+    }
+
+    SECTION("module attributes") {
+        auto t = EmissionTest("def f():\n  total = 0\n  for i in range(5):\n    total += sys.maxsize > 0\n  return total");
+        CHECK(t.returns() == "5");
+    }
+
+    SECTION("type modified while cached") {
+        auto t = EmissionTest("def f():\n  class C:\n    y = 1\n  c = C()\n  total = 0\n  for i in range(6):\n    if i == 2:\n      C.y = 10\n    if i == 4:\n      c.y = 100\n    total += c.y\n  return total");
+        CHECK(t.returns() == "222");
+    }
+
+    SECTION("different types at one site") {
+        auto t = EmissionTest("def f():\n  class A:\n    x = 1\n  class B:\n    def __init__(self): self.x = 2\n  objs = [A(), B(), 3j] * 30\n  total = 0\n  for o in objs:\n    total += o.real if type(o) is complex else o.x\n  return total");
+        CHECK(t.returns() == "90.0");
+    }
+
+    SECTION("missing attribute") {
+        auto t = EmissionTest("def f():\n  class C: pass\n  c = C()\n  c.x = 1\n  for i in range(5):\n    if i == 3:\n      del c.x\n    c.x\n");
+        CHECK(t.raises() == PyExc_AttributeError);
+    }
+}
+
+TEST_CASE("Method calls", "[LOAD_ATTR][CALL_FUNCTION][emission]") {
+    SECTION("argument counts") {
+        auto t = EmissionTest("def f():\n  class C:\n    def m0(self): return 1\n    def m1(self, a): return a\n    def m2(self, a, b): return a + b\n    def m3(self, a, b, c): return a + b + c\n    def m4(self, a, b, c, d): return a + b + c + d\n    def m5(self, a, b, c, d, e): return a + b + c + d + e\n  c = C()\n  return c.m0() + c.m1(1) + c.m2(1, 1) + c.m3(1, 1, 1) + c.m4(1, 1, 1, 1) + c.m5(1, 1, 1, 1, 1)");
+        CHECK(t.returns() == "16");
+    }
+
+    SECTION("nested method calls") {
+        auto t = EmissionTest("def f():\n  class C:\n    def m(self, a): return a * 2\n  c = C()\n  return c.m(c.m(c.m(1)) + 1)");
+        CHECK(t.returns() == "18");
+    }
+
+    SECTION("instance attribute shadows method") {
+        auto t = EmissionTest("def f():\n  class C:\n    def m(self): return 1\n  c = C()\n  c.m = lambda: 2\n  return c.m()");
+        CHECK(t.returns() == "2");
+    }
+
+    SECTION("builtin methods") {
+        auto t = EmissionTest("def f():\n  x = []\n  x.append(1)\n  x.extend((2, 3))\n  return x");
+        CHECK(t.returns() == "[1, 2, 3]");
+    }
+
+    SECTION("static and class methods") {
+        auto t = EmissionTest("def f():\n  class C:\n    @staticmethod\n    def s(a): return a\n    @classmethod\n    def c(cls, a): return cls.__name__ + a\n  c = C()\n  return c.c(str(c.s(1)))");
+        CHECK(t.returns() == "'C1'");
+    }
+
+    SECTION("module functions") {
+        auto t = EmissionTest("def f():\n  return sys.getrecursionlimit() > 0");
+        CHECK(t.returns() == "True");
+    }
+
+    SECTION("exception in arguments") {
+        auto t = EmissionTest("def f():\n  class C:\n    def m(self, a, b): return a\n  c = C()\n  return c.m(1, 1 / 0)");
+        CHECK(t.raises() == PyExc_ZeroDivisionError);
+    }
+
+    SECTION("missing method") {
+        auto t = EmissionTest("def f():\n  class C: pass\n  return C().m(1)");
+        CHECK(t.raises() == PyExc_AttributeError);
+    }
+
+    SECTION("conditional arguments") {
+        auto t = EmissionTest("def f():\n  class C:\n    def m(self, a): return a\n  c = C()\n  x = 1\n  return c.m(2 if x else 3)");
+        CHECK(t.returns() == "2");
+    }
+}
+
+TEST_CASE("Array calls", "[CALL_FUNCTION][CALL_FUNCTION_KW][emission]") {
+    SECTION("many positional arguments") {
+        auto t = EmissionTest("def f():\n  def g(a, b, c, d, e, f, g): return a + b + c + d + e + f + g\n  return g(1, 2, 3, 4, 5, 6, 7) + max(1, 5, 2, 8, 3, 4)");
+        CHECK(t.returns() == "36");
+    }
+
+    SECTION("keyword arguments") {
+        auto t = EmissionTest("def f():\n  def g(a, b=0, *, c): return a * 100 + b * 10 + c\n  return g(1, c=3, b=2)");
+        CHECK(t.returns() == "123");
+    }
+
+    SECTION("keyword arguments to builtins") {
+        auto t = EmissionTest("def f():\n  return sorted([3, 1, 2], reverse=True), dict(a=1)");
+        CHECK(t.returns() == "([3, 2, 1], {'a': 1})");
+    }
+
+    SECTION("keyword arguments to a bound method") {
+        auto t = EmissionTest("def f():\n  class C:\n    def m(self, a, b): return a - b\n  m = C().m\n  return m(1, b=3)");
+        CHECK(t.returns() == "-2");
+    }
+
+    SECTION("method calls") {
+        auto t = EmissionTest("def f():\n  class C:\n    def m(self, a, b=0, c=0, d=0, e=0, f=0): return a + b + c + d + e + f\n  c = C()\n  return c.m(1, f=2) + c.m(1, 1, 1, 1, 1, 1)");
+        CHECK(t.returns() == "9");
+    }
+
+    SECTION("unexpected keyword") {
+        auto t = EmissionTest("def f():\n  def g(a): return a\n  return g(1, b=2)");
+        CHECK(t.raises() == PyExc_TypeError);
+    }
+}
+
+TEST_CASE("Direct calls", "[CALL_FUNCTION][emission]") {
+    JitEnabled jit;
+    auto hits = g_inlineCacheStats.CallHits;
+
+    SECTION("jitted callee in a loop") {
+        auto t = EmissionTest("def f():\n  def g(a, b):\n    for i in range(2): a += b\n    return a\n  total = 0\n  for i in range(10):\n    total = g(total, i)\n  return total");
+        t.optimize("g");
+        CHECK(t.returns() == "90");
+        CHECK(g_inlineCacheStats.CallHits > hits);
+    }
+
+    SECTION("calls after the JIT is disabled") {
+        auto t = EmissionTest("def f():\n  def g(a, b):\n    return a + b\n  total = 0\n  for i in range(10):\n    total = g(total, i)\n  return total");
+        t.optimize("g");
+        CHECK(t.returns() == "45");
+        CHECK(g_inlineCacheStats.CallHits > hits);
+
+        auto interp = PyThreadState_GET()->interp;
+        interp->eval_frame = _PyEval_EvalFrameDefault;
+        hits = g_inlineCacheStats.CallHits;
+        auto res = t.returns();
+        interp->eval_frame = PyJit_EvalFrame;
+        CHECK(res == "45");
+        CHECK(g_inlineCacheStats.CallHits == hits);
+    }
+
+    SECTION("callee changes at a call site") {
+        auto t = EmissionTest("def f():\n  def g(a):\n    return a\n  def h(a):\n    return -a\n  total = 0\n  for i in range(6):\n    total += (g if i % 2 else h)(i)\n  return total");
+        t.optimize("g");
+        t.optimize("h");
+        CHECK(t.returns() == "3");
+    }
+
+    SECTION("callee code replaced") {
+        auto t = EmissionTest("def f():\n  def g(a):\n    return a\n  def h(a):\n    return a * 10\n  total = 0\n  for i in range(4):\n    if i == 2:\n      g.__code__ = h.__code__\n    total += g(1)\n  return total");
+        t.optimize("g");
+        t.optimize("h");
+        CHECK(t.returns() == "22");
+    }
+
+    SECTION("callee argument types change") {
+        auto t = EmissionTest("def f():\n  def g(a):\n    return a + a\n  res = []\n  for x in (1, 2.0, 'a', 3, 4):\n    res.append(g(x))\n  return res");
+        t.optimize("g");
+        CHECK(t.returns() == "[2, 4.0, 'aa', 6, 8]");
+        CHECK(g_inlineCacheStats.CallHits > hits);
+    }
+
+    SECTION("callee with defaults") {
+        auto t = EmissionTest("def f():\n  def g(a, b=2, *, c=3):\n    return a + b + c\n  total = 0\n  for i in range(3):\n    total += g(i)\n  return total");
+        t.optimize("g");
+        CHECK(t.returns() == "18");
+    }
+
+    SECTION("callee raises") {
+        auto t = EmissionTest("def f():\n  def g(a):\n    return 1 / a\n  total = 0\n  for i in range(3, -1, -1):\n    total += g(i)\n  return total");
+        t.optimize("g");
+        CHECK(t.raises() == PyExc_ZeroDivisionError);
+        CHECK(g_inlineCacheStats.CallHits > hits);
+    }
+
+    SECTION("recursion") {
+        auto t = EmissionTest("def f():\n  global fib\n  def fib(n):\n    return n if n < 2 else fib(n - 1) + fib(n - 2)\n  return fib(15)");
+        t.optimize("fib");
+        CHECK(t.returns() == "610");
+        CHECK(g_inlineCacheStats.CallHits > hits);
+    }
+
+    SECTION("wrong argument count") {
+        auto t = EmissionTest("def f():\n  def g(a):\n    return a\n  return g(1) + g()");
+        t.optimize("g");
+        CHECK(t.raises() == PyExc_TypeError);
+    }
+}
+
+TEST_CASE("Inlined calls", "[CALL_FUNCTION][inlining][emission]") {
+    SECTION("arithmetic helper") {
+        auto t = EmissionTest("def f():\n  def g(a, b): return a * b + 1\n  return g(3, 4)", true);
+        t.profile();
+        CHECK(t.returns() == "13");
+        CHECK(t.inlining(ID_Inlined) == 1);
+    }
+
+    SECTION("callee locals") {
+        auto t = EmissionTest("def f():\n  def g(a, b):\n    c = a + b\n    c = c * 2\n    return c, a\n  return g('x', 'y')", true);
+        t.profile();
+        CHECK(t.returns() == "('xyxy', 'x')");
+        CHECK(t.inlining(ID_Inlined) == 1);
+    }
+
+    // The class is kept on sys between the profiling and the optimized runs
+    SECTION("getter method") {
+        auto t = EmissionTest("def f():\n  C = getattr(sys, 'inline_getter', None)\n  if C is None:\n    class C:\n      def __init__(self): self.x = 5\n      def get(self): return self.x\n    sys.inline_getter = C\n  else:\n    del sys.inline_getter\n  return C().get()", true);
+        t.profile();
+        CHECK(t.returns() == "5");
+        CHECK(t.inlining(ID_Inlined) == 1);
+    }
+
+    SECTION("slot getter") {
+        auto t = EmissionTest("def f():\n  C = getattr(sys, 'inline_slot', None)\n  if C is None:\n    class C:\n      __slots__ = ('x',)\n      def __init__(self): self.x = 5\n      def get(self): return self.x + 1\n    sys.inline_slot = C\n  else:\n    del sys.inline_slot\n  return C().get()", true);
+        t.profile();
+        CHECK(t.returns() == "6");
+        CHECK(t.inlining(ID_Inlined) == 1);
+    }
+
+    SECTION("class changes after profiling") {
+        auto t = EmissionTest("def f():\n  C = getattr(sys, 'inline_changed', None)\n  if C is None:\n    class C:\n      def __init__(self): self.x = 5\n      def get(self): return self.x\n    sys.inline_changed = C\n  else:\n    del sys.inline_changed\n    C.x = property(lambda self: 7, lambda self, value: None)\n  return C().get()", true);
+        t.profile();
+        CHECK(t.returns() == "7");
+        CHECK(t.inlining(ID_Inlined) == 1);
+    }
+
+    SECTION("float arithmetic") {
+        auto t = EmissionTest("def f():\n  def g(a, b): return a * b + 0.5\n  values = [1.5, 2.0]\n  return g(values[0], values[1])", true);
+        t.profile();
+        CHECK(t.returns() == "3.5");
+        CHECK(t.inlining(ID_Inlined) == 1);
+    }
+
+    SECTION("user defined operator") {
+        auto t = EmissionTest("def f():\n  class C:\n    def __add__(self, other): return sys._getframe(1).f_code.co_name\n  def g(a, b): return a + b\n  return g(C(), 1)", true);
+        t.profile();
+        CHECK(t.returns() == "'g'");
+        CHECK(t.inlining(ID_UnknownTypes) == 1);
+    }
+
+    SECTION("callee changes after profiling") {
+        auto t = EmissionTest("def f():\n  def g(a): return a + 1\n  def h(a): return a * 2\n  k = g\n  if hasattr(sys, 'inline_test'):\n    k = h\n    del sys.inline_test\n  else:\n    sys.inline_test = True\n  return k(10)", true);
+        t.profile();
+        CHECK(t.returns() == "20");
+        CHECK(t.inlining(ID_Inlined) == 1);
+    }
+
+    SECTION("exception in the callee") {
+        auto t = EmissionTest("def f():\n  def g(a): return 1 / a\n  try:\n    g(0)\n  except ZeroDivisionError as e:\n    return e.__traceback__.tb_next.tb_frame.f_code.co_name", true);
+        t.profile();
+        CHECK(t.returns() == "'g'");
+        CHECK(t.inlining(ID_Inlined) == 1);
+    }
+
+    SECTION("callee locals in the traceback") {
+        auto t = EmissionTest("def f():\n  def g(a, b):\n    c = a + b\n    return c / b\n  try:\n    g(1, 0)\n  except ZeroDivisionError as e:\n    frame = e.__traceback__.tb_next.tb_frame\n    return sorted(frame.f_locals.items()), frame.f_globals is g.__globals__", true);
+        t.profile();
+        CHECK(t.returns() == "([('a', 1), ('b', 0), ('c', 1)], True)");
+        CHECK(t.inlining(ID_Inlined) == 1);
+    }
+
+    SECTION("callee with branches") {
+        auto t = EmissionTest("def f():\n  def g(a):\n    if a: return 1\n    return 2\n  return g(0)", true);
+        t.profile();
+        CHECK(t.returns() == "2");
+        CHECK(t.inlining(ID_UnsupportedOpcode) == 1);
+    }
+
+    SECTION("callee with defaults") {
+        auto t = EmissionTest("def f():\n  def g(a, b=2): return a + b\n  return g(1)", true);
+        t.profile();
+        CHECK(t.returns() == "3");
+        CHECK(t.inlining(ID_Signature) == 1);
+    }
+}
+
+// Enables frame elision for the code compiled while it's alive
+class FrameElision {
+public:
+    FrameElision() {
+        PyJit_SetFrameElision(true);
+    }
+    ~FrameElision() {
+        PyJit_SetFrameElision(false);
+    }
+};
+
+TEST_CASE("Frame elision", "[CALL_FUNCTION][frames][emission]") {
+    JitEnabled jit;
+    FrameElision elision;
+    auto elided = g_frameElisionStats.Elided;
+    auto materialized = g_frameElisionStats.Materialized;
+
+    SECTION("leaf callee") {
+        auto t = EmissionTest("def f():\n  def g(a, b):\n    return a * b + 1\n  total = 0\n  for i in range(10):\n    total += g(i, 2)\n  return total");
+        CHECK(t.optimize("g")->j_elide_frame);
+        CHECK(t.returns() == "100");
+        CHECK(g_frameElisionStats.Elided > elided);
+    }
+
+    SECTION("traceback through an elided frame") {
+        auto t = EmissionTest("def f():\n  def g(a):\n    b = a + 1\n    return b / a\n  for i in range(3, -1, -1):\n    try:\n      g(i)\n    except ZeroDivisionError as e:\n      frame = e.__traceback__.tb_next.tb_frame\n      return frame.f_code.co_name, frame.f_locals['b'], frame.f_back is sys._getframe()");
+        CHECK(!t.jitted()->j_elide_frame);
+        CHECK(t.optimize("g")->j_elide_frame);
+        CHECK(t.returns() == "('g', 1, True)");
+        CHECK(g_frameElisionStats.Elided > elided);
+        CHECK(g_frameElisionStats.Materialized > materialized);
+    }
+
+    SECTION("callee inspects its frame") {
+        auto t = EmissionTest("def f():\n  def g(a):\n    return sorted(locals())\n  res = None\n  for i in range(3):\n    res = g(i)\n  return res");
+        CHECK(!t.optimize("g")->j_elide_frame);
+        CHECK(t.returns() == "['a']");
+    }
+
+    SECTION("callee calls out") {
+        auto t = EmissionTest("def f():\n  def h():\n    return sys._getframe(1).f_code.co_name\n  def g(a):\n    return h()\n  res = None\n  for i in range(3):\n    res = g(i)\n  return res");
+        CHECK(!t.optimize("g")->j_elide_frame);
+        CHECK(t.returns() == "'g'");
+    }
+
+    SECTION("callee dispatches to a user defined operator") {
+        auto t = EmissionTest("def f():\n  class C:\n    def __add__(self, other):\n      return sys._getframe(1).f_code.co_name\n  def g(a, b):\n    return a + b\n  res = None\n  for i in range(3):\n    res = g(C(), i)\n  return res");
+        CHECK(t.optimize("g")->j_elide_frame);
+        CHECK(t.returns() == "'g'");
+        CHECK(g_frameElisionStats.Elided == elided);
+    }
+
+    SECTION("callee loads a global") {
+        auto t = EmissionTest("def f():\n  global k\n  k = 1\n  def g(a):\n    return a + k\n  total = 0\n  for i in range(3):\n    total += g(i)\n  return total");
+        CHECK(!t.optimize("g")->j_elide_frame);
+        CHECK(t.returns() == "6");
+    }
+
+    SECTION("recursion") {
+        auto t = EmissionTest("def f():\n  global fib\n  def fib(n):\n    return n if n < 2 else fib(n - 1) + fib(n - 2)\n  return fib(15)");
+        CHECK(!t.optimize("fib")->j_elide_frame);
+        CHECK(t.returns() == "610");
+    }
+}
+
+TEST_CASE("Register locals", "[LOAD_FAST][STORE_FAST][emission]") {
+    SECTION("loop variables") {
+        auto t = EmissionTest("def f():\n  total = ''\n  for s in ['a', 'b', 'c']:\n    total = total + s\n  return total, s");
+        CHECK(t.returns() == "('abc', 'c')");
+    }
+
+    SECTION("callee reads the caller's frame") {
+        auto t = EmissionTest("def f():\n  def g(): return sys._getframe(1).f_locals['x']\n  x = 'a'\n  x = x + 'b'\n  return g()");
+        CHECK(t.returns() == "'ab'");
+    }
+
+    SECTION("traceback locals") {
+        auto t = EmissionTest("def f():\n  x = 'abc'\n  try:\n    y = x + 1\n  except TypeError as e:\n    return e.__traceback__.tb_frame.f_locals['x']");
+        CHECK(t.returns() == "'abc'");
+    }
+
+    SECTION("deleted local") {
+        auto t = EmissionTest("def f():\n  x = 'a'\n  y = x\n  del x\n  return y + x");
+        CHECK(t.raises() == PyExc_UnboundLocalError);
+    }
+
+    SECTION("unbound local") {
+        auto t = EmissionTest("def f():\n  if len('') > 0:\n    x = 1\n  return x");
+        CHECK(t.raises() == PyExc_UnboundLocalError);
+    }
+}
+
+TEST_CASE("Global inline caches", "[LOAD_GLOBAL][emission]") {
+    SECTION("builtin in a loop") {
+        auto t = EmissionTest("def f():\n  total = 0\n  for i in range(5):\n    total += len('ab')\n  return total");
+        CHECK(t.returns() == "10");
+    }
+
+    SECTION("global reassigned while cached") {
+        auto t = EmissionTest("def f():\n  global g\n  g = 1\n  total = 0\n  for i in range(5):\n    total += g\n    g = 10\n  return total");
+        CHECK(t.returns() == "41");
+    }
+
+    SECTION("builtin shadowed while cached") {
+        auto t = EmissionTest("def f():\n  global len\n  total = 0\n  for i in range(4):\n    if i == 2:\n      len = lambda x: 100\n    total += len('ab')\n  return total");
+        CHECK(t.returns() == "204");
+    }
+
+    SECTION("undefined global") {
+        auto t = EmissionTest("def f():\n  for i in range(5):\n    if i == 3:\n      return undefined_name\n");
+        CHECK(t.raises() == PyExc_NameError);
+    }
+}
+
+TEST_CASE("Borrowed references", "[LOAD_FAST][LOAD_CONST][COMPARE_OP][POP_JUMP_IF_FALSE][emission]") {
+    SECTION("truth test of a local") {
+        auto t = EmissionTest("def f():\n  x = [1]\n  n = 0\n  for i in range(3):\n    if x: n += 1\n  return n, sys.getrefcount(x)");
+        CHECK(t.returns() == "(3, 2)");
+    }
+
+    SECTION("truth test raises") {
+        auto t = EmissionTest("def f():\n  class C:\n    def __bool__(self): raise ValueError()\n  x = C()\n  if x: return 1\n  return 2");
+        CHECK(t.raises() == PyExc_ValueError);
+    }
+
+    SECTION("identity comparisons") {
+        auto t = EmissionTest("def f():\n  x = None\n  y = []\n  return x is None, y is None, y is not None, x is not y, sys.getrefcount(y)");
+        CHECK(t.returns() == "(True, False, True, True, 2)");
+    }
+
+    SECTION("identity comparison in a branch") {
+        auto t = EmissionTest("def f():\n  x = None\n  if x is None:\n    return 'none'\n  return 'value'");
+        CHECK(t.returns() == "'none'");
+    }
+
+    SECTION("identity comparison with unbound local") {
+        auto t = EmissionTest("def f():\n  x = []\n  if len('') > 0:\n    y = 1\n  return x is y");
+        CHECK(t.raises() == PyExc_UnboundLocalError);
+    }
+
+    SECTION("last reference released") {
+        auto t = EmissionTest("def f():\n  log = []\n  class C:\n    def __del__(self): log.append('del')\n  x = C()\n  x = None\n  return log");
+        CHECK(t.returns() == "['del']");
+    }
+}
+
+TEST_CASE("Line numbers", "[f_lasti][emission]") {
+    SECTION("unbound local") {
+        auto t = EmissionTest("def f():\n  if len('') > 0:\n    x = 1\n  try:\n    y = 2\n    y = x\n  except UnboundLocalError as e:\n    tb = e.__traceback__\n    return tb.tb_lineno - tb.tb_frame.f_code.co_firstlineno");
+        CHECK(t.returns() == "5");
+    }
+
+    SECTION("undefined global") {
+        auto t = EmissionTest("def f():\n  try:\n    x = 1\n    x = undefined_name\n  except NameError as e:\n    tb = e.__traceback__\n    return tb.tb_lineno - tb.tb_frame.f_code.co_firstlineno");
+        CHECK(t.returns() == "3");
+    }
+
+    SECTION("callee reads the line") {
+        auto t = EmissionTest("def f():\n  x = 1\n  y = (x,\n    sys._getframe().f_lineno)\n  return y[1] - sys._getframe().f_code.co_firstlineno");
+        CHECK(t.returns() == "3");
+    }
+
+    SECTION("finalizer of an overwritten local reads the line") {
+        auto t = EmissionTest("def f():\n  class C:\n    def __del__(self): sys.del_line = sys._getframe(1).f_lineno\n  x = C()\n  y = 1\n  x = 2\n  line = sys.del_line\n  del sys.del_line\n  return line - sys._getframe().f_code.co_firstlineno");
+        CHECK(t.returns() == "5");
+    }
+}
+
+TEST_CASE("Generators", "[YIELD_VALUE][YIELD_FROM][generators][emission]") {
+    JitEnabled jit;
+
+    SECTION("simple generator") {
+        auto t = EmissionTest("def f():\n  def g():\n    yield 1\n    yield 2\n  return list(g())");
+        CHECK(t.returns() == "[1, 2]");
+        CHECK(t.nested("g")->j_generator != nullptr);
+    }
+
+    SECTION("values on the stack and loop iterators are saved") {
+        auto t = EmissionTest("def f():\n  def g(n):\n    for i in range(n):\n      for j in range(2):\n        x = (i, (yield i * 10 + j))\n  return list(g(2))");
+        CHECK(t.returns() == "[0, 1, 10, 11]");
+        CHECK(t.nested("g")->j_generator != nullptr);
+    }
+
+    SECTION("send") {
+        auto t = EmissionTest("def f():\n  def g():\n    total = 0\n    while True:\n      total += yield total\n  it = g()\n  next(it)\n  it.send(2)\n  return it.send(3)");
+        CHECK(t.returns() == "5");
+        CHECK(t.nested("g")->j_generator != nullptr);
+    }
+
+    SECTION("return value") {
+        auto t = EmissionTest("def f():\n  def g():\n    yield 1\n    return 2\n  it = g()\n  next(it)\n  try:\n    next(it)\n  except StopIteration as e:\n    return e.value");
+        CHECK(t.returns() == "2");
+        CHECK(t.nested("g")->j_generator != nullptr);
+    }
+
+    SECTION("throw") {
+        auto t = EmissionTest("def f():\n  def g():\n    try:\n      yield 1\n    except ValueError:\n      pass\n    yield 2\n  it = g()\n  next(it)\n  return it.throw(ValueError)");
+        CHECK(t.returns() == "2");
+        CHECK(t.nested("g")->j_generator != nullptr);
+    }
+
+    SECTION("throw before starting") {
+        auto t = EmissionTest("def f():\n  def g():\n    yield 1\n  try:\n    g().throw(ValueError)\n  except ValueError:\n    return 'raised'");
+        CHECK(t.returns() == "'raised'");
+        CHECK(t.nested("g")->j_generator != nullptr);
+    }
+
+    SECTION("closing a generator expression frees its iterator") {
+        auto t = EmissionTest("def f():\n  l = [1, 2, 3]\n  before = sys.getrefcount(l)\n  it = (x for x in l)\n  next(it)\n  it.close()\n  del it\n  return sys.getrefcount(l) - before");
+        CHECK(t.returns() == "0");
+        CHECK(t.nested("<genexpr>")->j_generator != nullptr);
+    }
+
+    SECTION("yield from") {
+        auto t = EmissionTest("def f():\n  def inner():\n    x = yield 1\n    yield x\n    return 'done'\n  def outer():\n    res = yield from inner()\n    yield res\n  it = outer()\n  return next(it), it.send('sent'), next(it)");
+        CHECK(t.returns() == "(1, 'sent', 'done')");
+        CHECK(t.nested("inner")->j_generator != nullptr);
+        CHECK(t.nested("outer")->j_generator != nullptr);
+    }
+
+    SECTION("throw into yield from") {
+        auto t = EmissionTest("def f():\n  def inner():\n    try:\n      yield 1\n    except ValueError:\n      yield 'caught'\n  def outer():\n    yield from inner()\n  it = outer()\n  next(it)\n  return it.throw(ValueError)");
+        CHECK(t.returns() == "'caught'");
+        CHECK(t.nested("inner")->j_generator != nullptr);
+        CHECK(t.nested("outer")->j_generator != nullptr);
+    }
+
+    SECTION("coroutine") {
+        auto t = EmissionTest("def f():\n  class Awaitable:\n    def __await__(self):\n      yield 'waiting'\n      return 42\n  async def c():\n    return 1 + await Awaitable()\n  co = c()\n  first = co.send(None)\n  try:\n    co.send(None)\n  except StopIteration as e:\n    return first, e.value");
+        CHECK(t.returns() == "('waiting', 43)");
+        CHECK(t.nested("c")->j_generator != nullptr);
+    }
+
+    SECTION("yield in an except handler runs in the interpreter") {
+        auto t = EmissionTest("def f():\n  def g():\n    try:\n      raise ValueError\n    except ValueError:\n      yield 1\n    yield 2\n  return list(g())");
+        CHECK(t.returns() == "[1, 2]");
+        CHECK(t.nested("g")->j_generator == nullptr);
+    }
+
+    SECTION("switching between the interpreter and the JIT at a yield") {
+        // The generator runs in the interpreter while a trace function is set
+        auto t = EmissionTest("def f():\n  def g():\n    total = 0\n    for i in range(4):\n      total += yield total\n    yield total\n  it = g()\n  res = [next(it), it.send(1)]\n  sys.settrace(lambda *args: None)\n  try:\n    res.append(it.send(2))\n  finally:\n    sys.settrace(None)\n  res.append(it.send(3))\n  return res");
+        CHECK(t.returns() == "[0, 1, 3, 6]");
+        CHECK(t.nested("g")->j_generator != nullptr);
+    }
+}
+
+TEST_CASE("With statements", "[SETUP_WITH][WITH_CLEANUP_START][WITH_CLEANUP_FINISH][emission]") {
+    SECTION("enter and exit are called") {
+        auto t = EmissionTest("def f():\n  log = []\n  class CM:\n    def __enter__(self):\n      log.append('enter')\n      return 42\n    def __exit__(self, *args):\n      log.append(args)\n  with CM() as x:\n    log.append(x)\n  return log");
+        CHECK(t.returns() == "['enter', 42, (None, None, None)]");
+    }
+
+    SECTION("exception is passed to exit") {
+        auto t = EmissionTest("def f():\n  class CM:\n    def __enter__(self):\n      pass\n    def __exit__(self, t, v, tb):\n      global seen\n      seen = (t, type(v), tb is not None)\n  try:\n    with CM():\n      raise ValueError\n  except ValueError:\n    pass\n  return seen");
+        CHECK(t.returns() == "(<class 'ValueError'>, <class 'ValueError'>, True)");
+    }
+
+    SECTION("exception is suppressed") {
+        auto t = EmissionTest("def f():\n  class CM:\n    def __enter__(self):\n      pass\n    def __exit__(self, *args):\n      return True\n  with CM():\n    raise ValueError\n  return sys.exc_info()");
+        CHECK(t.returns() == "(None, None, None)");
+    }
+
+    SECTION("exception propagates") {
+        auto t = EmissionTest("def f():\n  class CM:\n    def __enter__(self):\n      pass\n    def __exit__(self, *args):\n      return False\n  with CM():\n    raise ValueError");
+        CHECK(t.raises() == PyExc_ValueError);
+    }
+
+    SECTION("exit raises") {
+        auto t = EmissionTest("def f():\n  class CM:\n    def __enter__(self):\n      pass\n    def __exit__(self, *args):\n      raise TypeError\n  with CM():\n    pass");
+        CHECK(t.raises() == PyExc_TypeError);
+    }
+
+    SECTION("missing enter") {
+        auto t = EmissionTest("def f():\n  class CM:\n    def __exit__(self, *args):\n      pass\n  with CM():\n    pass");
+        CHECK(t.raises() == PyExc_AttributeError);
+    }
+
+    SECTION("enter is looked up on the type") {
+        auto t = EmissionTest("def f():\n  class CM:\n    def __enter__(self):\n      return 'type'\n    def __exit__(self, *args):\n      pass\n  cm = CM()\n  cm.__enter__ = lambda: 'instance'\n  with cm as x:\n    return x");
+        CHECK(t.returns() == "'type'");
+    }
+
+    SECTION("return calls exit") {
+        auto t = EmissionTest("def f():\n  class CM:\n    def __enter__(self):\n      pass\n    def __exit__(self, *args):\n      sys.with_test = args\n  with CM():\n    return 42");
+        CHECK(t.returns() == "42");
+        auto args = PySys_GetObject("with_test");
+        REQUIRE(args != nullptr);
+        auto repr = PyObject_ptr(PyObject_Repr(args));
+        CHECK(std::string(PyUnicode_AsUTF8(repr.get())) == "(None, None, None)");
+        PySys_SetObject("with_test", nullptr);
+    }
+
+    SECTION("break and continue call exit") {
+        auto t = EmissionTest("def f():\n  log = []\n  class CM:\n    def __enter__(self):\n      pass\n    def __exit__(self, *args):\n      log.append(args[0])\n  for i in range(3):\n    with CM():\n      if i == 0:\n        continue\n      break\n  return i, log");
+        CHECK(t.returns() == "(1, [None, None])");
+    }
+
+    SECTION("nested with statements") {
+        auto t = EmissionTest("def f():\n  log = []\n  class CM:\n    def __init__(self, name):\n      self.name = name\n    def __enter__(self):\n      return self.name\n    def __exit__(self, *args):\n      log.append(self.name)\n  with CM('a') as a, CM('b') as b:\n    log.append(a + b)\n  return log");
+        CHECK(t.returns() == "['ab', 'b', 'a']");
+    }
+
+    SECTION("lock guarded loop") {
+        auto t = EmissionTest("def f():\n  import threading\n  lock = threading.Lock()\n  total = 0\n  for i in range(100):\n    with lock:\n      total += i\n  return total, lock.locked()");
+        CHECK(t.returns() == "(4950, False)");
+    }
+
+    SECTION("yield inside of a with statement") {
+        JitEnabled jit;
+        auto t = EmissionTest("def f():\n  log = []\n  class CM:\n    def __enter__(self):\n      pass\n    def __exit__(self, *args):\n      log.append(args[0])\n      return True\n  def g():\n    for i in range(2):\n      with CM():\n        yield i\n        yield i * 10\n  it = g()\n  res = [next(it), next(it), it.throw(ValueError), next(it)] + list(it)\n  return res, log");
+        CHECK(t.returns() == "([0, 0, 1, 10], [<class 'ValueError'>, None])");
+        CHECK(t.nested("g")->j_generator != nullptr);
+    }
+}
+
+TEST_CASE("Range loops", "[FOR_ITER][range][emission]") {
+    SECTION("counting") {
+        auto t = EmissionTest("def f():\n  total = 0\n  for i in range(100):\n    total += i\n  return total");
+        CHECK(t.returns() == "4950");
+    }
+
+    SECTION("start, stop and step") {
+        auto t = EmissionTest("def f():\n  x = []\n  for i in range(10, 0, -3):\n    x.append(i)\n  return x");
+        CHECK(t.returns() == "[10, 7, 4, 1]");
+    }
+
+    SECTION("empty range") {
+        auto t = EmissionTest("def f():\n  for i in range(5, 0):\n    return i\n  return -1");
+        CHECK(t.returns() == "-1");
+    }
+
+    SECTION("break and continue") {
+        auto t = EmissionTest("def f():\n  total = 0\n  for i in range(10):\n    if i == 2:\n      continue\n    if i == 5:\n      break\n    total += i\n  return total, i");
+        CHECK(t.returns() == "(8, 5)");
+    }
+
+    SECTION("nested loops") {
+        auto t = EmissionTest("def f():\n  total = 0\n  for i in range(10):\n    for j in range(i):\n      total += j\n  return total");
+        CHECK(t.returns() == "120");
+    }
+
+    SECTION("values which don't fit in a long") {
+        auto t = EmissionTest("def f():\n  x = []\n  for i in range(2**40, 2**40 + 2):\n    x.append(i)\n  return x");
+        CHECK(t.returns() == "[1099511627776, 1099511627777]");
+    }
+
+    SECTION("range replaced") {
+        auto t = EmissionTest("def f():\n  global range\n  range = lambda n: iter(['a', 'b'])\n  x = []\n  for i in range(2):\n    x.append(i)\n  return x");
+        CHECK(t.returns() == "['a', 'b']");
+    }
+
+    SECTION("counting after profiling") {
+        auto t = EmissionTest("def f():\n  total = 0\n  for i in range(100):\n    total = total + i * 2\n  return total", true);
+        t.profile();
+        CHECK(t.returns() == "9900");
+    }
+
+    SECTION("range replaced after profiling") {
+        auto t = EmissionTest("def f():\n  global range\n  if hasattr(sys, 'range_test'):\n    del sys.range_test\n    range = lambda n: iter([1.5, 2.5])\n  else:\n    sys.range_test = True\n  total = 0\n  for i in range(3):\n    total = total + i\n  return total", true);
+        t.profile();
+        CHECK(t.returns() == "4.0");
+    }
+}
+
+TEST_CASE("Int arithmetic", "[BINARY_ADD][BINARY_SUBTRACT][BINARY_MULTIPLY][COMPARE_OP][emission]") {
+    SECTION("counting loop") {
+        auto t = EmissionTest("def f():\n  total = 0\n  i = 0\n  while i < 100:\n    total = total + i * i\n    i = i + 1\n  return total == 328350, i >= 100");
+        CHECK(t.returns() == "(True, True)");
+    }
+
+    SECTION("negative values") {
+        auto t = EmissionTest("def f():\n  x = -7\n  y = 3\n  return x * y == -21, x - y == -10, x & y == 1, x | y == -5, x ^ y == -6, x < y, x != y");
+        CHECK(t.returns() == "(True, True, True, True, True, True, True)");
+    }
+
+    SECTION("add overflows into a long") {
+        auto t = EmissionTest("def f():\n  x = 4611686018427387903\n  y = x + 1\n  return y == 4611686018427387904, y - 1 == x, y > x");
+        CHECK(t.returns() == "(True, True, True)");
+    }
+
+    SECTION("subtract overflows into a long") {
+        auto t = EmissionTest("def f():\n  x = -4611686018427387904\n  y = x - 1\n  return y == -4611686018427387905, y + 1 == x, y < x");
+        CHECK(t.returns() == "(True, True, True)");
+    }
+
+    SECTION("multiply overflows into a long") {
+        auto t = EmissionTest("def f():\n  x = 3037000500\n  y = x * x\n  w = 65536\n  z = w * w\n  return y == 9223372037000250000, z == 4294967296");
+        CHECK(t.returns() == "(True, True)");
+    }
+}
+
+TEST_CASE("Tuple unpacking", "[BUILD_TUPLE][UNPACK_SEQUENCE][emission]") {
+    SECTION("constant tuple") {
+        auto t = EmissionTest("def f():\n  a, b, c = 1, 'x', None\n  return c, b, a");
+        CHECK(t.returns() == "(None, 'x', 1)");
+    }
+
+    SECTION("built and unpacked") {
+        auto t = EmissionTest("def f():\n  a, b, c, d = 1, 2, 3, 4\n  a, b, c, d = d, c, b, a\n  return a, b, c, d");
+        CHECK(t.returns() == "(4, 3, 2, 1)");
+    }
+
+    SECTION("unboxed floats") {
+        auto t = EmissionTest("def f():\n  x, y, z, w = 1.5, 2.5, 3.5, 4.5\n  x, y, z, w = y + z, x, w * 2, z\n  return x, y, z, w");
+        CHECK(t.returns() == "(6.0, 1.5, 9.0, 3.5)");
+    }
+
+    SECTION("swap in a loop") {
+        auto t = EmissionTest("def f():\n  a, b = 0, 1\n  for i in range(10):\n    a, b = b, a + b\n  return a");
+        CHECK(t.returns() == "55");
+    }
+
+    SECTION("inlined call") {
+        auto t = EmissionTest("def f():\n  def g(a, b): return b, a\n  x, y = g(1, 2)\n  return x, y", true);
+        t.profile();
+        CHECK(t.returns() == "(2, 1)");
+        CHECK(t.inlining(ID_Inlined) == 1);
+    }
+
+    SECTION("callee changes after profiling") {
+        auto t = EmissionTest("def f():\n  def g(a, b): return b, a\n  def h(a, b): return [a, b]\n  k = g\n  if hasattr(sys, 'unpack_test'):\n    k = h\n    del sys.unpack_test\n  else:\n    sys.unpack_test = True\n  x, y = k(1, 2)\n  return x, y", true);
+        t.profile();
+        CHECK(t.returns() == "(1, 2)");
+        CHECK(t.inlining(ID_Inlined) == 1);
+    }
+}
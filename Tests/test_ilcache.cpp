@@ -0,0 +1,171 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) Microsoft Corporation
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+* OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+* OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+* ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+* OTHER DEALINGS IN THE SOFTWARE.
+*
+*/
+
+
+/**
+  Test caching the IL generated for functions on disk.
+*/
+
+#include "stdafx.h"
+#include "catch.hpp"
+#include "testing_util.h"
+#include <Python.h>
+#include <frameobject.h>
+#include <util.h>
+#include <pyjit.h>
+#include <ilcache.h>
+#include <string>
+
+// Creates an empty directory for a cache
+static std::string CacheDirectory(const char* name) {
+    char temp[MAX_PATH];
+    GetTempPathA(MAX_PATH, temp);
+    auto path = std::string(temp) + name;
+
+    WIN32_FIND_DATAA findData;
+    auto find = FindFirstFileA((path + "\\*.pjil").c_str(), &findData);
+    if (find != INVALID_HANDLE_VALUE) {
+        do {
+            DeleteFileA((path + "\\" + findData.cFileName).c_str());
+        } while (FindNextFileA(find, &findData));
+        FindClose(find);
+    }
+    return path;
+}
+
+static ILCacheEntry MakeEntry(size_t ilSize) {
+    ILCacheEntry entry;
+    entry.IL.resize(ilSize, 0x2A);  // ret
+    entry.Locals.push_back(1);
+    entry.Relocations.push_back(Relocation{ 1, RK_Const, 2, 0 });
+    entry.UserMethods.push_back(0x42);
+    entry.Speculative = true;
+    return entry;
+}
+
+// Runs a function with no arguments through the JIT
+static std::string RunFunction(const char* code) {
+    auto pyCode = py_ptr<PyCodeObject>(CompileCode(code));
+    REQUIRE(pyCode.get() != nullptr);
+    auto jitted = PyJit_EnsureExtra((PyObject*)*pyCode);
+    REQUIRE(jit_compile(pyCode.get()));
+    jitted->j_specialization_threshold = 0;
+    jitted->j_optimize_threshold = 0;
+
+    auto globals = PyObject_ptr(PyDict_New());
+    PyDict_SetItemString(globals.get(), "__builtins__", PyThreadState_GET()->interp->builtins);
+    auto frame = PyFrame_New(PyThreadState_Get(), pyCode.get(), globals.get(), nullptr);
+    auto res = PyObject_ptr(jitted->j_evalfunc(jitted, frame));
+    REQUIRE(res.get() != nullptr);
+    return std::string(PyUnicode_AsUTF8(PyObject_Repr(res.get())));
+}
+
+TEST_CASE("IL cache entries", "[ilcache]") {
+    SECTION("entries round trip") {
+        ILCache cache;
+        REQUIRE(cache.enable(CacheDirectory("pyjion_test_roundtrip").c_str(), 1024 * 1024));
+
+        auto entry = MakeEntry(100);
+        cache.store(1234, entry);
+        CHECK(cache.m_stores == 1);
+        CHECK(cache.entry_count() == 1);
+
+        ILCacheEntry loaded;
+        REQUIRE(cache.load(1234, loaded));
+        CHECK(loaded.IL == entry.IL);
+        CHECK(loaded.Locals == entry.Locals);
+        CHECK(loaded.Relocations.size() == 1);
+        CHECK(loaded.Relocations[0].Kind == RK_Const);
+        CHECK(loaded.Relocations[0].Index == 2);
+        CHECK(loaded.UserMethods == entry.UserMethods);
+        CHECK(loaded.Speculative);
+        CHECK(cache.m_hits == 1);
+
+        CHECK(!cache.load(5678, loaded));
+        CHECK(cache.m_misses == 1);
+    }
+
+    SECTION("entries are reloaded when the cache is enabled") {
+        auto path = CacheDirectory("pyjion_test_reload");
+        {
+            ILCache cache;
+            REQUIRE(cache.enable(path.c_str(), 1024 * 1024));
+            auto entry = MakeEntry(100);
+            cache.store(1234, entry);
+        }
+
+        ILCache cache;
+        REQUIRE(cache.enable(path.c_str(), 1024 * 1024));
+        CHECK(cache.entry_count() == 1);
+        ILCacheEntry loaded;
+        CHECK(cache.load(1234, loaded));
+    }
+
+    SECTION("least recently used entries are evicted") {
+        ILCache cache;
+        REQUIRE(cache.enable(CacheDirectory("pyjion_test_evict").c_str(), 2500));
+
+        auto entry = MakeEntry(1000);
+        cache.store(1, entry);
+        cache.store(2, entry);
+
+        ILCacheEntry loaded;
+        REQUIRE(cache.load(1, loaded));
+        cache.store(3, entry);
+
+        CHECK(cache.m_evictions == 1);
+        CHECK(cache.entry_count() == 2);
+        CHECK(cache.size() <= cache.max_size());
+        CHECK(cache.load(1, loaded));
+        CHECK(!cache.load(2, loaded));
+        CHECK(cache.load(3, loaded));
+    }
+
+    SECTION("entries larger than the cache aren't stored") {
+        ILCache cache;
+        REQUIRE(cache.enable(CacheDirectory("pyjion_test_large").c_str(), 100));
+
+        auto entry = MakeEntry(1000);
+        cache.store(1, entry);
+        CHECK(cache.m_stores == 0);
+        CHECK(cache.entry_count() == 0);
+    }
+}
+
+TEST_CASE("IL cache compilation", "[ilcache]") {
+    SECTION("identical code is compiled from the cache") {
+        REQUIRE(g_ilCache.enable(CacheDirectory("pyjion_test_compile").c_str(), 1024 * 1024));
+        auto hits = g_ilCache.m_hits;
+        auto stores = g_ilCache.m_stores;
+
+        const char* code = "def f():\n    x = [1, 2, 3]\n    return x[1] + len(x) + 2.5";
+        CHECK(RunFunction(code) == "7.5");
+        CHECK(g_ilCache.m_stores == stores + 1);
+        CHECK(RunFunction(code) == "7.5");
+        CHECK(g_ilCache.m_hits == hits + 1);
+
+        g_ilCache.disable();
+    }
+}
@@ -44,9 +44,13 @@ private:
     std::unique_ptr<AbstractInterpreter> m_absint;
 
 public:
-    InferenceTest(const char* code) {
+    InferenceTest(const char* code, std::vector<std::pair<int, AbstractValueKind>> speculated = {}, TypeProfile* profile = nullptr) {
         auto pyCode = CompileCode(code);
         m_absint = std::make_unique<AbstractInterpreter>(pyCode, nullptr);
+        for (auto local : speculated) {
+            m_absint->set_speculated_local_type(local.first, local.second);
+        }
+        m_absint->set_type_profile(profile);
         auto success = m_absint->interpret();
         if (!success) {
             Py_DECREF(pyCode);
@@ -58,6 +62,10 @@ public:
         auto local = m_absint->get_local_info(byteCodeIndex, localIndex);
         return local.ValueInfo.Value->kind();
     }
+
+    bool is_speculative() {
+        return m_absint->is_speculative();
+    }
 };
 
 
@@ -4564,3 +4572,51 @@ TEST_CASE("Generalize unpacking within a dict", "[dict][BUILD_MAP_UNPACK][infere
         REQUIRE(t.kind(22, 0) == AVK_Dict);       // LOAD_CONST 0
     }
 }
+
+TEST_CASE("Speculated local types", "[float][int][speculation][inference]") {
+    SECTION("unknown value stored to a speculated local") {
+        auto t = InferenceTest("def f(x):\n  y = x.real\n  return y", { { 1, AVK_Float } });
+        REQUIRE(t.kind(4, 1) == AVK_Undefined);  // STORE_FAST 1
+        REQUIRE(t.kind(6, 1) == AVK_Float);      // LOAD_FAST 1
+        REQUIRE(t.is_speculative());
+    }
+
+    SECTION("known value stored to a speculated local") {
+        auto t = InferenceTest("def f(x):\n  y = 1\n  return y", { { 1, AVK_Float } });
+        REQUIRE(t.kind(4, 1) == AVK_Integer);    // LOAD_FAST 1
+        REQUIRE(!t.is_speculative());
+    }
+
+    SECTION("store with other values on the stack") {
+        auto t = InferenceTest("def f(x):\n  y = z = x.real\n  return y", { { 1, AVK_Integer }, { 2, AVK_Integer } });
+        REQUIRE(t.kind(8, 1) == AVK_Integer);    // STORE_FAST 2
+        REQUIRE(t.kind(10, 2) == AVK_Integer);   // LOAD_FAST 1
+    }
+}
+
+TEST_CASE("Profiled result types", "[float][int][speculation][inference]") {
+    SECTION("attribute which produced a single type") {
+        TypeProfile profile(8);
+        profile.record(2, &PyFloat_Type);   // LOAD_ATTR
+        auto t = InferenceTest("def f(x):\n  y = x.real\n  return y", {}, &profile);
+        REQUIRE(t.kind(6, 1) == AVK_Float);      // LOAD_FAST 1
+        REQUIRE(t.is_speculative());
+    }
+
+    SECTION("attribute which produced multiple types") {
+        TypeProfile profile(8);
+        profile.record(2, &PyFloat_Type);   // LOAD_ATTR
+        profile.record(2, &PyLong_Type);
+        auto t = InferenceTest("def f(x):\n  y = x.real\n  return y", {}, &profile);
+        REQUIRE(t.kind(6, 1) == AVK_Any);        // LOAD_FAST 1
+        REQUIRE(!t.is_speculative());
+    }
+
+    SECTION("call which produced a single type") {
+        TypeProfile profile(10);
+        profile.record(2, &PyList_Type);    // CALL_FUNCTION
+        auto t = InferenceTest("def f(x):\n  y = x()\n  return y", {}, &profile);
+        REQUIRE(t.kind(6, 1) == AVK_List);       // LOAD_FAST 1
+        REQUIRE(t.is_speculative());
+    }
+}